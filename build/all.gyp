@@ -31,7 +31,11 @@
                 './gmock.gyp:gmock_main'
             ],
             'sources' : [
-                '../lib/http/test/basic_test.cc'
+                '../lib/http/test/basic_test.cc',
+                '../lib/http/test/buffer_pool_test.cc',
+                '../lib/http/test/hpack_test.cc',
+                '../lib/http/test/object_pool_test.cc',
+                '../lib/http/test/timer_wheel_test.cc'
             ]
         }
     ]
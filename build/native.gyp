@@ -14,12 +14,16 @@
                 '../lib/http/include'
             ],
             'sources' : [
+                '../lib/http/src/buffer_pool.cc',
                 '../lib/http/src/loop.cc',
                 '../lib/http/src/stream.cc',
                 '../lib/http/src/handle.cc',
 				'../lib/http/src/fs.cc',
                 '../lib/http/src/net.cc',
+                '../lib/http/src/pipe.cc',
                 '../lib/http/src/tcp.cc',
+                '../lib/http/src/timer_wheel.cc',
+                '../lib/http/src/hpack.cc',
                 '../lib/http/src/http.cc'
             ],
             'direct_dependent_settings' : {
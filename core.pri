@@ -72,6 +72,10 @@ contains(CONFIG, SSL_TLS) {
         INCLUDEPATH += /usr/local/opt/openssl/include
         LIBS += -L/usr/local/opt/openssl/lib -lssl -lcrypto
     }
+
+    unix:!macx {
+        LIBS += -lssl -lcrypto
+    }
 }
 
 macx: {
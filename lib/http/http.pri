@@ -2,26 +2,35 @@ message($$PWD)
 
 HEADERS += \
     $$PWD/include/native/base.h \
+    $$PWD/include/native/buffer_pool.h \
     $$PWD/include/native/callback.h \
     $$PWD/include/native/error.h \
     $$PWD/include/native/fs.h \
     $$PWD/include/native/handle.h \
+    $$PWD/include/native/hpack.h \
     $$PWD/include/native/http.h \
     $$PWD/include/native/loop.h \
     $$PWD/include/native/native.h \
     $$PWD/include/native/net.h \
+    $$PWD/include/native/object_pool.h \
+    $$PWD/include/native/pipe.h \
     $$PWD/include/native/stream.h \
     $$PWD/include/native/tcp.h \
-    $$PWD/include/native/text.h
+    $$PWD/include/native/text.h \
+    $$PWD/include/native/timer_wheel.h
 
 SOURCES += \
+    $$PWD/src/buffer_pool.cc \
     $$PWD/src/fs.cc \
     $$PWD/src/handle.cc \
+    $$PWD/src/hpack.cc \
     $$PWD/src/http.cc \
     $$PWD/src/loop.cc \
     $$PWD/src/net.cc \
+    $$PWD/src/pipe.cc \
     $$PWD/src/stream.cc \
-    $$PWD/src/tcp.cc
+    $$PWD/src/tcp.cc \
+    $$PWD/src/timer_wheel.cc
 
 INCLUDEPATH += \
     $$PWD/include \
@@ -69,4 +78,8 @@ contains(CONFIG, SSL_TLS) {
         INCLUDEPATH += /usr/local/opt/openssl/include
         LIBS += -L/usr/local/opt/openssl/lib -lssl -lcrypto
     }
+
+    unix:!macx {
+        LIBS += -lssl -lcrypto
+    }
 }
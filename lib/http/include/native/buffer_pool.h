@@ -0,0 +1,85 @@
+#ifndef __NATIVE_BUFFER_POOL_H__
+#define __NATIVE_BUFFER_POOL_H__
+
+#include "base.h"
+
+#include <atomic>
+
+namespace native
+{
+/*!
+ *  Freelist of buffers in a few fixed size classes, one per loop.
+ *  Only the thread running the loop may acquire and release buffers, the
+ *  counters can be read from any thread.
+ */
+class NNATIVE_DLLEXPORT buffer_pool
+{
+  public:
+    enum
+    {
+      small_size = 4 * 1024,
+      medium_size = 16 * 1024,
+      large_size = 64 * 1024,
+      size_class_count = 3
+    };
+
+    /*!
+     *  @param max_cached buffers kept per size class once released.
+     */
+    buffer_pool(size_t max_cached = 64);
+    ~buffer_pool();
+
+    /*!
+     *  Returns a buffer of at least size bytes, oLen is set to its actual
+     *  length.  Sizes above large_size are allocated and freed every time.
+     */
+    char* acquire(size_t size, size_t& oLen);
+
+    /*!
+     *  Takes back a buffer from acquire() along with the length it was handed
+     *  out with.  A null buffer is ignored.
+     */
+    void release(char* buf, size_t len);
+
+    //! Buffers served from the freelist.
+    uint64_t hits() const {
+      return hits_.load(std::memory_order_relaxed);
+    }
+
+    //! Buffers that had to come from the heap.
+    uint64_t misses() const {
+      return misses_.load(std::memory_order_relaxed);
+    }
+
+    //! Buffers currently sitting in the freelists.
+    size_t cached() const {
+      return cached_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    buffer_pool(const buffer_pool&);
+    void operator =(const buffer_pool&);
+
+    static int size_class(size_t size);
+    static size_t class_size(int index);
+
+  private:
+    size_t max_cached_;
+    std::vector<char*> free_[size_class_count];
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<size_t> cached_;
+};
+
+namespace internal
+{
+/*!
+ *  Read buffers for uv_read_start(), taken from the pool of the native::loop
+ *  wrapping l, or the heap for loops that aren't wrapped.
+ */
+NNATIVE_DLLEXPORT char* acquire_read_buffer(uv_loop_t* l, size_t size, size_t& oLen);
+NNATIVE_DLLEXPORT void release_read_buffer(uv_loop_t* l, char* buf, size_t len);
+}
+}
+
+#endif
@@ -8,10 +8,10 @@
 #include "callback.h"
 
 #include "native/error.h"
+#include "native/loop.h"
 
 namespace native
 {
-    // TODO: implement functions that accept loop pointer as extra argument.
     namespace fs
     {
         typedef uv_file file_handle;
@@ -119,7 +119,7 @@ namespace native
                     uv_fs_req_cleanup(req);
                     const uv_buf_t iov = uv_buf_init(ctx->buf, rte_context::buflen);
 
-                    error err(uv_fs_read(uv_default_loop(), req, ctx->file, &iov, 1, ctx->result.length(), rte_cb<callback_t>));
+                    error err(uv_fs_read(req->loop, req, ctx->file, &iov, 1, ctx->result.length(), rte_cb<callback_t>));
                     if(err)
                     {
                         invoke_from_req<callback_t>(req, std::string(), err);
@@ -129,27 +129,43 @@ namespace native
             }
         }
 
+        // Each operation runs on the given loop, the overloads without one use the default loop.
         bool open(const std::string& path, int flags, int mode, std::function<void(native::fs::file_handle fd, error e)> callback);
+        bool open(native::loop& l, const std::string& path, int flags, int mode, std::function<void(native::fs::file_handle fd, error e)> callback);
 
         bool read(file_handle fd, size_t len, off_t offset, std::function<void(const std::string& str, error e)> callback);
+        bool read(native::loop& l, file_handle fd, size_t len, off_t offset, std::function<void(const std::string& str, error e)> callback);
 
         bool write(file_handle fd, const char* buf, size_t len, off_t offset, std::function<void(int nwritten, error e)> callback);
+        bool write(native::loop& l, file_handle fd, const char* buf, size_t len, off_t offset, std::function<void(int nwritten, error e)> callback);
 
         bool read_to_end(file_handle fd, std::function<void(const std::string& str, error e)> callback);
+        bool read_to_end(native::loop& l, file_handle fd, std::function<void(const std::string& str, error e)> callback);
 
         bool close(file_handle fd, std::function<void(error e)> callback);
+        bool close(native::loop& l, file_handle fd, std::function<void(error e)> callback);
 
         bool unlink(const std::string& path, std::function<void(error e)> callback);
+        bool unlink(native::loop& l, const std::string& path, std::function<void(error e)> callback);
 
         bool mkdir(const std::string& path, int mode, std::function<void(error e)> callback);
+        bool mkdir(native::loop& l, const std::string& path, int mode, std::function<void(error e)> callback);
 
         bool rmdir(const std::string& path, std::function<void(error e)> callback);
+        bool rmdir(native::loop& l, const std::string& path, std::function<void(error e)> callback);
 
         bool rename(const std::string& path, const std::string& new_path, std::function<void(error e)> callback);
+        bool rename(native::loop& l, const std::string& path, const std::string& new_path, std::function<void(error e)> callback);
 
         bool chmod(const std::string& path, int mode, std::function<void(error e)> callback);
+        bool chmod(native::loop& l, const std::string& path, int mode, std::function<void(error e)> callback);
 
         bool chown(const std::string& path, int uid, int gid, std::function<void(error e)> callback);
+        bool chown(native::loop& l, const std::string& path, int uid, int gid, std::function<void(error e)> callback);
+
+        // Copies up to len bytes from in_fd at offset to out_fd inside the kernel, may send less.
+        bool sendfile(file_handle out_fd, file_handle in_fd, int64_t offset, size_t len, std::function<void(size_t nsent, error e)> callback);
+        bool sendfile(native::loop& l, file_handle out_fd, file_handle in_fd, int64_t offset, size_t len, std::function<void(size_t nsent, error e)> callback);
 
 #if 0
         bool readdir(const std::string& path, int flags, std::function<void(error e)> callback)
@@ -201,14 +217,20 @@ namespace native
     public:
         static bool read(const std::string& path, std::function<void(const std::string& str, error e)> callback)
         {
-            return fs::open(path.c_str(), fs::read_only, 0, [=](fs::file_handle fd, error e) {
+            return read(native::loop::get_default(), path, callback);
+        }
+
+        static bool read(native::loop& l, const std::string& path, std::function<void(const std::string& str, error e)> callback)
+        {
+            native::loop* lp = &l;
+            return fs::open(l, path.c_str(), fs::read_only, 0, [=](fs::file_handle fd, error e) {
                 if(e)
                 {
                     callback(std::string(), e);
                 }
                 else
                 {
-                    if(!fs::read_to_end(fd, callback))
+                    if(!fs::read_to_end(*lp, fd, callback))
                     {
                         // failed to initiate read_to_end()
                         //TODO: this should not happen for async (callback provided). Temporary return unknown error. To resolve this.
@@ -221,14 +243,20 @@ namespace native
 
         static bool write(const std::string& path, const std::string& str, std::function<void(int nwritten, error e)> callback)
         {
-            return fs::open(path.c_str(), fs::write_only|fs::create, 0664, [=](fs::file_handle fd, error e) {
+            return write(native::loop::get_default(), path, str, callback);
+        }
+
+        static bool write(native::loop& l, const std::string& path, const std::string& str, std::function<void(int nwritten, error e)> callback)
+        {
+            native::loop* lp = &l;
+            return fs::open(l, path.c_str(), fs::write_only|fs::create, 0664, [=](fs::file_handle fd, error e) {
                 if(e)
                 {
                     callback(0, e);
                 }
                 else
                 {
-                    if(!fs::write(fd, str.c_str(), str.length(), 0, callback))
+                    if(!fs::write(*lp, fd, str.c_str(), str.length(), 0, callback))
                     {
                         // failed to initiate read_to_end()
                         //TODO: this should not happen for async (callback provided). Temporary return unknown error. To resolve this.
@@ -0,0 +1,123 @@
+#ifndef __NATIVE_HPACK_H__
+#define __NATIVE_HPACK_H__
+
+#include <deque>
+#include "base.h"
+
+namespace native
+{
+namespace http
+{
+/*!
+ *  Header compression for HTTP/2 (RFC 7541).  Each direction of a connection
+ *  keeps its own dynamic table, so a decoder and an encoder belong to a single
+ *  connection and see every header block of it in order.
+ */
+namespace hpack
+{
+//! Size of a table entry as defined by the RFC, 32 bytes of overhead included.
+inline size_t entry_size(size_t name_length, size_t value_length)
+{
+  return name_length + value_length + 32;
+}
+
+//! Decodes a Huffman coded string, false if it is malformed.
+NNATIVE_DLLEXPORT bool huffman_decode(const uint8_t* data, size_t length, std::string& out);
+
+/*!
+ *  Appends value as an integer with an n bit prefix, first carrying the bits
+ *  above the prefix.
+ */
+NNATIVE_DLLEXPORT void encode_integer(std::string& out, uint8_t first, int prefix_bits, uint64_t value);
+
+class NNATIVE_DLLEXPORT table
+{
+  public:
+    table(size_t max_size = 4096);
+
+    //! Entry at index, 1 to 61 being the static table, nullptr past the end.
+    const std::pair<std::string, std::string>* get(size_t index) const;
+
+    /*!
+     *  Index of an entry matching name and value, or of one matching the name
+     *  only.  Returns 0 if there is neither, is_exact tells which one it is.
+     */
+    size_t find(const std::string& name, const std::string& value, bool& is_exact) const;
+
+    //! Adds an entry in front, evicting as many old ones as it takes.
+    void insert(const std::string& name, const std::string& value);
+
+    void set_max_size(size_t max_size);
+
+    size_t get_max_size() const {
+      return max_size_;
+    }
+
+    static const size_t static_size = 61;
+
+  private:
+    void evict(size_t max_size);
+
+  private:
+    std::deque<std::pair<std::string, std::string> > entries_;
+    size_t size_;
+    size_t max_size_;
+};
+
+class NNATIVE_DLLEXPORT decoder
+{
+  public:
+    /*!
+     *  @param max_table_size what SETTINGS_HEADER_TABLE_SIZE allows the peer
+     *  to use, size updates in header blocks can't exceed it.
+     */
+    decoder(size_t max_table_size = 4096);
+
+    /*!
+     *  Calls on_header for every field of a complete header block, in order.
+     *  Returns false on a compression error, which leaves the table out of
+     *  sync with the peer's and has to end the connection.
+     */
+    bool decode(const uint8_t* data, size_t length,
+                const std::function<void(const std::string&, const std::string&)>& on_header);
+
+  private:
+    bool decode_integer(const uint8_t*& pos, const uint8_t* end, int prefix_bits, uint64_t& value) const;
+    bool decode_string(const uint8_t*& pos, const uint8_t* end, std::string& out) const;
+
+  private:
+    table table_;
+    size_t max_table_size_;
+};
+
+/*!
+ *  Fields are indexed once and sent as a single index from then on, values
+ *  changing with every response such as content-length are never indexed.
+ *  Strings are sent as they are rather than Huffman coded.
+ */
+class NNATIVE_DLLEXPORT encoder
+{
+  public:
+    encoder();
+
+    //! Applies the peer's SETTINGS_HEADER_TABLE_SIZE from the next block on.
+    void set_max_table_size(size_t max_size);
+
+    //! Starts a header block, emitting a pending table size update.
+    void begin(std::string& out);
+
+    //! name has to be lower case.
+    void encode(std::string& out, const std::string& name, const std::string& value, bool is_indexed = true);
+
+    void encode_status(std::string& out, int status);
+
+  private:
+    table table_;
+    size_t pending_max_size_;
+    bool has_size_update_;
+};
+}
+}
+}
+
+#endif
@@ -135,6 +135,12 @@ class response
 
     static std::string get_status_text(int status);
 
+    /**
+     * "HTTP/1.1 <status> <text>\r\n", built once for every status code from
+     * 100 to 599.  Unknown codes come without a reason phrase.
+     */
+    static const std::string& get_status_line(int status);
+
   private:
     http_client_ptr client_;
     native::net::tcp* socket_;
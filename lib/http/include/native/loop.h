@@ -3,6 +3,7 @@
 
 #include "base.h"
 #include "error.h"
+#include "buffer_pool.h"
 
 namespace native
 {
@@ -19,10 +20,21 @@ class NNATIVE_DLLEXPORT loop
     loop(bool use_default = false);
 
     /*!
-     *  Destructor
+     *  Destructor, closes the loop unless it is the default loop.
+     *  Handles still open on the loop are reported and leaked.
      */
     ~loop();
 
+    /*!
+     *  Returns the instance wrapping uv_default_loop().
+     */
+    static loop& get_default();
+
+    /*!
+     *  Returns the instance wrapping l, or nullptr if it isn't wrapped.
+     */
+    static loop* from(uv_loop_t* l);
+
     /*!
      *  Returns internal handle for libuv functions.
      */
@@ -50,6 +62,27 @@ class NNATIVE_DLLEXPORT loop
      */
     bool run_nowait();
 
+    /*!
+     *  Stops the event loop, causing run() to end as soon as possible.
+     *  Internally, this function just calls uv_stop() function.
+     *  Like every other libuv call it has to be made on the thread running the loop.
+     */
+    void stop();
+
+    /*!
+     *  Read buffers lent to every stream on this loop.
+     */
+    buffer_pool& get_buffer_pool() {
+      return buffer_pool_;
+    }
+
+    /*!
+     *  Returns true if this instance wraps uv_default_loop().
+     */
+    bool is_default() const {
+      return is_default_;
+    }
+
     /*!
      *  ...
      *  Internally, this function just calls uv_update_time() function.
@@ -68,6 +101,8 @@ class NNATIVE_DLLEXPORT loop
 
   private:
     uv_loop_t* uv_loop_;
+    bool is_default_;
+    buffer_pool buffer_pool_;
 };
 
 /*!
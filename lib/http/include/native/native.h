@@ -6,6 +6,7 @@
 #include "loop.h"
 #include "error.h"
 #include "tcp.h"
+#include "pipe.h"
 #include "http.h"
 #include "fs.h"
 
@@ -0,0 +1,106 @@
+#ifndef __NATIVE_OBJECT_POOL_H__
+#define __NATIVE_OBJECT_POOL_H__
+
+#include "base.h"
+
+#include <atomic>
+#include <vector>
+
+namespace native
+{
+/*!
+ *  Freelist of recycled objects, one per loop.  Only the thread running the
+ *  loop may acquire and release objects, the counters can be read from any
+ *  thread.
+ *
+ *  The pool doesn't construct anything itself, objects are reset by their
+ *  owner before they are released so they keep whatever capacity they grew.
+ */
+template<typename T>
+class object_pool
+{
+  public:
+    /*!
+     *  @param max_cached objects kept once released, the rest are deleted.
+     */
+    object_pool(size_t max_cached = 256) :
+      max_cached_(max_cached),
+      free_(),
+      hits_(0),
+      misses_(0),
+      cached_(0)
+    {
+    }
+
+    ~object_pool()
+    {
+      for(auto obj : free_)
+      {
+        delete obj;
+      }
+    }
+
+    /*!
+     *  Returns a recycled object, or nullptr if there is none and the caller
+     *  has to allocate one.
+     */
+    T* acquire()
+    {
+      if(free_.empty())
+      {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      }
+
+      T* obj = free_.back();
+      free_.pop_back();
+      hits_.fetch_add(1, std::memory_order_relaxed);
+      cached_.store(free_.size(), std::memory_order_relaxed);
+      return obj;
+    }
+
+    /*!
+     *  Keeps obj for the next acquire(), or deletes it once max_cached objects
+     *  are waiting already.
+     */
+    void release(T* obj)
+    {
+      if(free_.size() >= max_cached_)
+      {
+        delete obj;
+        return;
+      }
+
+      free_.push_back(obj);
+      cached_.store(free_.size(), std::memory_order_relaxed);
+    }
+
+    //! Objects served from the freelist.
+    uint64_t hits() const {
+      return hits_.load(std::memory_order_relaxed);
+    }
+
+    //! Objects that had to be allocated.
+    uint64_t misses() const {
+      return misses_.load(std::memory_order_relaxed);
+    }
+
+    //! Objects currently sitting in the freelist.
+    size_t cached() const {
+      return cached_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    object_pool(const object_pool&);
+    void operator =(const object_pool&);
+
+  private:
+    size_t max_cached_;
+    std::vector<T*> free_;
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<size_t> cached_;
+};
+}
+
+#endif
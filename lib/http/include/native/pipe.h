@@ -0,0 +1,48 @@
+#ifndef __NATIVE_PIPE_H__
+#define __NATIVE_PIPE_H__
+
+#include "base.h"
+#include "handle.h"
+#include "loop.h"
+#include "stream.h"
+#include "callback.h"
+
+namespace native
+{
+namespace net
+{
+/** A Unix domain socket, or a named pipe on Windows.
+ */
+class NNATIVE_DLLEXPORT pipe : public native::base::stream
+{
+  public:
+    pipe(native::loop& l);
+
+    ~pipe();
+
+    /** Binds to the socket path name.  A socket file nobody is listening on
+     *  anymore, such as one left behind by a crashed process, is replaced.
+     */
+    bool bind(const std::string& name, error& oError);
+
+    /** Changes the permissions of the socket file once bound, so a proxy
+     *  running as another user can connect.  Not supported on Windows.
+     */
+    bool chmod(int mode, error& oError);
+
+    /** Wraps an already connected socket, such as one accepted on another loop.
+     *  The caller keeps ownership of sock if this fails.
+     */
+    bool open(uv_os_sock_t sock, error& oError);
+
+    /** The path this pipe is bound to.
+     */
+    bool getsockname(std::string& name) const;
+
+  private:
+    std::string name_;
+};
+}
+}
+
+#endif
@@ -5,6 +5,7 @@
 #include "error.h"
 #include "handle.h"
 #include "callback.h"
+#include "buffer_pool.h"
 
 #include <algorithm>
 
@@ -37,9 +38,31 @@ class stream : public handle
     bool write(const std::string& buf, std::function<void(error)> callback);
     bool write(const std::vector<char>& buf, std::function<void(error)> callback);
 
+    /** Vectored write, issues a single uv_write() for all buffers.
+     *  Any number of writes may be outstanding, each callback is called once
+     *  its own write completes, in the order the writes were issued.
+     */
+    bool write(const uv_buf_t* bufs, unsigned int nbufs, std::function<void(error)> callback);
+
+    /** Bytes queued by write() that haven't been handed to the kernel yet.
+     */
+    size_t write_queue_size() const;
+
+    /** Writes as much as the socket takes without queueing, returns the number
+     *  of bytes written or a negative error, UV_EAGAIN if nothing went out.
+     */
+    int try_write(const uv_buf_t* bufs, unsigned int nbufs);
+
     // TODO: implement write2()
 
     bool shutdown(std::function<void(error)> callback);
+
+    /** Duplicates the underlying socket so it can be handed to a stream of the
+     *  same kind on another loop with open(), the caller owns the returned
+     *  descriptor.
+     *  Returns false where the platform doesn't support it.
+     */
+    bool duplicate(uv_os_sock_t& oSock, error& oError);
 };
 
 // template body
@@ -49,10 +72,12 @@ bool stream::read_start(std::function<void(const char* buf, ssize_t len)> callba
 {
   callbacks::store(get()->data, native::internal::uv_cid_read_start, callback);
 
-  auto allocate = [](uv_handle_t*, size_t suggested_size, uv_buf_t* buf){
+  // Buffers are lent by the loop's pool for the duration of the callback.
+  auto allocate = [](uv_handle_t* h, size_t suggested_size, uv_buf_t* buf){
                     auto size = (std::max)(suggested_size, max_alloc_size);
-                    buf->base = new char[size];
-                    buf->len = size;
+                    size_t len = 0;
+                    buf->base = native::internal::acquire_read_buffer(h->loop, size, len);
+                    buf->len = len;
                     if((buf->base == NULL) && (buf->len > 0))
                     {
                       assert(0);
@@ -71,7 +96,7 @@ bool stream::read_start(std::function<void(const char* buf, ssize_t len)> callba
                      {
                        callbacks::invoke<decltype(callback)>(s->data, native::internal::uv_cid_read_start, buf->base, nread);
                      }
-                     delete buf->base;
+                     native::internal::release_read_buffer(s->loop, buf->base, buf->len);
                    };
 
   return uv_read_start(get<uv_stream_t>(), allocate, readyRead) == 0;
@@ -43,17 +43,57 @@ class NNATIVE_DLLEXPORT tcp : public native::base::stream
       return uv_tcp_simultaneous_accepts(get<uv_tcp_t>(), enable ? 1 : 0) == 0;
     }
 
+    /** Opens the socket ahead of bind() with SO_REUSEPORT set, so several
+     *  listeners (typically one per loop) can share the same address and the
+     *  kernel spreads incoming connections between them.
+     *  Returns false where the platform doesn't support it.
+     */
+    bool reuse_port(bool ip6, error& oError);
+
+    /** Wraps an already connected socket, such as one accepted on another loop.
+     *  The caller keeps ownership of sock if this fails.
+     */
+    bool open(uv_os_sock_t sock, error& oError);
+
+    /** Sets an integer socket option on the underlying descriptor, which only
+     *  exists once the socket is bound, opened or accepted.
+     */
+    bool set_option(int level, int name, int value, error& oError);
+
+    /** Kernel buffer sizes, Linux doubles the value for its bookkeeping.
+     */
+    bool receive_buffer_size(int size, error& oError);
+    bool send_buffer_size(int size, error& oError);
+
+    /** Listening sockets only: the kernel holds on to a connection until its
+     *  first data arrives or seconds pass.
+     *  Returns false where the platform doesn't support it (TCP_DEFER_ACCEPT).
+     */
+    bool defer_accept(unsigned int seconds, error& oError);
+
+    /** Listening sockets only, has to be set before listen(): accepts data in
+     *  the SYN from up to queue_length clients without a TFO cookie handshake
+     *  pending.
+     *  Returns false where the platform doesn't support it.
+     */
+    bool fast_open(int queue_length, error& oError);
+
     /** A general method which iAddr can be ip4 or ip6
      */
     virtual bool bind(const sockaddr* iAddr, error& oError);
 
+    /** flags are passed to uv_tcp_bind(), e.g. UV_TCP_IPV6ONLY.
+     */
+    bool bind(const sockaddr* iAddr, unsigned int flags, error& oError);
+
     /** ip4 bind
      */
     bool bind(const std::string& ip, int port, error& oError);
     bool bind(const std::string& ip, int port);
 
-    /** ip6 bind with
+    /** ip6 bind, ipv6_only keeps ip4 clients off an ip6 wildcard address.
      */
+    bool bind6(const std::string& ip, int port, bool ipv6_only, error& oError);
     bool bind6(const std::string& ip, int port, error& oError);
     bool bind6(const std::string& ip, int port);
 
@@ -26,6 +26,30 @@ namespace native
                     nocase_compare()); // comparison
             }
         };
+
+        enum { max_uint_digits = 20 };
+
+        /**
+         *  Writes value in decimal without a terminator, out has to hold
+         *  max_uint_digits characters.  Returns the number of digits.
+         */
+        inline size_t format_uint(uint64_t value, char* out)
+        {
+            char digits[max_uint_digits];
+            size_t count = 0;
+            do
+            {
+                digits[count++] = static_cast<char>('0' + (value % 10));
+                value /= 10;
+            }
+            while(value != 0);
+
+            for(size_t i = 0; i < count; ++i)
+            {
+                out[i] = digits[count - 1 - i];
+            }
+            return count;
+        }
     }
 }
 
@@ -0,0 +1,95 @@
+#ifndef __NATIVE_TIMER_WHEEL_H__
+#define __NATIVE_TIMER_WHEEL_H__
+
+#include "base.h"
+#include "loop.h"
+
+namespace native
+{
+/*!
+ *  Coarse timeouts for any number of objects off a single uv_timer_t, one
+ *  wheel per loop.  Starting and stopping an entry is constant time, expired
+ *  entries are found by visiting one slot per tick.  The timer only runs
+ *  while entries are pending.
+ *
+ *  Every call has to be made on the thread running the loop.
+ */
+class NNATIVE_DLLEXPORT timer_wheel
+{
+  public:
+    /*!
+     *  A timeout embedded in its owner, which has to stop it or outlive the
+     *  wheel.
+     */
+    class NNATIVE_DLLEXPORT entry
+    {
+      friend class timer_wheel;
+
+      public:
+        entry(std::function<void()> callback = nullptr);
+        ~entry();
+
+        void set_callback(std::function<void()> callback) {
+          callback_ = callback;
+        }
+
+        bool is_active() const {
+          return wheel_ != nullptr;
+        }
+
+      private:
+        entry(const entry&);
+        void operator =(const entry&);
+
+      private:
+        std::function<void()> callback_;
+        timer_wheel* wheel_;
+        entry* prev_;
+        entry* next_;
+        uint64_t expiry_;
+        size_t slot_;
+    };
+
+    /*!
+     *  @param tick_ms resolution, timeouts are rounded up to whole ticks.
+     *  @param slot_count ticks covered by one turn of the wheel, longer
+     *  timeouts take several turns.
+     */
+    timer_wheel(loop& l, uint64_t tick_ms = 100, size_t slot_count = 512);
+    ~timer_wheel();
+
+    /*!
+     *  Calls back e after timeout_ms, or restarts it if it is pending.
+     */
+    void start(entry& e, uint64_t timeout_ms);
+
+    //! Does nothing unless e is pending.
+    void stop(entry& e);
+
+    //! Pending entries.
+    size_t size() const {
+      return size_;
+    }
+
+  private:
+    timer_wheel(const timer_wheel&);
+    void operator =(const timer_wheel&);
+
+    uint64_t now_tick() const;
+    void link(entry& e, size_t slot);
+    void unlink(entry& e);
+    void on_tick();
+
+  private:
+    uv_timer_t* timer_;
+    uint64_t tick_ms_;
+    std::vector<entry*> slots_;
+    //! Entries of the slot being visited, while their callbacks run.
+    entry* expiring_;
+    //! Last tick whose slot was visited.
+    uint64_t tick_;
+    size_t size_;
+};
+}
+
+#endif
@@ -1,8 +1,133 @@
 #include "qttp.h"
+#include "qttp_http2.h"
+#include "qttp_websocket.h"
+#include "qttp_tls.h"
+
+#include <climits>
+
+#ifndef _WIN32
+  #include <unistd.h>
+#endif
 
 using namespace native;
 using namespace native::http;
 
+namespace
+{
+/**
+ * Empties bytes for the next request on a recycled object.  The allocation
+ * is kept unless it is shared with someone else or grew unusually large.
+ */
+void reset_bytes(QByteArray& bytes)
+{
+  if(bytes.isDetached() && bytes.capacity() <= buffer_pool::large_size)
+  {
+    // reserve() marks the capacity as reserved, resize() keeps it then.
+    bytes.reserve(bytes.capacity());
+    bytes.resize(0);
+  }
+  else
+  {
+    bytes.clear();
+  }
+}
+
+/**
+ * Header lines set for nearly every response, encoded once and shared with
+ * every response using them.
+ */
+const QttpResponseHeader& default_content_type()
+{
+  static const QttpResponseHeader header("Content-Type", "text/html");
+  return header;
+}
+
+const QttpResponseHeader& connection_keep_alive()
+{
+  static const QttpResponseHeader header("Connection", "keep-alive");
+  return header;
+}
+
+const QttpResponseHeader& connection_close()
+{
+  static const QttpResponseHeader header("Connection", "close");
+  return header;
+}
+
+const QttpResponseHeader& transfer_encoding_chunked()
+{
+  static const QttpResponseHeader header("Transfer-Encoding", "chunked");
+  return header;
+}
+
+//! Appends the hex size line of a chunk of length bytes to out.
+void append_chunk_size(QByteArray& out, size_t length)
+{
+  static const char hex[] = "0123456789abcdef";
+
+  char digits[16];
+  int count = 0;
+  for(; length > 0; length >>= 4)
+  {
+    digits[count++] = hex[length & 0xf];
+  }
+
+  while(count > 0)
+  {
+    out.append(digits[--count]);
+  }
+  out.append("\r\n", 2);
+}
+
+//! "<hex length>\r\n<data>\r\n", in one allocation.
+QByteArray frame_chunk(const QByteArray& data)
+{
+  QByteArray chunk;
+  chunk.reserve(16 + data.length() + 4);
+  append_chunk_size(chunk, static_cast<size_t>(data.length()));
+  chunk.append(data);
+  chunk.append("\r\n", 2);
+  return chunk;
+}
+
+//! Just the "<hex length>\r\n" in front of a chunk written as is.
+QByteArray frame_chunk_size(int length)
+{
+  QByteArray size_line;
+  size_line.reserve(18);
+  append_chunk_size(size_line, static_cast<size_t>(length));
+  return size_line;
+}
+
+void append_utf8(QByteArray& out, const QString& str)
+{
+  const QChar* chars = str.constData();
+  const int length = str.length();
+  for(int i = 0; i < length; ++i)
+  {
+    if(chars[i].unicode() >= 0x80)
+    {
+      // Rare enough to not bother, encode what is left in one go.
+      out.append(str.mid(i).toUtf8());
+      return;
+    }
+    out.append(static_cast<char>(chars[i].unicode()));
+  }
+}
+}
+
+QttpResponseHeader::QttpResponseHeader(const QString& k, const QString& v) :
+  key(k),
+  value(v),
+  line()
+{
+  line.reserve(k.length() + v.length() + 4);
+  append_utf8(line, k);
+  line.append(": ", 2);
+  append_utf8(line, v);
+  line.append("\r\n", 2);
+}
+
 QttpUrl::QttpUrl() :
   handle_(),
   buf_()
@@ -67,7 +192,7 @@ void QttpUrl::from_buf(const char* buf, std::size_t len, bool is_connect)
 {
   // TODO: validate input parameters
 
-  buf_.clear();
+  reset_bytes(buf_);
   buf_.append(buf, len);
 
   if(http_parser_parse_url(buf, len, is_connect, &handle_) != 0)
@@ -78,118 +203,455 @@ void QttpUrl::from_buf(const char* buf, std::size_t len, bool is_connect)
   }
 }
 
+void QttpUrl::reset()
+{
+  handle_ = http_parser_url();
+  reset_bytes(buf_);
+}
+
 QttpResponse::QttpResponse(QttpClientContext* client, native::net::tcp* socket) :
   client_(client),
   socket_(socket),
   headers_(),
   status_(200),
-  response_data_(),
-  is_response_written_(false)
+  head_(),
+  content_length_(0),
+  body_(),
+  owns_last_segment_(false),
+  file_path_(),
+  file_length_(0),
+  has_file_(false),
+  is_response_written_(false),
+  is_ready_(false),
+  stream_queue_(),
+  stream_mutex_(),
+  stream_backlog_(0),
+  drain_callback_(),
+  abort_callback_(),
+  is_chunking_allowed_(true),
+  is_http2_(false),
+  is_streaming_(false),
+  is_stream_blocked_(false),
+  is_stream_notified_(false),
+  is_stream_aborted_(false)
 {
-  headers_["Content-Type"] = "text/html";
+  headers_.push_back(default_content_type());
 }
 
 QttpResponse::~QttpResponse()
 {
 }
 
-void QttpResponse::write(int length, const QChar* body)
+void QttpResponse::reset()
 {
-  if(!is_response_written_)
+  headers_.clear();
+  headers_.push_back(default_content_type());
+  status_ = 200;
+  reset_bytes(head_);
+  content_length_ = 0;
+  // Drops our references to the bodies, the vector keeps its capacity.
+  body_.clear();
+  owns_last_segment_ = false;
+  file_path_.clear();
+  file_length_ = 0;
+  has_file_ = false;
+  is_response_written_ = false;
+  is_ready_ = false;
+  stream_queue_.clear();
+  stream_backlog_ = 0;
+  drain_callback_ = nullptr;
+  abort_callback_ = nullptr;
+  is_chunking_allowed_ = true;
+  is_http2_ = false;
+  is_streaming_ = false;
+  is_stream_blocked_ = false;
+  is_stream_notified_ = false;
+  is_stream_aborted_ = false;
+}
+
+void QttpResponse::set_header(const QttpResponseHeader& header)
+{
+  for(auto & h : headers_)
   {
-    is_response_written_ = true;
-    if(headers_.find("Content-Length") == headers_.end())
+    if(h.key.compare(header.key, Qt::CaseInsensitive) == 0)
     {
-      headers_["Content-Length"] = QString::number((length > 0 && body != nullptr ? length : 0));
+      h = header;
+      return;
     }
+  }
+  headers_.push_back(header);
+}
 
-    QTextStream stream(&response_data_);
-    stream << "HTTP/1.1 " << status_ << " " << response::get_status_text(status_).c_str() << "\r\n";
-    for(auto & h : headers_)
-    {
-      stream << h.first << ": " << h.second << "\r\n";
-    }
-    stream << "\r\n";
-    stream.flush();
+std::map<QString, QString> QttpResponse::get_headers() const
+{
+  std::map<QString, QString> headers;
+  for(auto & h : headers_)
+  {
+    headers[h.key] = h.value;
+  }
+  return headers;
+}
 
-    if(length > 0 && body != nullptr)
+const QttpResponseHeader* QttpResponse::find_header(const QString& key) const
+{
+  for(auto & h : headers_)
+  {
+    if(h.key.compare(key, Qt::CaseInsensitive) == 0)
     {
-      response_data_.resize(response_data_.length() + length);
-      for(int i = 0; i < length; ++i)
-      {
-        response_data_.append(body[i]);
-      }
+      return &h;
     }
   }
-  else
+  return nullptr;
+}
+
+void QttpResponse::serialize_head(QByteArray& out, int status,
+                                  const std::vector<QttpResponseHeader>& headers,
+                                  int64_t content_length)
+{
+  static const char length_prefix[] = "Content-Length: ";
+  static const size_t length_prefix_size = sizeof(length_prefix) - 1;
+
+  const std::string& status_line = response::get_status_line(status);
+
+  char digits[native::text::max_uint_digits];
+  size_t digit_count = 0;
+  size_t size = status_line.size() + 2;
+
+  for(auto & h : headers)
+  {
+    size += h.line.size();
+  }
+
+  if(content_length >= 0)
+  {
+    digit_count = native::text::format_uint(static_cast<uint64_t>(content_length), digits);
+    size += length_prefix_size + digit_count + 2;
+  }
+
+  out.resize(static_cast<int>(size));
+  char* pos = out.data();
+
+  memcpy(pos, status_line.data(), status_line.size());
+  pos += status_line.size();
+
+  for(auto & h : headers)
+  {
+    memcpy(pos, h.line.constData(), h.line.size());
+    pos += h.line.size();
+  }
+
+  if(content_length >= 0)
+  {
+    memcpy(pos, length_prefix, length_prefix_size);
+    pos += length_prefix_size;
+    memcpy(pos, digits, digit_count);
+    pos += digit_count;
+    *pos++ = '\r';
+    *pos++ = '\n';
+  }
+
+  *pos++ = '\r';
+  *pos++ = '\n';
+}
+
+void QttpResponse::write_head(size_t content_length)
+{
+  is_response_written_ = true;
+
+  bool has_length = find_header("Content-Length") != nullptr;
+  content_length_ = has_length ? -1 : static_cast<int64_t>(content_length);
+  if(!is_http2_)
+  {
+    serialize_head(head_, status_, headers_, content_length_);
+  }
+}
+
+void QttpResponse::announce_close()
+{
+  if(is_streaming_ || is_http2_)
+  {
+    // The head is out already, or GOAWAY tells the client.
+    return;
+  }
+
+  const QttpResponseHeader* header = find_header("Connection");
+  if(header && header->value.compare(connection_close().value, Qt::CaseInsensitive) == 0)
+  {
+    return;
+  }
+
+  set_header(connection_close());
+  serialize_head(head_, status_, headers_, content_length_);
+}
+
+void QttpResponse::append_body(const char* body, size_t length)
+{
+  // Data we don't hold a reference to has to be copied, at least keep it in
+  // one segment.
+  if(!owns_last_segment_)
+  {
+    body_.push_back(QByteArray());
+    owns_last_segment_ = true;
+  }
+  body_.back().append(body, static_cast<int>(length));
+}
+
+void QttpResponse::write(int length, const QChar* body)
+{
+  bool has_body = (length > 0 && body != nullptr);
+  if(!is_response_written_)
   {
-    if(length > 0 && body != nullptr)
+    write_head(has_body ? length : 0);
+  }
+
+  if(has_body)
+  {
+    QByteArray data;
+    data.reserve(length);
+    for(int i = 0; i < length; ++i)
     {
-      response_data_.resize(response_data_.length() + length);
-      for(int i = 0; i < length; ++i)
-      {
-        response_data_.append(body[i]);
-      }
+      data.append(body[i]);
     }
+    append_body(data.constData(), data.length());
   }
 }
 
 void QttpResponse::write(size_t length, const char* body)
+{
+  bool has_body = (length > 0 && body != nullptr);
+  if(!is_response_written_)
+  {
+    write_head(has_body ? length : 0);
+  }
+
+  if(has_body)
+  {
+    append_body(body, length);
+  }
+}
+
+void QttpResponse::write(const QByteArray& body)
 {
   if(!is_response_written_)
   {
-    is_response_written_ = true;
-    if(headers_.find("Content-Length") == headers_.end())
+    write_head(body.length());
+  }
+
+  if(!body.isEmpty())
+  {
+    body_.push_back(body);
+    owns_last_segment_ = false;
+  }
+}
+
+void QttpResponse::get_buffers(std::vector<uv_buf_t>& bufs) const
+{
+  // constData() avoids detaching, data() would copy a shared body.
+  bufs.push_back(uv_buf_init(const_cast<char*>(head_.constData()), static_cast<unsigned int>(head_.length())));
+  for(auto & segment : body_)
+  {
+    if(!segment.isEmpty())
     {
-      headers_["Content-Length"] = QString::number((length > 0 && body != nullptr ? length : 0));
+      bufs.push_back(uv_buf_init(const_cast<char*>(segment.constData()), static_cast<unsigned int>(segment.length())));
     }
+  }
+}
+
+bool QttpResponse::end_file(const std::string& path, uint64_t length)
+{
+  if(!is_response_written_)
+  {
+    write_head(length);
+  }
+  file_path_ = path;
+  file_length_ = length;
+  has_file_ = true;
+  return close();
+}
+
+bool QttpResponse::begin_stream()
+{
+  if(is_response_written_)
+  {
+    return false;
+  }
+  is_response_written_ = true;
+
+  if(is_http2_)
+  {
+    // The session sends the headers, an empty segment wakes it up.
+    is_streaming_ = true;
+    queue_stream(QByteArray());
+    return true;
+  }
+
+  if(is_chunking_allowed_)
+  {
+    set_header(transfer_encoding_chunked());
+  }
+  else
+  {
+    // Nothing else tells an HTTP/1.0 client where the body ends.
+    set_header(connection_close());
+  }
+  serialize_head(head_, status_, headers_, -1);
+
+  is_streaming_ = true;
+  queue_stream(head_);
+  return true;
+}
+
+bool QttpResponse::write_chunk(const QByteArray& chunk)
+{
+  if(!is_streaming_ || is_ready_ || is_stream_aborted_)
+  {
+    return false;
+  }
+
+  if(chunk.isEmpty())
+  {
+    // An empty chunk would end the body.
+    return get_stream_backlog() <= client_->options_.response_stream_high_watermark;
+  }
+
+  if(!is_chunking_allowed_ || is_http2_)
+  {
+    return queue_stream(chunk);
+  }
+
+  if(chunk.length() <= QttpClientContext::max_copied_bytes)
+  {
+    return queue_stream(frame_chunk(chunk));
+  }
+
+  // Larger chunks are written from the caller's buffer between their size
+  // line and CRLF, so the same chunk can go out to many streams uncopied.
+  static const QByteArray crlf("\r\n");
+  const QByteArray segments[] = { frame_chunk_size(chunk.length()), chunk, crlf };
+  return queue_stream(segments, 3);
+}
+
+bool QttpResponse::end_stream()
+{
+  if(!is_streaming_ || is_ready_)
+  {
+    return false;
+  }
+
+  if(is_chunking_allowed_ && !is_http2_)
+  {
+    static const QByteArray last_chunk("0\r\n\r\n");
+    queue_stream(last_chunk);
+  }
+  return close();
+}
+
+size_t QttpResponse::get_stream_backlog() const
+{
+  std::lock_guard<std::mutex> lock(stream_mutex_);
+  return stream_backlog_;
+}
 
-    QTextStream stream(&response_data_);
-    stream << "HTTP/1.1 " << status_ << " " << response::get_status_text(status_).c_str() << "\r\n";
-    for(auto & h : headers_)
+bool QttpResponse::queue_stream(const QByteArray* segments, size_t count)
+{
+  bool is_writable;
+  bool needs_notify;
+  {
+    std::lock_guard<std::mutex> lock(stream_mutex_);
+    for(size_t i = 0; i < count; ++i)
     {
-      stream << h.first << ": " << h.second << "\r\n";
+      stream_queue_.push_back(segments[i]);
+      stream_backlog_ += static_cast<size_t>(segments[i].length());
     }
-    stream << "\r\n";
-    stream.flush();
 
-    if(length > 0 && body != nullptr)
+    is_writable = stream_backlog_ <= client_->options_.response_stream_high_watermark;
+    if(!is_writable)
     {
-      response_data_.append(body, length);
+      is_stream_blocked_ = true;
     }
+
+    // One notification covers whatever is queued until the loop takes it.
+    needs_notify = !is_stream_notified_;
+    is_stream_notified_ = true;
   }
-  else
+
+  if(needs_notify)
+  {
+    client_->on_stream_data();
+  }
+  return is_writable;
+}
+
+size_t QttpResponse::take_stream(std::vector<QByteArray>& out)
+{
+  std::lock_guard<std::mutex> lock(stream_mutex_);
+  is_stream_notified_ = false;
+
+  size_t length = 0;
+  for(auto & segment : stream_queue_)
+  {
+    length += static_cast<size_t>(segment.length());
+    out.push_back(segment);
+  }
+  stream_queue_.clear();
+  return length;
+}
+
+void QttpResponse::on_stream_written(size_t length)
+{
+  bool is_drained = false;
   {
-    if(length > 0 && body != nullptr)
+    std::lock_guard<std::mutex> lock(stream_mutex_);
+    stream_backlog_ -= (std::min)(length, stream_backlog_);
+    if(is_stream_blocked_ && stream_backlog_ <= client_->options_.response_stream_low_watermark)
     {
-      response_data_.append(body, length);
+      is_stream_blocked_ = false;
+      is_drained = true;
     }
   }
+
+  if(is_drained && drain_callback_)
+  {
+    drain_callback_();
+  }
+}
+
+void QttpResponse::abort_stream()
+{
+  if(!is_streaming_ || is_ready_ || is_stream_aborted_)
+  {
+    return;
+  }
+  is_stream_aborted_ = true;
+
+  if(abort_callback_)
+  {
+    abort_callback_();
+  }
 }
 
 bool QttpResponse::close()
 {
-  auto str = response_data_.constData();
-  PRINT_DBG(str);
-  return socket_->write(str, static_cast<int>(response_data_.length()), [ = ](native::error e) {
-    if(e)
-    {
-      PRINT_STDERR("ERROR while trying to close QttpResponse");
-      PRINT_NN_ERROR(e);
-    }
-    // clean up
-    client_.reset();
-  });
+  if(!is_response_written_)
+  {
+    write_head(0);
+  }
+  PRINT_DBG(head_.constData());
+  client_->on_response_ready(this);
+  return true;
 }
 
 const QString QttpRequest::default_value_;
 
 QttpRequest::QttpRequest() :
   url_(),
+  header_data_(),
   headers_(),
   body_(),
   method_(),
-  timestamp_(uv_hrtime())
+  timestamp_(uv_hrtime()),
+  client_(nullptr),
+  is_body_streamed_(false)
 {
 }
 
@@ -197,91 +659,319 @@ QttpRequest::~QttpRequest()
 {
 }
 
+void QttpRequest::reset()
+{
+  url_.reset();
+  reset_bytes(header_data_);
+  headers_.clear();
+  reset_bytes(body_);
+  method_.clear();
+  client_ = nullptr;
+  is_body_streamed_ = false;
+}
+
+void QttpRequest::consume_body(size_t length)
+{
+  client_->on_body_consumed(length);
+}
+
 const QString& QttpRequest::get_header(const QString& key) const
 {
-  auto it = headers_.find(key);
-  if(it != headers_.end()) return it->second;
+  auto header = find_header(key);
+  if(header) return materialize(*header);
   return QttpRequest::default_value_;
 }
 
 bool QttpRequest::get_header(const QString& key, QString& value) const
 {
-  auto it = headers_.find(key);
-  if(it != headers_.end())
+  auto header = find_header(key);
+  if(header)
   {
-    value = it->second;
+    value = materialize(*header);
     return true;
   }
   return false;
 }
 
-const std::map<QString, QString>& QttpRequest::get_headers() const
+bool QttpRequest::has_header(const QString& key) const
 {
-  return headers_;
+  return find_header(key) != nullptr;
 }
 
-QttpClientContext::QttpClientContext(native::net::tcp* server) :
-  parser_(),
-  parser_settings_(),
-  was_header_value_(true),
-  last_header_field_(),
-  last_header_value_(),
-  socket_(nullptr),
-  request_(nullptr),
-  response_(nullptr),
-  callback_lut_(new callbacks(1))
+std::map<QString, QString> QttpRequest::get_headers() const
 {
-  assert(server);
-
-  // TODO: Check Error.
-  //
-  // TODO: Should this also toggle between SSL?
-
-  socket_ = std::shared_ptr<native::net::tcp> (new native::net::tcp);
-  server->accept(socket_.get());
+  std::map<QString, QString> headers;
+  for(auto & h : headers_)
+  {
+    headers[QString::fromLatin1(get_header_data(h.name_offset), h.name_length)] = materialize(h);
+  }
+  return headers;
 }
 
-QttpClientContext::~QttpClientContext()
+const QttpHeaderView* QttpRequest::find_header(const QString& key) const
 {
-  if(request_)
-  {
-    delete request_;
-    request_ = nullptr;
-  }
+  const int length = key.length();
+  const QChar* chars = key.constData();
 
-  if(response_)
+  // Backwards so a repeated header behaves like it overwrote the earlier one.
+  for(auto it = headers_.rbegin(); it != headers_.rend(); ++it)
   {
-    delete response_;
-    response_ = nullptr;
-  }
+    if(it->name_length != length)
+    {
+      continue;
+    }
 
-  if(callback_lut_)
+    const char* name = get_header_data(it->name_offset);
+    int i = 0;
+    for(; i < length; ++i)
+    {
+      ushort a = chars[i].unicode();
+      ushort b = static_cast<unsigned char>(name[i]);
+      if(a >= 'A' && a <= 'Z') a += 'a' - 'A';
+      if(b >= 'A' && b <= 'Z') b += 'a' - 'A';
+      if(a != b)
+      {
+        break;
+      }
+    }
+
+    if(i == length)
+    {
+      return &*it;
+    }
+  }
+  return nullptr;
+}
+
+const QString& QttpRequest::materialize(const QttpHeaderView& header) const
+{
+  if(!header.has_value)
+  {
+    header.value = QString::fromUtf8(get_header_data(header.value_offset), header.value_length);
+    header.has_value = true;
+  }
+  return header.value;
+}
+
+void QttpRequest::append_header_field(const char* at, size_t len, bool is_new)
+{
+  if(is_new)
+  {
+    headers_.push_back(QttpHeaderView(header_data_.length()));
+  }
+  header_data_.append(at, static_cast<int>(len));
+  headers_.back().name_length += static_cast<int>(len);
+  headers_.back().value_offset = header_data_.length();
+}
+
+void QttpRequest::append_header_value(const char* at, size_t len)
+{
+  // Fragments arrive back to back, the value starts where the name ended.
+  header_data_.append(at, static_cast<int>(len));
+  headers_.back().value_length += static_cast<int>(len);
+}
+
+const uint64_t QttpClientContext::max_body_reserve;
+const int QttpClientContext::max_copied_bytes;
+
+QttpClientContext::QttpClientContext(Qttp* server, const QttpOptions& options, bool is_local) :
+  server_(server),
+  parser_(),
+  parser_settings_(),
+  was_header_value_(true),
+  socket_(nullptr),
+  is_local_(false),
+  request_(nullptr),
+  response_(nullptr),
+  pipeline_(),
+  callback_lut_(new callbacks(1)),
+  http2_(nullptr),
+  is_protocol_known_(false),
+  preface_(),
+  websocket_(),
+  is_websocket_pinged_(false),
+  tls_(nullptr),
+  tls_input_(),
+  is_tls_established_(false),
+  options_(options),
+  read_timeout_(),
+  write_timeout_(),
+  read_timeout_kind_(no_timeout),
+  write_mark_(0),
+  bytes_completed_(0),
+  header_bytes_(0),
+  url_bytes_(0),
+  body_window_bytes_(0),
+  pending_(),
+  requests_served_(0),
+  writing_(0),
+  bytes_in_flight_(0),
+  file_fd_(-1),
+  file_offset_(0),
+  file_remaining_(0),
+  file_chunk_(),
+  is_sending_file_(false),
+  pending_notifies_(0),
+  body_backlog_(0),
+  is_parsing_(false),
+  is_paused_(false),
+  is_body_blocked_(false),
+  is_write_blocked_(false),
+  is_continue_pending_(false),
+  is_reading_body_(false),
+  is_closing_(false),
+  is_broken_(false),
+  is_closed_(false),
+  is_socket_closed_(false)
+{
+  assert(server);
+
+  read_timeout_.set_callback([this]() {
+    on_read_timeout();
+  });
+  write_timeout_.set_callback([this]() {
+    on_write_timeout();
+  });
+
+  init(options, is_local);
+}
+
+QttpClientContext::~QttpClientContext()
+{
+  reset();
+
+  if(callback_lut_)
   {
     delete callback_lut_;
     callback_lut_ = nullptr;
   }
+}
 
-  if(socket_.use_count())
+void QttpClientContext::init(const QttpOptions& options, bool is_local)
+{
+  if(is_local)
   {
-    socket_->close([ = ](){
-      PRINT_DBG("Socket closed");
-    });
+    socket_ = std::make_shared<native::net::pipe>(*server_->loop_);
+  }
+  else
+  {
+    socket_ = std::make_shared<native::net::tcp>(*server_->loop_);
+  }
+  is_local_ = is_local;
+  options_ = options;
+
+#ifdef SSL_TLS_UV
+  if(!is_local && server_->tls_context_)
+  {
+    tls_ = new QttpTlsSession(*server_->tls_context_, server_->loop_->get_buffer_pool());
+  }
+#endif
+
+  if(options_.max_pipelined_requests == 0)
+  {
+    options_.max_pipelined_requests = 1;
   }
 }
 
-bool QttpClientContext::parse(std::function<void(QttpRequest&, QttpResponse&)> callback)
+void QttpClientContext::reset()
 {
-  request_ = new QttpRequest;
-  response_ = new QttpResponse(this, socket_.get());
+  if(request_)
+  {
+    server_->recycle(request_);
+    request_ = nullptr;
+  }
+
+  if(response_)
+  {
+    server_->recycle(response_);
+    response_ = nullptr;
+  }
 
+  // Hands the requests and responses of its streams back first.
+  if(http2_)
+  {
+    delete http2_;
+    http2_ = nullptr;
+  }
+  is_protocol_known_ = false;
+  preface_.clear();
+
+  if(websocket_)
+  {
+    // Whoever still holds on to it can't send anymore.
+    QttpRequest* request = nullptr;
+    QttpResponse* response = nullptr;
+    websocket_->detach(request, response);
+    server_->recycle(request);
+    server_->recycle(response);
+    websocket_.reset();
+  }
+  is_websocket_pinged_ = false;
+
+  drop(pipeline_.size());
+  socket_.reset();
+
+#ifdef SSL_TLS_UV
+  // Pending records were handed back when the socket closed.
+  delete tls_;
+#endif
+  tls_ = nullptr;
+  reset_bytes(tls_input_);
+  is_tls_established_ = false;
+
+  was_header_value_ = true;
+  reset_bytes(pending_);
+  requests_served_ = 0;
+  writing_ = 0;
+  bytes_in_flight_ = 0;
+  file_fd_ = -1;
+  file_offset_ = 0;
+  file_remaining_ = 0;
+  file_chunk_.clear();
+  is_sending_file_ = false;
+  body_backlog_ = 0;
+  is_parsing_ = false;
+  is_paused_ = false;
+  is_body_blocked_ = false;
+  is_write_blocked_ = false;
+  is_continue_pending_ = false;
+  is_reading_body_ = false;
+  read_timeout_kind_ = no_timeout;
+  write_mark_ = 0;
+  bytes_completed_ = 0;
+  header_bytes_ = 0;
+  url_bytes_ = 0;
+  body_window_bytes_ = 0;
+  is_closing_ = false;
+  is_broken_ = false;
+  is_closed_ = false;
+  is_socket_closed_ = false;
+}
+
+bool QttpClientContext::parse(std::function<void(QttpRequest&, QttpResponse&)> callback)
+{
   http_parser_init(&parser_, HTTP_REQUEST);
   parser_.data = this;
 
   // store callback object
   callbacks::store(callback_lut_, 0, callback);
 
+  parser_settings_.on_message_begin = [](http_parser* parser) {
+                                        auto client = reinterpret_cast<QttpClientContext*>(parser->data);
+                                        client->request_ = client->server_->create_request(client);
+                                        client->response_ = client->server_->create_response(client);
+                                        client->header_bytes_ = 0;
+                                        client->url_bytes_ = 0;
+                                        client->update_read_timeout();
+                                        return 0;
+                                      };
+
   parser_settings_.on_url = [](http_parser* parser, const char *at, size_t len) {
                               auto client = reinterpret_cast<QttpClientContext*>(parser->data);
+                              if(!client->on_header_bytes(len, true))
+                              {
+                                return 0;
+                              }
                               try
                               {
                                 client->request_->url_.from_buf(at, len);
@@ -296,117 +986,2238 @@ bool QttpClientContext::parse(std::function<void(QttpRequest&, QttpResponse&)> c
 
   parser_settings_.on_header_field = [](http_parser* parser, const char* at, size_t len) {
                                        auto client = reinterpret_cast<QttpClientContext*>(parser->data);
-                                       if(client->was_header_value_)
-                                       {
-                                         // new field started
-                                         if(!client->last_header_field_.isEmpty())
-                                         {
-                                           // add new entry
-                                           client->request_->headers_[client->last_header_field_] = std::move(client->last_header_value_);
-                                         }
-
-                                         client->last_header_field_ = QString::fromUtf8(at, len);
-                                         client->was_header_value_ = false;
-                                       }
-                                       else
+                                       if(!client->on_header_bytes(len, false))
                                        {
-                                         // appending
-                                         client->last_header_field_ += QString::fromUtf8(at, len);
+                                         return 0;
                                        }
+                                       // a field following a value starts the next header
+                                       client->request_->append_header_field(at, len, client->was_header_value_);
+                                       client->was_header_value_ = false;
                                        return 0;
                                      };
 
   parser_settings_.on_header_value = [](http_parser* parser, const char* at, size_t len) {
                                        auto client = reinterpret_cast<QttpClientContext*>(parser->data);
-
-                                       if(!client->was_header_value_)
-                                       {
-                                         client->last_header_value_ = QString::fromUtf8(at, len);
-                                         client->was_header_value_ = true;
-                                       }
-                                       else
+                                       if(!client->on_header_bytes(len, false))
                                        {
-                                         // appending
-                                         client->last_header_value_ += QString::fromUtf8(at, len);
+                                         return 0;
                                        }
+                                       client->request_->append_header_value(at, len);
+                                       client->was_header_value_ = true;
                                        return 0;
                                      };
 
   parser_settings_.on_headers_complete = [](http_parser* parser) {
                                            auto client = reinterpret_cast<QttpClientContext*>(parser->data);
-                                           // add last entry if any
-                                           if(!client->last_header_field_.isEmpty()) {
-                                             // add new entry
-                                             client->request_->headers_[client->last_header_field_] = std::move(client->last_header_value_);
-                                           }
+                                           // the parser is re-used across requests on a persistent connection
+                                           client->was_header_value_ = true;
+                                           client->on_headers_complete();
                                            return 0; // 1 to prevent reading of message body.
                                          };
 
   parser_settings_.on_body = [](http_parser* parser, const char* at, size_t len) {
                                PRINT_DBG("on_body: len of 'char* at' is " << len);
                                auto client = reinterpret_cast<QttpClientContext*>(parser->data);
-                               client->request_->body_.append(at, len);
+                               client->on_body(at, len);
                                return 0;
                              };
 
   parser_settings_.on_message_complete = [](http_parser* parser) {
                                            PRINT_DBG("on_message_complete, so invoke the callback");
                                            auto client = reinterpret_cast<QttpClientContext*>(parser->data);
-                                           client->request_->method_ = http_method_str((http_method)parser->method);
-                                           // invoke stored callback object
-                                           callbacks::invoke<decltype(callback)>(client->callback_lut_, 0, *client->request_, *client->response_);
-                                           return 1; // 0 or 1?
+                                           if(parser->upgrade && (client->upgrade_to_http2() || client->upgrade_to_websocket()))
+                                           {
+                                             return 0;
+                                           }
+
+                                           auto request = client->request_;
+                                           auto response = client->response_;
+
+                                           ++client->requests_served_;
+                                           bool keep_alive = client->should_keep_alive();
+                                           response->set_header(keep_alive ? connection_keep_alive() : connection_close());
+                                           response->is_chunking_allowed_ = parser->http_major > 1 ||
+                                                                            (parser->http_major == 1 && parser->http_minor > 0);
+
+                                           client->pipeline_.push_back(transaction(request, response));
+                                           client->request_ = nullptr;
+                                           client->response_ = nullptr;
+                                           client->is_reading_body_ = false;
+                                           // The client didn't wait for it.
+                                           client->is_continue_pending_ = false;
+
+                                           // Stop after the last request we intend to answer or once enough
+                                           // are queued up, pausing makes http_parser_execute() return right
+                                           // after this message so the remainder can be stashed for later.
+                                           if(!keep_alive)
+                                           {
+                                             client->is_closing_ = true;
+                                           }
+                                           if(client->is_closing_ ||
+                                              client->pipeline_.size() >= client->options_.max_pipelined_requests)
+                                           {
+                                             client->pause();
+                                           }
+
+                                           client->update_read_timeout();
+                                           client->dispatch(request, response);
+                                           return 0;
                                          };
 
+  update_read_timeout();
+  start_reading();
+  return true;
+}
+
+void QttpClientContext::start_reading()
+{
   socket_->read_start([ = ](const char* buf, int len) {
     if ((buf == nullptr) || (len < 0)) {
-      response_->set_status(500);
+      hang_up();
+    } else if (tls_) {
+      receive_tls(buf, len);
     } else {
-      http_parser_execute(&parser_, &parser_settings_, buf, len);
+      execute(buf, len);
     }
   });
+}
 
-  return true;
+void QttpClientContext::hang_up()
+{
+  // Streams may never end, their producers are told to stop.
+  is_closing_ = true;
+  socket_->read_stop();
+  pending_.clear();
+  abort_streams();
+  maybe_close();
 }
 
-Qttp::Qttp() : socket_(new native::net::tcp)
+void QttpClientContext::receive_tls(const char* buf, size_t len)
 {
+#ifdef SSL_TLS_UV
+  std::vector<uv_buf_t> records;
+  reset_bytes(tls_input_);
+  bool result = tls_->is_valid() && tls_->receive(buf, len, tls_input_, records);
+
+  // Handshake messages, or the alert telling why it failed.
+  if(!records.empty())
+  {
+    write_records(records, nullptr);
+  }
+
+  if(!is_tls_established_ && tls_->is_established())
+  {
+    is_tls_established_ = true;
+    if(tls_->is_resumed())
+    {
+      ++server_->stats_.tls_resumed_handshakes;
+    }
+    else
+    {
+      ++server_->stats_.tls_handshakes;
+    }
+  }
+  else if(!result && !is_tls_established_)
+  {
+    ++server_->stats_.tls_failures;
+  }
+
+  // Requests that came along with close_notify are still answered.
+  if(!tls_input_.isEmpty())
+  {
+    execute(tls_input_.constData(), static_cast<size_t>(tls_input_.size()));
+  }
+  if(!result && !is_closed_)
+  {
+    hang_up();
+  }
+#else
+  execute(buf, len);
+#endif
 }
 
-Qttp::~Qttp()
+void QttpClientContext::execute(const char* buf, size_t len)
 {
-  if(socket_)
+  if(websocket_)
   {
-    socket_->close([](){
-      PRINT_DBG("Closing socket");
-    });
+    is_parsing_ = true;
+    websocket_->receive(buf, len);
+    is_parsing_ = false;
+
+    // The client is still around, its idle time starts over.
+    read_timeout_kind_ = no_timeout;
+    is_websocket_pinged_ = false;
+
+    flush();
+    update_read_timeout();
+    maybe_close();
+    return;
+  }
+
+  if(http2_)
+  {
+    is_parsing_ = true;
+    http2_->receive(buf, len);
+    is_parsing_ = false;
+
+    flush();
+    update_read_timeout();
+    maybe_close();
+    return;
   }
+
+  if(!is_protocol_known_ && options_.http2)
+  {
+    // Clients knowing the server speaks HTTP/2 open with its preface, which
+    // http_parser would reject as an unknown method.
+    const char* data = buf;
+    size_t length = len;
+    if(!preface_.isEmpty())
+    {
+      preface_.append(buf, static_cast<int>(len));
+      data = preface_.constData();
+      length = static_cast<size_t>(preface_.length());
+    }
+
+    int match = QttpHttp2Session::match_preface(data, length);
+    if(match == 0)
+    {
+      if(preface_.isEmpty())
+      {
+        preface_.append(buf, static_cast<int>(len));
+      }
+      update_read_timeout();
+      return;
+    }
+
+    is_protocol_known_ = true;
+    QByteArray buffered;
+    buffered.swap(preface_);
+    if(match > 0)
+    {
+      http2_ = new QttpHttp2Session(this);
+      ++server_->stats_.http2_connections;
+      http2_->start();
+    }
+
+    if(!buffered.isEmpty())
+    {
+      execute(buffered.constData(), static_cast<size_t>(buffered.length()));
+      return;
+    }
+    execute(buf, len);
+    return;
+  }
+  is_protocol_known_ = true;
+
+  is_parsing_ = true;
+  size_t parsed = http_parser_execute(&parser_, &parser_settings_, buf, len);
+
+  // http_parser stops after a request asking for an upgrade, whatever follows
+  // is either the new protocol or the next request if the upgrade wasn't
+  // taken.
+  while(!http2_ && !websocket_ && parsed < len && parser_.upgrade && HTTP_PARSER_ERRNO(&parser_) == HPE_OK)
+  {
+    size_t count = http_parser_execute(&parser_, &parser_settings_, buf + parsed, len - parsed);
+    if(count == 0)
+    {
+      break;
+    }
+    parsed += count;
+  }
+  is_parsing_ = false;
+
+  if(http2_ || websocket_)
+  {
+    if(parsed < len)
+    {
+      execute(buf + parsed, len - parsed);
+      return;
+    }
+
+    flush();
+    update_read_timeout();
+    maybe_close();
+    return;
+  }
+
+  switch(HTTP_PARSER_ERRNO(&parser_))
+  {
+    case HPE_OK:
+      break;
+
+    case HPE_PAUSED:
+      // Too many requests in flight, keep whatever followed for later.
+      if(parsed < len && !is_closing_)
+      {
+        pending_.append(buf + parsed, static_cast<int>(len - parsed));
+      }
+      break;
+
+    case HPE_HEADER_OVERFLOW:
+      // http_parser has a hard limit of its own.
+      if(request_ != nullptr)
+      {
+        ++server_->stats_.headers_too_large;
+        reject_request(431);
+        break;
+      }
+      // fall through
+
+    default:
+      PRINT_STDERR("Failed to parse request: " << http_errno_name(HTTP_PARSER_ERRNO(&parser_)));
+      is_closing_ = true;
+      socket_->read_stop();
+      break;
+  }
+
+  // Responses finished synchronously by the callback go out in one write.
+  flush();
+  send_continue();
+  update_read_timeout();
+  maybe_close();
 }
 
-bool Qttp::listen(const std::string& ip, int port, std::function<void(QttpRequest&, QttpResponse&)> callback)
+bool QttpClientContext::should_keep_alive() const
 {
-  if(!socket_->bind(ip, port)) {
-    PRINT_STDERR("Failed to bind to ip/port " << ip << ":" << port);
+  if(!options_.keep_alive || is_closing_ || server_->is_draining_)
+  {
     return false;
   }
 
-  auto closed = [](){
-                  PRINT_STDERR("Closing socket due to an error");
+  if(options_.max_requests_per_connection > 0 &&
+     requests_served_ >= options_.max_requests_per_connection)
+  {
+    return false;
+  }
+
+  // Takes care of "Connection: close|keep-alive" as well as the HTTP/1.0
+  // default of closing unless asked otherwise.
+  return http_should_keep_alive(&parser_) != 0;
+}
+
+void QttpClientContext::dispatch(QttpRequest* request, QttpResponse* response)
+{
+  // invoke stored callback object
+  callbacks::invoke<std::function<void(QttpRequest&, QttpResponse&)> >(callback_lut_, 0, *request, *response);
+}
+
+bool QttpClientContext::upgrade_to_http2()
+{
+  // Only an idle connection can switch, there must be nothing to answer in
+  // HTTP/1.1 after the 101.  Over TLS HTTP/2 is negotiated through ALPN.
+  if(!options_.http2 || tls_ || is_closing_ || server_->is_draining_ || !pipeline_.empty() || writing_ != 0)
+  {
+    return false;
+  }
+
+  QString upgrade;
+  if(!request_->get_header("Upgrade", upgrade))
+  {
+    return false;
+  }
+
+  bool is_h2c = false;
+  for(auto & token : upgrade.split(','))
+  {
+    is_h2c = is_h2c || token.trimmed().compare("h2c", Qt::CaseInsensitive) == 0;
+  }
+
+  QString settings_header;
+  if(!is_h2c || !request_->get_header("HTTP2-Settings", settings_header))
+  {
+    return false;
+  }
+
+  QByteArray settings = QByteArray::fromBase64(settings_header.trimmed().toLatin1(), QByteArray::Base64UrlEncoding);
+  if(settings.length() % 6 != 0)
+  {
+    return false;
+  }
+
+  static const char switching_protocols[] = "HTTP/1.1 101 Switching Protocols\r\n"
+                                            "Connection: Upgrade\r\n"
+                                            "Upgrade: h2c\r\n\r\n";
+  write_static(switching_protocols, sizeof(switching_protocols) - 1);
+
+  QttpRequest* request = request_;
+  QttpResponse* response = response_;
+  request_ = nullptr;
+  response_ = nullptr;
+  is_reading_body_ = false;
+  is_continue_pending_ = false;
+
+  http2_ = new QttpHttp2Session(this);
+  ++server_->stats_.http2_connections;
+  http2_->upgrade(request, response, settings);
+  return true;
+}
+
+bool QttpClientContext::upgrade_to_websocket()
+{
+  // Same as for HTTP/2, nothing may be left to answer in HTTP/1.1.
+  if(!server_->websocket_filter_ || is_closing_ || server_->is_draining_ || !pipeline_.empty() || writing_ != 0)
+  {
+    return false;
+  }
+
+  if(parser_.method != HTTP_GET || parser_.http_major != 1 || parser_.http_minor < 1)
+  {
+    return false;
+  }
+
+  QString upgrade;
+  if(!request_->get_header("Upgrade", upgrade))
+  {
+    return false;
+  }
+
+  bool is_websocket = false;
+  for(auto & token : upgrade.split(','))
+  {
+    is_websocket = is_websocket || token.trimmed().compare("websocket", Qt::CaseInsensitive) == 0;
+  }
+
+  // Other versions are left to the action, which answers with 426 and the
+  // version it speaks.
+  QString key;
+  if(!is_websocket || request_->get_header("Sec-WebSocket-Version").trimmed() != "13" ||
+     !request_->get_header("Sec-WebSocket-Key", key))
+  {
+    return false;
+  }
+
+  QByteArray nonce = key.trimmed().toLatin1();
+  if(QByteArray::fromBase64(nonce).length() != 16 || !server_->websocket_filter_(*request_))
+  {
+    return false;
+  }
+
+  static const QByteArray guid("258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+  QByteArray accept = QCryptographicHash::hash(nonce + guid, QCryptographicHash::Sha1).toBase64();
+
+  websocket_ = std::make_shared<QttpWebSocket>(this, request_, response_);
+  request_ = nullptr;
+  response_ = nullptr;
+  is_reading_body_ = false;
+  is_continue_pending_ = false;
+
+  ++server_->stats_.websocket_connections;
+  websocket_->start(accept);
+  return true;
+}
+
+void QttpClientContext::write_static(const char* data, size_t length)
+{
+  uv_buf_t buf = uv_buf_init(const_cast<char*>(data), static_cast<unsigned int>(length));
+
+  if(writing_ == 0)
+  {
+    int written = try_write(&buf, 1);
+    if(written == static_cast<int>(buf.len))
+    {
+      return;
+    }
+    if(written > 0)
+    {
+      buf.base += written;
+      buf.len -= written;
+    }
+  }
+
+  // The data is static, a failure shows up on the writes that follow.
+  write(&buf, 1, [](native::error e) {
+    if(e)
+    {
+      PRINT_NN_ERROR(e);
+    }
+  });
+}
+
+int QttpClientContext::try_write(const uv_buf_t* bufs, unsigned int nbufs)
+{
+  if(tls_)
+  {
+    return UV_EAGAIN;
+  }
+  return socket_->try_write(bufs, nbufs);
+}
+
+bool QttpClientContext::write(const uv_buf_t* bufs, unsigned int nbufs, std::function<void(native::error)> callback)
+{
+#ifdef SSL_TLS_UV
+  if(tls_)
+  {
+    std::vector<uv_buf_t> records;
+    if(!tls_->encrypt(bufs, nbufs, records))
+    {
+      QttpTlsSession::release(server_->loop_->get_buffer_pool(), records);
+      return false;
+    }
+    return write_records(records, callback);
+  }
+#endif
+  return socket_->write(bufs, nbufs, callback);
+}
+
+bool QttpClientContext::write_records(const std::vector<uv_buf_t>& records, std::function<void(native::error)> callback)
+{
+#ifdef SSL_TLS_UV
+  // The pool belongs to the loop, which outlives every write on it.
+  native::buffer_pool& pool = server_->loop_->get_buffer_pool();
+  bool result = socket_->write(records.data(), static_cast<unsigned int>(records.size()),
+                               [&pool, records, callback](native::error e) {
+    QttpTlsSession::release(pool, records);
+    if(callback)
+    {
+      callback(e);
+    }
+  });
+
+  if(!result)
+  {
+    QttpTlsSession::release(pool, records);
+  }
+  return result;
+#else
+  return socket_->write(records.data(), static_cast<unsigned int>(records.size()), callback);
+#endif
+}
+
+void QttpClientContext::pause()
+{
+  if(is_paused_)
+  {
+    return;
+  }
+  is_paused_ = true;
+
+  socket_->read_stop();
+  http_parser_pause(&parser_, 1);
+  update_read_timeout();
+}
+
+void QttpClientContext::resume()
+{
+  if(!is_paused_ || is_closing_ || is_closed_ || is_body_blocked_ || is_write_blocked_ ||
+     pipeline_.size() >= options_.max_pipelined_requests)
+  {
+    return;
+  }
+  is_paused_ = false;
+
+  http_parser_pause(&parser_, 0);
+
+  if(!pending_.isEmpty())
+  {
+    QByteArray pending;
+    pending.swap(pending_);
+    execute(pending.constData(), pending.length());
+
+    // The leftovers may have filled up the pipeline again.
+    if(is_paused_ || is_closing_ || is_closed_)
+    {
+      return;
+    }
+  }
+
+  start_reading();
+  update_read_timeout();
+}
+
+void QttpClientContext::on_response_ready(QttpResponse* response)
+{
+  if(std::this_thread::get_id() == server_->loop_thread_)
+  {
+    response->is_ready_ = true;
+
+    if(is_closed_)
+    {
+      flush();
+      release();
+      return;
+    }
+
+    // While parsing, execute() flushes once the whole buffer is consumed.
+    if(!is_parsing_)
+    {
+      flush();
+      maybe_close();
+    }
+    return;
+  }
+
+  // Keeps the context alive until the loop thread has seen the notification,
+  // so it has to be counted before the response can be picked up by flush().
+  ++pending_notifies_;
+  response->is_ready_ = true;
+  server_->notify(this);
+}
+
+void QttpClientContext::on_stream_data()
+{
+  if(std::this_thread::get_id() == server_->loop_thread_)
+  {
+    if(!is_parsing_)
+    {
+      flush();
+    }
+    return;
+  }
+
+  ++pending_notifies_;
+  server_->notify(this);
+}
+
+bool QttpClientContext::on_header_bytes(size_t length, bool is_url)
+{
+  header_bytes_ += length;
+  if(is_url)
+  {
+    url_bytes_ += length;
+    if(options_.max_url_length > 0 && url_bytes_ > options_.max_url_length)
+    {
+      ++server_->stats_.urls_too_long;
+      reject_request(414);
+      return false;
+    }
+  }
+
+  if(options_.max_header_size > 0 && header_bytes_ > options_.max_header_size)
+  {
+    ++server_->stats_.headers_too_large;
+    reject_request(431);
+    return false;
+  }
+  return true;
+}
+
+void QttpClientContext::on_headers_complete()
+{
+  request_->method_ = http_method_str((http_method)parser_.method);
+  is_reading_body_ = true;
+
+  bool is_chunked = (parser_.flags & F_CHUNKED) != 0;
+  bool has_length = parser_.content_length > 0 && parser_.content_length != ULLONG_MAX;
+  if(!is_chunked && !has_length)
+  {
+    return;
+  }
+
+  // HTTP/1.0 clients don't know about expectations, they are ignored.
+  bool expects_continue = false;
+  QString expect;
+  if((parser_.http_major > 1 || parser_.http_minor > 0) && request_->get_header("Expect", expect))
+  {
+    if(expect.compare("100-continue", Qt::CaseInsensitive) != 0)
+    {
+      ++server_->stats_.admission_rejects;
+      reject_request(417);
+      return;
+    }
+    expects_continue = true;
+  }
+
+  if(server_->admission_)
+  {
+    int status = server_->admission_(*request_);
+    if(status != 0)
+    {
+      ++server_->stats_.admission_rejects;
+      reject_request(status);
+      return;
+    }
+  }
+
+  if(server_->stream_filter_ && server_->stream_filter_(*request_))
+  {
+    request_->is_body_streamed_ = true;
+  }
+  else if(has_length && options_.max_body_size > 0 && parser_.content_length > options_.max_body_size)
+  {
+    // No point in reading what would be thrown away.
+    ++server_->stats_.bodies_too_large;
+    reject_request(413);
+    return;
+  }
+  else if(has_length)
+  {
+    // Grows once instead of reallocating along with every read.
+    request_->body_.reserve(static_cast<int>((std::min)(parser_.content_length, max_body_reserve)));
+  }
+
+  if(expects_continue)
+  {
+    is_continue_pending_ = true;
+    send_continue();
+  }
+}
+
+void QttpClientContext::send_continue()
+{
+  // An interim response can't overtake the final ones of earlier requests.
+  if(!is_continue_pending_ || is_closing_ || is_closed_ || writing_ < pipeline_.size())
+  {
+    return;
+  }
+  is_continue_pending_ = false;
+  ++server_->stats_.continues;
+
+  static const char continue_line[] = "HTTP/1.1 100 Continue\r\n\r\n";
+  write_static(continue_line, sizeof(continue_line) - 1);
+}
+
+void QttpClientContext::on_body(const char* at, size_t len)
+{
+  body_window_bytes_ += len;
+
+  if(!request_->is_body_streamed_)
+  {
+    // Chunked bodies don't tell their size up front.
+    if(options_.max_body_size > 0 &&
+       static_cast<uint64_t>(request_->body_.size()) + len > options_.max_body_size)
+    {
+      ++server_->stats_.bodies_too_large;
+      reject_request(413);
+      return;
+    }
+    request_->body_.append(at, static_cast<int>(len));
+    return;
+  }
+
+  // Every chunk keeps the context alive until it is consumed, the consumer
+  // notifies the loop thread for each of them.
+  body_backlog_ += len;
+  ++pending_notifies_;
+  server_->body_callback_(*request_, *response_, QByteArray(at, static_cast<int>(len)));
+
+  if(body_backlog_ > options_.body_stream_high_watermark)
+  {
+    is_body_blocked_ = true;
+    pause();
+  }
+}
+
+void QttpClientContext::abort_body()
+{
+  if(request_ && request_->is_body_streamed_)
+  {
+    request_->is_body_streamed_ = false;
+    ++pending_notifies_;
+    server_->body_callback_(*request_, *response_, QByteArray());
+  }
+}
+
+void QttpClientContext::on_body_consumed(size_t length)
+{
+  body_backlog_ -= length;
+  server_->notify(this);
+}
+
+void QttpClientContext::on_notify()
+{
+  --pending_notifies_;
+
+  if(is_closed_)
+  {
+    flush();
+    release();
+    return;
+  }
+
+  if(is_body_blocked_ && body_backlog_ <= options_.body_stream_low_watermark)
+  {
+    is_body_blocked_ = false;
+    resume();
+
+    if(is_closed_)
+    {
+      return;
+    }
+  }
+
+  flush();
+  maybe_close();
+}
+
+void QttpClientContext::flush()
+{
+  if(is_closed_)
+  {
+    // Closed before everything was answered, the rest is dropped as it
+    // comes in.
+    is_broken_ = true;
+  }
+
+  if(http2_)
+  {
+    http2_->flush();
+    return;
+  }
+
+  if(websocket_)
+  {
+    websocket_->flush();
+    update_read_timeout();
+    return;
+  }
+
+  // Responses already being written stay at the front of the pipeline until
+  // their write completes.  A response still streaming only goes out as far
+  // as it got, it stays in front of the ones behind it.
+  size_t count = 0;
+  bool has_file = false;
+  QttpResponse* stream = nullptr;
+  for(size_t i = writing_; i < pipeline_.size(); ++i)
+  {
+    QttpResponse* response = pipeline_[i].second;
+    if(!response->is_ready_)
+    {
+      if(response->is_streaming_)
+      {
+        stream = response;
+      }
+      break;
+    }
+    ++count;
+
+    if(is_closing_ && i + 1 == pipeline_.size())
+    {
+      // Whatever decided to close after it, the client learns it from here.
+      response->announce_close();
+    }
+
+    if(response->has_file_)
+    {
+      has_file = true;
+      break;
+    }
+  }
+
+  if(count == 0 && stream == nullptr)
+  {
+    return;
+  }
+
+  if(is_broken_)
+  {
+    // Nobody is listening anymore, just get rid of them once the writes
+    // still outstanding have failed too.  A producer still streaming gets
+    // its chunks discarded and is told to finish, last as it may do so
+    // right away.
+    if(stream)
+    {
+      std::vector<QByteArray> discarded;
+      stream->on_stream_written(stream->take_stream(discarded));
+    }
+    if(writing_ == 0 && count > 0)
+    {
+      drop(count);
+    }
+    if(stream)
+    {
+      stream->abort_stream();
+    }
+    return;
+  }
+
+  if(has_file)
+  {
+    // A file goes out on its own once everything in front of it is written.
+    if(count > 1)
+    {
+      --count;
+    }
+    else if(writing_ == 0)
+    {
+      send_file(pipeline_.front().second);
+      return;
+    }
+    else
+    {
+      return;
+    }
+  }
+
+  // Stream segments are handed over by the producer, they have to outlive
+  // the write they are part of.
+  std::shared_ptr<std::vector<QByteArray> > segments;
+  size_t stream_bytes = 0;
+
+  std::vector<uv_buf_t> bufs;
+  bufs.reserve(count * 2);
+  for(size_t i = writing_; i < writing_ + count; ++i)
+  {
+    QttpResponse* response = pipeline_[i].second;
+    if(!response->is_streaming_)
+    {
+      response->get_buffers(bufs);
+      continue;
+    }
+
+    if(!segments)
+    {
+      segments = std::make_shared<std::vector<QByteArray> >();
+    }
+    size_t first = segments->size();
+    response->take_stream(*segments);
+    append_buffers(bufs, *segments, first, segments->size());
+
+    if(!response->is_chunking_allowed_)
+    {
+      // The body ends with the connection.
+      is_closing_ = true;
+      pause();
+    }
+  }
+
+  if(stream)
+  {
+    if(!segments)
+    {
+      segments = std::make_shared<std::vector<QByteArray> >();
+    }
+    size_t first = segments->size();
+    stream_bytes = stream->take_stream(*segments);
+    append_buffers(bufs, *segments, first, segments->size());
+  }
+
+  size_t total = 0;
+  for(auto & buf : bufs)
+  {
+    total += buf.len;
+  }
+
+  if(total == 0)
+  {
+    // Woken up for a stream whose chunks went out with an earlier write.
+    if(count > 0 && writing_ == 0)
+    {
+      on_write_complete(count, 0, true);
+    }
+    return;
+  }
+
+  // A partially streamed response isn't counted, it can't be dropped before
+  // this write completes.
+  write_status status = write_output(bufs, count, segments, [stream, stream_bytes](bool) {
+    if(stream)
+    {
+      stream->on_stream_written(stream_bytes);
+    }
+  });
+  if(status == write_queued)
+  {
+    return;
+  }
+
+  if(stream)
+  {
+    stream->on_stream_written(stream_bytes);
+  }
+
+  // Earlier writes may still reference the responses in front of these,
+  // leave it to them to drop these once they are done.
+  if(writing_ == 0)
+  {
+    on_write_complete(count, 0, status == write_done);
+  }
+}
+
+QttpClientContext::write_status QttpClientContext::write_output(std::vector<uv_buf_t>& bufs, size_t count,
+                                                                std::shared_ptr<std::vector<QByteArray> > segments,
+                                                                std::function<void(bool)> done)
+{
+  if(is_closed_ || is_broken_)
+  {
+    return write_failed;
+  }
+
+  size_t total = 0;
+  for(auto & buf : bufs)
+  {
+    total += buf.len;
+  }
+  if(total == 0)
+  {
+    return write_done;
+  }
+
+  // Most output fits into the socket buffer, only queue a write request for
+  // whatever the kernel didn't take right away.  Writes can't jump the queue
+  // so there's no point trying while others are outstanding.
+  size_t sent = 0;
+  if(writing_ == 0)
+  {
+    int written = try_write(bufs.data(), static_cast<unsigned int>(bufs.size()));
+    if(written < 0 && written != UV_EAGAIN)
+    {
+      native::error e(written);
+      PRINT_NN_ERROR(e);
+      is_broken_ = true;
+      is_closing_ = true;
+      return write_failed;
+    }
+
+    sent = (written > 0) ? static_cast<size_t>(written) : 0;
+    if(sent == total)
+    {
+      return write_done;
+    }
+  }
+
+  size_t bytes = total - sent;
+  size_t first = 0;
+  while(sent >= bufs[first].len)
+  {
+    sent -= bufs[first].len;
+    ++first;
+  }
+  bufs[first].base += sent;
+  bufs[first].len -= sent;
+
+  writing_ += count;
+  bytes_in_flight_ += bytes;
+  update_write_backpressure();
+  update_write_timeout();
+
+  bool result = write(&bufs[first], static_cast<unsigned int>(bufs.size() - first),
+                      [this, count, bytes, segments, done](native::error e) {
+    if(e)
+    {
+      PRINT_STDERR("ERROR while trying to write to the client");
+      PRINT_NN_ERROR(e);
+    }
+    done(!e);
+    on_write_complete(count, bytes, !e);
+  });
+
+  if(!result)
+  {
+    writing_ -= count;
+    bytes_in_flight_ -= bytes;
+    is_broken_ = true;
+    is_closing_ = true;
+    return write_failed;
+  }
+  return write_queued;
+}
+
+void QttpClientContext::append_buffers(std::vector<uv_buf_t>& bufs, const std::vector<QByteArray>& segments,
+                                       size_t first, size_t last)
+{
+  for(size_t i = first; i < last; ++i)
+  {
+    const QByteArray& segment = segments[i];
+    if(!segment.isEmpty())
+    {
+      bufs.push_back(uv_buf_init(const_cast<char*>(segment.constData()), static_cast<unsigned int>(segment.length())));
+    }
+  }
+}
+
+void QttpClientContext::on_write_complete(size_t count, size_t bytes, bool success)
+{
+  // Writes complete in the order they were issued, these are at the front.
+  writing_ -= (std::min)(count, writing_);
+  bytes_in_flight_ -= (std::min)(bytes, bytes_in_flight_);
+  bytes_completed_ += bytes;
+  drop(count);
+
+  if(!success)
+  {
+    is_broken_ = true;
+    is_closing_ = true;
+  }
+
+  flush();
+  send_continue();
+  update_write_backpressure();
+  update_write_timeout();
+  resume();
+  update_read_timeout();
+  maybe_close();
+}
+
+void QttpClientContext::update_write_backpressure()
+{
+  if(options_.write_queue_high_watermark == 0)
+  {
+    return;
+  }
+
+  // sendfile doesn't go through the write queue, what is left of a file is
+  // output waiting all the same.
+  uint64_t backlog = bytes_in_flight_ + file_remaining_;
+  if(!is_write_blocked_)
+  {
+    if(backlog > options_.write_queue_high_watermark)
+    {
+      is_write_blocked_ = true;
+      ++server_->stats_.write_queue_high_hits;
+      pause();
+    }
+    return;
+  }
+
+  if(backlog <= options_.write_queue_low_watermark)
+  {
+    is_write_blocked_ = false;
+    ++server_->stats_.write_queue_low_hits;
+  }
+}
+
+void QttpClientContext::send_file(QttpResponse* response)
+{
+  // Occupies the front of the pipeline until finish_file() completes it.
+  ++writing_;
+  file_offset_ = 0;
+  file_remaining_ = response->file_length_;
+  is_sending_file_ = true;
+
+  std::vector<uv_buf_t> bufs;
+  response->get_buffers(bufs);
+  size_t bytes = 0;
+  for(auto & buf : bufs)
+  {
+    bytes += buf.len;
+  }
+
+  // Counted like any other output, a client that stops reading halfway
+  // through the file runs into the write timeout.
+  bytes_in_flight_ += bytes;
+  update_write_backpressure();
+  update_write_timeout();
+
+  std::string path = response->file_path_;
+  bool result = write(bufs.data(), static_cast<unsigned int>(bufs.size()), [ = ](native::error e) {
+    on_file_written(bytes);
+    if(e)
+    {
+      PRINT_NN_ERROR(e);
+      finish_file(false);
+      return;
+    }
+
+    if(is_closed_)
+    {
+      finish_file(false);
+      return;
+    }
+
+    if(!native::fs::open(*server_->loop_, path, native::fs::read_only, 0, [ = ](native::fs::file_handle fd, native::error e) {
+      if(e)
+      {
+        PRINT_STDERR("Unable to open " << path);
+        PRINT_NN_ERROR(e);
+        finish_file(false);
+        return;
+      }
+      file_fd_ = fd;
+      send_file_chunk();
+    }))
+    {
+      finish_file(false);
+    }
+  });
+
+  if(!result)
+  {
+    bytes_in_flight_ -= bytes;
+    finish_file(false);
+  }
+}
+
+void QttpClientContext::send_file_chunk()
+{
+  if(is_closed_)
+  {
+    finish_file(false);
+    return;
+  }
+
+  if(file_remaining_ == 0)
+  {
+    finish_file(true);
+    return;
+  }
+
+#ifdef _WIN32
+  send_buffered_chunk();
+#else
+  if(tls_)
+  {
+    // Bytes have to pass through the TLS layer, sendfile would bypass it.
+    send_buffered_chunk();
+    return;
+  }
+
+  uv_os_fd_t out_fd;
+  if(uv_fileno(socket_->get(), &out_fd) != 0)
+  {
+    finish_file(false);
+    return;
+  }
+
+  bool result = native::fs::sendfile(*server_->loop_, out_fd, file_fd_, file_offset_, file_remaining_, [ = ](size_t sent, native::error e) {
+    if(e.code() == UV_EAGAIN)
+    {
+      // The socket buffer is full.  A regular write waits until it drains,
+      // sendfile takes over again afterwards.
+      send_buffered_chunk();
+      return;
+    }
+
+    if(e || sent == 0)
+    {
+      PRINT_STDERR("sendfile stopped at " << file_offset_ << " of " << file_offset_ + file_remaining_);
+      finish_file(false);
+      return;
+    }
+
+    // Progress the write timeout sees, the kernel took these right away.
+    bytes_completed_ += sent;
+    file_offset_ += sent;
+    file_remaining_ -= (std::min)(static_cast<uint64_t>(sent), file_remaining_);
+    on_file_progress();
+    send_file_chunk();
+  });
+
+  if(!result)
+  {
+    finish_file(false);
+  }
+#endif
+}
+
+void QttpClientContext::send_buffered_chunk()
+{
+  size_t len = static_cast<size_t>((std::min)(file_remaining_, static_cast<uint64_t>(native::buffer_pool::large_size)));
+
+  bool result = native::fs::read(*server_->loop_, file_fd_, len, file_offset_, [ = ](const std::string& str, native::error e) {
+    if(e || str.empty() || is_closed_)
+    {
+      finish_file(false);
+      return;
+    }
+
+    // Moved from what is left of the file to what is in flight, the
+    // backlog stays the same.
+    file_chunk_ = str;
+    size_t bytes = file_chunk_.size();
+    file_offset_ += bytes;
+    file_remaining_ -= (std::min)(static_cast<uint64_t>(bytes), file_remaining_);
+    bytes_in_flight_ += bytes;
+    update_write_timeout();
+
+    uv_buf_t buf = uv_buf_init(const_cast<char*>(file_chunk_.data()), static_cast<unsigned int>(bytes));
+    if(!write(&buf, 1, [ = ](native::error e) {
+      on_file_written(bytes);
+      if(e)
+      {
+        PRINT_NN_ERROR(e);
+        finish_file(false);
+        return;
+      }
+      send_file_chunk();
+    }))
+    {
+      bytes_in_flight_ -= bytes;
+      finish_file(false);
+    }
+  });
+
+  if(!result)
+  {
+    finish_file(false);
+  }
+}
+
+void QttpClientContext::on_file_written(size_t bytes)
+{
+  bytes_in_flight_ -= (std::min)(bytes, bytes_in_flight_);
+  bytes_completed_ += bytes;
+  on_file_progress();
+}
+
+void QttpClientContext::on_file_progress()
+{
+  // Requests pipelined behind the file are read again once most of it went
+  // out, their responses still wait for it.
+  update_write_backpressure();
+  resume();
+}
+
+void QttpClientContext::finish_file(bool success)
+{
+  if(file_fd_ >= 0)
+  {
+    native::fs::close(*server_->loop_, file_fd_, [](native::error) {});
+    file_fd_ = -1;
+  }
+  file_chunk_.clear();
+  file_remaining_ = 0;
+  is_sending_file_ = false;
+
+  on_write_complete(1, 0, success);
+
+  // The socket may have closed while the file was read, release() waited.
+  if(is_closed_)
+  {
+    release();
+  }
+}
+
+void QttpClientContext::drop(size_t count)
+{
+  for(size_t i = 0; i < count && !pipeline_.empty(); ++i)
+  {
+    transaction& t = pipeline_.front();
+    server_->recycle(t.first);
+    server_->recycle(t.second);
+    pipeline_.pop_front();
+  }
+}
+
+void QttpClientContext::update_read_timeout()
+{
+  read_timeout_kind kind = no_timeout;
+  uint64_t timeout_ms = 0;
+  if(!is_closed_ && !is_closing_ && !is_paused_)
+  {
+    if(http2_)
+    {
+      // Streams waiting for their responses are the server's business.
+      kind = http2_->is_idle() ? idle_timeout : no_timeout;
+    }
+    else if(websocket_)
+    {
+      // Once closing, only an answer to the close frame is waited for.
+      kind = websocket_->is_closing() ? idle_timeout : websocket_timeout;
+    }
+    else if(request_ != nullptr)
+    {
+      kind = is_reading_body_ ? body_timeout : header_timeout;
+    }
+    else if(pipeline_.empty())
+    {
+      // The first request of a connection is due like the rest of a header.
+      kind = (requests_served_ == 0) ? header_timeout : idle_timeout;
+    }
+  }
+
+  switch(kind)
+  {
+    case header_timeout:
+      timeout_ms = options_.header_timeout_ms;
+      break;
+
+    case body_timeout:
+      timeout_ms = options_.body_timeout_ms;
+      break;
+
+    case idle_timeout:
+      timeout_ms = options_.keep_alive_timeout_ms;
+      break;
+
+    case websocket_timeout:
+      timeout_ms = options_.websocket_idle_timeout_ms;
+      break;
+
+    default:
+      break;
+  }
+
+  if(timeout_ms == 0)
+  {
+    read_timeout_kind_ = no_timeout;
+    server_->timer_wheel_.stop(read_timeout_);
+    return;
+  }
+
+  // A client trickling in its header or body doesn't get more time for it,
+  // the body is checked against its minimum rate once the window is over.
+  // Only what a WebSocket client sends keeps it alive, not what it is sent.
+  if((kind == header_timeout || kind == body_timeout || kind == websocket_timeout) &&
+     read_timeout_kind_ == kind && read_timeout_.is_active())
+  {
+    return;
+  }
+
+  read_timeout_kind_ = kind;
+  body_window_bytes_ = 0;
+  server_->timer_wheel_.start(read_timeout_, timeout_ms);
+}
+
+void QttpClientContext::on_read_timeout()
+{
+  switch(read_timeout_kind_)
+  {
+    case header_timeout:
+      ++server_->stats_.header_timeouts;
+      break;
+
+    case body_timeout:
+      if(body_window_bytes_ > 0 &&
+         body_window_bytes_ >= options_.body_min_rate * options_.body_timeout_ms / 1000)
+      {
+        body_window_bytes_ = 0;
+        server_->timer_wheel_.start(read_timeout_, options_.body_timeout_ms);
+        return;
+      }
+      ++server_->stats_.body_timeouts;
+      break;
+
+    case idle_timeout:
+      ++server_->stats_.idle_timeouts;
+      break;
+
+    case websocket_timeout:
+      if(!is_websocket_pinged_)
+      {
+        // A client that is still around answers with a pong.
+        is_websocket_pinged_ = true;
+        websocket_->ping();
+        flush();
+        server_->timer_wheel_.start(read_timeout_, options_.websocket_idle_timeout_ms);
+        return;
+      }
+      ++server_->stats_.idle_timeouts;
+      break;
+
+    default:
+      return;
+  }
+  read_timeout_kind_ = no_timeout;
+
+  if(request_ != nullptr)
+  {
+    PRINT_DBG("Request timed out");
+    reject_request(408);
+    return;
+  }
+
+  if(http2_)
+  {
+    // GOAWAY first, the client may have a request on its way.
+    PRINT_DBG("Closing idle HTTP/2 connection");
+    http2_->drain();
+    flush();
+    maybe_close();
+    return;
+  }
+
+  PRINT_DBG("Closing idle connection");
+  is_closing_ = true;
+  socket_->read_stop();
+  pending_.clear();
+  maybe_close();
+}
+
+void QttpClientContext::reject_request(int status)
+{
+  abort_body();
+
+  is_closing_ = true;
+  if(HTTP_PARSER_ERRNO(&parser_) == HPE_OK)
+  {
+    pause();
+  }
+  else
+  {
+    // A parser that failed can't be paused, it won't parse anything anyway.
+    socket_->read_stop();
+    update_read_timeout();
+  }
+  pending_.clear();
+
+  // Goes out after whatever is still pending, nothing else is read.
+  QttpResponse* response = response_;
+  pipeline_.push_back(transaction(request_, response_));
+  request_ = nullptr;
+  response_ = nullptr;
+  is_reading_body_ = false;
+  is_continue_pending_ = false;
+
+  response->set_status(status);
+  response->set_header(connection_close());
+  response->close();
+}
+
+void QttpClientContext::update_write_timeout()
+{
+  if(is_closed_ || options_.write_timeout_ms == 0)
+  {
+    return;
+  }
+
+  // sendfile bypasses the write queue, a file being sent is output as well.
+  if(bytes_in_flight_ == 0 && file_remaining_ == 0)
+  {
+    server_->timer_wheel_.stop(write_timeout_);
+    return;
+  }
+
+  if(!write_timeout_.is_active())
+  {
+    write_mark_ = get_bytes_drained();
+    server_->timer_wheel_.start(write_timeout_, options_.write_timeout_ms);
+  }
+}
+
+void QttpClientContext::on_write_timeout()
+{
+  // Large writes take a while, only a client that reads nothing is stalled.
+  uint64_t drained = get_bytes_drained();
+  if(drained != write_mark_)
+  {
+    write_mark_ = drained;
+    server_->timer_wheel_.start(write_timeout_, options_.write_timeout_ms);
+    return;
+  }
+
+  PRINT_DBG("Closing stalled connection");
+  ++server_->stats_.write_timeouts;
+  is_broken_ = true;
+  is_closing_ = true;
+  close();
+}
+
+void QttpClientContext::drain()
+{
+  if(websocket_)
+  {
+    if(!is_closed_)
+    {
+      websocket_->drain();
+      flush();
+      maybe_close();
+    }
+    return;
+  }
+
+  if(http2_)
+  {
+    // Streams already open are answered, GOAWAY refuses new ones.
+    if(!is_closed_)
+    {
+      http2_->drain();
+      flush();
+      update_read_timeout();
+      maybe_close();
+    }
+    return;
+  }
+
+  // A request being read is answered first, should_keep_alive() closes
+  // after it.
+  if(is_closed_ || is_closing_ || request_ != nullptr)
+  {
+    return;
+  }
+
+  // Requests parsed ahead but not dispatched are dropped, the client retries
+  // them once the last response told it the connection closes.
+  is_closing_ = true;
+  pause();
+  pending_.clear();
+
+  flush();
+  update_read_timeout();
+  maybe_close();
+}
+
+uint64_t QttpClientContext::get_bytes_drained() const
+{
+  size_t queued = (std::min)(socket_->write_queue_size(), bytes_in_flight_);
+  return bytes_completed_ + (bytes_in_flight_ - queued);
+}
+
+void QttpClientContext::maybe_close()
+{
+  if(!is_closed_ && is_closing_ && pipeline_.empty() && writing_ == 0 &&
+     (!http2_ || http2_->can_close()) && (!websocket_ || websocket_->can_close()))
+  {
+    close();
+  }
+}
+
+void QttpClientContext::close()
+{
+  if(is_closed_)
+  {
+    return;
+  }
+  is_closed_ = true;
+
+  abort_body();
+  if(http2_)
+  {
+    http2_->abort_bodies();
+  }
+  if(websocket_)
+  {
+    websocket_->on_close();
+  }
+
+  abort_streams();
+
+  server_->timer_wheel_.stop(read_timeout_);
+  server_->timer_wheel_.stop(write_timeout_);
+
+#ifdef SSL_TLS_UV
+  if(tls_ && !is_broken_)
+  {
+    // Tells the client the last response wasn't cut off, best effort since
+    // closing cancels whatever the kernel didn't take right away.
+    std::vector<uv_buf_t> records;
+    tls_->shutdown(records);
+    if(!records.empty())
+    {
+      write_records(records, nullptr);
+    }
+  }
+#endif
+
+  socket_->close([ = ](){
+    PRINT_DBG("Socket closed");
+    is_socket_closed_ = true;
+    release();
+  });
+}
+
+void QttpClientContext::abort_streams()
+{
+  if(http2_)
+  {
+    http2_->abort_streams();
+    return;
+  }
+
+  // Producers may end any stream right from the callback, which changes the
+  // pipeline, so it is searched again after each one.
+  bool is_found = true;
+  while(is_found)
+  {
+    is_found = false;
+    for(auto & t : pipeline_)
+    {
+      QttpResponse* response = t.second;
+      if(response->is_streaming_ && !response->is_ready_ && !response->is_stream_aborted_)
+      {
+        response->abort_stream();
+        is_found = true;
+        break;
+      }
+    }
+  }
+}
+
+void QttpClientContext::release()
+{
+  if(!is_socket_closed_ || pending_notifies_ != 0 || is_sending_file_)
+  {
+    return;
+  }
+
+  if(http2_ && !http2_->is_releasable())
+  {
+    return;
+  }
+
+  // Responses still being produced come back through on_response_ready().
+  for(auto & t : pipeline_)
+  {
+    if(!t.second->is_ready_)
+    {
+      return;
+    }
+  }
+  server_->recycle(this);
+}
+
+QttpConnectionLimiter::QttpConnectionLimiter(int max_open, int low_mark) :
+  max_open_((std::max)(max_open, 0)),
+  low_mark_((std::min)((std::max)(low_mark, 0), (std::max)(max_open, 0))),
+  mutex_(),
+  waiting_(),
+  open_(0),
+  peak_(0),
+  deferred_(0)
+{
+}
+
+bool QttpConnectionLimiter::acquire(Qttp* listener)
+{
+  if(max_open_ == 0)
+  {
+    add();
+    return true;
+  }
+
+  // Taken under the lock so listeners on other loops can't all pass the
+  // check at once, and remove() can't miss a listener about to wait.
+  std::lock_guard<std::mutex> lock(mutex_);
+  if(open_ < max_open_)
+  {
+    add();
+    return true;
+  }
+
+  ++deferred_;
+  if(std::find(waiting_.begin(), waiting_.end(), listener) == waiting_.end())
+  {
+    waiting_.push_back(listener);
+  }
+  return false;
+}
+
+void QttpConnectionLimiter::add()
+{
+  int open = ++open_;
+  int peak = peak_;
+  while(open > peak && !peak_.compare_exchange_weak(peak, open))
+  {
+  }
+}
+
+void QttpConnectionLimiter::remove()
+{
+  if(max_open_ == 0)
+  {
+    --open_;
+    return;
+  }
+
+  std::vector<Qttp*> waiting;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(--open_ <= low_mark_)
+    {
+      waiting.swap(waiting_);
+    }
+  }
+
+  for(auto listener : waiting)
+  {
+    listener->resume_accept();
+  }
+}
+
+Qttp* QttpRoundRobinBalancer::select(const std::vector<Qttp*>& workers)
+{
+  return workers[next_++ % workers.size()];
+}
+
+Qttp* QttpLeastConnectionsBalancer::select(const std::vector<Qttp*>& workers)
+{
+  Qttp* result = workers.front();
+  for(auto worker : workers)
+  {
+    if(worker->get_connection_count() < result->get_connection_count())
+    {
+      result = worker;
+    }
+  }
+  return result;
+}
+
+Qttp::Qttp() :
+  Qttp(native::loop::get_default())
+{
+}
+
+Qttp::Qttp(native::loop& l) :
+  loop_(&l),
+  socket_(new native::net::tcp(l)),
+  local_socket_(),
+  options_(),
+  loop_thread_(),
+  async_(new uv_async_t),
+  notify_mutex_(),
+  notify_queue_(),
+  adopt_queue_(),
+  is_stopping_(false),
+  is_shutdown_requested_(false),
+  is_draining_(false),
+  is_accept_resumed_(false),
+  is_accept_deferred_(false),
+  is_local_accept_deferred_(false),
+  connections_(0),
+  limiter_(std::make_shared<QttpConnectionLimiter>()),
+  callback_(),
+  workers_(),
+  balancer_(),
+  stats_(),
+  timer_wheel_(l),
+  drain_timeout_(),
+  clients_(),
+  response_pool_(),
+  request_pool_(),
+  context_pool_()
+{
+  uv_async_init(l.get(), async_, [](uv_async_t* handle) {
+    reinterpret_cast<Qttp*>(handle->data)->process_notifications();
+  });
+  async_->data = this;
+
+  drain_timeout_.set_callback([this]() {
+    on_drain_timeout();
+  });
+}
+
+Qttp::~Qttp()
+{
+  if(async_)
+  {
+    uv_close(reinterpret_cast<uv_handle_t*>(async_), [](uv_handle_t* h) {
+      delete reinterpret_cast<uv_async_t*>(h);
+    });
+    async_ = nullptr;
+  }
+
+  if(socket_)
+  {
+    socket_->close([](){
+      PRINT_DBG("Closing socket");
+    });
+  }
+
+  if(local_socket_)
+  {
+    local_socket_->close([](){
+      PRINT_DBG("Closing local socket");
+    });
+  }
+}
+
+void Qttp::notify(QttpClientContext* client)
+{
+  {
+    std::lock_guard<std::mutex> lock(notify_mutex_);
+    notify_queue_.push_back(client);
+  }
+  // Coalesces, any number of sends results in at least one callback.
+  uv_async_send(async_);
+}
+
+QttpClientContext* Qttp::create_client(bool is_local)
+{
+  QttpClientContext* client = context_pool_.acquire();
+  if(client)
+  {
+    client->init(options_, is_local);
+  }
+  else
+  {
+    client = new QttpClientContext(this, options_, is_local);
+  }
+  clients_.insert(client);
+  return client;
+}
+
+QttpRequest* Qttp::create_request(QttpClientContext* client)
+{
+  QttpRequest* request = request_pool_.acquire();
+  if(request)
+  {
+    request->timestamp_ = uv_hrtime();
+  }
+  else
+  {
+    request = new QttpRequest;
+  }
+  request->client_ = client;
+  return request;
+}
+
+QttpResponse* Qttp::create_response(QttpClientContext* client)
+{
+  native::net::tcp* socket = client->is_local_ ? nullptr : static_cast<native::net::tcp*>(client->socket_.get());
+
+  QttpResponse* response = response_pool_.acquire();
+  if(response)
+  {
+    response->client_ = client;
+    response->socket_ = socket;
+    return response;
+  }
+  return new QttpResponse(client, socket);
+}
+
+void Qttp::recycle(QttpClientContext* client)
+{
+  --connections_;
+  limiter_->remove();
+  clients_.erase(client);
+  client->reset();
+  context_pool_.release(client);
+
+  if(is_draining_ && connections_ == 0)
+  {
+    timer_wheel_.stop(drain_timeout_);
+    loop_->stop();
+  }
+}
+
+void Qttp::recycle(QttpRequest* request)
+{
+  request->reset();
+  request_pool_.release(request);
+}
+
+void Qttp::recycle(QttpResponse* response)
+{
+  response->reset();
+  response_pool_.release(response);
+}
+
+void Qttp::serve(std::function<void(QttpRequest&, QttpResponse&)> callback)
+{
+  callback_ = callback;
+  loop_thread_ = std::this_thread::get_id();
+}
+
+void Qttp::adopt(uv_os_sock_t sock, bool is_local)
+{
+  // Counted right away so the balancer sees connections still in flight, the
+  // acceptor already holds their slot in the limiter.
+  ++connections_;
+  {
+    std::lock_guard<std::mutex> lock(notify_mutex_);
+    adopt_queue_.push_back(std::make_pair(sock, is_local));
+  }
+  uv_async_send(async_);
+}
+
+void Qttp::resume_accept()
+{
+  is_accept_resumed_ = true;
+  uv_async_send(async_);
+}
+
+void Qttp::on_connection(bool is_local)
+{
+  // Leaving the connection pending makes libuv stop polling the listening
+  // socket until it is accepted, the kernel backlog holds the rest.
+  if(!limiter_->acquire(this))
+  {
+    if(is_local)
+    {
+      is_local_accept_deferred_ = true;
+    }
+    else
+    {
+      is_accept_deferred_ = true;
+    }
+    return;
+  }
+
+  if(!workers_.empty())
+  {
+    hand_off(is_local);
+  }
+  else
+  {
+    accept(is_local);
+  }
+}
+
+void Qttp::accept(bool is_local)
+{
+  // The slot on_connection() acquired is given back by recycle().
+  ++connections_;
+  auto client = create_client(is_local);
+  native::base::stream* listener = is_local ? static_cast<native::base::stream*>(local_socket_.get()) : socket_.get();
+  if(!listener->accept(client->socket_.get()))
+  {
+    PRINT_STDERR("Failed to accept connection");
+    client->close();
+    return;
+  }
+  if(!is_local)
+  {
+    configure_client(static_cast<native::net::tcp&>(*client->socket_));
+  }
+  client->parse(callback_);
+}
+
+void Qttp::hand_off(bool is_local)
+{
+  native::base::stream* client;
+  native::base::stream* listener;
+  if(is_local)
+  {
+    client = new native::net::pipe(*loop_);
+    listener = local_socket_.get();
+  }
+  else
+  {
+    client = new native::net::tcp(*loop_);
+    listener = socket_.get();
+  }
+  native::error err;
+  uv_os_sock_t sock;
+
+  bool is_accepted = listener->accept(client);
+  bool is_duplicated = is_accepted && client->duplicate(sock, err);
+
+  // The connection lives on in the duplicate, this handle was only needed
+  // to accept it.
+  client->close([client](){
+    delete client;
+  });
+
+  if(!is_duplicated)
+  {
+    PRINT_STDERR("Failed to hand off connection");
+    limiter_->remove();
+    return;
+  }
+
+  balancer_->select(workers_)->adopt(sock, is_local);
+}
+
+void Qttp::stop()
+{
+  is_stopping_ = true;
+  uv_async_send(async_);
+}
+
+void Qttp::shutdown()
+{
+  is_shutdown_requested_ = true;
+  uv_async_send(async_);
+}
+
+void Qttp::start_drain()
+{
+  is_draining_ = true;
+  is_accept_deferred_ = false;
+  is_local_accept_deferred_ = false;
+
+  if(options_.drain_timeout_ms == 0)
+  {
+    loop_->stop();
+    return;
+  }
+
+  // Connections still in the backlog are refused, their clients can retry
+  // them elsewhere right away.
+  if(socket_)
+  {
+    socket_->close([](){
+      PRINT_DBG("Listener closed");
+    });
+    socket_.reset();
+  }
+  if(local_socket_)
+  {
+    local_socket_->close([](){
+      PRINT_DBG("Local listener closed");
+    });
+    local_socket_.reset();
+  }
+
+  std::vector<QttpClientContext*> clients(clients_.begin(), clients_.end());
+  for(auto client : clients)
+  {
+    client->drain();
+  }
+
+  if(connections_ == 0)
+  {
+    loop_->stop();
+    return;
+  }
+  timer_wheel_.start(drain_timeout_, options_.drain_timeout_ms);
+}
+
+void Qttp::on_drain_timeout()
+{
+  PRINT_STDERR("Closing " << clients_.size() << " connections still open after draining");
+
+  std::vector<QttpClientContext*> clients(clients_.begin(), clients_.end());
+  for(auto client : clients)
+  {
+    client->is_broken_ = true;
+    client->close();
+  }
+  loop_->stop();
+}
+
+void Qttp::process_notifications()
+{
+  std::vector<QttpClientContext*> queue;
+  std::vector<std::pair<uv_os_sock_t, bool> > adopted;
+  {
+    std::lock_guard<std::mutex> lock(notify_mutex_);
+    queue.swap(notify_queue_);
+    adopted.swap(adopt_queue_);
+  }
+
+  for(auto client : queue)
+  {
+    client->on_notify();
+  }
+
+  for(auto & a : adopted)
+  {
+    uv_os_sock_t sock = a.first;
+    bool is_local = a.second;
+    auto client = create_client(is_local);
+    native::error err;
+    bool is_opened = is_local ?
+                     static_cast<native::net::pipe&>(*client->socket_).open(sock, err) :
+                     static_cast<native::net::tcp&>(*client->socket_).open(sock, err);
+    if(!is_opened)
+    {
+      PRINT_STDERR("Failed to adopt connection");
+#ifndef _WIN32
+      ::close(sock);
+#endif
+      client->close();
+      continue;
+    }
+    if(!is_local)
+    {
+      configure_client(static_cast<native::net::tcp&>(*client->socket_));
+    }
+    client->parse(callback_);
+  }
+
+  if(is_shutdown_requested_.exchange(false) && !is_draining_)
+  {
+    start_drain();
+  }
+
+  if(is_accept_resumed_.exchange(false))
+  {
+    if(is_accept_deferred_)
+    {
+      is_accept_deferred_ = false;
+      on_connection(false);
+    }
+    if(is_local_accept_deferred_)
+    {
+      is_local_accept_deferred_ = false;
+      on_connection(true);
+    }
+  }
+
+  if(is_stopping_)
+  {
+    loop_->stop();
+  }
+}
+
+void Qttp::configure_client(native::net::tcp& socket)
+{
+  // Failures are reported by native and leave the system defaults in place.
+  native::error err;
+  socket.nodelay(options_.tcp_nodelay);
+  if(options_.tcp_keepalive)
+  {
+    socket.keepalive(true, options_.tcp_keepalive_delay_s);
+  }
+  if(options_.receive_buffer_size > 0)
+  {
+    socket.receive_buffer_size(options_.receive_buffer_size, err);
+  }
+  if(options_.send_buffer_size > 0)
+  {
+    socket.send_buffer_size(options_.send_buffer_size, err);
+  }
+}
+
+bool Qttp::listen(const std::string& ip, int port, std::function<void(QttpRequest&, QttpResponse&)> callback)
+{
+  bool is_ip6 = ip.find(':') != std::string::npos;
+  native::error err;
+  if(options_.reuse_port && !socket_->reuse_port(is_ip6, err)) {
+    PRINT_STDERR("Failed to enable SO_REUSEPORT for " << ip << ":" << port);
+    return false;
+  }
+
+  bool is_bound = is_ip6 ? socket_->bind6(ip, port, options_.ipv6_only, err) : socket_->bind(ip, port, err);
+  if(!is_bound) {
+    PRINT_STDERR("Failed to bind to ip/port " << ip << ":" << port);
+    return false;
+  }
+
+  // Both are optimizations, the listener works without them.
+  if(options_.defer_accept_s > 0 && !socket_->defer_accept(options_.defer_accept_s, err)) {
+    PRINT_STDERR("Failed to enable TCP_DEFER_ACCEPT for " << ip << ":" << port);
+  }
+  if(options_.fast_open_queue > 0 && !socket_->fast_open(options_.fast_open_queue, err)) {
+    PRINT_STDERR("Failed to enable TCP_FASTOPEN for " << ip << ":" << port);
+  }
+
+  // The loop is run by whichever thread listens, responses finished
+  // anywhere else are handed over through async_.
+  loop_thread_ = std::this_thread::get_id();
+  callback_ = callback;
+
+  auto closed = [](){
+                  PRINT_STDERR("Closing socket due to an error");
+                };
+
+  auto connected = [ = ](native::error err) {
+                     if(err)
+                     {
+                       PRINT_NN_ERROR(err);
+                       // Running out of descriptors or memory passes, keep listening.
+                       if(err.code() != UV_EMFILE && err.code() != UV_ENFILE &&
+                          err.code() != UV_ENOBUFS && err.code() != UV_ENOMEM)
+                       {
+                         socket_.get()->close(closed);
+                       }
+                     }
+                     else
+                     {
+                       on_connection(false);
+                     }
+                   };
+
+  return socket_->listen(connected, options_.listen_backlog);
+}
+
+bool Qttp::listen_local(const std::string& path, std::function<void(QttpRequest&, QttpResponse&)> callback)
+{
+  native::error err;
+  local_socket_ = std::make_shared<native::net::pipe>(*loop_);
+  if(!local_socket_->bind(path, err)) {
+    PRINT_STDERR("Failed to bind to " << path);
+    return false;
+  }
+
+  // Otherwise a proxy running as another user may not be able to connect.
+  if(options_.local_socket_mode > 0 && !local_socket_->chmod(options_.local_socket_mode, err)) {
+    PRINT_STDERR("Failed to change the permissions of " << path);
+  }
+
+  loop_thread_ = std::this_thread::get_id();
+  callback_ = callback;
+
+  auto closed = [](){
+                  PRINT_STDERR("Closing local socket due to an error");
                 };
 
   auto connected = [ = ](native::error err) {
                      if(err)
                      {
-                       // TODO: handle client connection error
                        PRINT_NN_ERROR(err);
-                       socket_.get()->close(closed);
+                       if(err.code() != UV_EMFILE && err.code() != UV_ENFILE &&
+                          err.code() != UV_ENOBUFS && err.code() != UV_ENOMEM)
+                       {
+                         local_socket_.get()->close(closed);
+                       }
                      }
                      else
                      {
-                       auto client = new QttpClientContext(socket_.get());
-                       client->parse(callback);
+                       on_connection(true);
                      }
                    };
 
-  return socket_->listen(connected);
+  return local_socket_->listen(connected, options_.listen_backlog);
 }
@@ -5,14 +5,23 @@
 #include <sys/types.h>
 #include <sstream>
 #include <iostream>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
 #include <http_parser.h>
 #include "base.h"
 #include "handle.h"
 #include "net.h"
 #include "tcp.h"
+#include "pipe.h"
 #include "text.h"
 #include "callback.h"
+#include "fs.h"
 #include "http.h"
+#include "object_pool.h"
+#include "timer_wheel.h"
 
 #include <QtCore>
 
@@ -24,6 +33,8 @@ namespace http
 class NNATIVE_DLLEXPORT QttpUrl
 {
   friend class QttpClientContext;
+  friend class QttpRequest;
+  friend class QttpHttp2Session;
 
   public:
     QttpUrl();
@@ -42,6 +53,7 @@ class NNATIVE_DLLEXPORT QttpUrl
 
   private:
     void from_buf(const char* buf, std::size_t len, bool is_connect = false);
+    void reset();
 
     bool has_schema() const {
       return (handle_.field_set & (1 << UF_SCHEMA)) != 0;
@@ -67,17 +79,284 @@ class NNATIVE_DLLEXPORT QttpUrl
     QByteArray buf_;
 };
 
+class Qttp;
 class QttpClientContext;
-typedef std::shared_ptr<QttpClientContext> qttp_client_ptr;
+class QttpHttp2Session;
+class QttpWebSocket;
+class QttpTlsContext;
+class QttpTlsSession;
+
+/**
+ * Connection handling knobs, populated by the owner before Qttp::listen().
+ */
+struct NNATIVE_DLLEXPORT QttpOptions
+{
+  QttpOptions() :
+    keep_alive(true),
+    max_requests_per_connection(100),
+    keep_alive_timeout_ms(5000),
+    max_pipelined_requests(16),
+    reuse_port(false),
+    body_stream_high_watermark(1024 * 1024),
+    body_stream_low_watermark(256 * 1024),
+    response_stream_high_watermark(1024 * 1024),
+    response_stream_low_watermark(256 * 1024),
+    write_queue_high_watermark(1024 * 1024),
+    write_queue_low_watermark(256 * 1024),
+    header_timeout_ms(10000),
+    body_timeout_ms(30000),
+    body_min_rate(1024),
+    write_timeout_ms(30000),
+    max_header_size(0),
+    max_url_length(0),
+    max_body_size(0),
+    tcp_nodelay(true),
+    tcp_keepalive(false),
+    tcp_keepalive_delay_s(60),
+    defer_accept_s(0),
+    fast_open_queue(0),
+    receive_buffer_size(0),
+    send_buffer_size(0),
+    ipv6_only(false),
+    listen_backlog(511),
+    local_socket_mode(0),
+    drain_timeout_ms(10000),
+    http2(false),
+    http2_max_concurrent_streams(100),
+    http2_initial_window_size(1024 * 1024),
+    websocket_max_message_size(8 * 1024 * 1024),
+    websocket_idle_timeout_ms(60000)
+  {
+  }
+
+  //! Allows persistent connections when the client asks for them.
+  bool keep_alive;
+
+  //! Closes a persistent connection after this many requests, 0 is unlimited.
+  uint32_t max_requests_per_connection;
+
+  //! Closes a connection that stays idle between requests, 0 disables it.
+  uint64_t keep_alive_timeout_ms;
+
+  //! Requests parsed ahead while earlier responses are still pending.
+  uint32_t max_pipelined_requests;
+
+  //! Binds with SO_REUSEPORT so one listener per loop can share the port.
+  bool reuse_port;
+
+  //! Stops reading once this many streamed body bytes wait to be consumed.
+  size_t body_stream_high_watermark;
+
+  //! Reads again once the consumer got the backlog down to this many bytes.
+  size_t body_stream_low_watermark;
+
+  //! QttpResponse::write_chunk() reports backpressure past this many bytes.
+  size_t response_stream_high_watermark;
+
+  //! The drain callback runs once the stream backlog is down to this many bytes.
+  size_t response_stream_low_watermark;
+
+  //! Stops reading from a client once this many bytes wait to be written to
+  //! it, the rest of a file being sent included, 0 disables it.
+  size_t write_queue_high_watermark;
+
+  //! Reads again once the queued output is down to this many bytes.
+  size_t write_queue_low_watermark;
+
+  //! Time a client gets to send the headers of a request, including the
+  //! first request of a connection, 0 disables it.
+  uint64_t header_timeout_ms;
+
+  //! Window a request body is measured over, a client sending less than
+  //! body_min_rate in it times out.  0 disables it.
+  uint64_t body_timeout_ms;
+
+  //! Bytes per second a request body has to average over each window of
+  //! body_timeout_ms, at least one byte per window.
+  size_t body_min_rate;
+
+  //! Time queued output may go without any of it being written, 0 disables it.
+  uint64_t write_timeout_ms;
+
+  //! Bytes of request line and headers answered with 431 beyond, 0 is unlimited.
+  size_t max_header_size;
+
+  //! Request target length answered with 414 beyond, 0 is unlimited.
+  size_t max_url_length;
+
+  //! Buffered request body size answered with 413 beyond, 0 is unlimited.
+  //! Streamed bodies are bounded by their watermarks instead.
+  uint64_t max_body_size;
+
+  //! Disables Nagle's algorithm on client sockets, so a small response isn't
+  //! held back waiting for the client's delayed ACK.
+  bool tcp_nodelay;
+
+  //! Sends TCP keep-alive probes on client sockets.
+  bool tcp_keepalive;
+
+  //! Idle seconds before the first keep-alive probe.
+  unsigned int tcp_keepalive_delay_s;
+
+  //! Accepts a connection only once its first data arrived or this many
+  //! seconds passed, 0 disables it.  Linux only.
+  unsigned int defer_accept_s;
+
+  //! TCP Fast Open queue length of the listening socket, 0 disables it.
+  int fast_open_queue;
+
+  //! SO_RCVBUF of client sockets, 0 keeps the system default.
+  int receive_buffer_size;
+
+  //! SO_SNDBUF of client sockets, 0 keeps the system default.
+  int send_buffer_size;
+
+  //! Keeps ip4 clients off a listener bound to an ip6 address.
+  bool ipv6_only;
+
+  //! Connections the kernel queues until they are accepted, capped by
+  //! net.core.somaxconn.
+  int listen_backlog;
+
+  //! Permissions of the socket file Qttp::listen_local() creates, 0 leaves
+  //! those the umask gave it.
+  int local_socket_mode;
+
+  //! Time Qttp::shutdown() gives connections to finish their requests before
+  //! the loop stops regardless, 0 stops right away.
+  uint64_t drain_timeout_ms;
+
+  //! Speaks cleartext HTTP/2 with clients opening with its connection
+  //! preface or asking for "Upgrade: h2c".
+  bool http2;
+
+  //! Streams an HTTP/2 client may have open at once, more are refused.
+  uint32_t http2_max_concurrent_streams;
+
+  //! Request body bytes an HTTP/2 client may send ahead on each stream and
+  //! on the connection before it has to wait for a WINDOW_UPDATE.
+  uint32_t http2_initial_window_size;
+
+  //! Size of a WebSocket message, fragments put together, beyond which the
+  //! connection is closed with 1009, 0 is unlimited.
+  uint64_t websocket_max_message_size;
+
+  //! Pings a WebSocket client that sent nothing for this long and closes the
+  //! connection if it stays silent for as long again, 0 disables it.
+  uint64_t websocket_idle_timeout_ms;
+};
+
+/**
+ * Counters of a loop, updated on the loop thread and readable from any thread.
+ */
+struct NNATIVE_DLLEXPORT QttpStats
+{
+  QttpStats() :
+    write_queue_high_hits(0),
+    write_queue_low_hits(0),
+    header_timeouts(0),
+    body_timeouts(0),
+    idle_timeouts(0),
+    write_timeouts(0),
+    headers_too_large(0),
+    urls_too_long(0),
+    bodies_too_large(0),
+    continues(0),
+    admission_rejects(0),
+    http2_connections(0),
+    http2_streams(0),
+    websocket_connections(0),
+    websocket_messages(0),
+    tls_handshakes(0),
+    tls_resumed_handshakes(0),
+    tls_failures(0)
+  {
+  }
+
+  //! Connections that stopped reading because too much output was queued.
+  std::atomic<uint64_t> write_queue_high_hits;
+
+  //! Connections that read again once their output drained.
+  std::atomic<uint64_t> write_queue_low_hits;
+
+  //! Connections closed by QttpOptions::header_timeout_ms.
+  std::atomic<uint64_t> header_timeouts;
+
+  //! Connections closed by QttpOptions::body_timeout_ms.
+  std::atomic<uint64_t> body_timeouts;
+
+  //! Connections closed by QttpOptions::keep_alive_timeout_ms or
+  //! websocket_idle_timeout_ms.
+  std::atomic<uint64_t> idle_timeouts;
+
+  //! Connections closed by QttpOptions::write_timeout_ms.
+  std::atomic<uint64_t> write_timeouts;
+
+  //! Requests answered with 431 by QttpOptions::max_header_size.
+  std::atomic<uint64_t> headers_too_large;
+
+  //! Requests answered with 414 by QttpOptions::max_url_length.
+  std::atomic<uint64_t> urls_too_long;
+
+  //! Requests answered with 413 by QttpOptions::max_body_size.
+  std::atomic<uint64_t> bodies_too_large;
+
+  //! "100 Continue" responses sent to clients expecting one.
+  std::atomic<uint64_t> continues;
+
+  //! Requests answered by the admission callback or with 417 before their
+  //! body was read.
+  std::atomic<uint64_t> admission_rejects;
+
+  //! Connections that switched to HTTP/2, by preface or upgrade.
+  std::atomic<uint64_t> http2_connections;
+
+  //! HTTP/2 streams opened by clients.
+  std::atomic<uint64_t> http2_streams;
+
+  //! Connections upgraded to WebSockets.
+  std::atomic<uint64_t> websocket_connections;
+
+  //! WebSocket messages received from clients.
+  std::atomic<uint64_t> websocket_messages;
+
+  //! TLS handshakes that negotiated a new session.
+  std::atomic<uint64_t> tls_handshakes;
+
+  //! TLS handshakes that resumed a cached session or a ticket.
+  std::atomic<uint64_t> tls_resumed_handshakes;
+
+  //! Connections closed before or because their TLS handshake failed.
+  std::atomic<uint64_t> tls_failures;
+};
+
+/**
+ * A response header along with its serialized "key: value\r\n" line, which
+ * is encoded once when the header is set.
+ */
+struct NNATIVE_DLLEXPORT QttpResponseHeader
+{
+  QttpResponseHeader(const QString& k, const QString& v);
+
+  QString key;
+  QString value;
+  QByteArray line;
+};
 
 class NNATIVE_DLLEXPORT QttpResponse
 {
   friend class QttpClientContext;
+  friend class QttpHttp2Session;
+  friend class Qttp;
+  template<typename> friend class native::object_pool;
 
   private:
     QttpResponse(QttpClientContext* client, native::net::tcp* socket);
     ~QttpResponse();
 
+    //! Returns to the defaults before going back to the pool, keeping capacity.
+    void reset();
+
   public:
 
     bool end(const QString& body) {
@@ -88,7 +367,7 @@ class NNATIVE_DLLEXPORT QttpResponse
     void write(int length, const QChar* body);
 
     bool end(const QByteArray& body) {
-      write(body.length(), body.constData());
+      write(body);
       return close();
     }
 
@@ -109,8 +388,82 @@ class NNATIVE_DLLEXPORT QttpResponse
 
     void write(size_t length, const char* body);
 
+    /**
+     * Keeps a shallow copy of body, which is written as is without copying
+     * the data.
+     */
+    void write(const QByteArray& body);
+
     bool close();
 
+    /**
+     * Sends the file at path as the body and closes the response.  The loop
+     * thread streams it with sendfile(2) right after the head, or reads it in
+     * chunks under TLS.  length has to be the size of the file.
+     */
+    bool end_file(const std::string& path, uint64_t length);
+
+    /**
+     * Sends the head right away and streams the body in chunks after it, with
+     * "Transfer-Encoding: chunked" or until the connection closes for HTTP/1.0
+     * clients, in DATA frames over HTTP/2.  Headers and status have to be set
+     * before.
+     *
+     * write_chunk() and end_stream() may be called from any thread, the
+     * response stays valid until end_stream().
+     */
+    bool begin_stream();
+
+    /**
+     * Queues a chunk for the loop thread, which writes it as soon as the
+     * responses in front of this one are out.  Returns false once more than
+     * QttpOptions::response_stream_high_watermark bytes are waiting, the
+     * producer should hold off until the drain callback runs.
+     */
+    bool write_chunk(const QByteArray& chunk);
+
+    bool write_chunk(size_t length, const char* chunk) {
+      return write_chunk(QByteArray(chunk, static_cast<int>(length)));
+    }
+
+    //! Writes the terminating chunk and closes the response.
+    bool end_stream();
+
+    /**
+     * Called on the loop thread once a blocked stream is down to the low
+     * watermark again.  Set it before begin_stream().
+     */
+    void set_drain_callback(std::function<void()> callback) {
+      drain_callback_ = callback;
+    }
+
+    /**
+     * Called on the loop thread once the connection went away, or the HTTP/2
+     * stream was reset, while the body was still streaming.  write_chunk()
+     * fails from here on, end_stream() still has to be called to let go of
+     * the response.  Set it before begin_stream().
+     */
+    void set_abort_callback(std::function<void()> callback) {
+      abort_callback_ = callback;
+    }
+
+    //! Nobody is listening to the stream anymore.
+    bool is_stream_aborted() const {
+      return is_stream_aborted_;
+    }
+
+    //! Stream bytes queued or still being written.
+    size_t get_stream_backlog() const;
+
+    bool is_streaming() const {
+      return is_streaming_;
+    }
+
+    //! Whether the response goes out on an HTTP/2 stream.
+    bool is_http2() const {
+      return is_http2_;
+    }
+
     void set_status(int status_code) {
       status_ = status_code;
     }
@@ -119,49 +472,164 @@ class NNATIVE_DLLEXPORT QttpResponse
       return status_;
     }
 
+    //! Replaces a header of the same name, compared case-insensitively.
     void set_header(const QString& key, const QString& value) {
-      headers_[key] = value;
+      set_header(QttpResponseHeader(key, value));
     }
 
-    const std::map<QString, QString>& get_headers() const {
-      return headers_;
-    }
+    void set_header(const QttpResponseHeader& header);
+
+    std::map<QString, QString> get_headers() const;
+
+    /**
+     * Serializes the head into out, sized up front and copied in one pass.
+     * content_length is added unless the headers carry one, or it is negative.
+     */
+    static void serialize_head(QByteArray& out, int status,
+                               const std::vector<QttpResponseHeader>& headers,
+                               int64_t content_length);
 
+    //! Both fail for connections over a Unix domain socket.
     bool getsockname(bool& ip4, std::string& ip, int& port) const
     {
-      return socket_->getsockname(ip4, ip, port);
+      return socket_ && socket_->getsockname(ip4, ip, port);
     }
 
     bool getpeername(bool& ip4, std::string& ip, int& port) const
     {
-      return socket_->getpeername(ip4, ip, port);
+      return socket_ && socket_->getpeername(ip4, ip, port);
+    }
+
+  private:
+    const QttpResponseHeader* find_header(const QString& key) const;
+
+    void write_head(size_t content_length);
+    void append_body(const char* body, size_t length);
+
+    /**
+     * Makes a finished response announce "Connection: close" in case it said
+     * otherwise, on the loop thread before its head is written.
+     */
+    void announce_close();
+
+    //! Appends the head and every body segment to bufs for a vectored write.
+    void get_buffers(std::vector<uv_buf_t>& bufs) const;
+
+    //! Moves the queued stream segments to out, on the loop thread.
+    size_t take_stream(std::vector<QByteArray>& out);
+
+    //! Called on the loop thread once length stream bytes left the process.
+    void on_stream_written(size_t length);
+
+    //! Queues framed segments and wakes up the loop thread if needed.
+    bool queue_stream(const QByteArray* segments, size_t count);
+
+    bool queue_stream(const QByteArray& segment) {
+      return queue_stream(&segment, 1);
     }
 
+    //! Tells the producer of an unfinished stream, on the loop thread.
+    void abort_stream();
+
   private:
-    qttp_client_ptr client_;
+    QttpClientContext* client_;
+    //! Null unless the connection is TCP.
     native::net::tcp* socket_;
-    std::map<QString, QString> headers_;
+    std::vector<QttpResponseHeader> headers_;
     int status_;
-    QByteArray response_data_;
+    QByteArray head_;
+    //! Content-Length head_ was serialized with, -1 if the headers carry one.
+    int64_t content_length_;
+    //! Body segments, shared with the caller where possible.
+    std::vector<QByteArray> body_;
+    //! Whether the last segment is ours to append to.
+    bool owns_last_segment_;
+    std::string file_path_;
+    uint64_t file_length_;
+    bool has_file_;
     bool is_response_written_;
+    //! Set once close() was called, from whichever thread finished it.
+    std::atomic<bool> is_ready_;
+
+    //! Framed stream segments waiting for the loop thread.
+    std::vector<QByteArray> stream_queue_;
+    //! Guards the queue, backlog and flags the producer shares with the loop.
+    mutable std::mutex stream_mutex_;
+    size_t stream_backlog_;
+    std::function<void()> drain_callback_;
+    std::function<void()> abort_callback_;
+    //! Set on dispatch, HTTP/1.0 clients get the body delimited by closing.
+    bool is_chunking_allowed_;
+    //! Headers and body are framed by QttpHttp2Session, head_ stays empty.
+    bool is_http2_;
+    std::atomic<bool> is_streaming_;
+    bool is_stream_blocked_;
+    //! A notification for the queue is on its way to the loop thread.
+    bool is_stream_notified_;
+    std::atomic<bool> is_stream_aborted_;
+};
+
+/**
+ * A request header as offsets into the header block of its request.  The
+ * value is only converted to a QString once somebody asks for it.
+ */
+struct NNATIVE_DLLEXPORT QttpHeaderView
+{
+  QttpHeaderView(int offset) :
+    name_offset(offset),
+    name_length(0),
+    value_offset(offset),
+    value_length(0),
+    value(),
+    has_value(false)
+  {
+  }
+
+  int name_offset;
+  int name_length;
+  int value_offset;
+  int value_length;
+  mutable QString value;
+  mutable bool has_value;
 };
 
 class NNATIVE_DLLEXPORT QttpRequest
 {
   friend class QttpClientContext;
+  friend class QttpHttp2Session;
+  friend class Qttp;
+  template<typename> friend class native::object_pool;
 
   private:
     QttpRequest();
     ~QttpRequest();
 
+    void reset();
+
   public:
     const QttpUrl& url() const {
       return url_;
     }
 
+    /**
+     * Header names are compared case-insensitively, the last one wins if a
+     * header was sent more than once.
+     */
     const QString& get_header(const QString& key) const;
     bool get_header(const QString& key, QString& value) const;
-    const std::map<QString, QString>& get_headers() const;
+    bool has_header(const QString& key) const;
+
+    //! Materializes every header, prefer get_header() for single lookups.
+    std::map<QString, QString> get_headers() const;
+
+    const std::vector<QttpHeaderView>& get_header_views() const {
+      return headers_;
+    }
+
+    //! Raw bytes of a name or value of a header view.
+    const char* get_header_data(int offset) const {
+      return header_data_.constData() + offset;
+    }
 
     const QByteArray& get_body (void) const {
       return body_;
@@ -175,12 +643,36 @@ class NNATIVE_DLLEXPORT QttpRequest
       return timestamp_;
     }
 
+    //! Whether the body goes to the body callback instead of get_body().
+    bool is_body_streamed() const {
+      return is_body_streamed_;
+    }
+
+    /**
+     * Has to be called for every chunk handed to the body callback once it
+     * was dealt with, from any thread.  Reading resumes once the backlog is
+     * consumed, see QttpOptions::body_stream_low_watermark.
+     */
+    void consume_body(size_t length);
+
+  private:
+    const QttpHeaderView* find_header(const QString& key) const;
+    const QString& materialize(const QttpHeaderView& header) const;
+
+    //! Appends a fragment to the header being parsed, or starts a new one.
+    void append_header_field(const char* at, size_t len, bool is_new);
+    void append_header_value(const char* at, size_t len);
+
   private:
     QttpUrl url_;
-    std::map<QString, QString> headers_;
+    //! Header names and values as received, back to back.
+    QByteArray header_data_;
+    std::vector<QttpHeaderView> headers_;
     QByteArray body_;
     QString method_;
     uint64_t timestamp_;
+    QttpClientContext* client_;
+    bool is_body_streamed_;
 
     static const QString default_value_;
 };
@@ -188,41 +680,599 @@ class NNATIVE_DLLEXPORT QttpRequest
 class NNATIVE_DLLEXPORT QttpClientContext
 {
   friend class Qttp;
+  friend class QttpResponse;
+  friend class QttpRequest;
+  friend class QttpHttp2Session;
+  friend class QttpWebSocket;
+  template<typename> friend class native::object_pool;
 
   private:
-    QttpClientContext(native::net::tcp* server);
+    //! The socket is connected afterwards by accepting or adopting it.
+    QttpClientContext(Qttp* server, const QttpOptions& options, bool is_local);
 
   public:
     ~QttpClientContext();
 
   private:
+    typedef std::pair<QttpRequest*, QttpResponse*> transaction;
+
+    //! Caps how much a declared body or message length may have
+    //! preallocated.
+    static const uint64_t max_body_reserve = 8 * 1024 * 1024;
+
+    //! Body slices and messages up to this size are copied next to their
+    //! framing, larger ones are shared with whoever handed them over.
+    static const int max_copied_bytes = 1024;
+
+    enum write_status
+    {
+      write_done,
+      write_queued,
+      write_failed
+    };
+
+    enum read_timeout_kind
+    {
+      no_timeout,
+      header_timeout,
+      body_timeout,
+      idle_timeout,
+      websocket_timeout
+    };
+
+    //! Prepares a fresh socket, for new and recycled contexts alike.
+    void init(const QttpOptions& options, bool is_local);
+
+    /**
+     * Returns to the state of a new context once closed, the timeout entries and
+     * callback table are kept for the next connection.
+     */
+    void reset();
+
     bool parse(std::function<void(QttpRequest&, QttpResponse&)> callback);
 
+    void start_reading();
+
+    //! The client hung up or the read failed, what was parsed is answered.
+    void hang_up();
+
+    //! Decrypts bytes read from a TLS connection and executes them.
+    void receive_tls(const char* buf, size_t len);
+    void execute(const char* buf, size_t len);
+    bool should_keep_alive() const;
+
+    //! Hands a complete request to the callback given to parse().
+    void dispatch(QttpRequest* request, QttpResponse* response);
+
+    /**
+     * Switches to HTTP/2 after an "Upgrade: h2c" request, which is answered
+     * as its first stream.  Returns false to go on with HTTP/1.1 instead.
+     */
+    bool upgrade_to_http2();
+
+    /**
+     * Hands the connection to a QttpWebSocket after a handshake request the
+     * WebSocket filter accepted.  Returns false to answer it as a regular
+     * request instead.
+     */
+    bool upgrade_to_websocket();
+
+    //! Writes bytes that live as long as the process, in order with the rest.
+    void write_static(const char* data, size_t length);
+
+    /**
+     * Writes to the socket, through the TLS session if there is one.  Encrypted
+     * bytes can't be taken back, try_write() leaves everything to write() then
+     * by returning UV_EAGAIN.
+     */
+    int try_write(const uv_buf_t* bufs, unsigned int nbufs);
+    bool write(const uv_buf_t* bufs, unsigned int nbufs, std::function<void(native::error)> callback);
+
+    //! Writes TLS records and hands their buffers back to the pool afterwards.
+    bool write_records(const std::vector<uv_buf_t>& records, std::function<void(native::error)> callback);
+
+    /**
+     * Writes bufs, with try_write() first if no other write is outstanding,
+     * and queues a write request covering count responses for whatever the
+     * kernel didn't take.  segments are kept alive until it completes.
+     * Returns write_queued while the request is outstanding, done then runs
+     * once it completes, followed by on_write_complete().  Otherwise bufs
+     * were written or the connection is broken, and neither is called.
+     */
+    write_status write_output(std::vector<uv_buf_t>& bufs, size_t count,
+                              std::shared_ptr<std::vector<QByteArray> > segments,
+                              std::function<void(bool)> done);
+
+    //! Appends the segments in [first, last) that aren't empty to bufs.
+    static void append_buffers(std::vector<uv_buf_t>& bufs, const std::vector<QByteArray>& segments,
+                               size_t first, size_t last);
+
+    //! Stops reading and parsing until resume() is called.
+    void pause();
+    void resume();
+
+    /**
+     * Called by QttpResponse::close() on any thread, the actual write always
+     * happens on the loop thread so responses go out in request order.
+     */
+    void on_response_ready(QttpResponse* response);
+
+    //! Wakes up the loop thread for chunks queued by a streaming response.
+    void on_stream_data();
+
+    //! Loop thread side of a notification posted through Qttp.
+    void on_notify();
+
+    /**
+     * Counts bytes of the request line and headers against the limits,
+     * returns false once the request was rejected.
+     */
+    bool on_header_bytes(size_t length, bool is_url);
+
+    /**
+     * Decides whether the body of the request being parsed is streamed and
+     * whether it is read at all.
+     */
+    void on_headers_complete();
+
+    //! Tells a client waiting for it to send the body, once nothing is in front.
+    void send_continue();
+    void on_body(const char* at, size_t len);
+
+    //! Tells the body consumer a streamed body won't be completed.
+    void abort_body();
+
+    //! Called by QttpRequest::consume_body() on any thread.
+    void on_body_consumed(size_t length);
+
+    /**
+     * Coalesces the finished responses following those already being written
+     * into a single write.  Any number of writes may be outstanding.
+     */
+    void flush();
+    void on_write_complete(size_t count, size_t bytes, bool success);
+
+    //! Pauses or resumes reading as the queued output crosses the watermarks.
+    void update_write_backpressure();
+
+    //! Writes the head of a file response and streams the file after it.
+    void send_file(QttpResponse* response);
+    void send_file_chunk();
+    //! Reads and writes a chunk the regular way, waiting for the socket to drain.
+    void send_buffered_chunk();
+    //! Takes a write of the file response off bytes_in_flight_.
+    void on_file_written(size_t bytes);
+    //! Lets the backpressure follow the file being sent.
+    void on_file_progress();
+    void finish_file(bool success);
+    void drop(size_t count);
+
+    /**
+     * Arms the read timeout for whatever the connection waits for, the
+     * header deadline keeps running once started.
+     */
+    void update_read_timeout();
+    void on_read_timeout();
+
+    //! Answers the request being read with status and closes after it.
+    void reject_request(int status);
+
+    //! Watches queued output for progress while there is any.
+    void update_write_timeout();
+    void on_write_timeout();
+
+    /**
+     * Finishes whatever request is under way and closes after its response,
+     * right away if the connection is idle.
+     */
+    void drain();
+
+    //! Output bytes that left the write queue since the connection opened.
+    uint64_t get_bytes_drained() const;
+
+    //! Closes once nothing is left to send and no responses are pending.
+    void maybe_close();
+
+    /**
+     * Closes the socket and stops the timeouts, the context goes back to the
+     * pool once libuv is done with the handle, no notifications are pending
+     * and every response in the pipeline was finished.
+     */
+    void close();
+
+    //! Tells the producers of unfinished streams nobody listens anymore.
+    void abort_streams();
+    void release();
+
   private:
+    Qttp* server_;
     http_parser parser_;
     http_parser_settings parser_settings_;
     bool was_header_value_;
-    QString last_header_field_;
-    QString last_header_value_;
 
-    std::shared_ptr<native::net::tcp> socket_;
+    //! A native::net::pipe for local connections, a native::net::tcp otherwise.
+    std::shared_ptr<native::base::stream> socket_;
+    bool is_local_;
+    //! The request currently being parsed, if any.
     QttpRequest* request_;
     QttpResponse* response_;
+    //! Dispatched requests waiting for their responses, in request order.
+    std::deque<transaction> pipeline_;
 
     callbacks* callback_lut_;
+    //! Set once the connection speaks HTTP/2, which takes over from parser_.
+    QttpHttp2Session* http2_;
+    //! The first bytes read ruled out or confirmed the HTTP/2 preface.
+    bool is_protocol_known_;
+    //! Start of a connection that may be the HTTP/2 preface.
+    QByteArray preface_;
+    //! Set once the connection was upgraded, which takes over from parser_.
+    std::shared_ptr<QttpWebSocket> websocket_;
+    //! The WebSocket client was pinged for going silent.
+    bool is_websocket_pinged_;
+    //! Set for TCP connections while Qttp::set_tls_context() is in effect.
+    QttpTlsSession* tls_;
+    //! Plaintext decrypted out of the last read.
+    QByteArray tls_input_;
+    bool is_tls_established_;
+
+    QttpOptions options_;
+    //! Entries on the timer wheel of the loop, kept across connections.
+    native::timer_wheel::entry read_timeout_;
+    native::timer_wheel::entry write_timeout_;
+    read_timeout_kind read_timeout_kind_;
+    //! get_bytes_drained() when the write timeout was armed.
+    uint64_t write_mark_;
+    //! Output bytes whose write completed.
+    uint64_t bytes_completed_;
+    //! Request line and header bytes of the request being read.
+    size_t header_bytes_;
+    size_t url_bytes_;
+    //! Body bytes received since the body timeout was armed.
+    uint64_t body_window_bytes_;
+    //! Bytes read past the last request parsed while paused.
+    QByteArray pending_;
+    uint32_t requests_served_;
+    //! Number of responses covered by outstanding writes.
+    size_t writing_;
+    //! Bytes handed to uv_write() whose completion is still pending.
+    size_t bytes_in_flight_;
+    native::fs::file_handle file_fd_;
+    uint64_t file_offset_;
+    uint64_t file_remaining_;
+    std::string file_chunk_;
+    //! File I/O is outstanding, the context can't be recycled before it ends.
+    bool is_sending_file_;
+    std::atomic<int> pending_notifies_;
+    //! Streamed body bytes handed out but not consumed yet.
+    std::atomic<size_t> body_backlog_;
+    bool is_parsing_;
+    bool is_paused_;
+    //! Paused until the body consumer catches up.
+    bool is_body_blocked_;
+    //! Paused until the client reads what was written to it.
+    bool is_write_blocked_;
+    //! The request being read waits for "100 Continue".
+    bool is_continue_pending_;
+    //! The headers of the request being read are complete.
+    bool is_reading_body_;
+    bool is_closing_;
+    bool is_broken_;
+    bool is_closed_;
+    bool is_socket_closed_;
+};
+
+/**
+ * Caps the connections open across every Qttp sharing it, see
+ * Qttp::set_connection_limiter().  A listener at the cap leaves further
+ * connections in the backlog instead of accepting them, and picks them up
+ * once the count is down to the low mark.  Safe from any thread.
+ */
+class NNATIVE_DLLEXPORT QttpConnectionLimiter
+{
+  public:
+    /**
+     * @param max_open connections allowed at once, 0 is unlimited.
+     * @param low_mark open connections accepting resumes at.
+     */
+    QttpConnectionLimiter(int max_open = 0, int low_mark = 0);
+
+    /**
+     * Reserves a slot for a connection listener is about to accept and
+     * returns true, listeners on other loops can't take it meanwhile.
+     * Otherwise listener is woken up through Qttp::resume_accept() once
+     * there is room again.
+     */
+    bool acquire(Qttp* listener);
+
+    //! Gives a slot back once its connection was closed or failed to open.
+    void remove();
+
+    int get_open() const {
+      return open_;
+    }
+
+    int get_peak() const {
+      return peak_;
+    }
+
+    //! Times a listener had to leave connections in the backlog.
+    uint64_t get_deferred() const {
+      return deferred_;
+    }
+
+  private:
+    QttpConnectionLimiter(const QttpConnectionLimiter&);
+    void operator =(const QttpConnectionLimiter&);
+
+    void add();
+
+  private:
+    const int max_open_;
+    const int low_mark_;
+    std::mutex mutex_;
+    std::vector<Qttp*> waiting_;
+    std::atomic<int> open_;
+    std::atomic<int> peak_;
+    std::atomic<uint64_t> deferred_;
+};
+
+/**
+ * Picks the worker a freshly accepted connection is handed to when a single
+ * acceptor feeds several loops, see Qttp::set_workers().
+ */
+class NNATIVE_DLLEXPORT QttpBalancer
+{
+  public:
+    virtual ~QttpBalancer() {
+    }
+
+    //! Called on the acceptor's loop thread, workers is never empty.
+    virtual Qttp* select(const std::vector<Qttp*>& workers) = 0;
+};
+
+class NNATIVE_DLLEXPORT QttpRoundRobinBalancer : public QttpBalancer
+{
+  public:
+    QttpRoundRobinBalancer() : next_(0) {
+    }
+
+    Qttp* select(const std::vector<Qttp*>& workers);
+
+  private:
+    size_t next_;
+};
+
+/**
+ * Prefers the worker with the fewest open connections, which keeps long lived
+ * keep-alive connections from piling up on a single loop.
+ */
+class NNATIVE_DLLEXPORT QttpLeastConnectionsBalancer : public QttpBalancer
+{
+  public:
+    Qttp* select(const std::vector<Qttp*>& workers);
 };
 
 class NNATIVE_DLLEXPORT Qttp
 {
+  friend class QttpClientContext;
+  friend class QttpHttp2Session;
+  friend class QttpWebSocket;
+
   public:
     Qttp();
+
+    /**
+     * Listens and serves connections on the given loop, which has to be run
+     * by the thread calling listen() and outlive this instance.
+     */
+    Qttp(native::loop& l);
     virtual ~Qttp();
 
   public:
     bool listen(const std::string& ip, int port, std::function<void(QttpRequest&, QttpResponse&)> callback);
 
+    /**
+     * Listens on the Unix domain socket at path as well, or instead of
+     * listen().  Its connections are served like TCP ones on the same loop,
+     * or handed to the workers.
+     */
+    bool listen_local(const std::string& path, std::function<void(QttpRequest&, QttpResponse&)> callback);
+
+    void set_options(const QttpOptions& options) {
+      options_ = options;
+    }
+
+    const QttpOptions& get_options() const {
+      return options_;
+    }
+
+    /**
+     * Streams the bodies of requests filter accepts to body_callback as they
+     * arrive instead of buffering them.  Both run on the loop thread, filter
+     * once the headers are parsed and only for requests with a body.  The
+     * request is dispatched as usual once complete, an empty chunk tells the
+     * body was aborted and the request never will be.
+     */
+    void set_body_streaming(std::function<bool(QttpRequest&)> filter,
+                            std::function<void(QttpRequest&, QttpResponse&, const QByteArray&)> body_callback) {
+      stream_filter_ = filter;
+      body_callback_ = body_callback;
+    }
+
+    /**
+     * Runs on the loop thread once the headers of a request with a body are
+     * complete, before the body is read or a "100 Continue" is sent.  Returns
+     * 0 to go on or the status the request is answered with right away, which
+     * closes the connection without reading the body.
+     */
+    void set_admission(std::function<int(QttpRequest&)> admission) {
+      admission_ = admission;
+    }
+
+    /**
+     * Upgrades connections to WebSockets for the handshake requests filter
+     * accepts, on the loop thread once the request was parsed.  callback gets
+     * every QttpWebSocket::event of a connection in order on the loop thread,
+     * along with the handshake request.  Each event has to be acknowledged
+     * with QttpRequest::consume_body() for the length of its message, from
+     * any thread, reading pauses while too much is unacknowledged like for
+     * streamed bodies.
+     */
+    void set_websocket(std::function<bool(QttpRequest&)> filter,
+                       std::function<void(QttpRequest&, QttpResponse&, const std::shared_ptr<QttpWebSocket>&,
+                                          int, const QByteArray&)> callback) {
+      websocket_filter_ = filter;
+      websocket_callback_ = callback;
+    }
+
+    /**
+     * Serves the connections handed over by an acceptor instead of listening,
+     * has to be called by the thread running the loop.
+     */
+    void serve(std::function<void(QttpRequest&, QttpResponse&)> callback);
+
+    /**
+     * Hands every connection accepted by listen() to one of the workers rather
+     * than serving it on this loop.  Workers have to outlive this instance.
+     */
+    void set_workers(const std::vector<Qttp*>& workers, std::shared_ptr<QttpBalancer> balancer) {
+      workers_ = workers;
+      balancer_ = balancer;
+    }
+
+    native::loop& get_loop() {
+      return *loop_;
+    }
+
+    /**
+     * Shares a connection cap with other instances, each one has a limiter
+     * of its own without limit otherwise.  Has to be set before listening.
+     */
+    void set_connection_limiter(std::shared_ptr<QttpConnectionLimiter> limiter) {
+      limiter_ = limiter;
+    }
+
+    const QttpConnectionLimiter& get_connection_limiter() const {
+      return *limiter_;
+    }
+
+    /**
+     * Terminates TLS on TCP connections, Unix domain sockets stay cleartext.
+     * The context and its session cache may be shared with other instances,
+     * so clients resume on any loop.  Has to be set before listening.
+     */
+    void set_tls_context(std::shared_ptr<QttpTlsContext> context) {
+      tls_context_ = context;
+    }
+
+    //! Accepts what waited in the backlog once there is room, from any thread.
+    void resume_accept();
+
+    //! Connections served or about to be served, readable from any thread.
+    int get_connection_count() const {
+      return connections_;
+    }
+
+    //! Stops the loop this instance is listening on, safe from any thread.
+    void stop();
+
+    /**
+     * Closes the listener and lets every connection finish the requests it
+     * started, the last response tells the client the connection closes.
+     * The loop stops once all of them are closed or after
+     * QttpOptions::drain_timeout_ms.  Safe from any thread.
+     */
+    void shutdown();
+
+    //! Pools recycling per connection and per request objects, see object_pool.
+    const native::object_pool<QttpClientContext>& get_context_pool() const {
+      return context_pool_;
+    }
+
+    const native::object_pool<QttpRequest>& get_request_pool() const {
+      return request_pool_;
+    }
+
+    const native::object_pool<QttpResponse>& get_response_pool() const {
+      return response_pool_;
+    }
+
+    const QttpStats& get_stats() const {
+      return stats_;
+    }
+
+  private:
+    QttpClientContext* create_client(bool is_local);
+    QttpRequest* create_request(QttpClientContext* client);
+    QttpResponse* create_response(QttpClientContext* client);
+
+    void recycle(QttpClientContext* client);
+    void recycle(QttpRequest* request);
+    void recycle(QttpResponse* response);
+
+    //! Queues a context for a flush on the loop thread, safe from any thread.
+    void notify(QttpClientContext* client);
+    void process_notifications();
+
+    //! Accepts or hands off a pending connection unless at the cap.
+    void on_connection(bool is_local);
+    void accept(bool is_local);
+    void hand_off(bool is_local);
+
+    //! Queues a socket accepted on another loop, safe from any thread.
+    void adopt(uv_os_sock_t sock, bool is_local);
+
+    //! Applies the socket options to an accepted or adopted connection.
+    void configure_client(native::net::tcp& socket);
+
+    //! Loop thread side of shutdown().
+    void start_drain();
+    void on_drain_timeout();
+
   private:
+    native::loop* loop_;
     std::shared_ptr<native::net::tcp> socket_;
+    //! Unix domain socket listener, if any.
+    std::shared_ptr<native::net::pipe> local_socket_;
+    QttpOptions options_;
+    std::thread::id loop_thread_;
+    uv_async_t* async_;
+    std::mutex notify_mutex_;
+    std::vector<QttpClientContext*> notify_queue_;
+    //! Sockets handed over and whether they are Unix domain sockets.
+    std::vector<std::pair<uv_os_sock_t, bool> > adopt_queue_;
+    std::atomic<bool> is_stopping_;
+    std::atomic<bool> is_shutdown_requested_;
+    //! Set on the loop thread once shutdown() took effect.
+    bool is_draining_;
+    //! Set by resume_accept() for the loop thread.
+    std::atomic<bool> is_accept_resumed_;
+    //! A connection is left pending on the listening socket.
+    bool is_accept_deferred_;
+    bool is_local_accept_deferred_;
+    std::atomic<int> connections_;
+    std::shared_ptr<QttpConnectionLimiter> limiter_;
+    std::shared_ptr<QttpTlsContext> tls_context_;
+    std::function<void(QttpRequest&, QttpResponse&)> callback_;
+    std::function<bool(QttpRequest&)> stream_filter_;
+    std::function<int(QttpRequest&)> admission_;
+    std::function<void(QttpRequest&, QttpResponse&, const QByteArray&)> body_callback_;
+    std::function<bool(QttpRequest&)> websocket_filter_;
+    std::function<void(QttpRequest&, QttpResponse&, const std::shared_ptr<QttpWebSocket>&,
+                       int, const QByteArray&)> websocket_callback_;
+    std::vector<Qttp*> workers_;
+    std::shared_ptr<QttpBalancer> balancer_;
+    QttpStats stats_;
+    //! Timeouts of every connection on this loop.
+    native::timer_wheel timer_wheel_;
+    native::timer_wheel::entry drain_timeout_;
+    //! Connections of this loop, on the loop thread.
+    std::unordered_set<QttpClientContext*> clients_;
+    // Contexts are destroyed first, they hand requests and responses back.
+    native::object_pool<QttpResponse> response_pool_;
+    native::object_pool<QttpRequest> request_pool_;
+    native::object_pool<QttpClientContext> context_pool_;
 };
 
 }
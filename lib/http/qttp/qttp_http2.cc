@@ -0,0 +1,1630 @@
+#include "qttp_http2.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+using namespace native;
+using namespace native::http;
+
+namespace
+{
+const char connection_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+const size_t frame_header_size = 9;
+const uint32_t default_window = 65535;
+const uint32_t max_window = 0x7fffffff;
+const uint32_t default_frame_size = 16384;
+const uint32_t max_frame_size = 0xffffff;
+
+//! Bounds header blocks with QttpOptions::max_header_size off, the way
+//! http_parser bounds HTTP/1.x headers.
+const size_t max_header_block_size = 80 * 1024;
+
+enum frame_type
+{
+  data_frame = 0x0,
+  headers_frame = 0x1,
+  priority_frame = 0x2,
+  rst_stream_frame = 0x3,
+  settings_frame = 0x4,
+  push_promise_frame = 0x5,
+  ping_frame = 0x6,
+  goaway_frame = 0x7,
+  window_update_frame = 0x8,
+  continuation_frame = 0x9
+};
+
+enum frame_flag
+{
+  end_stream_flag = 0x1,
+  ack_flag = 0x1,
+  end_headers_flag = 0x4,
+  padded_flag = 0x8,
+  priority_flag = 0x20
+};
+
+enum error_code
+{
+  no_error = 0x0,
+  protocol_error = 0x1,
+  internal_error = 0x2,
+  flow_control_error = 0x3,
+  stream_closed_error = 0x5,
+  frame_size_error = 0x6,
+  refused_stream_error = 0x7,
+  compression_error = 0x9,
+  enhance_your_calm_error = 0xb
+};
+
+enum setting
+{
+  header_table_size_setting = 0x1,
+  enable_push_setting = 0x2,
+  max_concurrent_streams_setting = 0x3,
+  initial_window_size_setting = 0x4,
+  max_frame_size_setting = 0x5,
+  max_header_list_size_setting = 0x6
+};
+
+uint32_t read_uint32(const uint8_t* p)
+{
+  return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+void append_uint32(QByteArray& out, uint32_t value)
+{
+  char bytes[4] = {
+    static_cast<char>(value >> 24), static_cast<char>(value >> 16),
+    static_cast<char>(value >> 8), static_cast<char>(value)
+  };
+  out.append(bytes, 4);
+}
+
+void append_frame_header(QByteArray& out, size_t length, uint8_t type, uint8_t flags, uint32_t stream_id)
+{
+  char header[frame_header_size] = {
+    static_cast<char>(length >> 16), static_cast<char>(length >> 8), static_cast<char>(length),
+    static_cast<char>(type), static_cast<char>(flags),
+    static_cast<char>((stream_id >> 24) & 0x7f), static_cast<char>(stream_id >> 16),
+    static_cast<char>(stream_id >> 8), static_cast<char>(stream_id)
+  };
+  out.append(header, frame_header_size);
+}
+
+//! Leaves payload and length covering the data of a PADDED frame.
+bool strip_padding(uint8_t flags, const uint8_t*& payload, uint32_t& length)
+{
+  if((flags & padded_flag) == 0)
+  {
+    return true;
+  }
+  if(length < 1 || payload[0] >= length)
+  {
+    return false;
+  }
+  length -= payload[0] + 1;
+  ++payload;
+  return true;
+}
+
+//! Headers HTTP/2 does without, RFC 7540 8.1.2.2.
+bool is_connection_header(const std::string& name)
+{
+  return name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+         name == "transfer-encoding" || name == "upgrade";
+}
+
+//! Response headers whose values rarely repeat aren't worth a table entry.
+bool is_indexed_header(const std::string& name)
+{
+  return name != "content-length" && name != "date" && name != "etag" &&
+         name != "last-modified" && name != "expires" && name != "set-cookie";
+}
+}
+
+const size_t QttpHttp2Session::preface_size;
+
+QttpHttp2Session::QttpHttp2Session(QttpClientContext* client) :
+  client_(client),
+  server_(client->server_),
+  decoder_(4096),
+  encoder_(),
+  streams_(),
+  preface_remaining_(preface_size),
+  input_(),
+  header_block_(),
+  header_stream_id_(0),
+  header_flags_(0),
+  last_stream_id_(0),
+  send_window_(default_window),
+  recv_window_(default_window),
+  recv_unacked_(0),
+  peer_initial_window_(default_window),
+  local_initial_window_((std::min)((std::max)(client->options_.http2_initial_window_size, default_window), max_window)),
+  peer_max_frame_size_(default_frame_size),
+  output_(),
+  owns_last_output_(false),
+  retained_(),
+  stream_written_(),
+  aborted_(),
+  pending_file_ops_(0),
+  is_flushing_(false),
+  needs_flush_(false),
+  is_going_away_(false),
+  is_failed_(false)
+{
+}
+
+QttpHttp2Session::~QttpHttp2Session()
+{
+  for(auto it = streams_.begin(); it != streams_.end(); )
+  {
+    it = finish_stream(it);
+  }
+
+  for(auto & t : aborted_)
+  {
+    server_->recycle(t.first);
+    server_->recycle(t.second);
+  }
+}
+
+int QttpHttp2Session::match_preface(const char* data, size_t length)
+{
+  size_t count = (std::min)(length, preface_size);
+  if(memcmp(data, connection_preface, count) != 0)
+  {
+    return -1;
+  }
+  return (count == preface_size) ? 1 : 0;
+}
+
+void QttpHttp2Session::start()
+{
+  queue_settings();
+}
+
+void QttpHttp2Session::upgrade(QttpRequest* request, QttpResponse* response, const QByteArray& settings)
+{
+  queue_settings();
+
+  // The request was read as HTTP/1.1, its response is the first one sent
+  // as HTTP/2.
+  last_stream_id_ = 1;
+  stream& s = open_stream(1, request, response);
+  s.is_remote_closed = true;
+
+  // No SETTINGS ACK, the 101 response acknowledged them.
+  if(apply_settings(reinterpret_cast<const uint8_t*>(settings.constData()), static_cast<size_t>(settings.length())))
+  {
+    dispatch(s);
+  }
+}
+
+void QttpHttp2Session::receive(const char* data, size_t length)
+{
+  if(is_failed_)
+  {
+    return;
+  }
+
+  if(preface_remaining_ > 0)
+  {
+    size_t count = (std::min)(length, preface_remaining_);
+    if(memcmp(data, connection_preface + (preface_size - preface_remaining_), count) != 0)
+    {
+      PRINT_STDERR("Invalid HTTP/2 connection preface");
+      fail(protocol_error);
+      return;
+    }
+    preface_remaining_ -= count;
+    data += count;
+    length -= count;
+  }
+
+  // Frames are processed right out of the read buffer, only a frame that is
+  // cut off is kept for the next read.
+  const char* pos = data;
+  size_t available = length;
+  if(!input_.isEmpty())
+  {
+    input_.append(data, static_cast<int>(length));
+    pos = input_.constData();
+    available = static_cast<size_t>(input_.length());
+  }
+
+  size_t consumed = 0;
+  while(!is_failed_ && available - consumed >= frame_header_size)
+  {
+    const uint8_t* header = reinterpret_cast<const uint8_t*>(pos + consumed);
+    uint32_t frame_length = (static_cast<uint32_t>(header[0]) << 16) |
+                            (static_cast<uint32_t>(header[1]) << 8) | header[2];
+    if(frame_length > default_frame_size)
+    {
+      // Larger than our SETTINGS_MAX_FRAME_SIZE.
+      fail(frame_size_error);
+      break;
+    }
+    if(available - consumed < frame_header_size + frame_length)
+    {
+      break;
+    }
+
+    on_frame(header[3], header[4], read_uint32(header + 5) & max_window,
+             header + frame_header_size, frame_length);
+    consumed += frame_header_size + frame_length;
+  }
+
+  if(is_failed_)
+  {
+    input_.clear();
+  }
+  else if(!input_.isEmpty())
+  {
+    input_.remove(0, static_cast<int>(consumed));
+  }
+  else if(consumed < available)
+  {
+    input_.append(pos + consumed, static_cast<int>(available - consumed));
+  }
+}
+
+void QttpHttp2Session::on_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t length)
+{
+  // A header block can't be interrupted by other frames.
+  if(header_stream_id_ != 0 && type != continuation_frame)
+  {
+    fail(protocol_error);
+    return;
+  }
+
+  switch(type)
+  {
+    case data_frame:
+      on_data(flags, stream_id, payload, length);
+      break;
+
+    case headers_frame:
+      on_headers(flags, stream_id, payload, length);
+      break;
+
+    case priority_frame:
+      if(stream_id == 0)
+      {
+        fail(protocol_error);
+      }
+      else if(length != 5)
+      {
+        fail(frame_size_error);
+      }
+      break;
+
+    case rst_stream_frame:
+      on_rst_stream(stream_id, payload, length);
+      break;
+
+    case settings_frame:
+      on_settings(flags, stream_id, payload, length);
+      break;
+
+    case push_promise_frame:
+      // Clients can't push.
+      fail(protocol_error);
+      break;
+
+    case ping_frame:
+      on_ping(flags, stream_id, payload, length);
+      break;
+
+    case goaway_frame:
+      on_goaway(stream_id, length);
+      break;
+
+    case window_update_frame:
+      on_window_update(stream_id, payload, length);
+      break;
+
+    case continuation_frame:
+      on_continuation(flags, stream_id, payload, length);
+      break;
+
+    default:
+      // Unknown frame types are ignored.
+      break;
+  }
+}
+
+void QttpHttp2Session::on_data(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t length)
+{
+  if(stream_id == 0)
+  {
+    fail(protocol_error);
+    return;
+  }
+
+  // Padding included, the whole frame counts against the windows.
+  uint32_t frame_length = length;
+  if(frame_length > recv_window_)
+  {
+    fail(flow_control_error);
+    return;
+  }
+  recv_window_ -= frame_length;
+
+  auto it = streams_.find(stream_id);
+  if(it == streams_.end() || it->second.is_remote_closed)
+  {
+    consume(nullptr, frame_length);
+    if(stream_id > last_stream_id_)
+    {
+      fail(protocol_error);
+    }
+    else if(it != streams_.end() && !it->second.is_reset)
+    {
+      reset_stream(it->second, stream_closed_error);
+    }
+    // Otherwise data for a stream that was reset or rejected, still on its way.
+    return;
+  }
+
+  stream& s = it->second;
+  if(frame_length > s.recv_window)
+  {
+    consume(nullptr, frame_length);
+    reset_stream(s, flow_control_error);
+    return;
+  }
+  s.recv_window -= frame_length;
+
+  if(!strip_padding(flags, payload, length))
+  {
+    fail(protocol_error);
+    return;
+  }
+
+  on_body(s, payload, length);
+
+  if(flags & end_stream_flag)
+  {
+    s.is_remote_closed = true;
+    consume(nullptr, frame_length);
+    if(!s.is_dispatched)
+    {
+      dispatch(s);
+    }
+    return;
+  }
+  consume(&s, frame_length);
+}
+
+void QttpHttp2Session::on_headers(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t length)
+{
+  if(stream_id == 0 || !strip_padding(flags, payload, length))
+  {
+    fail(protocol_error);
+    return;
+  }
+
+  if(flags & priority_flag)
+  {
+    // Stream dependency and weight, priorities are ignored.
+    if(length < 5)
+    {
+      fail(frame_size_error);
+      return;
+    }
+    payload += 5;
+    length -= 5;
+  }
+
+  header_block_.assign(reinterpret_cast<const char*>(payload), length);
+  header_stream_id_ = stream_id;
+  header_flags_ = flags;
+
+  if(flags & end_headers_flag)
+  {
+    on_header_block();
+  }
+}
+
+void QttpHttp2Session::on_continuation(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t length)
+{
+  if(header_stream_id_ == 0 || stream_id != header_stream_id_)
+  {
+    fail(protocol_error);
+    return;
+  }
+
+  header_block_.append(reinterpret_cast<const char*>(payload), length);
+
+  // The block is decoded once complete, a client could otherwise send
+  // CONTINUATION frames forever.
+  size_t max_header_size = client_->options_.max_header_size;
+  size_t max_block_size = (max_header_size > 0) ? 2 * max_header_size + default_frame_size : max_header_block_size;
+  if(header_block_.size() > max_block_size)
+  {
+    fail(enhance_your_calm_error);
+    return;
+  }
+
+  if(flags & end_headers_flag)
+  {
+    on_header_block();
+  }
+}
+
+void QttpHttp2Session::on_header_block()
+{
+  uint32_t stream_id = header_stream_id_;
+  bool is_end_stream = (header_flags_ & end_stream_flag) != 0;
+  header_stream_id_ = 0;
+
+  const uint8_t* block = reinterpret_cast<const uint8_t*>(header_block_.data());
+  size_t block_size = header_block_.size();
+
+  if(stream_id <= last_stream_id_)
+  {
+    // Trailers or a stream that is gone, decoded all the same to keep the
+    // table in sync.  Trailer fields are dropped.
+    if(!decoder_.decode(block, block_size, [](const std::string&, const std::string&) {}))
+    {
+      fail(compression_error);
+      return;
+    }
+
+    auto it = streams_.find(stream_id);
+    if(it == streams_.end() || it->second.is_reset)
+    {
+      return;
+    }
+
+    stream& s = it->second;
+    if(s.is_remote_closed)
+    {
+      reset_stream(s, stream_closed_error);
+    }
+    else if(!is_end_stream)
+    {
+      reset_stream(s, protocol_error);
+    }
+    else
+    {
+      s.is_remote_closed = true;
+      if(!s.is_dispatched)
+      {
+        dispatch(s);
+      }
+    }
+    return;
+  }
+
+  if((stream_id & 1) == 0)
+  {
+    // Even streams are the server's.
+    fail(protocol_error);
+    return;
+  }
+  last_stream_id_ = stream_id;
+
+  QttpRequest* request = server_->create_request(client_);
+  QttpResponse* response = server_->create_response(client_);
+
+  std::string method;
+  std::string path;
+  std::string authority;
+  std::string cookie;
+  size_t header_size = 0;
+  bool has_host = false;
+  bool has_regular = false;
+  bool is_malformed = false;
+
+  bool is_decoded = decoder_.decode(block, block_size, [&](const std::string& name, const std::string& value) {
+    header_size += hpack::entry_size(name.size(), value.size());
+
+    if(!name.empty() && name[0] == ':')
+    {
+      // Pseudo headers come first.
+      is_malformed = is_malformed || has_regular;
+      if(name == ":method")
+      {
+        method = value;
+      }
+      else if(name == ":path")
+      {
+        path = value;
+      }
+      else if(name == ":authority")
+      {
+        authority = value;
+      }
+      else if(name != ":scheme")
+      {
+        is_malformed = true;
+      }
+      return;
+    }
+    has_regular = true;
+
+    if(name == "cookie")
+    {
+      // May be split into a field per pair, joined as HTTP/1.x sends it.
+      if(!cookie.empty())
+      {
+        cookie.append("; ");
+      }
+      cookie.append(value);
+      return;
+    }
+
+    if(is_connection_header(name))
+    {
+      is_malformed = true;
+      return;
+    }
+
+    has_host = has_host || name == "host";
+    request->append_header_field(name.data(), name.size(), true);
+    request->append_header_value(value.data(), value.size());
+  });
+
+  if(!is_decoded)
+  {
+    server_->recycle(request);
+    server_->recycle(response);
+    fail(compression_error);
+    return;
+  }
+
+  if(is_going_away_ || streams_.size() >= client_->options_.http2_max_concurrent_streams)
+  {
+    server_->recycle(request);
+    server_->recycle(response);
+    queue_rst_stream(stream_id, refused_stream_error);
+    return;
+  }
+
+  if(!cookie.empty())
+  {
+    request->append_header_field("cookie", 6, true);
+    request->append_header_value(cookie.data(), cookie.size());
+  }
+  if(!has_host && !authority.empty())
+  {
+    // Actions look for the host where HTTP/1.1 has it.
+    request->append_header_field("host", 4, true);
+    request->append_header_value(authority.data(), authority.size());
+  }
+
+  stream& s = open_stream(stream_id, request, response);
+  s.is_remote_closed = is_end_stream;
+
+  if(is_malformed || method.empty() || path.empty())
+  {
+    reset_stream(s, protocol_error);
+    return;
+  }
+  request->method_ = QString::fromLatin1(method.data(), static_cast<int>(method.size()));
+
+  const QttpOptions& options = client_->options_;
+  if(options.max_header_size > 0 && header_size > options.max_header_size)
+  {
+    ++server_->stats_.headers_too_large;
+    reject(s, 431);
+    return;
+  }
+
+  if(options.max_url_length > 0 && path.size() > options.max_url_length)
+  {
+    ++server_->stats_.urls_too_long;
+    reject(s, 414);
+    return;
+  }
+
+  try
+  {
+    request->url_.from_buf(path.data(), path.size());
+  }
+  catch(const url_parse_exception& ex)
+  {
+    PRINT_STDERR(ex.message());
+    reject(s, 400);
+    return;
+  }
+
+  if(is_end_stream)
+  {
+    dispatch(s);
+    return;
+  }
+  admit(s);
+}
+
+void QttpHttp2Session::on_rst_stream(uint32_t stream_id, const uint8_t*, uint32_t length)
+{
+  if(stream_id == 0)
+  {
+    fail(protocol_error);
+    return;
+  }
+  if(length != 4)
+  {
+    fail(frame_size_error);
+    return;
+  }
+
+  auto it = streams_.find(stream_id);
+  if(it == streams_.end())
+  {
+    if(stream_id > last_stream_id_)
+    {
+      fail(protocol_error);
+    }
+    return;
+  }
+
+  // Dropped by the next flush once its response is ready.
+  stream& s = it->second;
+  s.is_reset = true;
+  s.is_remote_closed = true;
+  abort_body(s);
+}
+
+void QttpHttp2Session::on_settings(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t length)
+{
+  if(stream_id != 0)
+  {
+    fail(protocol_error);
+    return;
+  }
+
+  if(flags & ack_flag)
+  {
+    if(length != 0)
+    {
+      fail(frame_size_error);
+    }
+    return;
+  }
+
+  if(length % 6 != 0)
+  {
+    fail(frame_size_error);
+    return;
+  }
+
+  if(apply_settings(payload, length))
+  {
+    queue_frame(settings_frame, ack_flag, 0, nullptr, 0);
+  }
+}
+
+void QttpHttp2Session::on_ping(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t length)
+{
+  if(stream_id != 0)
+  {
+    fail(protocol_error);
+    return;
+  }
+  if(length != 8)
+  {
+    fail(frame_size_error);
+    return;
+  }
+
+  if((flags & ack_flag) == 0)
+  {
+    queue_frame(ping_frame, ack_flag, 0, reinterpret_cast<const char*>(payload), length);
+  }
+}
+
+void QttpHttp2Session::on_goaway(uint32_t stream_id, uint32_t length)
+{
+  if(stream_id != 0)
+  {
+    fail(protocol_error);
+    return;
+  }
+  if(length < 8)
+  {
+    fail(frame_size_error);
+    return;
+  }
+
+  // The client opens no more streams, those it did are still answered.
+  drain();
+}
+
+void QttpHttp2Session::on_window_update(uint32_t stream_id, const uint8_t* payload, uint32_t length)
+{
+  if(length != 4)
+  {
+    fail(frame_size_error);
+    return;
+  }
+
+  uint32_t increment = read_uint32(payload) & max_window;
+  if(stream_id == 0)
+  {
+    if(increment == 0)
+    {
+      fail(protocol_error);
+      return;
+    }
+    send_window_ += increment;
+    if(send_window_ > max_window)
+    {
+      fail(flow_control_error);
+    }
+    return;
+  }
+
+  auto it = streams_.find(stream_id);
+  if(it == streams_.end())
+  {
+    if(stream_id > last_stream_id_)
+    {
+      fail(protocol_error);
+    }
+    return;
+  }
+
+  stream& s = it->second;
+  if(increment == 0)
+  {
+    reset_stream(s, protocol_error);
+    return;
+  }
+  s.send_window += increment;
+  if(s.send_window > max_window)
+  {
+    reset_stream(s, flow_control_error);
+  }
+}
+
+bool QttpHttp2Session::apply_settings(const uint8_t* payload, size_t length)
+{
+  for(size_t i = 0; i + 6 <= length; i += 6)
+  {
+    uint16_t id = static_cast<uint16_t>((payload[i] << 8) | payload[i + 1]);
+    uint32_t value = read_uint32(payload + i + 2);
+
+    switch(id)
+    {
+      case header_table_size_setting:
+        encoder_.set_max_table_size(value);
+        break;
+
+      case enable_push_setting:
+        if(value > 1)
+        {
+          fail(protocol_error);
+          return false;
+        }
+        break;
+
+      case initial_window_size_setting:
+      {
+        if(value > max_window)
+        {
+          fail(flow_control_error);
+          return false;
+        }
+
+        // Applies to open streams as well, their windows may go negative.
+        int64_t delta = static_cast<int64_t>(value) - peer_initial_window_;
+        for(auto & entry : streams_)
+        {
+          entry.second.send_window += delta;
+          if(entry.second.send_window > max_window)
+          {
+            fail(flow_control_error);
+            return false;
+          }
+        }
+        peer_initial_window_ = value;
+        break;
+      }
+
+      case max_frame_size_setting:
+        if(value < default_frame_size || value > max_frame_size)
+        {
+          fail(protocol_error);
+          return false;
+        }
+        peer_max_frame_size_ = value;
+        break;
+
+      default:
+        // SETTINGS_MAX_CONCURRENT_STREAMS only limits pushes, unknown
+        // settings are ignored.
+        break;
+    }
+  }
+  return true;
+}
+
+QttpHttp2Session::stream& QttpHttp2Session::open_stream(uint32_t stream_id, QttpRequest* request, QttpResponse* response)
+{
+  ++server_->stats_.http2_streams;
+  response->is_http2_ = true;
+
+  stream& s = streams_[stream_id];
+  s.id = stream_id;
+  s.request = request;
+  s.response = response;
+  s.send_window = peer_initial_window_;
+  s.recv_window = local_initial_window_;
+  return s;
+}
+
+void QttpHttp2Session::admit(stream& s)
+{
+  QttpRequest& request = *s.request;
+
+  bool expects_continue = false;
+  QString expect;
+  if(request.get_header("Expect", expect))
+  {
+    if(expect.compare("100-continue", Qt::CaseInsensitive) != 0)
+    {
+      ++server_->stats_.admission_rejects;
+      reject(s, 417);
+      return;
+    }
+    expects_continue = true;
+  }
+
+  if(server_->admission_)
+  {
+    int status = server_->admission_(request);
+    if(status != 0)
+    {
+      ++server_->stats_.admission_rejects;
+      reject(s, status);
+      return;
+    }
+  }
+
+  QString length_header;
+  bool has_length = false;
+  uint64_t content_length = 0;
+  if(request.get_header("Content-Length", length_header))
+  {
+    content_length = length_header.toULongLong(&has_length);
+  }
+
+  uint64_t max_body_size = client_->options_.max_body_size;
+  if(server_->stream_filter_ && server_->stream_filter_(request))
+  {
+    request.is_body_streamed_ = true;
+  }
+  else if(has_length && max_body_size > 0 && content_length > max_body_size)
+  {
+    ++server_->stats_.bodies_too_large;
+    reject(s, 413);
+    return;
+  }
+  else if(has_length)
+  {
+    request.body_.reserve(static_cast<int>((std::min)(content_length, QttpClientContext::max_body_reserve)));
+  }
+
+  if(expects_continue)
+  {
+    ++server_->stats_.continues;
+    queue_headers(s, 100, false);
+  }
+}
+
+void QttpHttp2Session::on_body(stream& s, const uint8_t* data, uint32_t length)
+{
+  // Answered already, the rest of the body is dropped.
+  if(s.is_dispatched || length == 0)
+  {
+    return;
+  }
+
+  QttpRequest& request = *s.request;
+  const char* at = reinterpret_cast<const char*>(data);
+  if(!request.is_body_streamed_)
+  {
+    uint64_t max_body_size = client_->options_.max_body_size;
+    if(max_body_size > 0 && static_cast<uint64_t>(request.body_.size()) + length > max_body_size)
+    {
+      ++server_->stats_.bodies_too_large;
+      reject(s, 413);
+      return;
+    }
+    request.body_.append(at, static_cast<int>(length));
+    return;
+  }
+
+  // Like over HTTP/1.x the whole connection stops reading until the
+  // consumer caught up, the windows are granted back regardless.
+  client_->body_backlog_ += length;
+  ++client_->pending_notifies_;
+  server_->body_callback_(request, *s.response, QByteArray(at, static_cast<int>(length)));
+
+  if(client_->body_backlog_ > client_->options_.body_stream_high_watermark)
+  {
+    client_->is_body_blocked_ = true;
+    client_->pause();
+  }
+}
+
+void QttpHttp2Session::abort_body(stream& s)
+{
+  if(!s.is_dispatched && s.request->is_body_streamed_)
+  {
+    s.request->is_body_streamed_ = false;
+    s.is_body_aborted = true;
+    ++client_->pending_notifies_;
+    server_->body_callback_(*s.request, *s.response, QByteArray());
+  }
+}
+
+void QttpHttp2Session::abort_bodies()
+{
+  for(auto & entry : streams_)
+  {
+    abort_body(entry.second);
+  }
+}
+
+void QttpHttp2Session::abort_streams()
+{
+  // Producers may end any stream right from the callback, which may finish
+  // it, so the streams are searched again after each one.
+  bool is_found = true;
+  while(is_found)
+  {
+    is_found = false;
+    for(auto & entry : streams_)
+    {
+      QttpResponse* response = entry.second.response;
+      if(entry.second.is_dispatched && response->is_streaming_ &&
+         !response->is_ready_ && !response->is_stream_aborted_)
+      {
+        response->abort_stream();
+        is_found = true;
+        break;
+      }
+    }
+  }
+}
+
+void QttpHttp2Session::dispatch(stream& s)
+{
+  s.is_dispatched = true;
+  client_->dispatch(s.request, s.response);
+}
+
+void QttpHttp2Session::reject(stream& s, int status)
+{
+  abort_body(s);
+  s.is_dispatched = true;
+
+  // Comes back through QttpClientContext::on_response_ready() and goes out
+  // with the next flush, followed by a RST_STREAM if the body is still due.
+  s.response->set_status(status);
+  s.response->close();
+}
+
+void QttpHttp2Session::reset_stream(stream& s, uint32_t code)
+{
+  if(s.is_reset)
+  {
+    return;
+  }
+  s.is_reset = true;
+  s.is_remote_closed = true;
+  abort_body(s);
+  queue_rst_stream(s.id, code);
+}
+
+void QttpHttp2Session::fail(uint32_t code)
+{
+  if(is_failed_)
+  {
+    return;
+  }
+  is_failed_ = true;
+  PRINT_DBG("HTTP/2 connection error " << code);
+
+  if(!is_going_away_)
+  {
+    is_going_away_ = true;
+    queue_goaway(code);
+  }
+  input_.clear();
+  header_stream_id_ = 0;
+  abort_bodies();
+
+  // Closes once GOAWAY is written, see can_close().
+  client_->is_closing_ = true;
+  client_->socket_->read_stop();
+}
+
+void QttpHttp2Session::drain()
+{
+  if(is_going_away_)
+  {
+    return;
+  }
+  is_going_away_ = true;
+  queue_goaway(no_error);
+}
+
+void QttpHttp2Session::consume(stream* s, uint32_t length)
+{
+  // Bodies are buffered or handed on right away, the windows only keep the
+  // client from sending more than it was allowed to.
+  recv_unacked_ += length;
+  if(recv_unacked_ >= local_initial_window_ / 2)
+  {
+    queue_window_update(0, recv_unacked_);
+    recv_window_ += recv_unacked_;
+    recv_unacked_ = 0;
+  }
+
+  if(s && !s->is_remote_closed)
+  {
+    s->recv_unacked += length;
+    if(s->recv_unacked >= local_initial_window_ / 2)
+    {
+      queue_window_update(s->id, s->recv_unacked);
+      s->recv_window += s->recv_unacked;
+      s->recv_unacked = 0;
+    }
+  }
+}
+
+bool QttpHttp2Session::is_releasable() const
+{
+  if(pending_file_ops_ != 0)
+  {
+    return false;
+  }
+
+  for(auto & entry : streams_)
+  {
+    if(entry.second.is_dispatched && !entry.second.response->is_ready_)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void QttpHttp2Session::flush()
+{
+  // Drain callbacks run from in here may queue more stream data.
+  if(is_flushing_)
+  {
+    needs_flush_ = true;
+    return;
+  }
+  is_flushing_ = true;
+
+  do
+  {
+    needs_flush_ = false;
+    if(is_failed_ || client_->is_closed_ || client_->is_broken_)
+    {
+      purge();
+    }
+    else
+    {
+      for(auto it = streams_.begin(); it != streams_.end(); )
+      {
+        it = service(it->second) ? finish_stream(it) : std::next(it);
+      }
+    }
+    write_output();
+  }
+  while(needs_flush_);
+
+  is_flushing_ = false;
+
+  if(is_going_away_ && streams_.empty())
+  {
+    client_->is_closing_ = true;
+  }
+}
+
+bool QttpHttp2Session::service(stream& s)
+{
+  if(s.is_reset)
+  {
+    discard(s);
+    return !s.is_file_busy && (!s.is_dispatched || s.response->is_ready_);
+  }
+
+  if(!s.is_dispatched)
+  {
+    return false;
+  }
+
+  // Read first, whatever the producer queued before finishing is taken
+  // along with it.
+  QttpResponse* response = s.response;
+  bool is_ready = response->is_ready_;
+
+  if(!s.is_head_sent)
+  {
+    if(is_ready && !response->is_streaming_)
+    {
+      for(auto & segment : response->body_)
+      {
+        if(!segment.isEmpty())
+        {
+          s.data.push_back(segment);
+        }
+      }
+      if(response->has_file_)
+      {
+        s.file_remaining = response->file_length_;
+      }
+      s.is_body_complete = true;
+
+      bool has_body = !s.data.empty() || s.file_remaining > 0;
+      queue_headers(s, response->status_, !has_body);
+      s.is_head_sent = true;
+      s.is_local_closed = !has_body;
+    }
+    else if(response->is_streaming_)
+    {
+      queue_headers(s, response->status_, false);
+      s.is_head_sent = true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  if(response->is_streaming_ && !s.is_body_complete)
+  {
+    std::vector<QByteArray> segments;
+    s.stream_backlog += response->take_stream(segments);
+    for(auto & segment : segments)
+    {
+      if(!segment.isEmpty())
+      {
+        s.data.push_back(segment);
+      }
+    }
+    s.is_body_complete = is_ready;
+  }
+
+  send_data(s);
+
+  if(!s.is_local_closed)
+  {
+    return false;
+  }
+
+  if(!s.is_remote_closed)
+  {
+    // Answered before the body arrived, the client can stop sending it.
+    queue_rst_stream(s.id, no_error);
+    s.is_remote_closed = true;
+  }
+  return true;
+}
+
+void QttpHttp2Session::send_data(stream& s)
+{
+  while(!s.is_local_closed)
+  {
+    if(s.data.empty())
+    {
+      if(s.file_remaining > 0)
+      {
+        read_file(s);
+        return;
+      }
+      if(!s.is_body_complete)
+      {
+        return;
+      }
+
+      // The last segment went out before the producer finished.
+      queue_data(s.id, end_stream_flag, QByteArray(), 0, 0);
+      s.is_local_closed = true;
+      return;
+    }
+
+    int64_t window = (std::min)(send_window_, s.send_window);
+    if(window <= 0)
+    {
+      return;
+    }
+
+    const QByteArray& segment = s.data.front();
+    int available = segment.length() - s.data_offset;
+    int length = static_cast<int>((std::min)((std::min)(static_cast<int64_t>(available), window),
+                                             static_cast<int64_t>(peer_max_frame_size_)));
+    bool is_last = length == available && s.data.size() == 1 &&
+                   s.is_body_complete && s.file_remaining == 0;
+
+    queue_data(s.id, is_last ? end_stream_flag : 0, segment, s.data_offset, length);
+    send_window_ -= length;
+    s.send_window -= length;
+
+    if(s.stream_backlog > 0)
+    {
+      size_t written = (std::min)(static_cast<size_t>(length), s.stream_backlog);
+      s.stream_backlog -= written;
+      if(!stream_written_.empty() && stream_written_.back().first == s.id)
+      {
+        stream_written_.back().second += written;
+      }
+      else
+      {
+        stream_written_.push_back(std::make_pair(s.id, written));
+      }
+    }
+
+    s.data_offset += length;
+    if(s.data_offset == segment.length())
+    {
+      s.data.pop_front();
+      s.data_offset = 0;
+    }
+    s.is_local_closed = is_last;
+  }
+}
+
+void QttpHttp2Session::read_file(stream& s)
+{
+  if(s.is_file_busy)
+  {
+    return;
+  }
+  s.is_file_busy = true;
+  ++pending_file_ops_;
+
+  uint32_t stream_id = s.id;
+  bool result;
+  if(s.file_fd < 0)
+  {
+    std::string path = s.response->file_path_;
+    result = native::fs::open(*server_->loop_, path, native::fs::read_only, 0, [ = ](native::fs::file_handle fd, native::error e) {
+      --pending_file_ops_;
+      stream& current = streams_[stream_id];
+      current.is_file_busy = false;
+      if(e)
+      {
+        PRINT_STDERR("Unable to open " << path);
+        PRINT_NN_ERROR(e);
+        reset_stream(current, internal_error);
+      }
+      else
+      {
+        current.file_fd = fd;
+      }
+      on_file_done();
+    });
+  }
+  else
+  {
+    // Reads stay one buffer ahead of the windows.
+    size_t length = static_cast<size_t>((std::min)(s.file_remaining, static_cast<uint64_t>(native::buffer_pool::large_size)));
+    result = native::fs::read(*server_->loop_, s.file_fd, length, s.file_offset, [ = ](const std::string& str, native::error e) {
+      --pending_file_ops_;
+      stream& current = streams_[stream_id];
+      current.is_file_busy = false;
+      if(e || str.empty())
+      {
+        reset_stream(current, internal_error);
+      }
+      else if(!current.is_reset)
+      {
+        current.data.push_back(QByteArray(str.data(), static_cast<int>(str.size())));
+        current.file_offset += str.size();
+        current.file_remaining -= (std::min)(static_cast<uint64_t>(str.size()), current.file_remaining);
+      }
+      on_file_done();
+    });
+  }
+
+  if(!result)
+  {
+    --pending_file_ops_;
+    s.is_file_busy = false;
+    reset_stream(s, internal_error);
+  }
+}
+
+void QttpHttp2Session::on_file_done()
+{
+  flush();
+  if(client_->is_closed_)
+  {
+    client_->release();
+    return;
+  }
+  client_->maybe_close();
+}
+
+void QttpHttp2Session::discard(stream& s)
+{
+  if(s.is_dispatched && s.response->is_streaming_)
+  {
+    std::vector<QByteArray> segments;
+    s.stream_backlog += s.response->take_stream(segments);
+  }
+  s.data.clear();
+  s.data_offset = 0;
+  s.file_remaining = 0;
+
+  if(s.stream_backlog > 0)
+  {
+    // Lets a blocked producer go on to its end.
+    size_t backlog = s.stream_backlog;
+    s.stream_backlog = 0;
+    s.response->on_stream_written(backlog);
+  }
+
+  if(s.is_dispatched)
+  {
+    s.response->abort_stream();
+  }
+}
+
+void QttpHttp2Session::purge()
+{
+  for(auto it = streams_.begin(); it != streams_.end(); )
+  {
+    stream& s = it->second;
+    discard(s);
+    if(!s.is_file_busy && (!s.is_dispatched || s.response->is_ready_))
+    {
+      it = finish_stream(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+QttpHttp2Session::stream_iterator QttpHttp2Session::finish_stream(stream_iterator it)
+{
+  stream& s = it->second;
+  if(s.file_fd >= 0)
+  {
+    native::fs::close(*server_->loop_, s.file_fd, [](native::error) {});
+  }
+
+  if(s.is_body_aborted)
+  {
+    // The consumer learns about it on another thread.
+    aborted_.push_back(std::make_pair(s.request, s.response));
+  }
+  else
+  {
+    server_->recycle(s.request);
+    server_->recycle(s.response);
+  }
+  return streams_.erase(it);
+}
+
+QByteArray& QttpHttp2Session::output_buffer()
+{
+  if(!owns_last_output_)
+  {
+    output_.push_back(QByteArray());
+    owns_last_output_ = true;
+  }
+  return output_.back();
+}
+
+void QttpHttp2Session::queue_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const char* payload, size_t length)
+{
+  QByteArray& out = output_buffer();
+  append_frame_header(out, length, type, flags, stream_id);
+  if(length > 0)
+  {
+    out.append(payload, static_cast<int>(length));
+  }
+}
+
+void QttpHttp2Session::queue_settings()
+{
+  const QttpOptions& options = client_->options_;
+
+  QByteArray payload;
+  payload.reserve(18);
+  payload.append(static_cast<char>(0)).append(static_cast<char>(max_concurrent_streams_setting));
+  append_uint32(payload, options.http2_max_concurrent_streams);
+  payload.append(static_cast<char>(0)).append(static_cast<char>(initial_window_size_setting));
+  append_uint32(payload, local_initial_window_);
+  if(options.max_header_size > 0)
+  {
+    payload.append(static_cast<char>(0)).append(static_cast<char>(max_header_list_size_setting));
+    append_uint32(payload, static_cast<uint32_t>(options.max_header_size));
+  }
+  queue_frame(settings_frame, 0, 0, payload.constData(), static_cast<size_t>(payload.length()));
+
+  // The connection window doesn't follow SETTINGS_INITIAL_WINDOW_SIZE.
+  if(local_initial_window_ > default_window)
+  {
+    queue_window_update(0, local_initial_window_ - default_window);
+    recv_window_ += local_initial_window_ - default_window;
+  }
+}
+
+void QttpHttp2Session::queue_headers(stream& s, int status, bool is_end_stream)
+{
+  std::string block;
+  encoder_.begin(block);
+  encoder_.encode_status(block, status);
+
+  QttpResponse* response = s.response;
+  if(status >= 200)
+  {
+    // The lines are encoded already, only the names need to be lower case.
+    std::string name;
+    std::string value;
+    for(auto & h : response->headers_)
+    {
+      const QByteArray& line = h.line;
+      int colon = line.indexOf(':');
+      if(colon <= 0 || line.length() < colon + 4)
+      {
+        continue;
+      }
+
+      name.assign(line.constData(), static_cast<size_t>(colon));
+      for(auto & c : name)
+      {
+        if(c >= 'A' && c <= 'Z')
+        {
+          c += 'a' - 'A';
+        }
+      }
+      if(is_connection_header(name))
+      {
+        continue;
+      }
+
+      value.assign(line.constData() + colon + 2, static_cast<size_t>(line.length() - colon - 4));
+      encoder_.encode(block, name, value, is_indexed_header(name));
+    }
+
+    if(response->content_length_ >= 0 && !response->is_streaming_ && status != 204 && status != 304)
+    {
+      // Counted from what is sent, the length given to write_head() only
+      // covers the first write.
+      uint64_t content_length = s.file_remaining;
+      for(auto & segment : s.data)
+      {
+        content_length += static_cast<uint64_t>(segment.length());
+      }
+
+      char digits[native::text::max_uint_digits];
+      size_t count = native::text::format_uint(content_length, digits);
+      encoder_.encode(block, "content-length", std::string(digits, count), false);
+    }
+  }
+
+  // Blocks larger than a frame continue in CONTINUATION frames.
+  size_t offset = 0;
+  uint8_t type = headers_frame;
+  do
+  {
+    size_t length = (std::min)(block.size() - offset, static_cast<size_t>(peer_max_frame_size_));
+    uint8_t flags = 0;
+    if(offset + length == block.size())
+    {
+      flags |= end_headers_flag;
+    }
+    if(type == headers_frame && is_end_stream)
+    {
+      flags |= end_stream_flag;
+    }
+    queue_frame(type, flags, s.id, block.data() + offset, length);
+    offset += length;
+    type = continuation_frame;
+  }
+  while(offset < block.size());
+}
+
+void QttpHttp2Session::queue_data(uint32_t stream_id, uint8_t flags, const QByteArray& segment, int offset, int length)
+{
+  QByteArray& out = output_buffer();
+  append_frame_header(out, static_cast<size_t>(length), data_frame, flags, stream_id);
+  if(length == 0)
+  {
+    return;
+  }
+
+  if(length <= QttpClientContext::max_copied_bytes)
+  {
+    out.append(segment.constData() + offset, length);
+    return;
+  }
+
+  if(offset == 0 && length == segment.length())
+  {
+    output_.push_back(segment);
+  }
+  else
+  {
+    // A slice of a segment, which has to live as long as the write.
+    output_.push_back(QByteArray::fromRawData(segment.constData() + offset, length));
+    retained_.push_back(segment);
+  }
+  owns_last_output_ = false;
+}
+
+void QttpHttp2Session::queue_window_update(uint32_t stream_id, uint32_t increment)
+{
+  QByteArray& out = output_buffer();
+  append_frame_header(out, 4, window_update_frame, 0, stream_id);
+  append_uint32(out, increment);
+}
+
+void QttpHttp2Session::queue_rst_stream(uint32_t stream_id, uint32_t code)
+{
+  QByteArray& out = output_buffer();
+  append_frame_header(out, 4, rst_stream_frame, 0, stream_id);
+  append_uint32(out, code);
+}
+
+void QttpHttp2Session::queue_goaway(uint32_t code)
+{
+  QByteArray& out = output_buffer();
+  append_frame_header(out, 8, goaway_frame, 0, 0);
+  append_uint32(out, last_stream_id_);
+  append_uint32(out, code);
+}
+
+void QttpHttp2Session::write_output()
+{
+  if(output_.empty())
+  {
+    return;
+  }
+
+  // The buffers are written first, the retained segments only keep what
+  // they refer to alive.
+  auto segments = std::make_shared<std::vector<QByteArray> >();
+  segments->swap(output_);
+  owns_last_output_ = false;
+  size_t count = segments->size();
+  segments->insert(segments->end(), retained_.begin(), retained_.end());
+  retained_.clear();
+
+  auto written = std::make_shared<std::vector<std::pair<uint32_t, size_t> > >();
+  written->swap(stream_written_);
+
+  std::vector<uv_buf_t> bufs;
+  bufs.reserve(count);
+  QttpClientContext::append_buffers(bufs, *segments, 0, count);
+
+  auto status = client_->write_output(bufs, 1, segments, [this, written](bool) {
+    on_output_written(*written);
+  });
+  if(status != QttpClientContext::write_queued)
+  {
+    on_output_written(*written);
+  }
+}
+
+void QttpHttp2Session::on_output_written(const std::vector<std::pair<uint32_t, size_t> >& written)
+{
+  for(auto & w : written)
+  {
+    // Finished streams are gone, their producers are done anyway.
+    auto it = streams_.find(w.first);
+    if(it != streams_.end())
+    {
+      it->second.response->on_stream_written(w.second);
+    }
+  }
+}
@@ -0,0 +1,251 @@
+#ifndef __NATIVE_QTTP_HTTP2_H__
+#define __NATIVE_QTTP_HTTP2_H__
+
+#include <deque>
+#include <map>
+#include "hpack.h"
+#include "qttp.h"
+
+namespace native
+{
+namespace http
+{
+
+/**
+ * The HTTP/2 side of a QttpClientContext (RFC 7540), taking over once the
+ * client sent the connection preface or upgraded with "Upgrade: h2c".
+ *
+ * Every stream is dispatched as a QttpRequest and QttpResponse pair through
+ * the same callback as HTTP/1.x requests.  Responses finish in any order and
+ * are interleaved on the connection as the client's flow control windows
+ * allow, request bodies are granted back as they are buffered.  Priorities
+ * are ignored and nothing is pushed.
+ *
+ * Owned by its context and used on the loop thread only.
+ */
+class QttpHttp2Session
+{
+  public:
+    QttpHttp2Session(QttpClientContext* client);
+    ~QttpHttp2Session();
+
+    static const size_t preface_size = 24;
+
+    /**
+     * Compares the start of a connection with the client preface, returns 1
+     * if it is there, 0 if data is too short to tell and -1 otherwise.
+     */
+    static int match_preface(const char* data, size_t length);
+
+    //! Starts a connection whose client knew it speaks HTTP/2.
+    void start();
+
+    /**
+     * Takes over after the 101 response to an "Upgrade: h2c" request, which
+     * becomes stream 1.  settings is the decoded HTTP2-Settings header.
+     */
+    void upgrade(QttpRequest* request, QttpResponse* response, const QByteArray& settings);
+
+    //! Processes bytes read from the socket, starting with the preface.
+    void receive(const char* data, size_t length);
+
+    //! Writes whatever ready responses and the flow control windows allow.
+    void flush();
+
+    //! Sends GOAWAY, the connection closes once the open streams are answered.
+    void drain();
+
+    //! Tells the body consumer streamed bodies won't be completed.
+    void abort_bodies();
+
+    //! Tells the producers of streamed responses nobody listens anymore.
+    void abort_streams();
+
+    //! No stream is open.
+    bool is_idle() const {
+      return streams_.empty();
+    }
+
+    //! Nothing is left to answer, or the connection failed.
+    bool can_close() const {
+      return is_failed_ || streams_.empty();
+    }
+
+    //! No response is still being produced and no file is being read.
+    bool is_releasable() const;
+
+  private:
+    struct stream
+    {
+      stream() :
+        id(0),
+        request(nullptr),
+        response(nullptr),
+        send_window(0),
+        recv_window(0),
+        recv_unacked(0),
+        data(),
+        data_offset(0),
+        stream_backlog(0),
+        file_fd(-1),
+        file_offset(0),
+        file_remaining(0),
+        is_file_busy(false),
+        is_remote_closed(false),
+        is_dispatched(false),
+        is_head_sent(false),
+        is_body_complete(false),
+        is_local_closed(false),
+        is_reset(false),
+        is_body_aborted(false)
+      {
+      }
+
+      uint32_t id;
+      QttpRequest* request;
+      QttpResponse* response;
+      //! Body bytes the client lets us send.
+      int64_t send_window;
+      //! Body bytes the client may still send.
+      int64_t recv_window;
+      //! Body bytes received since the last WINDOW_UPDATE.
+      uint32_t recv_unacked;
+      //! Body segments waiting for the send windows, shared with the response.
+      std::deque<QByteArray> data;
+      int data_offset;
+      //! Bytes taken from a streaming response that weren't written yet.
+      size_t stream_backlog;
+      native::fs::file_handle file_fd;
+      uint64_t file_offset;
+      uint64_t file_remaining;
+      //! An open or read of the response file is outstanding.
+      bool is_file_busy;
+      //! The client sent END_STREAM, or the stream was reset.
+      bool is_remote_closed;
+      //! Handed to the callback or answered on the loop thread.
+      bool is_dispatched;
+      bool is_head_sent;
+      //! Every body segment of the response is in data, or the file.
+      bool is_body_complete;
+      //! END_STREAM was queued.
+      bool is_local_closed;
+      bool is_reset;
+      //! The body consumer may still hold on to the request.
+      bool is_body_aborted;
+    };
+
+    typedef std::map<uint32_t, stream>::iterator stream_iterator;
+
+    void on_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t length);
+    void on_data(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t length);
+    void on_headers(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t length);
+    void on_continuation(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t length);
+    void on_header_block();
+    void on_rst_stream(uint32_t stream_id, const uint8_t* payload, uint32_t length);
+    void on_settings(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t length);
+    void on_ping(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t length);
+    void on_goaway(uint32_t stream_id, uint32_t length);
+    void on_window_update(uint32_t stream_id, const uint8_t* payload, uint32_t length);
+
+    //! Applies a SETTINGS payload of the client, false once it failed.
+    bool apply_settings(const uint8_t* payload, size_t length);
+
+    stream& open_stream(uint32_t stream_id, QttpRequest* request, QttpResponse* response);
+
+    //! Checks a request with a body before reading it, like HTTP/1.x does.
+    void admit(stream& s);
+    void on_body(stream& s, const uint8_t* data, uint32_t length);
+    void abort_body(stream& s);
+    void dispatch(stream& s);
+
+    //! Answers a request on the loop thread without dispatching it.
+    void reject(stream& s, int status);
+
+    //! Resets a stream with code, it is dropped once its response is ready.
+    void reset_stream(stream& s, uint32_t code);
+
+    //! Connection error, sends GOAWAY and closes after writing it.
+    void fail(uint32_t code);
+
+    //! Grants body bytes back to the client once half a window was used.
+    void consume(stream* s, uint32_t length);
+
+    /**
+     * Queues the headers and as much of the body as the windows allow,
+     * returns true once the stream is done.
+     */
+    bool service(stream& s);
+    void send_data(stream& s);
+    void read_file(stream& s);
+    void on_file_done();
+
+    //! Throws away body data nobody will receive.
+    void discard(stream& s);
+
+    //! Drops finished streams while the connection is closing or failed.
+    void purge();
+    stream_iterator finish_stream(stream_iterator it);
+
+    QByteArray& output_buffer();
+    void queue_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const char* payload, size_t length);
+    void queue_settings();
+    void queue_headers(stream& s, int status, bool is_end_stream);
+    void queue_data(uint32_t stream_id, uint8_t flags, const QByteArray& segment, int offset, int length);
+    void queue_window_update(uint32_t stream_id, uint32_t increment);
+    void queue_rst_stream(uint32_t stream_id, uint32_t code);
+    void queue_goaway(uint32_t code);
+
+    //! Writes the queued frames, with uv_try_write() first.
+    void write_output();
+
+    //! Reports stream bytes that left the process to their responses.
+    void on_output_written(const std::vector<std::pair<uint32_t, size_t> >& written);
+
+  private:
+    QttpClientContext* client_;
+    Qttp* server_;
+    native::http::hpack::decoder decoder_;
+    native::http::hpack::encoder encoder_;
+    std::map<uint32_t, stream> streams_;
+
+    //! Bytes of the preface still to be checked.
+    size_t preface_remaining_;
+    //! A frame received in part.
+    QByteArray input_;
+    //! Header block of a HEADERS frame waiting for its CONTINUATION frames.
+    std::string header_block_;
+    uint32_t header_stream_id_;
+    uint8_t header_flags_;
+    uint32_t last_stream_id_;
+
+    //! Connection level windows, body bytes we may send and may receive.
+    int64_t send_window_;
+    int64_t recv_window_;
+    uint32_t recv_unacked_;
+    //! Window of new streams in both directions.
+    uint32_t peer_initial_window_;
+    uint32_t local_initial_window_;
+    uint32_t peer_max_frame_size_;
+
+    //! Frames for the next write, small ones are appended to the last buffer.
+    std::vector<QByteArray> output_;
+    bool owns_last_output_;
+    //! Segments output_ refers to without owning them.
+    std::vector<QByteArray> retained_;
+    //! Streaming response bytes in output_, reported once written.
+    std::vector<std::pair<uint32_t, size_t> > stream_written_;
+    //! Requests whose streamed body was aborted, recycled with the session.
+    std::vector<std::pair<QttpRequest*, QttpResponse*> > aborted_;
+
+    int pending_file_ops_;
+    bool is_flushing_;
+    bool needs_flush_;
+    //! GOAWAY was sent, new streams are refused.
+    bool is_going_away_;
+    bool is_failed_;
+};
+
+}
+}
+
+#endif // __NATIVE_QTTP_HTTP2_H__
@@ -0,0 +1,418 @@
+#include "qttp_tls.h"
+
+#ifdef SSL_TLS_UV
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+using namespace native;
+using namespace native::http;
+
+namespace
+{
+//! Plaintext read per SSL_read(), the largest a record can carry.
+const int max_plaintext_read = 16 * 1024;
+
+const size_t min_record_size = 512;
+const size_t max_record_size = 16 * 1024;
+
+//! Only shows up in logging builds.
+inline std::string last_error()
+{
+  char message[256];
+  ERR_error_string_n(ERR_get_error(), message, sizeof(message));
+  return message;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+int select_alpn(SSL* ssl, const unsigned char** out, unsigned char* outlen,
+                const unsigned char* in, unsigned int inlen, void* arg)
+{
+  Q_UNUSED(ssl);
+  static const unsigned char protocols[] = "\x02h2\x08http/1.1";
+
+  // Clients speaking HTTP/2 over TLS send the preface right away, which is
+  // picked up like on a cleartext connection.
+  const unsigned char* offered = protocols;
+  unsigned int length = sizeof(protocols) - 1;
+  if(!static_cast<QttpTlsContext*>(arg)->get_options().http2)
+  {
+    offered += 3;
+    length -= 3;
+  }
+
+  unsigned char* selected = nullptr;
+  if(SSL_select_next_proto(&selected, outlen, offered, length, in, inlen) != OPENSSL_NPN_NEGOTIATED)
+  {
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+  *out = selected;
+  return SSL_TLSEXT_ERR_OK;
+}
+#endif
+
+} // End namespace
+
+QttpTlsContext::QttpTlsContext() :
+  ctx_(),
+  is_initialized_(false),
+  options_(),
+  mutex_()
+{
+  memset(&ctx_, 0, sizeof(ctx_));
+}
+
+QttpTlsContext::~QttpTlsContext()
+{
+  // Not evt_ctx_free(), which cleans up OpenSSL for the whole process.
+  if(ctx_.ctx)
+  {
+    SSL_CTX_free(ctx_.ctx);
+    ctx_.ctx = nullptr;
+  }
+}
+
+bool QttpTlsContext::init(const QttpTlsOptions& options)
+{
+  if(ctx_.ctx)
+  {
+    PRINT_STDERR("TLS context was initialized already");
+    return false;
+  }
+
+  if(evt_ctx_init(&ctx_) != 0)
+  {
+    PRINT_STDERR("Unable to create TLS context: " << last_error());
+    return false;
+  }
+
+  options_ = options;
+  options_.record_size = (std::max)(min_record_size, (std::min)(options_.record_size, max_record_size));
+  SSL_CTX* ctx = ctx_.ctx;
+
+  if(SSL_CTX_use_certificate_chain_file(ctx, options_.cert_file.c_str()) != 1 ||
+     SSL_CTX_use_PrivateKey_file(ctx, options_.key_file.c_str(), SSL_FILETYPE_PEM) != 1 ||
+     SSL_CTX_check_private_key(ctx) != 1)
+  {
+    PRINT_STDERR("Unable to load TLS certificate " << options_.cert_file <<
+                 " with key " << options_.key_file << ": " << last_error());
+    return false;
+  }
+  ctx_.cert_set = 1;
+  ctx_.key_set = 1;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+#endif
+#ifdef SSL_OP_NO_RENEGOTIATION
+  // A client could have every connection pay for handshakes over and over.
+  SSL_CTX_set_options(ctx, SSL_OP_NO_RENEGOTIATION);
+#endif
+
+  // Sessions are cached in the context, so clients resume on any loop.
+  static const unsigned char session_id_context[] = "qttp";
+  SSL_CTX_set_session_id_context(ctx, session_id_context, sizeof(session_id_context) - 1);
+  if(options_.session_cache_size > 0)
+  {
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, static_cast<long>(options_.session_cache_size));
+  }
+  else
+  {
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+  }
+  SSL_CTX_set_timeout(ctx, options_.session_timeout_s);
+
+  if(!options_.session_tickets)
+  {
+    SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+  }
+  else if(!options_.ticket_key_file.empty())
+  {
+    std::ifstream in(options_.ticket_key_file.c_str(), std::ios::in | std::ios::binary);
+    std::string keys((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    bool is_loaded = !keys.empty() && SSL_CTX_set_tlsext_ticket_keys(ctx, &keys[0], static_cast<long>(keys.size())) == 1;
+    if(!keys.empty())
+    {
+      OPENSSL_cleanse(&keys[0], keys.size());
+    }
+    if(!is_loaded)
+    {
+      PRINT_STDERR("Unable to load " << SSL_CTX_get_tlsext_ticket_keys(ctx, nullptr, 0) <<
+                   " bytes of ticket keys from " << options_.ticket_key_file);
+      return false;
+    }
+  }
+
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+  SSL_CTX_set_alpn_select_cb(ctx, select_alpn, this);
+#endif
+
+  SSL_CTX_set_max_send_fragment(ctx, static_cast<long>(options_.record_size));
+
+  is_initialized_ = true;
+  return true;
+}
+
+long QttpTlsContext::get_cached_sessions() const
+{
+  return ctx_.ctx ? SSL_CTX_sess_number(ctx_.ctx) : 0;
+}
+
+evt_tls_t* QttpTlsContext::create()
+{
+  if(!is_initialized_)
+  {
+    return nullptr;
+  }
+
+  // evt_tls keeps a list of the sessions of a context.
+  std::lock_guard<std::mutex> lock(mutex_);
+  evt_tls_t* tls = evt_ctx_get_tls(&ctx_);
+  if(tls)
+  {
+    evt_tls_set_role(tls, ENDPT_IS_SERVER);
+  }
+  return tls;
+}
+
+void QttpTlsContext::destroy(evt_tls_t* tls)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  evt_tls_free(tls);
+}
+
+const size_t QttpTlsSession::record_buffer_size;
+
+QttpTlsSession::QttpTlsSession(QttpTlsContext& context, native::buffer_pool& pool) :
+  context_(context),
+  pool_(pool),
+  tls_(context.create()),
+  is_established_(false),
+  is_shut_down_(false)
+{
+}
+
+QttpTlsSession::~QttpTlsSession()
+{
+  if(tls_)
+  {
+    context_.destroy(tls_);
+    tls_ = nullptr;
+  }
+}
+
+bool QttpTlsSession::receive(const char* data, size_t length, QByteArray& plaintext, std::vector<uv_buf_t>& records)
+{
+  while(length > 0)
+  {
+    // The BIO pair only holds about a record, OpenSSL empties it in between.
+    int written = BIO_write(tls_->app_bio, data, static_cast<int>((std::min)(length, static_cast<size_t>(INT_MAX))));
+    if(written <= 0)
+    {
+      return false;
+    }
+    data += written;
+    length -= static_cast<size_t>(written);
+
+    bool result = process(plaintext, records);
+    take_records(records);
+    if(!result)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool QttpTlsSession::process(QByteArray& plaintext, std::vector<uv_buf_t>& records)
+{
+  SSL* ssl = tls_->ssl;
+
+  while(!is_established_)
+  {
+    ERR_clear_error();
+    int result = SSL_do_handshake(ssl);
+    if(result == 1)
+    {
+      is_established_ = true;
+      break;
+    }
+
+    int error = SSL_get_error(ssl, result);
+    if(error == SSL_ERROR_WANT_WRITE && BIO_ctrl_pending(tls_->app_bio) > 0)
+    {
+      // A long certificate chain fills the BIO pair.
+      take_records(records);
+      continue;
+    }
+    if(error != SSL_ERROR_WANT_READ)
+    {
+      PRINT_DBG("TLS handshake failed: " << last_error());
+      return false;
+    }
+    return true;
+  }
+
+  while(true)
+  {
+    int size = plaintext.size();
+    plaintext.resize(size + max_plaintext_read);
+    ERR_clear_error();
+    int read = SSL_read(ssl, plaintext.data() + size, max_plaintext_read);
+    plaintext.resize(size + (std::max)(read, 0));
+    if(read > 0)
+    {
+      continue;
+    }
+
+    int error = SSL_get_error(ssl, read);
+    if(error == SSL_ERROR_WANT_WRITE && BIO_ctrl_pending(tls_->app_bio) > 0)
+    {
+      take_records(records);
+      continue;
+    }
+    // SSL_ERROR_ZERO_RETURN is close_notify.
+    return error == SSL_ERROR_WANT_READ;
+  }
+}
+
+bool QttpTlsSession::encrypt(const uv_buf_t* bufs, unsigned int nbufs, std::vector<uv_buf_t>& records)
+{
+  if(!is_established_ || is_shut_down_)
+  {
+    return false;
+  }
+
+  const size_t record_size = context_.options_.record_size;
+  char* stage = nullptr;
+  size_t stage_capacity = 0;
+  size_t staged = 0;
+  bool result = true;
+
+  for(unsigned int i = 0; i < nbufs && result; ++i)
+  {
+    const char* data = bufs[i].base;
+    size_t length = bufs[i].len;
+
+    while(length > 0 && result)
+    {
+      if(staged == 0 && length >= record_size)
+      {
+        // Whole records are encrypted right out of the caller's buffer.
+        size_t whole = length - length % record_size;
+        result = write_plaintext(data, whole, records);
+        data += whole;
+        length -= whole;
+        continue;
+      }
+
+      if(!stage)
+      {
+        stage = pool_.acquire(record_size, stage_capacity);
+      }
+      size_t count = (std::min)(length, record_size - staged);
+      memcpy(stage + staged, data, count);
+      staged += count;
+      data += count;
+      length -= count;
+
+      if(staged == record_size)
+      {
+        result = write_plaintext(stage, staged, records);
+        staged = 0;
+      }
+    }
+  }
+
+  if(result && staged > 0)
+  {
+    result = write_plaintext(stage, staged, records);
+  }
+  pool_.release(stage, stage_capacity);
+  return result;
+}
+
+bool QttpTlsSession::write_plaintext(const char* data, size_t length, std::vector<uv_buf_t>& records)
+{
+  SSL* ssl = tls_->ssl;
+
+  while(length > 0)
+  {
+    ERR_clear_error();
+    int written = SSL_write(ssl, data, static_cast<int>((std::min)(length, static_cast<size_t>(INT_MAX))));
+    if(written > 0)
+    {
+      data += written;
+      length -= static_cast<size_t>(written);
+      take_records(records);
+      continue;
+    }
+
+    int error = SSL_get_error(ssl, written);
+    if(error == SSL_ERROR_WANT_WRITE && BIO_ctrl_pending(tls_->app_bio) > 0)
+    {
+      take_records(records);
+      continue;
+    }
+    PRINT_DBG("TLS write failed: " << last_error());
+    return false;
+  }
+  return true;
+}
+
+void QttpTlsSession::shutdown(std::vector<uv_buf_t>& records)
+{
+  if(!is_established_ || is_shut_down_)
+  {
+    return;
+  }
+  is_shut_down_ = true;
+
+  ERR_clear_error();
+  SSL_shutdown(tls_->ssl);
+  take_records(records);
+}
+
+void QttpTlsSession::take_records(std::vector<uv_buf_t>& records)
+{
+  size_t pending;
+  while((pending = BIO_ctrl_pending(tls_->app_bio)) > 0)
+  {
+    // Records are packed back to back, a buffer is only started once the
+    // last one is full.
+    if(records.empty() || records.back().len == record_buffer_size)
+    {
+      size_t capacity = 0;
+      char* buf = pool_.acquire(record_buffer_size, capacity);
+      records.push_back(uv_buf_init(buf, 0));
+    }
+
+    uv_buf_t& record = records.back();
+    size_t room = record_buffer_size - record.len;
+    int read = BIO_read(tls_->app_bio, record.base + record.len, static_cast<int>((std::min)(pending, room)));
+    if(read <= 0)
+    {
+      break;
+    }
+    record.len += read;
+  }
+}
+
+void QttpTlsSession::release(native::buffer_pool& pool, const std::vector<uv_buf_t>& records)
+{
+  for(auto & record : records)
+  {
+    pool.release(record.base, record_buffer_size);
+  }
+}
+
+bool QttpTlsSession::is_resumed() const
+{
+  return tls_ && SSL_session_reused(tls_->ssl) == 1;
+}
+
+#endif // SSL_TLS_UV
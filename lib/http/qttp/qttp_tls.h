@@ -0,0 +1,171 @@
+#ifndef __NATIVE_QTTP_TLS_H__
+#define __NATIVE_QTTP_TLS_H__
+
+#ifdef SSL_TLS_UV
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <QByteArray>
+#include <evt_tls.h>
+#include "buffer_pool.h"
+
+namespace native
+{
+namespace http
+{
+
+struct NNATIVE_DLLEXPORT QttpTlsOptions
+{
+  QttpTlsOptions() :
+    cert_file(),
+    key_file(),
+    session_cache_size(20480),
+    session_timeout_s(300),
+    session_tickets(true),
+    ticket_key_file(),
+    record_size(16384),
+    http2(false)
+  {
+  }
+
+  //! PEM certificate followed by its chain, if any.
+  std::string cert_file;
+  std::string key_file;
+
+  //! Sessions kept for resumption by session id, 0 turns the cache off.
+  size_t session_cache_size;
+
+  //! How long a session or ticket can be resumed.
+  long session_timeout_s;
+
+  //! Lets clients resume with a ticket (RFC 5077) instead of a session id.
+  bool session_tickets;
+
+  /**
+   * File holding the keys tickets are encrypted with, so every process behind
+   * a load balancer resumes the tickets of the others.  Random keys of this process are used
+   * if empty.  80 bytes with OpenSSL 1.1 and later, 48 bytes before.
+   */
+  std::string ticket_key_file;
+
+  /**
+   * Plaintext bytes per record, between 512 and 16384.  Small records let
+   * the client start parsing sooner, large ones cost less per byte.
+   */
+  size_t record_size;
+
+  //! Offers "h2" through ALPN besides "http/1.1", along with
+  //! QttpOptions::http2.
+  bool http2;
+};
+
+/**
+ * The certificate, session cache and ticket keys shared by every loop
+ * terminating TLS, see Qttp::set_tls_context().  The OpenSSL context itself
+ * is safe from any thread, sessions are created and freed under a lock.
+ */
+class NNATIVE_DLLEXPORT QttpTlsContext
+{
+  friend class QttpTlsSession;
+
+  public:
+    QttpTlsContext();
+    ~QttpTlsContext();
+
+    //! Loads the certificate and key, false after logging why not.
+    bool init(const QttpTlsOptions& options);
+
+    const QttpTlsOptions& get_options() const {
+      return options_;
+    }
+
+    //! Sessions resumable by id that are cached right now.
+    long get_cached_sessions() const;
+
+  private:
+    QttpTlsContext(const QttpTlsContext&);
+    void operator =(const QttpTlsContext&);
+
+    evt_tls_t* create();
+    void destroy(evt_tls_t* tls);
+
+  private:
+    evt_ctx_t ctx_;
+    bool is_initialized_;
+    QttpTlsOptions options_;
+    std::mutex mutex_;
+};
+
+/**
+ * The server side of a TLS connection, fed with what was read from the
+ * socket and handing back the records to write to it.  Records are packed
+ * into buffers taken from the pool of the loop, so encrypting a response
+ * allocates nothing once the pool is warm.  Loop thread only.
+ */
+class NNATIVE_DLLEXPORT QttpTlsSession
+{
+  public:
+    //! Every record buffer is of this size.
+    static const size_t record_buffer_size = native::buffer_pool::medium_size;
+
+    QttpTlsSession(QttpTlsContext& context, native::buffer_pool& pool);
+    ~QttpTlsSession();
+
+    //! False if OpenSSL couldn't set up the session.
+    bool is_valid() const {
+      return tls_ != nullptr;
+    }
+
+    /**
+     * Takes bytes read from the socket, decrypted ones are appended to
+     * plaintext and the handshake records to answer with to records.
+     * Returns false on a failure or once the client sent close_notify,
+     * whatever was decrypted before is still appended.
+     */
+    bool receive(const char* data, size_t length, QByteArray& plaintext, std::vector<uv_buf_t>& records);
+
+    /**
+     * Appends the records carrying bufs, small buffers are put together into
+     * records of QttpTlsOptions::record_size.  False on a failure.
+     */
+    bool encrypt(const uv_buf_t* bufs, unsigned int nbufs, std::vector<uv_buf_t>& records);
+
+    //! Appends close_notify, nothing can be encrypted afterwards.
+    void shutdown(std::vector<uv_buf_t>& records);
+
+    //! Hands the buffers of records back to pool once they are written.
+    static void release(native::buffer_pool& pool, const std::vector<uv_buf_t>& records);
+
+    bool is_established() const {
+      return is_established_;
+    }
+
+    //! The handshake resumed a session instead of negotiating a new one.
+    bool is_resumed() const;
+
+  private:
+    QttpTlsSession(const QttpTlsSession&);
+    void operator =(const QttpTlsSession&);
+
+    //! Completes the handshake and decrypts the records the BIO pair holds.
+    bool process(QByteArray& plaintext, std::vector<uv_buf_t>& records);
+    bool write_plaintext(const char* data, size_t length, std::vector<uv_buf_t>& records);
+
+    //! Moves what OpenSSL wrote to the BIO pair into record buffers.
+    void take_records(std::vector<uv_buf_t>& records);
+
+  private:
+    QttpTlsContext& context_;
+    native::buffer_pool& pool_;
+    evt_tls_t* tls_;
+    bool is_established_;
+    bool is_shut_down_;
+};
+
+}
+}
+
+#endif // SSL_TLS_UV
+
+#endif // __NATIVE_QTTP_TLS_H__
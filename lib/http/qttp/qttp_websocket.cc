@@ -0,0 +1,762 @@
+#include "qttp_websocket.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define QTTP_WEBSOCKET_SSE2
+#endif
+
+using namespace native;
+using namespace native::http;
+
+namespace
+{
+enum opcode
+{
+  continuation_opcode = 0x0,
+  text_opcode = 0x1,
+  binary_opcode = 0x2,
+  close_opcode = 0x8,
+  ping_opcode = 0x9,
+  pong_opcode = 0xa
+};
+
+enum close_code
+{
+  normal_closure = 1000,
+  going_away = 1001,
+  protocol_error = 1002,
+  no_status_received = 1005,
+  abnormal_closure = 1006,
+  invalid_payload = 1007,
+  message_too_big = 1009
+};
+
+const uint8_t fin_bit = 0x80;
+const uint8_t rsv_bits = 0x70;
+const uint8_t mask_bit = 0x80;
+const uint64_t max_control_payload = 125;
+
+//! Length of a client frame header, given its second byte.
+size_t header_size(uint8_t second)
+{
+  size_t size = 2;
+  uint8_t length = second & 0x7f;
+  if(length == 126)
+  {
+    size += 2;
+  }
+  else if(length == 127)
+  {
+    size += 8;
+  }
+  if(second & mask_bit)
+  {
+    size += 4;
+  }
+  return size;
+}
+
+void append_frame_header(QByteArray& out, uint8_t opcode, uint64_t length)
+{
+  char header[10];
+  int size = 2;
+  header[0] = static_cast<char>(fin_bit | opcode);
+  if(length < 126)
+  {
+    header[1] = static_cast<char>(length);
+  }
+  else if(length <= 0xffff)
+  {
+    header[1] = 126;
+    header[2] = static_cast<char>(length >> 8);
+    header[3] = static_cast<char>(length);
+    size = 4;
+  }
+  else
+  {
+    header[1] = 127;
+    for(int i = 0; i < 8; ++i)
+    {
+      header[2 + i] = static_cast<char>(length >> (56 - 8 * i));
+    }
+    size = 10;
+  }
+  out.append(header, size);
+}
+
+QByteArray close_payload(uint16_t code, const QByteArray& reason)
+{
+  QByteArray payload;
+  payload.reserve(2 + (std::min)(reason.size(), 123));
+  payload.append(static_cast<char>(code >> 8));
+  payload.append(static_cast<char>(code));
+  payload.append(reason.constData(), (std::min)(reason.size(), 123));
+  return payload;
+}
+
+//! Codes a client may send, RFC 6455 7.4.
+bool is_valid_close_code(uint16_t code)
+{
+  if(code >= 3000 && code <= 4999)
+  {
+    return true;
+  }
+  return code >= 1000 && code <= 1011 && code != 1004 && code != no_status_received && code != abnormal_closure;
+}
+
+/**
+ * XORs length bytes at src with the key into dst, which may be src.  offset
+ * is the position of src within the payload and decides where in the key it
+ * starts.  16 bytes at a time with SSE2, a word at a time otherwise.
+ */
+void unmask(char* dst, const char* src, size_t length, const uint8_t* key, uint64_t offset)
+{
+  uint8_t rotated[8];
+  for(int i = 0; i < 8; ++i)
+  {
+    rotated[i] = key[(offset + i) & 3];
+  }
+
+  size_t i = 0;
+#ifdef QTTP_WEBSOCKET_SSE2
+  if(length >= 16)
+  {
+    int key32;
+    memcpy(&key32, rotated, 4);
+    const __m128i mask = _mm_set1_epi32(key32);
+    for(; i + 16 <= length; i += 16)
+    {
+      __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(block, mask));
+    }
+  }
+#endif
+
+  uint64_t key64;
+  memcpy(&key64, rotated, 8);
+  for(; i + 8 <= length; i += 8)
+  {
+    uint64_t word;
+    memcpy(&word, src + i, 8);
+    word ^= key64;
+    memcpy(dst + i, &word, 8);
+  }
+
+  // i is a multiple of 8 here, the key lines up again.
+  for(; i < length; ++i)
+  {
+    dst[i] = static_cast<char>(src[i] ^ rotated[i & 3]);
+  }
+}
+
+//! Rejects overlong forms, surrogates and code points past U+10FFFF.
+bool is_valid_utf8(const char* data, size_t length)
+{
+  const uint8_t* pos = reinterpret_cast<const uint8_t*>(data);
+  const uint8_t* end = pos + length;
+  while(pos < end)
+  {
+    // Mostly ASCII, skipped a word at a time.
+    if(end - pos >= 8)
+    {
+      uint64_t word;
+      memcpy(&word, pos, 8);
+      if((word & 0x8080808080808080ULL) == 0)
+      {
+        pos += 8;
+        continue;
+      }
+    }
+
+    uint8_t c = *pos;
+    if(c < 0x80)
+    {
+      ++pos;
+      continue;
+    }
+
+    size_t count;
+    uint32_t code_point;
+    uint32_t min;
+    if((c & 0xe0) == 0xc0)
+    {
+      count = 1;
+      code_point = c & 0x1f;
+      min = 0x80;
+    }
+    else if((c & 0xf0) == 0xe0)
+    {
+      count = 2;
+      code_point = c & 0x0f;
+      min = 0x800;
+    }
+    else if((c & 0xf8) == 0xf0)
+    {
+      count = 3;
+      code_point = c & 0x07;
+      min = 0x10000;
+    }
+    else
+    {
+      return false;
+    }
+
+    if(static_cast<size_t>(end - pos) <= count)
+    {
+      return false;
+    }
+    for(size_t i = 1; i <= count; ++i)
+    {
+      if((pos[i] & 0xc0) != 0x80)
+      {
+        return false;
+      }
+      code_point = (code_point << 6) | (pos[i] & 0x3f);
+    }
+    if(code_point < min || code_point > 0x10ffff || (code_point >= 0xd800 && code_point <= 0xdfff))
+    {
+      return false;
+    }
+    pos += count + 1;
+  }
+  return true;
+}
+}
+
+QttpWebSocket::QttpWebSocket(QttpClientContext* client, QttpRequest* request, QttpResponse* response) :
+  client_(client),
+  server_(client->server_),
+  request_(request),
+  response_(response),
+  header_(),
+  header_length_(0),
+  is_in_frame_(false),
+  opcode_(0),
+  is_final_(false),
+  key_(),
+  payload_length_(0),
+  payload_read_(0),
+  message_opcode_(0),
+  message_(),
+  control_(),
+  mutex_(),
+  queue_(),
+  owns_last_queued_(false),
+  queued_message_bytes_(0),
+  backlog_(0),
+  drain_callback_(),
+  is_blocked_(false),
+  is_notified_(false),
+  is_closed_(false),
+  is_close_sent_(false),
+  is_close_received_(false),
+  output_(),
+  output_message_bytes_(0),
+  is_flushing_(false),
+  needs_flush_(false),
+  is_failed_(false),
+  close_code_(abnormal_closure)
+{
+  control_.reserve(static_cast<int>(max_control_payload));
+}
+
+QttpWebSocket::~QttpWebSocket()
+{
+}
+
+bool QttpWebSocket::send_text(const QByteArray& utf8)
+{
+  return queue_frame(text_opcode, utf8, true);
+}
+
+bool QttpWebSocket::send_binary(const QByteArray& data)
+{
+  return queue_frame(binary_opcode, data, true);
+}
+
+bool QttpWebSocket::ping(const QByteArray& payload)
+{
+  if(static_cast<uint64_t>(payload.size()) > max_control_payload)
+  {
+    return false;
+  }
+  return queue_frame(ping_opcode, payload, false);
+}
+
+bool QttpWebSocket::close(uint16_t code, const QByteArray& reason)
+{
+  return queue_frame(close_opcode, close_payload(code, reason), false);
+}
+
+bool QttpWebSocket::is_open() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return !is_closed_ && !is_close_sent_ && !is_close_received_;
+}
+
+size_t QttpWebSocket::get_backlog() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return backlog_;
+}
+
+void QttpWebSocket::set_drain_callback(std::function<void()> callback)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  drain_callback_ = callback;
+}
+
+void QttpWebSocket::start(const QByteArray& accept)
+{
+  static const char head[] = "HTTP/1.1 101 Switching Protocols\r\n"
+                             "Upgrade: websocket\r\n"
+                             "Connection: Upgrade\r\n"
+                             "Sec-WebSocket-Accept: ";
+
+  // Written by execute() once the request was parsed, before any frame.
+  QByteArray response;
+  response.reserve(static_cast<int>(sizeof(head)) + accept.size() + 4);
+  response.append(head, static_cast<int>(sizeof(head) - 1));
+  response.append(accept);
+  response.append("\r\n\r\n", 4);
+  output_.push_back(response);
+
+  deliver(opened, QByteArray());
+}
+
+void QttpWebSocket::receive(const char* data, size_t length)
+{
+  // Payloads are unmasked straight from the read buffer into the message,
+  // only a frame header that is cut off is copied aside.
+  const char* pos = data;
+  const char* end = data + length;
+  while(pos < end && !is_failed_ && !is_close_received_)
+  {
+    if(!is_in_frame_)
+    {
+      size_t size = (header_length_ < 2) ? 2 : header_size(header_[1]);
+      size_t count = (std::min)(size - header_length_, static_cast<size_t>(end - pos));
+      memcpy(header_ + header_length_, pos, count);
+      header_length_ += count;
+      pos += count;
+      if(header_length_ < 2 || header_length_ < header_size(header_[1]))
+      {
+        continue;
+      }
+
+      header_length_ = 0;
+      if(!on_frame_header())
+      {
+        break;
+      }
+      is_in_frame_ = true;
+      if(payload_length_ > 0)
+      {
+        continue;
+      }
+    }
+    else
+    {
+      size_t count = static_cast<size_t>((std::min)(static_cast<uint64_t>(end - pos), payload_length_ - payload_read_));
+      QByteArray& target = (opcode_ >= close_opcode) ? control_ : message_;
+      int offset = target.size();
+      target.resize(offset + static_cast<int>(count));
+      unmask(target.data() + offset, pos, count, key_, payload_read_);
+      payload_read_ += count;
+      pos += count;
+      if(payload_read_ < payload_length_)
+      {
+        continue;
+      }
+    }
+
+    is_in_frame_ = false;
+    on_frame_complete();
+
+    if(client_->is_paused_ && pos < end && !is_failed_ && !is_close_received_)
+    {
+      // The consumer fell behind, the rest waits for QttpClientContext::resume().
+      client_->pending_.append(pos, static_cast<int>(end - pos));
+      return;
+    }
+  }
+}
+
+bool QttpWebSocket::on_frame_header()
+{
+  const uint8_t first = header_[0];
+  const uint8_t second = header_[1];
+
+  // No extension defines the reserved bits, and clients have to mask.
+  if((first & rsv_bits) != 0 || (second & mask_bit) == 0)
+  {
+    fail(protocol_error);
+    return false;
+  }
+
+  opcode_ = first & 0x0f;
+  is_final_ = (first & fin_bit) != 0;
+
+  uint64_t length = second & 0x7f;
+  size_t key_offset = 2;
+  if(length == 126)
+  {
+    length = (static_cast<uint64_t>(header_[2]) << 8) | header_[3];
+    key_offset = 4;
+  }
+  else if(length == 127)
+  {
+    length = 0;
+    for(int i = 2; i < 10; ++i)
+    {
+      length = (length << 8) | header_[i];
+    }
+    key_offset = 10;
+    if(length >> 63)
+    {
+      fail(protocol_error);
+      return false;
+    }
+  }
+  memcpy(key_, header_ + key_offset, 4);
+  payload_length_ = length;
+  payload_read_ = 0;
+
+  if(opcode_ >= close_opcode)
+  {
+    // Control frames may come in between the fragments of a message.
+    if(opcode_ > pong_opcode || !is_final_ || length > max_control_payload)
+    {
+      fail(protocol_error);
+      return false;
+    }
+    control_.resize(0);
+    return true;
+  }
+
+  if(opcode_ == continuation_opcode)
+  {
+    if(message_opcode_ == 0)
+    {
+      fail(protocol_error);
+      return false;
+    }
+  }
+  else if(opcode_ == text_opcode || opcode_ == binary_opcode)
+  {
+    if(message_opcode_ != 0)
+    {
+      fail(protocol_error);
+      return false;
+    }
+    message_opcode_ = opcode_;
+  }
+  else
+  {
+    fail(protocol_error);
+    return false;
+  }
+
+  uint64_t max_size = client_->options_.websocket_max_message_size;
+  uint64_t message_size = static_cast<uint64_t>(message_.size()) + length;
+  if((max_size > 0 && message_size > max_size) || message_size > static_cast<uint64_t>(INT_MAX))
+  {
+    fail(message_too_big);
+    return false;
+  }
+
+  if(opcode_ != continuation_opcode)
+  {
+    // Later fragments grow it geometrically.
+    message_.reserve(static_cast<int>((std::min)(length, QttpClientContext::max_body_reserve)));
+  }
+  return true;
+}
+
+void QttpWebSocket::on_frame_complete()
+{
+  if(opcode_ >= close_opcode)
+  {
+    on_control_frame();
+  }
+  else if(is_final_)
+  {
+    on_message_complete();
+  }
+}
+
+void QttpWebSocket::on_control_frame()
+{
+  if(opcode_ == ping_opcode)
+  {
+    // A copy, control_ is reused for the next control frame.
+    queue_frame(pong_opcode, QByteArray(control_.constData(), control_.size()), false);
+    return;
+  }
+
+  if(opcode_ != close_opcode)
+  {
+    return;
+  }
+
+  uint16_t code = no_status_received;
+  if(control_.size() == 1)
+  {
+    fail(protocol_error);
+    return;
+  }
+  if(control_.size() >= 2)
+  {
+    code = static_cast<uint16_t>((static_cast<uint8_t>(control_[0]) << 8) | static_cast<uint8_t>(control_[1]));
+    if(!is_valid_close_code(code))
+    {
+      fail(protocol_error);
+      return;
+    }
+    if(!is_valid_utf8(control_.constData() + 2, static_cast<size_t>(control_.size() - 2)))
+    {
+      fail(invalid_payload);
+      return;
+    }
+  }
+
+  // Answered with the same code unless we started closing, the connection
+  // closes once the answer is out.
+  close_code_ = code;
+  is_close_received_ = true;
+  queue_frame(close_opcode, (code == no_status_received) ? QByteArray() : close_payload(code, QByteArray()), false);
+
+  client_->is_closing_ = true;
+  client_->socket_->read_stop();
+  client_->pending_.clear();
+}
+
+void QttpWebSocket::on_message_complete()
+{
+  QByteArray message;
+  message.swap(message_);
+  bool is_text = (message_opcode_ == text_opcode);
+  message_opcode_ = 0;
+
+  if(is_text && !is_valid_utf8(message.constData(), static_cast<size_t>(message.size())))
+  {
+    fail(invalid_payload);
+    return;
+  }
+
+  ++server_->stats_.websocket_messages;
+  deliver(is_text ? text_message : binary_message, message);
+
+  // Same as for streamed request bodies, reading stops until the consumer
+  // caught up.
+  if(client_->body_backlog_ > client_->options_.body_stream_high_watermark)
+  {
+    client_->is_body_blocked_ = true;
+    client_->pause();
+  }
+}
+
+void QttpWebSocket::fail(uint16_t code)
+{
+  PRINT_DBG("Closing WebSocket with " << code);
+  is_failed_ = true;
+  queue_frame(close_opcode, close_payload(code, QByteArray()), false);
+
+  client_->is_closing_ = true;
+  client_->socket_->read_stop();
+  client_->pending_.clear();
+}
+
+void QttpWebSocket::deliver(event e, const QByteArray& message)
+{
+  // Every event keeps the context alive until it is consumed, like a chunk
+  // of a streamed body.
+  client_->body_backlog_ += static_cast<size_t>(message.size());
+  ++client_->pending_notifies_;
+  server_->websocket_callback_(*request_, *response_, client_->websocket_, e, message);
+}
+
+void QttpWebSocket::drain()
+{
+  close(going_away);
+}
+
+bool QttpWebSocket::can_close() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return queue_.empty() && output_.empty();
+}
+
+void QttpWebSocket::on_close()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_closed_ = true;
+  }
+  deliver(closed, QByteArray());
+}
+
+void QttpWebSocket::detach(QttpRequest*& request, QttpResponse*& response)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_closed_ = true;
+    queue_.clear();
+  }
+  request = request_;
+  response = response_;
+  request_ = nullptr;
+  response_ = nullptr;
+}
+
+bool QttpWebSocket::queue_frame(uint8_t opcode, const QByteArray& payload, bool is_message)
+{
+  bool is_writable;
+  bool needs_notify;
+  bool is_loop_thread;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(is_closed_ || is_close_sent_)
+    {
+      return false;
+    }
+    if(opcode == close_opcode)
+    {
+      is_close_sent_ = true;
+    }
+
+    append_frame(opcode, payload);
+    if(is_message)
+    {
+      queued_message_bytes_ += static_cast<size_t>(payload.size());
+      backlog_ += static_cast<size_t>(payload.size());
+      if(backlog_ > client_->options_.response_stream_high_watermark)
+      {
+        is_blocked_ = true;
+      }
+    }
+    is_writable = !is_message || !is_blocked_;
+
+    // One notification covers whatever is queued until the loop takes it.
+    needs_notify = !is_notified_;
+    is_notified_ = true;
+    is_loop_thread = (std::this_thread::get_id() == server_->loop_thread_);
+    if(needs_notify && !is_loop_thread)
+    {
+      // Counted while the context can't be closed under us.
+      ++client_->pending_notifies_;
+    }
+  }
+
+  if(needs_notify)
+  {
+    if(!is_loop_thread)
+    {
+      server_->notify(client_);
+    }
+    else if(!client_->is_parsing_)
+    {
+      // While parsing, execute() flushes once the whole buffer is consumed.
+      client_->flush();
+    }
+  }
+  return is_writable;
+}
+
+void QttpWebSocket::append_frame(uint8_t opcode, const QByteArray& payload)
+{
+  if(!owns_last_queued_ || queue_.empty())
+  {
+    queue_.push_back(QByteArray());
+    owns_last_queued_ = true;
+  }
+
+  QByteArray& out = queue_.back();
+  append_frame_header(out, opcode, static_cast<uint64_t>(payload.size()));
+  if(payload.size() <= QttpClientContext::max_copied_bytes)
+  {
+    out.append(payload.constData(), payload.size());
+    return;
+  }
+
+  // Shared with the sender, which may broadcast it to other connections.
+  queue_.push_back(payload);
+  owns_last_queued_ = false;
+}
+
+void QttpWebSocket::flush()
+{
+  // Drain callbacks run from in here may queue more messages.
+  if(is_flushing_)
+  {
+    needs_flush_ = true;
+    return;
+  }
+  is_flushing_ = true;
+
+  do
+  {
+    needs_flush_ = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      is_notified_ = false;
+      output_.insert(output_.end(), queue_.begin(), queue_.end());
+      queue_.clear();
+      owns_last_queued_ = false;
+      output_message_bytes_ += queued_message_bytes_;
+      queued_message_bytes_ = 0;
+    }
+    write_output();
+  }
+  while(needs_flush_);
+
+  is_flushing_ = false;
+}
+
+void QttpWebSocket::write_output()
+{
+  if(output_.empty())
+  {
+    return;
+  }
+
+  auto segments = std::make_shared<std::vector<QByteArray> >();
+  segments->swap(output_);
+  size_t message_bytes = output_message_bytes_;
+  output_message_bytes_ = 0;
+
+  std::vector<uv_buf_t> bufs;
+  bufs.reserve(segments->size());
+  QttpClientContext::append_buffers(bufs, *segments, 0, segments->size());
+
+  auto status = client_->write_output(bufs, 1, segments, [this, message_bytes](bool) {
+    on_output_written(message_bytes);
+  });
+  if(status != QttpClientContext::write_queued)
+  {
+    on_output_written(message_bytes);
+  }
+}
+
+void QttpWebSocket::on_output_written(size_t message_bytes)
+{
+  std::function<void()> callback;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    backlog_ -= (std::min)(message_bytes, backlog_);
+    if(is_blocked_ && backlog_ <= client_->options_.response_stream_low_watermark)
+    {
+      is_blocked_ = false;
+      callback = drain_callback_;
+    }
+  }
+
+  if(callback)
+  {
+    callback();
+  }
+}
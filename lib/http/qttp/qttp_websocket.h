@@ -0,0 +1,184 @@
+#ifndef __NATIVE_QTTP_WEBSOCKET_H__
+#define __NATIVE_QTTP_WEBSOCKET_H__
+
+#include "qttp.h"
+
+namespace native
+{
+namespace http
+{
+
+/**
+ * A connection upgraded with "Upgrade: websocket" (RFC 6455), taking over
+ * from the HTTP/1.1 parser once the handshake request was accepted by the
+ * filter given to Qttp::set_websocket().
+ *
+ * Frames are parsed right out of the read buffer, the payload is unmasked
+ * while it is copied into the message handed to the callback, which is the
+ * only copy made.  Fragmented messages are put together before they are
+ * delivered, pings are answered on the loop thread.  No extensions or
+ * subprotocols are negotiated.
+ *
+ * Shared by its context and whoever holds on to it, sending is safe from any
+ * thread and fails once the connection is closed.
+ */
+class NNATIVE_DLLEXPORT QttpWebSocket
+{
+  friend class QttpClientContext;
+
+  public:
+    enum event
+    {
+      //! The 101 response is on its way, message is empty.
+      opened,
+      text_message,
+      binary_message,
+      //! The connection closed, message is empty and no more events follow.
+      closed
+    };
+
+    QttpWebSocket(QttpClientContext* client, QttpRequest* request, QttpResponse* response);
+    ~QttpWebSocket();
+
+    /**
+     * Queues a message for the loop thread, the payload is shared rather
+     * than copied.  Returns false once the connection is closing or more
+     * than QttpOptions::response_stream_high_watermark bytes are waiting,
+     * the message is queued anyway in the latter case.
+     */
+    bool send_text(const QByteArray& utf8);
+    bool send_binary(const QByteArray& data);
+
+    //! payload is at most 125 bytes.
+    bool ping(const QByteArray& payload = QByteArray());
+
+    /**
+     * Starts the closing handshake, the connection closes once the client
+     * answered or after QttpOptions::keep_alive_timeout_ms.
+     */
+    bool close(uint16_t code = 1000, const QByteArray& reason = QByteArray());
+
+    //! Neither side started closing.
+    bool is_open() const;
+
+    //! Message bytes queued or still being written.
+    size_t get_backlog() const;
+
+    /**
+     * Called on the loop thread once a backlog that passed the high watermark
+     * is down to QttpOptions::response_stream_low_watermark.
+     */
+    void set_drain_callback(std::function<void()> callback);
+
+    /**
+     * Status code of the close frame received, 1005 if it had none and 1006
+     * if the connection closed without one.
+     */
+    uint16_t get_close_code() const {
+      return close_code_;
+    }
+
+  private:
+    //! Queues the 101 response and delivers the opened event.
+    void start(const QByteArray& accept);
+
+    //! Processes bytes read from the socket.
+    void receive(const char* data, size_t length);
+
+    //! Writes whatever was queued, from the loop thread.
+    void flush();
+
+    //! Closes with 1001 as the server shuts down.
+    void drain();
+
+    //! The closing handshake was started by either side.
+    bool is_closing() const {
+      return is_close_sent_ || is_close_received_;
+    }
+
+    //! Nothing queued is left to write.
+    bool can_close() const;
+
+    //! The context closed, delivers the closed event and refuses sends.
+    void on_close();
+
+    //! Hands the request and response back for recycling.
+    void detach(QttpRequest*& request, QttpResponse*& response);
+
+    //! Checks a frame header once it is complete, false on a protocol error.
+    bool on_frame_header();
+    void on_frame_complete();
+    void on_control_frame();
+    void on_message_complete();
+
+    //! Protocol error, closes with code without reading any further.
+    void fail(uint16_t code);
+
+    void deliver(event e, const QByteArray& message);
+
+    /**
+     * Queues a frame from any thread and gets the loop thread to write it,
+     * false once the connection is closing or the backlog is too large.
+     */
+    bool queue_frame(uint8_t opcode, const QByteArray& payload, bool is_message);
+
+    //! Frames payload into queue_, under the mutex.
+    void append_frame(uint8_t opcode, const QByteArray& payload);
+
+    void write_output();
+    void on_output_written(size_t message_bytes);
+
+  private:
+    QttpClientContext* client_;
+    Qttp* server_;
+    QttpRequest* request_;
+    QttpResponse* response_;
+
+    //! Header of the frame being read, copied as it may be cut off.
+    uint8_t header_[14];
+    size_t header_length_;
+    //! The header is complete and the payload is being read.
+    bool is_in_frame_;
+    uint8_t opcode_;
+    bool is_final_;
+    uint8_t key_[4];
+    uint64_t payload_length_;
+    uint64_t payload_read_;
+    //! Opcode of the message being put together, 0 between messages.
+    uint8_t message_opcode_;
+    QByteArray message_;
+    //! Payload of the control frame being read.
+    QByteArray control_;
+
+    //! Guards the queue and state senders share with the loop thread.
+    mutable std::mutex mutex_;
+    //! Frames waiting for the loop thread.
+    std::vector<QByteArray> queue_;
+    //! Whether the last frame in queue_ is ours to append to.
+    bool owns_last_queued_;
+    //! Message bytes in queue_.
+    size_t queued_message_bytes_;
+    //! Message bytes queued or still being written.
+    size_t backlog_;
+    std::function<void()> drain_callback_;
+    bool is_blocked_;
+    //! A notification for the queue is on its way to the loop thread.
+    bool is_notified_;
+    //! The context closed, nothing is sent anymore.
+    bool is_closed_;
+    std::atomic<bool> is_close_sent_;
+    std::atomic<bool> is_close_received_;
+
+    //! Frames for the next write, on the loop thread.
+    std::vector<QByteArray> output_;
+    size_t output_message_bytes_;
+    bool is_flushing_;
+    bool needs_flush_;
+    bool is_failed_;
+    uint16_t close_code_;
+};
+
+}
+}
+
+#endif // __NATIVE_QTTP_WEBSOCKET_H__
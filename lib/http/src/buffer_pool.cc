@@ -0,0 +1,91 @@
+#include "native/buffer_pool.h"
+
+using namespace native;
+
+buffer_pool::buffer_pool(size_t max_cached) :
+  max_cached_(max_cached),
+  hits_(0),
+  misses_(0),
+  cached_(0)
+{
+}
+
+buffer_pool::~buffer_pool()
+{
+  for(auto& list : free_)
+  {
+    for(auto buf : list)
+    {
+      delete[] buf;
+    }
+    list.clear();
+  }
+  cached_ = 0;
+}
+
+int buffer_pool::size_class(size_t size)
+{
+  if(size <= small_size)
+  {
+    return 0;
+  }
+  if(size <= medium_size)
+  {
+    return 1;
+  }
+  if(size <= large_size)
+  {
+    return 2;
+  }
+  return -1;
+}
+
+size_t buffer_pool::class_size(int index)
+{
+  static const size_t sizes[size_class_count] = { small_size, medium_size, large_size };
+  return sizes[index];
+}
+
+char* buffer_pool::acquire(size_t size, size_t& oLen)
+{
+  int index = size_class(size);
+  if(index < 0)
+  {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    oLen = size;
+    return new char[size];
+  }
+
+  oLen = class_size(index);
+  auto& list = free_[index];
+  if(list.empty())
+  {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return new char[oLen];
+  }
+
+  char* buf = list.back();
+  list.pop_back();
+  hits_.fetch_add(1, std::memory_order_relaxed);
+  cached_.fetch_sub(1, std::memory_order_relaxed);
+  return buf;
+}
+
+void buffer_pool::release(char* buf, size_t len)
+{
+  if(buf == nullptr)
+  {
+    return;
+  }
+
+  // Only exact class sizes came from acquire(), anything else is oversized.
+  int index = size_class(len);
+  if(index < 0 || class_size(index) != len || free_[index].size() >= max_cached_)
+  {
+    delete[] buf;
+    return;
+  }
+
+  free_[index].push_back(buf);
+  cached_.fetch_add(1, std::memory_order_relaxed);
+}
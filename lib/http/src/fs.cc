@@ -3,11 +3,11 @@
 using namespace native;
 using namespace native::fs;
 
-bool native::fs::open(const std::string& path, int flags, int mode, std::function<void(native::fs::file_handle fd, native::error e)> callback)
+bool native::fs::open(native::loop& l, const std::string& path, int flags, int mode, std::function<void(native::fs::file_handle fd, native::error e)> callback)
 {
     auto req = internal::create_req(callback);
     native::error err;
-    if((err = uv_fs_open(uv_default_loop(), req, path.c_str(), flags, mode, [](uv_fs_t* req) {
+    if((err = uv_fs_open(l.get(), req, path.c_str(), flags, mode, [](uv_fs_t* req) {
         assert(req->fs_type == UV_FS_OPEN);
 
         if(req->result < 0) internal::invoke_from_req<decltype(callback)>(req, file_handle(-1), native::error(req->result));
@@ -22,12 +22,12 @@ bool native::fs::open(const std::string& path, int flags, int mode, std::functio
     return true;
 }
 
-bool native::fs::read(file_handle fd, size_t len, off_t offset, std::function<void(const std::string& str, native::error e)> callback)
+bool native::fs::read(native::loop& l, file_handle fd, size_t len, off_t offset, std::function<void(const std::string& str, native::error e)> callback)
 {
     auto buf = new char[len];
     auto req = internal::create_req(callback, buf);
     const uv_buf_t iov = uv_buf_init(buf, len);
-    if(uv_fs_read(uv_default_loop(), req, fd, &iov, 1, offset, [](uv_fs_t* req){
+    if(uv_fs_read(l.get(), req, fd, &iov, 1, offset, [](uv_fs_t* req){
         assert(req->fs_type == UV_FS_READ);
 
         if(req->result < 0)
@@ -55,13 +55,13 @@ bool native::fs::read(file_handle fd, size_t len, off_t offset, std::function<vo
     return true;
 }
 
-bool native::fs::write(file_handle fd, const char* buf, size_t len, off_t offset, std::function<void(int nwritten, native::error e)> callback)
+bool native::fs::write(native::loop& l, file_handle fd, const char* buf, size_t len, off_t offset, std::function<void(int nwritten, native::error e)> callback)
 {
     auto req = internal::create_req(callback);
     const uv_buf_t iov = uv_buf_init(const_cast<char*>(buf), len);
 
     // TODO: const_cast<> !!
-    if(uv_fs_write(uv_default_loop(), req, fd, &iov, 1, offset, [](uv_fs_t* req){
+    if(uv_fs_write(l.get(), req, fd, &iov, 1, offset, [](uv_fs_t* req){
         assert(req->fs_type == UV_FS_WRITE);
 
         if(req->result)
@@ -82,14 +82,14 @@ bool native::fs::write(file_handle fd, const char* buf, size_t len, off_t offset
     return true;
 }
 
-bool native::fs::read_to_end(file_handle fd, std::function<void(const std::string& str, native::error e)> callback)
+bool native::fs::read_to_end(native::loop& l, file_handle fd, std::function<void(const std::string& str, native::error e)> callback)
 {
     auto ctx = new internal::rte_context;
     ctx->file = fd;
     auto req = internal::create_req(callback, ctx);
     const uv_buf_t iov = uv_buf_init(ctx->buf, internal::rte_context::buflen);
 
-    if(uv_fs_read(uv_default_loop(), req, fd, &iov, 1, 0, internal::rte_cb<decltype(callback)>)) {
+    if(uv_fs_read(l.get(), req, fd, &iov, 1, 0, internal::rte_cb<decltype(callback)>)) {
         // failed to initiate uv_fs_read()
         internal::delete_req<decltype(callback), internal::rte_context>(req);
         return false;
@@ -97,10 +97,10 @@ bool native::fs::read_to_end(file_handle fd, std::function<void(const std::strin
     return true;
 }
 
-bool native::fs::close(file_handle fd, std::function<void(native::error e)> callback)
+bool native::fs::close(native::loop& l, file_handle fd, std::function<void(native::error e)> callback)
 {
     auto req = internal::create_req(callback);
-    if(uv_fs_close(uv_default_loop(), req, fd, [](uv_fs_t* req){
+    if(uv_fs_close(l.get(), req, fd, [](uv_fs_t* req){
         assert(req->fs_type == UV_FS_CLOSE);
         internal::invoke_from_req<decltype(callback)>(req, req->result < 0? native::error(req->result): native::error());
         internal::delete_req(req);
@@ -111,10 +111,10 @@ bool native::fs::close(file_handle fd, std::function<void(native::error e)> call
     return true;
 }
 
-bool native::fs::unlink(const std::string& path, std::function<void(native::error e)> callback)
+bool native::fs::unlink(native::loop& l, const std::string& path, std::function<void(native::error e)> callback)
 {
     auto req = internal::create_req(callback);
-    if(uv_fs_unlink(uv_default_loop(), req, path.c_str(), [](uv_fs_t* req){
+    if(uv_fs_unlink(l.get(), req, path.c_str(), [](uv_fs_t* req){
         assert(req->fs_type == UV_FS_UNLINK);
         internal::invoke_from_req<decltype(callback)>(req, req->result < 0? native::error(req->result): native::error());
         internal::delete_req(req);
@@ -125,10 +125,10 @@ bool native::fs::unlink(const std::string& path, std::function<void(native::erro
     return true;
 }
 
-bool native::fs::mkdir(const std::string& path, int mode, std::function<void(native::error e)> callback)
+bool native::fs::mkdir(native::loop& l, const std::string& path, int mode, std::function<void(native::error e)> callback)
 {
     auto req = internal::create_req(callback);
-    if(uv_fs_mkdir(uv_default_loop(), req, path.c_str(), mode, [](uv_fs_t* req){
+    if(uv_fs_mkdir(l.get(), req, path.c_str(), mode, [](uv_fs_t* req){
         assert(req->fs_type == UV_FS_MKDIR);
         internal::invoke_from_req<decltype(callback)>(req, req->result < 0? native::error(req->result): native::error());
         internal::delete_req(req);
@@ -139,10 +139,10 @@ bool native::fs::mkdir(const std::string& path, int mode, std::function<void(nat
     return true;
 }
 
-bool native::fs::rmdir(const std::string& path, std::function<void(native::error e)> callback)
+bool native::fs::rmdir(native::loop& l, const std::string& path, std::function<void(native::error e)> callback)
 {
     auto req = internal::create_req(callback);
-    if(uv_fs_rmdir(uv_default_loop(), req, path.c_str(), [](uv_fs_t* req){
+    if(uv_fs_rmdir(l.get(), req, path.c_str(), [](uv_fs_t* req){
         assert(req->fs_type == UV_FS_RMDIR);
         internal::invoke_from_req<decltype(callback)>(req, req->result < 0? native::error(req->result): native::error());
         internal::delete_req(req);
@@ -153,10 +153,10 @@ bool native::fs::rmdir(const std::string& path, std::function<void(native::error
     return true;
 }
 
-bool native::fs::rename(const std::string& path, const std::string& new_path, std::function<void(native::error e)> callback)
+bool native::fs::rename(native::loop& l, const std::string& path, const std::string& new_path, std::function<void(native::error e)> callback)
 {
     auto req = internal::create_req(callback);
-    if(uv_fs_rename(uv_default_loop(), req, path.c_str(), new_path.c_str(), [](uv_fs_t* req){
+    if(uv_fs_rename(l.get(), req, path.c_str(), new_path.c_str(), [](uv_fs_t* req){
         assert(req->fs_type == UV_FS_RENAME);
         internal::invoke_from_req<decltype(callback)>(req, req->result<0? native::error(req->result): native::error());
         internal::delete_req(req);
@@ -167,10 +167,10 @@ bool native::fs::rename(const std::string& path, const std::string& new_path, st
     return true;
 }
 
-bool native::fs::chmod(const std::string& path, int mode, std::function<void(native::error e)> callback)
+bool native::fs::chmod(native::loop& l, const std::string& path, int mode, std::function<void(native::error e)> callback)
 {
     auto req = internal::create_req(callback);
-    if(uv_fs_chmod(uv_default_loop(), req, path.c_str(), mode, [](uv_fs_t* req){
+    if(uv_fs_chmod(l.get(), req, path.c_str(), mode, [](uv_fs_t* req){
         assert(req->fs_type == UV_FS_CHMOD);
         internal::invoke_from_req<decltype(callback)>(req, req->result<0? native::error(req->result): native::error());
         internal::delete_req(req);
@@ -181,10 +181,10 @@ bool native::fs::chmod(const std::string& path, int mode, std::function<void(nat
     return true;
 }
 
-bool native::fs::chown(const std::string& path, int uid, int gid, std::function<void(native::error e)> callback)
+bool native::fs::chown(native::loop& l, const std::string& path, int uid, int gid, std::function<void(native::error e)> callback)
 {
     auto req = internal::create_req(callback);
-    if(uv_fs_chown(uv_default_loop(), req, path.c_str(), uid, gid, [](uv_fs_t* req){
+    if(uv_fs_chown(l.get(), req, path.c_str(), uid, gid, [](uv_fs_t* req){
         assert(req->fs_type == UV_FS_CHOWN);
         internal::invoke_from_req<decltype(callback)>(req, req->result<0? native::error(req->result): native::error());
         internal::delete_req(req);
@@ -194,3 +194,81 @@ bool native::fs::chown(const std::string& path, int uid, int gid, std::function<
     }
     return true;
 }
+
+bool native::fs::sendfile(native::loop& l, file_handle out_fd, file_handle in_fd, int64_t offset, size_t len, std::function<void(size_t nsent, native::error e)> callback)
+{
+    auto req = internal::create_req(callback);
+    if(uv_fs_sendfile(l.get(), req, out_fd, in_fd, offset, len, [](uv_fs_t* req){
+        assert(req->fs_type == UV_FS_SENDFILE);
+
+        if(req->result < 0) internal::invoke_from_req<decltype(callback)>(req, 0, native::error(req->result));
+        else internal::invoke_from_req<decltype(callback)>(req, static_cast<size_t>(req->result), native::error());
+
+        internal::delete_req(req);
+    })) {
+        // failed to initiate uv_fs_sendfile()
+        internal::delete_req(req);
+        return false;
+    }
+    return true;
+}
+
+bool native::fs::open(const std::string& path, int flags, int mode, std::function<void(native::fs::file_handle fd, native::error e)> callback)
+{
+    return open(native::loop::get_default(), path, flags, mode, callback);
+}
+
+bool native::fs::read(file_handle fd, size_t len, off_t offset, std::function<void(const std::string& str, native::error e)> callback)
+{
+    return read(native::loop::get_default(), fd, len, offset, callback);
+}
+
+bool native::fs::write(file_handle fd, const char* buf, size_t len, off_t offset, std::function<void(int nwritten, native::error e)> callback)
+{
+    return write(native::loop::get_default(), fd, buf, len, offset, callback);
+}
+
+bool native::fs::read_to_end(file_handle fd, std::function<void(const std::string& str, native::error e)> callback)
+{
+    return read_to_end(native::loop::get_default(), fd, callback);
+}
+
+bool native::fs::close(file_handle fd, std::function<void(native::error e)> callback)
+{
+    return close(native::loop::get_default(), fd, callback);
+}
+
+bool native::fs::unlink(const std::string& path, std::function<void(native::error e)> callback)
+{
+    return unlink(native::loop::get_default(), path, callback);
+}
+
+bool native::fs::mkdir(const std::string& path, int mode, std::function<void(native::error e)> callback)
+{
+    return mkdir(native::loop::get_default(), path, mode, callback);
+}
+
+bool native::fs::rmdir(const std::string& path, std::function<void(native::error e)> callback)
+{
+    return rmdir(native::loop::get_default(), path, callback);
+}
+
+bool native::fs::rename(const std::string& path, const std::string& new_path, std::function<void(native::error e)> callback)
+{
+    return rename(native::loop::get_default(), path, new_path, callback);
+}
+
+bool native::fs::chmod(const std::string& path, int mode, std::function<void(native::error e)> callback)
+{
+    return chmod(native::loop::get_default(), path, mode, callback);
+}
+
+bool native::fs::chown(const std::string& path, int uid, int gid, std::function<void(native::error e)> callback)
+{
+    return chown(native::loop::get_default(), path, uid, gid, callback);
+}
+
+bool native::fs::sendfile(file_handle out_fd, file_handle in_fd, int64_t offset, size_t len, std::function<void(size_t nsent, native::error e)> callback)
+{
+    return sendfile(native::loop::get_default(), out_fd, in_fd, offset, len, callback);
+}
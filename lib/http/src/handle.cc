@@ -17,6 +17,7 @@ void native::base::_delete_handle(uv_handle_t* h)
   switch(h->type)
   {
     case UV_TCP: delete reinterpret_cast<uv_tcp_t*>(h); break;
+    case UV_NAMED_PIPE: delete reinterpret_cast<uv_pipe_t*>(h); break;
     default: assert(0); break;
   }
 }
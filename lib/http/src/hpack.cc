@@ -0,0 +1,562 @@
+#include "native/hpack.h"
+
+#include <cstring>
+
+using namespace native;
+using namespace native::http;
+
+namespace
+{
+struct huffman_code
+{
+  uint32_t code;
+  int bits;
+};
+
+//! Codes of the 256 octets and EOS, RFC 7541 Appendix B.
+const huffman_code huffman_codes[257] = {
+  { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+  { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+  { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+  { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+  { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+  { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+  { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+  { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+  { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+  { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+  { 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+  { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+  { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+  { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+  { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+  { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+  { 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+  { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+  { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+  { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+  { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+  { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+  { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+  { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+  { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+  { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+  { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+  { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+  { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+  { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+  { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+  { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+  { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+  { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+  { 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 },
+  { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+  { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 },
+  { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+  { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+  { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+  { 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 },
+  { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+  { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 },
+  { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+  { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+  { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+  { 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 },
+  { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+  { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+  { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+  { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+  { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+  { 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 },
+  { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+  { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 },
+  { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+  { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+  { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+  { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+  { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+  { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 },
+  { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+  { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+  { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+  { 0x3fffffff, 30 }
+};
+
+/**
+ * Binary tree of the code, walked a bit at a time.  Children are node
+ * indexes, or the symbol plus one negated for leaves.
+ */
+class huffman_tree
+{
+  public:
+    huffman_tree() :
+      count_(1)
+    {
+      memset(children_, 0, sizeof(children_));
+      for(int symbol = 0; symbol < 257; ++symbol)
+      {
+        const huffman_code& c = huffman_codes[symbol];
+        int node = 0;
+        for(int i = c.bits - 1; i > 0; --i)
+        {
+          int bit = (c.code >> i) & 1;
+          if(children_[node][bit] == 0)
+          {
+            children_[node][bit] = static_cast<int16_t>(count_++);
+          }
+          node = children_[node][bit];
+        }
+        children_[node][c.code & 1] = static_cast<int16_t>(-(symbol + 1));
+      }
+    }
+
+    int16_t next(int node, int bit) const {
+      return children_[node][bit];
+    }
+
+  private:
+    int16_t children_[256][2];
+    int count_;
+};
+
+const huffman_tree& get_huffman_tree()
+{
+  static const huffman_tree tree;
+  return tree;
+}
+
+const std::pair<std::string, std::string>* get_static_table()
+{
+  static const std::pair<std::string, std::string> entries[hpack::table::static_size] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" }
+  };
+  return entries;
+}
+
+void encode_string(std::string& out, const std::string& str)
+{
+  hpack::encode_integer(out, 0x00, 7, str.size());
+  out.append(str);
+}
+}
+
+bool hpack::huffman_decode(const uint8_t* data, size_t length, std::string& out)
+{
+  const huffman_tree& tree = get_huffman_tree();
+  int node = 0;
+  int depth = 0;
+  bool is_padding = true;
+
+  for(size_t i = 0; i < length; ++i)
+  {
+    for(int shift = 7; shift >= 0; --shift)
+    {
+      int bit = (data[i] >> shift) & 1;
+      int16_t next = tree.next(node, bit);
+      if(next < 0)
+      {
+        int symbol = -next - 1;
+        if(symbol == 256)
+        {
+          // EOS must not appear in the string itself.
+          return false;
+        }
+        out.push_back(static_cast<char>(symbol));
+        node = 0;
+        depth = 0;
+        is_padding = true;
+      }
+      else
+      {
+        node = next;
+        ++depth;
+        is_padding = is_padding && bit == 1;
+      }
+    }
+  }
+
+  // Whatever is left has to be a prefix of EOS shorter than an octet.
+  return depth < 8 && is_padding;
+}
+
+void hpack::encode_integer(std::string& out, uint8_t first, int prefix_bits, uint64_t value)
+{
+  const uint64_t mask = (1u << prefix_bits) - 1;
+  if(value < mask)
+  {
+    out.push_back(static_cast<char>(first | value));
+    return;
+  }
+
+  out.push_back(static_cast<char>(first | mask));
+  value -= mask;
+  while(value >= 128)
+  {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+hpack::table::table(size_t max_size) :
+  entries_(),
+  size_(0),
+  max_size_(max_size)
+{
+}
+
+const std::pair<std::string, std::string>* hpack::table::get(size_t index) const
+{
+  if(index == 0)
+  {
+    return nullptr;
+  }
+  if(index <= static_size)
+  {
+    return &get_static_table()[index - 1];
+  }
+  index -= static_size + 1;
+  return (index < entries_.size()) ? &entries_[index] : nullptr;
+}
+
+size_t hpack::table::find(const std::string& name, const std::string& value, bool& is_exact) const
+{
+  size_t name_index = 0;
+  is_exact = false;
+
+  const std::pair<std::string, std::string>* entries = get_static_table();
+  for(size_t i = 0; i < static_size; ++i)
+  {
+    if(entries[i].first != name)
+    {
+      continue;
+    }
+    if(entries[i].second == value)
+    {
+      is_exact = true;
+      return i + 1;
+    }
+    if(name_index == 0)
+    {
+      name_index = i + 1;
+    }
+  }
+
+  for(size_t i = 0; i < entries_.size(); ++i)
+  {
+    if(entries_[i].first != name)
+    {
+      continue;
+    }
+    if(entries_[i].second == value)
+    {
+      is_exact = true;
+      return static_size + 1 + i;
+    }
+    if(name_index == 0)
+    {
+      name_index = static_size + 1 + i;
+    }
+  }
+  return name_index;
+}
+
+void hpack::table::insert(const std::string& name, const std::string& value)
+{
+  size_t size = entry_size(name.size(), value.size());
+  if(size > max_size_)
+  {
+    // Not an error, the table just ends up empty.
+    evict(0);
+    return;
+  }
+
+  evict(max_size_ - size);
+  entries_.push_front(std::make_pair(name, value));
+  size_ += size;
+}
+
+void hpack::table::set_max_size(size_t max_size)
+{
+  max_size_ = max_size;
+  evict(max_size);
+}
+
+void hpack::table::evict(size_t max_size)
+{
+  while(size_ > max_size && !entries_.empty())
+  {
+    const std::pair<std::string, std::string>& last = entries_.back();
+    size_ -= entry_size(last.first.size(), last.second.size());
+    entries_.pop_back();
+  }
+}
+
+hpack::decoder::decoder(size_t max_table_size) :
+  table_(max_table_size),
+  max_table_size_(max_table_size)
+{
+}
+
+bool hpack::decoder::decode(const uint8_t* data, size_t length,
+                            const std::function<void(const std::string&, const std::string&)>& on_header)
+{
+  const uint8_t* pos = data;
+  const uint8_t* end = data + length;
+  std::string name;
+  std::string value;
+  uint64_t index;
+
+  while(pos < end)
+  {
+    uint8_t first = *pos;
+
+    if(first & 0x80)
+    {
+      // Indexed field.
+      if(!decode_integer(pos, end, 7, index))
+      {
+        return false;
+      }
+      const std::pair<std::string, std::string>* entry = table_.get(static_cast<size_t>(index));
+      if(!entry)
+      {
+        return false;
+      }
+      on_header(entry->first, entry->second);
+      continue;
+    }
+
+    if((first & 0xe0) == 0x20)
+    {
+      // Dynamic table size update.
+      if(!decode_integer(pos, end, 5, index) || index > max_table_size_)
+      {
+        return false;
+      }
+      table_.set_max_size(static_cast<size_t>(index));
+      continue;
+    }
+
+    // Literal with incremental indexing, without indexing or never indexed.
+    bool is_indexed = (first & 0x40) != 0;
+    if(!decode_integer(pos, end, is_indexed ? 6 : 4, index))
+    {
+      return false;
+    }
+
+    name.clear();
+    value.clear();
+    if(index != 0)
+    {
+      const std::pair<std::string, std::string>* entry = table_.get(static_cast<size_t>(index));
+      if(!entry)
+      {
+        return false;
+      }
+      // Copied, inserting may evict the entry.
+      name = entry->first;
+    }
+    else if(!decode_string(pos, end, name))
+    {
+      return false;
+    }
+
+    if(!decode_string(pos, end, value))
+    {
+      return false;
+    }
+
+    if(is_indexed)
+    {
+      table_.insert(name, value);
+    }
+    on_header(name, value);
+  }
+  return true;
+}
+
+bool hpack::decoder::decode_integer(const uint8_t*& pos, const uint8_t* end, int prefix_bits, uint64_t& value) const
+{
+  if(pos >= end)
+  {
+    return false;
+  }
+
+  const uint64_t mask = (1u << prefix_bits) - 1;
+  value = *pos++ & mask;
+  if(value < mask)
+  {
+    return true;
+  }
+
+  for(int shift = 0; shift <= 56; shift += 7)
+  {
+    if(pos >= end)
+    {
+      return false;
+    }
+    uint8_t b = *pos++;
+    value += static_cast<uint64_t>(b & 0x7f) << shift;
+    if((b & 0x80) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool hpack::decoder::decode_string(const uint8_t*& pos, const uint8_t* end, std::string& out) const
+{
+  if(pos >= end)
+  {
+    return false;
+  }
+
+  bool is_huffman = (*pos & 0x80) != 0;
+  uint64_t length;
+  if(!decode_integer(pos, end, 7, length) || length > static_cast<uint64_t>(end - pos))
+  {
+    return false;
+  }
+
+  const uint8_t* data = pos;
+  pos += length;
+  if(is_huffman)
+  {
+    return huffman_decode(data, static_cast<size_t>(length), out);
+  }
+  out.assign(reinterpret_cast<const char*>(data), static_cast<size_t>(length));
+  return true;
+}
+
+hpack::encoder::encoder() :
+  table_(4096),
+  pending_max_size_(4096),
+  has_size_update_(false)
+{
+}
+
+void hpack::encoder::set_max_table_size(size_t max_size)
+{
+  // Nothing gained from a larger table than the default.
+  pending_max_size_ = (std::min)(max_size, static_cast<size_t>(4096));
+  has_size_update_ = pending_max_size_ != table_.get_max_size();
+}
+
+void hpack::encoder::begin(std::string& out)
+{
+  if(has_size_update_)
+  {
+    has_size_update_ = false;
+    table_.set_max_size(pending_max_size_);
+    encode_integer(out, 0x20, 5, pending_max_size_);
+  }
+}
+
+void hpack::encoder::encode(std::string& out, const std::string& name, const std::string& value, bool is_indexed)
+{
+  bool is_exact;
+  size_t index = table_.find(name, value, is_exact);
+  if(is_exact)
+  {
+    encode_integer(out, 0x80, 7, index);
+    return;
+  }
+
+  if(is_indexed && entry_size(name.size(), value.size()) <= table_.get_max_size() / 2)
+  {
+    encode_integer(out, 0x40, 6, index);
+    if(index == 0)
+    {
+      encode_string(out, name);
+    }
+    encode_string(out, value);
+    table_.insert(name, value);
+    return;
+  }
+
+  encode_integer(out, 0x00, 4, index);
+  if(index == 0)
+  {
+    encode_string(out, name);
+  }
+  encode_string(out, value);
+}
+
+void hpack::encoder::encode_status(std::string& out, int status)
+{
+  // Statuses of the static table.
+  switch(status)
+  {
+    case 200: encode_integer(out, 0x80, 7, 8); return;
+    case 204: encode_integer(out, 0x80, 7, 9); return;
+    case 206: encode_integer(out, 0x80, 7, 10); return;
+    case 304: encode_integer(out, 0x80, 7, 11); return;
+    case 400: encode_integer(out, 0x80, 7, 12); return;
+    case 404: encode_integer(out, 0x80, 7, 13); return;
+    case 500: encode_integer(out, 0x80, 7, 14); return;
+    default: break;
+  }
+  encode(out, ":status", std::to_string(status));
+}
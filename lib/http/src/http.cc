@@ -189,7 +189,7 @@ std::string http::response::get_status_text(int status)
     case 414: return "Request-URI Too Long";
     case 415: return "Unsupported Media Type";
     case 416: return "Requested Range Not Satisfiable";
-    case 417: return "Expectation Faiiled";
+    case 417: return "Expectation Failed";
     case 418: return "I'm a teapot"; //RFC2324.
     case 422: return "Unprocessable Entity";       // RFC 4918
     case 423: return "Locked";                     // RFC 4918
@@ -217,6 +217,37 @@ std::string http::response::get_status_text(int status)
   }
 }
 
+const std::string& http::response::get_status_line(int status)
+{
+  static const int first = 100;
+  static const int last = 599;
+
+  static const std::vector<std::string> lines = [](){
+    std::vector<std::string> result;
+    for(int code = first; code <= last; ++code)
+    {
+      std::string line = "HTTP/1.1 " + std::to_string(code) + " ";
+      try
+      {
+        line += get_status_text(code);
+      }
+      catch(const response_exception&)
+      {
+        // RFC 7230 allows an empty reason phrase.
+      }
+      result.push_back(line + "\r\n");
+    }
+    return result;
+  }();
+
+  if(status < first || status > last)
+  {
+    static const std::string invalid = "HTTP/1.1 500 Internal Server Error\r\n";
+    return invalid;
+  }
+  return lines[status - first];
+}
+
 http::request::request() :
   url_(),
   headers_(),
@@ -4,17 +4,57 @@ using namespace native;
 
 
 loop::loop(bool use_default) :
-    uv_loop_(use_default ? uv_default_loop() : uv_loop_new())
+    uv_loop_(use_default ? uv_default_loop() : new uv_loop_t),
+    is_default_(use_default),
+    buffer_pool_()
 {
+    if(!is_default_)
+    {
+        int err = uv_loop_init(uv_loop_);
+        if(err)
+        {
+            PRINT_NN_ERROR(error(err));
+        }
+    }
+    uv_loop_->data = this;
 }
 
 loop::~loop()
 {
     if(uv_loop_)
     {
-        uv_loop_delete(uv_loop_);
-        uv_loop_ = nullptr;
+        uv_loop_->data = nullptr;
+    }
+
+    if(uv_loop_ && !is_default_)
+    {
+        int err = uv_loop_close(uv_loop_);
+        if(err)
+        {
+            // Handles are still referencing the memory, better to leak it.
+            PRINT_NN_ERROR(error(err));
+        }
+        else
+        {
+            delete uv_loop_;
+        }
     }
+    uv_loop_ = nullptr;
+}
+
+loop& loop::get_default()
+{
+    static loop default_loop(true);
+    return default_loop;
+}
+
+loop* loop::from(uv_loop_t* l)
+{
+    if(l->data)
+    {
+        return reinterpret_cast<loop*>(l->data);
+    }
+    return (l == uv_default_loop()) ? &get_default() : nullptr;
 }
 
 bool loop::run() { 
@@ -25,6 +65,15 @@ bool loop::run_once() {
     return (uv_run(uv_loop_, UV_RUN_ONCE) == 0); 
 }
 
+bool loop::run_nowait() {
+    return (uv_run(uv_loop_, UV_RUN_NOWAIT) == 0);
+}
+
+void loop::stop()
+{
+    uv_stop(uv_loop_);
+}
+
 void loop::update_time()
 {
     uv_update_time(uv_loop_);
@@ -54,3 +103,27 @@ void native::stop()
 {
     return uv_stop(uv_default_loop());
 }
+
+char* native::internal::acquire_read_buffer(uv_loop_t* l, size_t size, size_t& oLen)
+{
+    loop* owner = loop::from(l);
+    if(owner)
+    {
+        return owner->get_buffer_pool().acquire(size, oLen);
+    }
+    oLen = size;
+    return new char[size];
+}
+
+void native::internal::release_read_buffer(uv_loop_t* l, char* buf, size_t len)
+{
+    loop* owner = loop::from(l);
+    if(owner)
+    {
+        owner->get_buffer_pool().release(buf, len);
+    }
+    else
+    {
+        delete[] buf;
+    }
+}
@@ -0,0 +1,120 @@
+#include "native/pipe.h"
+
+#ifndef _WIN32
+  #include <cerrno>
+  #include <cstring>
+  #include <sys/socket.h>
+  #include <sys/stat.h>
+  #include <sys/un.h>
+  #include <unistd.h>
+#endif
+
+using namespace native;
+using namespace net;
+
+namespace
+{
+#ifndef _WIN32
+/** Whether name is a socket file without a listener behind it, which a
+ *  connect attempt tells by being refused.
+ */
+bool is_stale_socket(const std::string& name)
+{
+  struct stat st;
+  if(::stat(name.c_str(), &st) != 0 || !S_ISSOCK(st.st_mode))
+  {
+    return false;
+  }
+
+  sockaddr_un addr;
+  if(name.size() >= sizeof(addr.sun_path))
+  {
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, name.c_str(), name.size());
+
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0)
+  {
+    return false;
+  }
+  bool is_refused = ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 &&
+                    errno == ECONNREFUSED;
+  ::close(fd);
+  return is_refused;
+}
+#endif
+}
+
+pipe::pipe(native::loop& l) :
+  native::base::stream(new uv_pipe_t),
+  name_()
+{
+  uv_pipe_init(l.get(), get<uv_pipe_t>(), 0);
+}
+
+pipe::~pipe()
+{
+}
+
+bool pipe::bind(const std::string& name, error& oError)
+{
+  oError = uv_pipe_bind(get<uv_pipe_t>(), name.c_str());
+
+#ifndef _WIN32
+  if(oError.code() == UV_EADDRINUSE && is_stale_socket(name))
+  {
+    ::unlink(name.c_str());
+    oError = uv_pipe_bind(get<uv_pipe_t>(), name.c_str());
+  }
+#endif
+
+  if(oError)
+  {
+    PRINT_NN_ERROR(oError);
+    return false;
+  }
+  name_ = name;
+  return true;
+}
+
+bool pipe::chmod(int mode, error& oError)
+{
+#ifndef _WIN32
+  if(::chmod(name_.c_str(), static_cast<mode_t>(mode)) != 0)
+  {
+    oError = -errno;
+    PRINT_NN_ERROR(oError);
+    return false;
+  }
+  return true;
+#else
+  oError = UV_ENOTSUP;
+  return false;
+#endif
+}
+
+bool pipe::open(uv_os_sock_t sock, error& oError)
+{
+  oError = uv_pipe_open(get<uv_pipe_t>(), static_cast<uv_file>(sock));
+  if(oError)
+  {
+    PRINT_NN_ERROR(oError);
+    return false;
+  }
+  return true;
+}
+
+bool pipe::getsockname(std::string& name) const
+{
+  char buf[256];
+  size_t len = sizeof(buf);
+  if(uv_pipe_getsockname(get<uv_pipe_t>(), buf, &len) == 0)
+  {
+    name.assign(buf, len);
+    return true;
+  }
+  return false;
+}
@@ -1,7 +1,9 @@
 #include "native/stream.h"
 
-#ifdef SSL_TLS_UV
-  #include <uv_tls.h>
+#ifndef _WIN32
+  #include <cerrno>
+  #include <fcntl.h>
+  #include <unistd.h>
 #endif
 
 using namespace native;
@@ -29,38 +31,7 @@ bool stream::listen(std::function<void(native::error)> callback, int backlog)
 
 bool stream::accept(stream* client)
 {
-#ifdef SSL_TLS_UV
-  uv_tls_t* sclient = new uv_tls_t;
-  memset(sclient, 0, sizeof(uv_tls_t));
-  evt_ctx_t* ctx = (evt_ctx_t*) client->get<uv_stream_t>()->data;
-  evt_tls_t* t = evt_ctx_get_tls(ctx);
-  if(t != nullptr) {
-    // FIXME later when this starts working.
-    // assert( t != NULL );
-    t->data = sclient;
-    sclient->tls = t;
-    sclient->tls_rd_cb = NULL;
-    sclient->tls_cls_cb = NULL;
-    sclient->tls_hsk_cb = NULL;
-    sclient->tls_wr_cb = NULL;
-  }
-#endif
-
-  bool result = uv_accept(get<uv_stream_t>(), client->get<uv_stream_t>()) == 0;
-
-#ifdef SSL_TLS_UV
-  // FIXME won't need (t != nullptr) later when this starts working.
-  if(result && t != nullptr) {
-    assert( sclient != nullptr );
-    int rv = evt_tls_accept(sclient->tls, []( evt_tls_t *t, int status) {
-      uv_tls_t *ut = (uv_tls_t*)t->data;
-      assert( ut != NULL && ut->tls_hsk_cb != NULL);
-      ut->tls_hsk_cb(ut, status - 1);
-    });
-  }
-#endif
-
-  return result;
+  return uv_accept(get<uv_stream_t>(), client->get<uv_stream_t>()) == 0;
 }
 
 bool stream::read_start(std::function<void(const char* buf, ssize_t len)> callback)
@@ -75,34 +46,71 @@ bool stream::read_stop()
 
 // TODO: implement read2_start()
 
+namespace
+{
+// Every write request carries its own callback, so any number of writes can
+// be outstanding on a stream and each one completes individually.
+typedef std::function<void(error)> write_callback;
+
+uv_write_t* create_write_req(write_callback callback)
+{
+  auto req = new uv_write_t;
+  req->data = new callbacks(1);
+  assert(req->data);
+  callbacks::store(req->data, 0, callback);
+  return req;
+}
+
+void delete_write_req(uv_write_t* req)
+{
+  delete reinterpret_cast<callbacks*>(req->data);
+  delete req;
+}
+
+void on_write(uv_write_t* req, int status)
+{
+  callbacks::invoke<write_callback>(req->data, 0, ((status != 0) ? error(status) : error()));
+  delete_write_req(req);
+}
+}
+
 bool stream::write(const char* buf, int len, std::function<void(error)> callback)
 {
   uv_buf_t bufs[] = CREATE_UVBUF(len, buf);
-  callbacks::store(get()->data, native::internal::uv_cid_write, callback);
-  return uv_write(new uv_write_t, get<uv_stream_t>(), bufs, 1, [](uv_write_t* req, int status) {
-    callbacks::invoke<decltype(callback)>(req->handle->data, native::internal::uv_cid_write, ((status != 0) ? error(status) : error()));
-    delete req;
-  }) == 0;
+  return write(bufs, 1, callback);
 }
 
 bool stream::write(const std::string& buf, std::function<void(error)> callback)
 {
   uv_buf_t bufs[] = CREATE_UVBUF(buf.length(), buf.c_str());
-  callbacks::store(get()->data, native::internal::uv_cid_write, callback);
-  return uv_write(new uv_write_t, get<uv_stream_t>(), bufs, 1, [](uv_write_t* req, int status) {
-    callbacks::invoke<decltype(callback)>(req->handle->data, native::internal::uv_cid_write, ((status != 0) ? error(status) : error()));
-    delete req;
-  }) == 0;
+  return write(bufs, 1, callback);
 }
 
 bool stream::write(const std::vector<char>& buf, std::function<void(error)> callback)
 {
   uv_buf_t bufs[] = CREATE_UVBUF(buf.size(), &buf[0]);
-  callbacks::store(get()->data, native::internal::uv_cid_write, callback);
-  return uv_write(new uv_write_t, get<uv_stream_t>(), bufs, 1, [](uv_write_t* req, int status) {
-    callbacks::invoke<decltype(callback)>(req->handle->data, native::internal::uv_cid_write, ((status != 0) ? error(status) : error()));
-    delete req;
-  }) == 0;
+  return write(bufs, 1, callback);
+}
+
+bool stream::write(const uv_buf_t* bufs, unsigned int nbufs, std::function<void(error)> callback)
+{
+  uv_write_t* req = create_write_req(callback);
+  if(uv_write(req, get<uv_stream_t>(), bufs, nbufs, on_write) != 0)
+  {
+    delete_write_req(req);
+    return false;
+  }
+  return true;
+}
+
+size_t stream::write_queue_size() const
+{
+  return get<uv_stream_t>()->write_queue_size;
+}
+
+int stream::try_write(const uv_buf_t* bufs, unsigned int nbufs)
+{
+  return uv_try_write(get<uv_stream_t>(), bufs, nbufs);
 }
 
 // TODO: implement write2()
@@ -116,3 +124,29 @@ bool stream::shutdown(std::function<void(error)> callback)
     delete req;
   }) == 0;
 }
+
+bool stream::duplicate(uv_os_sock_t& oSock, error& oError)
+{
+#ifndef _WIN32
+  uv_os_fd_t fd;
+  oError = uv_fileno(get(), &fd);
+  if(oError)
+  {
+    PRINT_NN_ERROR(oError);
+    return false;
+  }
+
+  // Unlike dup(), keeps the copy from leaking into child processes.
+  oSock = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if(oSock < 0)
+  {
+    oError = -errno;
+    PRINT_NN_ERROR(oError);
+    return false;
+  }
+  return true;
+#else
+  oError = UV_ENOTSUP;
+  return false;
+#endif
+}
@@ -1,8 +1,11 @@
 #include "native/tcp.h"
 
-#ifdef SSL_TLS_UV
-  #include <uv_tls.h>
-  #include <iostream>
+#ifndef _WIN32
+  #include <cerrno>
+  #include <netinet/in.h>
+  #include <netinet/tcp.h>
+  #include <sys/socket.h>
+  #include <unistd.h>
 #endif
 
 using namespace native;
@@ -35,29 +38,128 @@ std::shared_ptr<tcp> tcp::create()
 //    return nullptr;
 //}
 
-bool tcp::bind(const sockaddr* iAddr, error& oError)
+bool tcp::reuse_port(bool ip6, error& oError)
 {
-  uv_tcp_t* listener = get<uv_tcp_t>();
+#if defined(SO_REUSEPORT) && !defined(_WIN32)
+  int fd = ::socket(ip6 ? AF_INET6 : AF_INET, SOCK_STREAM, 0);
+  if(fd < 0)
+  {
+    oError = -errno;
+    PRINT_NN_ERROR(oError);
+    return false;
+  }
+
+  int on = 1;
+  if(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0)
+  {
+    oError = -errno;
+    PRINT_NN_ERROR(oError);
+    ::close(fd);
+    return false;
+  }
 
-#ifdef SSL_TLS_UV
-  evt_ctx_t* ctx = new evt_ctx_t;
-  // TODO: FIXME: This only needs to occur once.
-  int result = evt_ctx_init_ex(ctx, "server-cert.pem", "server-key.pem");
-  if(result != 1) {
-    std::cout << "Warning! TLS certificates did not load [" << result << "]" << std::endl;
-    delete (evt_ctx_t*) ctx;
-  } else {
-    evt_ctx_set_nio(ctx, NULL, ::uv_tls_writer);
-    if(listener->data != nullptr) {
-      std::cout << "Warning! Potential memory leak";
-    }
-    // TODO: FIXME: Callbacks is set here, need to find another place to store it.
-    listener->data = ctx;
+  // libuv binds the socket it's handed instead of creating its own.
+  oError = uv_tcp_open(get<uv_tcp_t>(), fd);
+  if(oError)
+  {
+    PRINT_NN_ERROR(oError);
+    ::close(fd);
+    return false;
   }
+  return true;
+#else
+  oError = UV_ENOTSUP;
+  return false;
 #endif
+}
 
-  // TODO: add flags
-  oError = uv_tcp_bind(listener, iAddr, 0);
+bool tcp::open(uv_os_sock_t sock, error& oError)
+{
+  oError = uv_tcp_open(get<uv_tcp_t>(), sock);
+  if(oError)
+  {
+    PRINT_NN_ERROR(oError);
+    return false;
+  }
+  return true;
+}
+
+bool tcp::set_option(int level, int name, int value, error& oError)
+{
+#ifndef _WIN32
+  uv_os_fd_t fd;
+  oError = uv_fileno(get(), &fd);
+  if(oError)
+  {
+    PRINT_NN_ERROR(oError);
+    return false;
+  }
+
+  if(setsockopt(fd, level, name, &value, sizeof(value)) != 0)
+  {
+    oError = -errno;
+    PRINT_NN_ERROR(oError);
+    return false;
+  }
+  return true;
+#else
+  oError = UV_ENOTSUP;
+  return false;
+#endif
+}
+
+bool tcp::receive_buffer_size(int size, error& oError)
+{
+  oError = uv_recv_buffer_size(get(), &size);
+  if(oError)
+  {
+    PRINT_NN_ERROR(oError);
+    return false;
+  }
+  return true;
+}
+
+bool tcp::send_buffer_size(int size, error& oError)
+{
+  oError = uv_send_buffer_size(get(), &size);
+  if(oError)
+  {
+    PRINT_NN_ERROR(oError);
+    return false;
+  }
+  return true;
+}
+
+bool tcp::defer_accept(unsigned int seconds, error& oError)
+{
+#if defined(TCP_DEFER_ACCEPT) && !defined(_WIN32)
+  return set_option(IPPROTO_TCP, TCP_DEFER_ACCEPT, static_cast<int>(seconds), oError);
+#else
+  oError = UV_ENOTSUP;
+  return false;
+#endif
+}
+
+bool tcp::fast_open(int queue_length, error& oError)
+{
+#if defined(TCP_FASTOPEN) && !defined(_WIN32)
+  return set_option(IPPROTO_TCP, TCP_FASTOPEN, queue_length, oError);
+#else
+  oError = UV_ENOTSUP;
+  return false;
+#endif
+}
+
+bool tcp::bind(const sockaddr* iAddr, error& oError)
+{
+  return bind(iAddr, 0, oError);
+}
+
+bool tcp::bind(const sockaddr* iAddr, unsigned int flags, error& oError)
+{
+  uv_tcp_t* listener = get<uv_tcp_t>();
+
+  oError = uv_tcp_bind(listener, iAddr, flags);
   if(oError)
   {
     PRINT_NN_ERROR(oError);
@@ -83,7 +185,7 @@ bool tcp::bind(const std::string& ip, int port)
   return bind(ip, port, err);
 }
 
-bool tcp::bind6(const std::string& ip, int port, error& oError)
+bool tcp::bind6(const std::string& ip, int port, bool ipv6_only, error& oError)
 {
   ip6_addr addr;
   to_ip6_addr(ip.c_str(), port, addr, oError);
@@ -91,13 +193,18 @@ bool tcp::bind6(const std::string& ip, int port, error& oError)
     PRINT_NN_ERROR(oError);
     return false;
   }
-  return bind(reinterpret_cast<const sockaddr*>(&addr), oError);
+  return bind(reinterpret_cast<const sockaddr*>(&addr), ipv6_only ? UV_TCP_IPV6ONLY : 0, oError);
+}
+
+bool tcp::bind6(const std::string& ip, int port, error& oError)
+{
+  return bind6(ip, port, false, oError);
 }
 
 bool tcp::bind6(const std::string& ip, int port)
 {
   error err;
-  return bind(ip, port, err);
+  return bind6(ip, port, err);
 }
 
 bool tcp::connect(const std::string& ip, int port, std::function<void(error)> callback, error& oError)
@@ -0,0 +1,177 @@
+#include "native/timer_wheel.h"
+
+using namespace native;
+
+namespace
+{
+//! Slot of entries moved to timer_wheel::expiring_.
+const size_t expiring_slot = static_cast<size_t>(-1);
+}
+
+timer_wheel::entry::entry(std::function<void()> callback) :
+  callback_(callback),
+  wheel_(nullptr),
+  prev_(nullptr),
+  next_(nullptr),
+  expiry_(0),
+  slot_(0)
+{
+}
+
+timer_wheel::entry::~entry()
+{
+  if(wheel_)
+  {
+    wheel_->stop(*this);
+  }
+}
+
+timer_wheel::timer_wheel(loop& l, uint64_t tick_ms, size_t slot_count) :
+  timer_(new uv_timer_t),
+  tick_ms_((std::max)(tick_ms, static_cast<uint64_t>(1))),
+  slots_((std::max)(slot_count, static_cast<size_t>(1)), nullptr),
+  expiring_(nullptr),
+  tick_(0),
+  size_(0)
+{
+  uv_timer_init(l.get(), timer_);
+  timer_->data = this;
+}
+
+timer_wheel::~timer_wheel()
+{
+  for(auto head : slots_)
+  {
+    for(entry* e = head; e != nullptr; e = e->next_)
+    {
+      e->wheel_ = nullptr;
+    }
+  }
+
+  uv_timer_stop(timer_);
+  uv_close(reinterpret_cast<uv_handle_t*>(timer_), [](uv_handle_t* h) {
+    delete reinterpret_cast<uv_timer_t*>(h);
+  });
+  timer_ = nullptr;
+}
+
+uint64_t timer_wheel::now_tick() const
+{
+  return uv_now(timer_->loop) / tick_ms_;
+}
+
+void timer_wheel::start(entry& e, uint64_t timeout_ms)
+{
+  if(e.wheel_)
+  {
+    unlink(e);
+  }
+
+  if(size_ == 0)
+  {
+    // Nothing was pending, the slots in between are empty.
+    tick_ = now_tick();
+    uv_timer_start(timer_, [](uv_timer_t* timer) {
+      reinterpret_cast<timer_wheel*>(timer->data)->on_tick();
+    }, tick_ms_, tick_ms_);
+  }
+
+  uint64_t ticks = (std::max)((timeout_ms + tick_ms_ - 1) / tick_ms_, static_cast<uint64_t>(1));
+  e.expiry_ = (std::max)(now_tick(), tick_) + ticks;
+  link(e, static_cast<size_t>(e.expiry_ % slots_.size()));
+}
+
+void timer_wheel::stop(entry& e)
+{
+  if(e.wheel_ != this)
+  {
+    return;
+  }
+  unlink(e);
+
+  if(size_ == 0)
+  {
+    uv_timer_stop(timer_);
+  }
+}
+
+void timer_wheel::link(entry& e, size_t slot)
+{
+  entry*& head = (slot == expiring_slot) ? expiring_ : slots_[slot];
+  e.wheel_ = this;
+  e.slot_ = slot;
+  e.prev_ = nullptr;
+  e.next_ = head;
+  if(head)
+  {
+    head->prev_ = &e;
+  }
+  head = &e;
+  ++size_;
+}
+
+void timer_wheel::unlink(entry& e)
+{
+  entry*& head = (e.slot_ == expiring_slot) ? expiring_ : slots_[e.slot_];
+  if(e.prev_)
+  {
+    e.prev_->next_ = e.next_;
+  }
+  else
+  {
+    head = e.next_;
+  }
+  if(e.next_)
+  {
+    e.next_->prev_ = e.prev_;
+  }
+  e.wheel_ = nullptr;
+  e.prev_ = nullptr;
+  e.next_ = nullptr;
+  --size_;
+}
+
+void timer_wheel::on_tick()
+{
+  uint64_t now = now_tick();
+
+  // After a stall, one turn visits every slot and catches all that expired.
+  if(now - tick_ > slots_.size())
+  {
+    tick_ = now - slots_.size();
+  }
+
+  while(tick_ < now && size_ > 0)
+  {
+    ++tick_;
+    size_t slot = static_cast<size_t>(tick_ % slots_.size());
+
+    // Callbacks may start and stop any entry, including the ones up next.
+    while(entry* e = slots_[slot])
+    {
+      unlink(*e);
+      link(*e, expiring_slot);
+    }
+
+    while(entry* e = expiring_)
+    {
+      unlink(*e);
+      if(e->expiry_ > tick_)
+      {
+        // Due on a later turn of the wheel.
+        link(*e, slot);
+        continue;
+      }
+
+      if(e->callback_)
+      {
+        e->callback_();
+      }
+    }
+  }
+
+  if(size_ == 0)
+  {
+    uv_timer_stop(timer_);
+  }
+}
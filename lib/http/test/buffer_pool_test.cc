@@ -0,0 +1,49 @@
+#include "native/native.h"
+#include "gtest/gtest.h"
+
+TEST(BufferPoolTests, ReusesReleasedBuffers)
+{
+    native::buffer_pool pool;
+    size_t len = 0;
+
+    char* first = pool.acquire(1000, len);
+    EXPECT_EQ(static_cast<size_t>(native::buffer_pool::small_size), len);
+    EXPECT_EQ(0u, pool.hits());
+    EXPECT_EQ(1u, pool.misses());
+
+    pool.release(first, len);
+    EXPECT_EQ(1u, pool.cached());
+
+    char* second = pool.acquire(4096, len);
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(1u, pool.hits());
+    EXPECT_EQ(0u, pool.cached());
+
+    pool.release(second, len);
+}
+
+TEST(BufferPoolTests, OversizedBuffersBypassThePool)
+{
+    native::buffer_pool pool;
+    size_t len = 0;
+
+    char* buf = pool.acquire(native::buffer_pool::large_size + 1, len);
+    EXPECT_EQ(static_cast<size_t>(native::buffer_pool::large_size + 1), len);
+    pool.release(buf, len);
+
+    EXPECT_EQ(0u, pool.cached());
+    EXPECT_EQ(1u, pool.misses());
+}
+
+TEST(BufferPoolTests, KeepsAtMostMaxCached)
+{
+    native::buffer_pool pool(1);
+    size_t len = 0;
+
+    char* a = pool.acquire(65536, len);
+    char* b = pool.acquire(65536, len);
+    pool.release(a, len);
+    pool.release(b, len);
+
+    EXPECT_EQ(1u, pool.cached());
+}
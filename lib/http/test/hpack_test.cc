@@ -0,0 +1,250 @@
+#include "native/native.h"
+#include "native/hpack.h"
+#include "gtest/gtest.h"
+
+namespace
+{
+
+typedef std::vector<std::pair<std::string, std::string> > header_list;
+
+std::string from_hex(const char* hex)
+{
+    std::string out;
+    int high = -1;
+    for(const char* c = hex; *c; ++c)
+    {
+        int digit;
+        if(*c >= '0' && *c <= '9')
+        {
+            digit = *c - '0';
+        }
+        else if(*c >= 'a' && *c <= 'f')
+        {
+            digit = *c - 'a' + 10;
+        }
+        else
+        {
+            // Spaces as the RFC groups the bytes.
+            continue;
+        }
+
+        if(high < 0)
+        {
+            high = digit;
+        }
+        else
+        {
+            out.push_back(static_cast<char>((high << 4) | digit));
+            high = -1;
+        }
+    }
+    return out;
+}
+
+bool decode(native::http::hpack::decoder& decoder, const std::string& block, header_list& headers)
+{
+    headers.clear();
+    return decoder.decode(reinterpret_cast<const uint8_t*>(block.data()), block.size(),
+                          [&](const std::string& name, const std::string& value) {
+        headers.push_back(std::make_pair(name, value));
+    });
+}
+
+header_list request(const std::string& scheme, const std::string& path)
+{
+    header_list headers;
+    headers.push_back(std::make_pair(":method", "GET"));
+    headers.push_back(std::make_pair(":scheme", scheme));
+    headers.push_back(std::make_pair(":path", path));
+    headers.push_back(std::make_pair(":authority", "www.example.com"));
+    return headers;
+}
+
+header_list response(const std::string& status, const std::string& date)
+{
+    header_list headers;
+    headers.push_back(std::make_pair(":status", status));
+    headers.push_back(std::make_pair("cache-control", "private"));
+    headers.push_back(std::make_pair("date", date));
+    headers.push_back(std::make_pair("location", "https://www.example.com"));
+    return headers;
+}
+
+// The requests of RFC 7541 C.3 and C.4, which carry the same fields.
+void expect_requests(const char* first, const char* second, const char* third)
+{
+    native::http::hpack::decoder decoder;
+    header_list headers;
+
+    ASSERT_TRUE(decode(decoder, from_hex(first), headers));
+    EXPECT_EQ(request("http", "/"), headers);
+
+    header_list expected = request("http", "/");
+    expected.push_back(std::make_pair("cache-control", "no-cache"));
+    ASSERT_TRUE(decode(decoder, from_hex(second), headers));
+    EXPECT_EQ(expected, headers);
+
+    expected = request("https", "/index.html");
+    expected.push_back(std::make_pair("custom-key", "custom-value"));
+    ASSERT_TRUE(decode(decoder, from_hex(third), headers));
+    EXPECT_EQ(expected, headers);
+}
+
+// The responses of RFC 7541 C.5 and C.6, the table of 256 bytes evicts on
+// every one of them.
+void expect_responses(const char* first, const char* second, const char* third)
+{
+    native::http::hpack::decoder decoder(256);
+    header_list headers;
+
+    ASSERT_TRUE(decode(decoder, from_hex(first), headers));
+    EXPECT_EQ(response("302", "Mon, 21 Oct 2013 20:13:21 GMT"), headers);
+
+    ASSERT_TRUE(decode(decoder, from_hex(second), headers));
+    EXPECT_EQ(response("307", "Mon, 21 Oct 2013 20:13:21 GMT"), headers);
+
+    header_list expected = response("200", "Mon, 21 Oct 2013 20:13:22 GMT");
+    expected.push_back(std::make_pair("content-encoding", "gzip"));
+    expected.push_back(std::make_pair("set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"));
+    ASSERT_TRUE(decode(decoder, from_hex(third), headers));
+    EXPECT_EQ(expected, headers);
+}
+
+} // End namespace
+
+TEST(HpackTests, EncodesIntegers)
+{
+    // RFC 7541 C.1.
+    std::string out;
+    native::http::hpack::encode_integer(out, 0, 5, 10);
+    EXPECT_EQ(from_hex("0a"), out);
+
+    out.clear();
+    native::http::hpack::encode_integer(out, 0, 5, 1337);
+    EXPECT_EQ(from_hex("1f9a0a"), out);
+
+    out.clear();
+    native::http::hpack::encode_integer(out, 0, 8, 42);
+    EXPECT_EQ(from_hex("2a"), out);
+}
+
+TEST(HpackTests, DecodesHuffmanStrings)
+{
+    std::string encoded = from_hex("f1e3 c2e5 f23a 6ba0 ab90 f4ff");
+    std::string out;
+    ASSERT_TRUE(native::http::hpack::huffman_decode(reinterpret_cast<const uint8_t*>(encoded.data()), encoded.size(), out));
+    EXPECT_EQ("www.example.com", out);
+
+    // Padding longer than 7 bits isn't allowed.
+    encoded = from_hex("f1e3 c2e5 f23a 6ba0 ab90 f4ff ff");
+    EXPECT_FALSE(native::http::hpack::huffman_decode(reinterpret_cast<const uint8_t*>(encoded.data()), encoded.size(), out));
+}
+
+TEST(HpackTests, DecodesRequestsWithoutHuffman)
+{
+    expect_requests("8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+                    "8286 84be 5808 6e6f 2d63 6163 6865",
+                    "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65");
+}
+
+TEST(HpackTests, DecodesRequestsWithHuffman)
+{
+    expect_requests("8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+                    "8286 84be 5886 a8eb 1064 9cbf",
+                    "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf");
+}
+
+TEST(HpackTests, DecodesResponsesWithoutHuffman)
+{
+    expect_responses("4803 3330 3258 0770 7269 7661 7465 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133"
+                     "2032 303a 3133 3a32 3120 474d 546e 1768 7474 7073 3a2f 2f77 7777 2e65 7861 6d70"
+                     "6c65 2e63 6f6d",
+                     "4803 3330 37c1 c0bf",
+                     "88c1 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32 3220 474d"
+                     "54c0 5a04 677a 6970 7738 666f 6f3d 4153 444a 4b48 514b 425a 584f 5157 454f 5049"
+                     "5541 5851 5745 4f49 553b 206d 6178 2d61 6765 3d33 3630 303b 2076 6572 7369 6f6e"
+                     "3d31");
+}
+
+TEST(HpackTests, DecodesResponsesWithHuffman)
+{
+    expect_responses("4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81 66e0 82a6"
+                     "2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae 43d3",
+                     "4883 640e ffc1 c0bf",
+                     "88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a 839b d9ab"
+                     "77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27 0fb5 291f"
+                     "9587 3160 65c0 03ed 4ee5 b106 3d50 07");
+}
+
+TEST(HpackTests, EvictsTheOldestEntries)
+{
+    native::http::hpack::table table(100);
+    table.insert("first", "1");
+    table.insert("second", "2");
+    EXPECT_EQ("second", table.get(native::http::hpack::table::static_size + 1)->first);
+    EXPECT_EQ("first", table.get(native::http::hpack::table::static_size + 2)->first);
+
+    // 38 + 39 + 38 bytes don't fit into 100.
+    table.insert("third", "3");
+    EXPECT_EQ("third", table.get(native::http::hpack::table::static_size + 1)->first);
+    EXPECT_EQ("second", table.get(native::http::hpack::table::static_size + 2)->first);
+    EXPECT_EQ(nullptr, table.get(native::http::hpack::table::static_size + 3));
+
+    table.set_max_size(0);
+    EXPECT_EQ(nullptr, table.get(native::http::hpack::table::static_size + 1));
+}
+
+TEST(HpackTests, RejectsMalformedBlocks)
+{
+    native::http::hpack::decoder decoder;
+    header_list headers;
+
+    // Index 0 and an index past both tables.
+    EXPECT_FALSE(decode(decoder, from_hex("80"), headers));
+    native::http::hpack::decoder out_of_range;
+    EXPECT_FALSE(decode(out_of_range, from_hex("ff00"), headers));
+
+    // A literal cut off before its value.
+    native::http::hpack::decoder truncated;
+    EXPECT_FALSE(decode(truncated, from_hex("400a 6375 7374 6f6d 2d6b 6579 0c63"), headers));
+
+    // A table size update past SETTINGS_HEADER_TABLE_SIZE.
+    native::http::hpack::decoder limited(256);
+    EXPECT_FALSE(decode(limited, from_hex("3fe1 1f"), headers));
+}
+
+TEST(HpackTests, DecodesWhatItEncodes)
+{
+    native::http::hpack::encoder encoder;
+    native::http::hpack::decoder decoder;
+    header_list headers;
+
+    header_list expected;
+    expected.push_back(std::make_pair(":status", "200"));
+    expected.push_back(std::make_pair("content-type", "application/json"));
+    expected.push_back(std::make_pair("x-custom", "value"));
+    expected.push_back(std::make_pair("content-length", "42"));
+
+    // The second block refers to the entries the first one added.
+    for(int i = 0; i < 2; ++i)
+    {
+        std::string block;
+        encoder.begin(block);
+        encoder.encode_status(block, 200);
+        encoder.encode(block, "content-type", "application/json");
+        encoder.encode(block, "x-custom", "value");
+        encoder.encode(block, "content-length", "42", false);
+
+        ASSERT_TRUE(decode(decoder, block, headers));
+        EXPECT_EQ(expected, headers);
+    }
+
+    // A smaller table is announced with the next block.
+    encoder.set_max_table_size(0);
+    std::string block;
+    encoder.begin(block);
+    encoder.encode(block, "x-custom", "value");
+    ASSERT_TRUE(decode(decoder, block, headers));
+    ASSERT_EQ(1u, headers.size());
+    EXPECT_EQ("x-custom", headers[0].first);
+}
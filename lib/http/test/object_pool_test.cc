@@ -0,0 +1,40 @@
+#include "native/native.h"
+#include "native/object_pool.h"
+#include "gtest/gtest.h"
+
+namespace
+{
+struct pooled
+{
+    int value;
+};
+}
+
+TEST(ObjectPoolTests, ReusesReleasedObjects)
+{
+    native::object_pool<pooled> pool;
+
+    EXPECT_EQ(nullptr, pool.acquire());
+    EXPECT_EQ(0u, pool.hits());
+    EXPECT_EQ(1u, pool.misses());
+
+    pooled* obj = new pooled();
+    pool.release(obj);
+    EXPECT_EQ(1u, pool.cached());
+
+    EXPECT_EQ(obj, pool.acquire());
+    EXPECT_EQ(1u, pool.hits());
+    EXPECT_EQ(0u, pool.cached());
+
+    pool.release(obj);
+}
+
+TEST(ObjectPoolTests, KeepsAtMostMaxCached)
+{
+    native::object_pool<pooled> pool(1);
+
+    pool.release(new pooled());
+    pool.release(new pooled());
+
+    EXPECT_EQ(1u, pool.cached());
+}
@@ -0,0 +1,51 @@
+#include "native/native.h"
+#include "native/timer_wheel.h"
+#include "gtest/gtest.h"
+
+TEST(TimerWheelTests, ExpiresEntries)
+{
+    native::loop l;
+    native::timer_wheel wheel(l, 10, 8);
+
+    int fired = 0;
+    native::timer_wheel::entry first([&]() { ++fired; });
+    native::timer_wheel::entry second([&]() { ++fired; });
+
+    // Longer than a turn of the wheel.
+    wheel.start(first, 20);
+    wheel.start(second, 150);
+    EXPECT_EQ(2u, wheel.size());
+
+    l.run();
+
+    EXPECT_EQ(2, fired);
+    EXPECT_EQ(0u, wheel.size());
+    EXPECT_FALSE(first.is_active());
+}
+
+TEST(TimerWheelTests, StopsAndRestartsEntries)
+{
+    native::loop l;
+    native::timer_wheel wheel(l, 10, 8);
+
+    int fired = 0;
+    native::timer_wheel::entry stopped([&]() { ++fired; });
+    native::timer_wheel::entry restarted;
+    restarted.set_callback([&]() {
+        // Restarting from its own callback puts it back on the wheel.
+        if(++fired < 3)
+        {
+            wheel.start(restarted, 10);
+        }
+    });
+
+    wheel.start(stopped, 20);
+    wheel.start(restarted, 10);
+    wheel.stop(stopped);
+    EXPECT_FALSE(stopped.is_active());
+
+    l.run();
+
+    EXPECT_EQ(3, fired);
+    EXPECT_EQ(0u, wheel.size());
+}
@@ -114,6 +114,24 @@ void Action::onUnknown(HttpData& data)
   Q_UNUSED(data);
 }
 
+bool Action::isBodyStreamed() const
+{
+  return false;
+}
+
+void Action::onBodyChunk(HttpData& data, const char* chunk, size_t length)
+{
+  Q_UNUSED(data);
+  Q_UNUSED(chunk);
+  Q_UNUSED(length);
+}
+
+HttpStatus Action::admitRequest(const HttpRequest& request) const
+{
+  Q_UNUSED(request);
+  return HttpStatus::OK;
+}
+
 set<qttp::HttpPath> Action::getRoutes() const
 {
   return EMPTY_ROUTES;
@@ -39,6 +39,33 @@ class QTTPSHARED_EXPORT Action
     virtual void onConnect(HttpData& data);
     virtual void onUnknown(HttpData& data);
 
+    /**
+     * @brief Opt in to receive request bodies as they arrive rather than
+     * buffered in full.  The body of a matching request is then handed to
+     * onBodyChunk() piece by piece and getBody() stays empty, onAction() is
+     * invoked with the same HttpData once the whole body was received.
+     *
+     * Reading from the client is paused while too much of the body waits to
+     * be processed, see "server.requestBody" in the config.
+     */
+    virtual bool isBodyStreamed() const;
+
+    /**
+     * @brief Receives the next chunk of a streamed request body, before any
+     * preprocessing.  The chunk is only valid during this call.
+     */
+    virtual void onBodyChunk(HttpData& data, const char* chunk, size_t length);
+
+    /**
+     * @brief Decides on a request with a body once its headers arrived, before
+     * the body is read and before a client that sent "Expect: 100-continue"
+     * is told to go ahead.  Anything but HttpStatus::OK answers the request
+     * with that status right away and closes the connection.
+     *
+     * Runs on an I/O thread, keep it quick and thread safe.
+     */
+    virtual HttpStatus admitRequest(const HttpRequest& request) const;
+
     /**
      * @brief Override  in order to associate this action to a specific
      * HttpMethod and path (e.g. "/myroute/").
@@ -4,11 +4,26 @@ using namespace std;
 using namespace qttp;
 using namespace native::http;
 
+namespace
+{
+const size_t MAX_CACHED_EVENTS = 1024;
+
+// Shared by every I/O thread allocating and the Qt thread deleting events.
+std::mutex s_EventPoolMutex;
+std::vector<void*> s_EventPool;
+std::atomic<quint64> s_EventPoolHits(0);
+std::atomic<quint64> s_EventPoolMisses(0);
+}
+
 HttpEvent::HttpEvent() :
   QEvent(QEvent::None),
   m_Request(nullptr),
   m_Response(nullptr),
-  m_Timestamp()
+  m_Timestamp(),
+  m_BodyChunk(),
+  m_IsBodyChunk(false),
+  m_WebSocket(),
+  m_WebSocketEvent(0)
 {
 }
 
@@ -16,7 +31,36 @@ HttpEvent::HttpEvent(QttpRequest* req, QttpResponse* resp) :
   QEvent(QEvent::None),
   m_Request(req),
   m_Response(resp),
-  m_Timestamp(QDateTime::currentDateTime())
+  m_Timestamp(QDateTime::currentDateTime()),
+  m_BodyChunk(),
+  m_IsBodyChunk(false),
+  m_WebSocket(),
+  m_WebSocketEvent(0)
+{
+}
+
+HttpEvent::HttpEvent(QttpRequest* req, QttpResponse* resp, const QByteArray& chunk) :
+  QEvent(QEvent::None),
+  m_Request(req),
+  m_Response(resp),
+  m_Timestamp(),
+  m_BodyChunk(chunk),
+  m_IsBodyChunk(true),
+  m_WebSocket(),
+  m_WebSocketEvent(0)
+{
+}
+
+HttpEvent::HttpEvent(QttpRequest* req, QttpResponse* resp, const std::shared_ptr<QttpWebSocket>& socket,
+                     int webSocketEvent, const QByteArray& message) :
+  QEvent(QEvent::None),
+  m_Request(req),
+  m_Response(resp),
+  m_Timestamp(),
+  m_BodyChunk(message),
+  m_IsBodyChunk(false),
+  m_WebSocket(socket),
+  m_WebSocketEvent(webSocketEvent)
 {
 }
 
@@ -38,3 +82,76 @@ const QDateTime& HttpEvent::getTimestamp() const
 {
   return m_Timestamp;
 }
+
+bool HttpEvent::isBodyChunk() const
+{
+  return m_IsBodyChunk;
+}
+
+const QByteArray& HttpEvent::getBodyChunk() const
+{
+  return m_BodyChunk;
+}
+
+bool HttpEvent::isWebSocket() const
+{
+  return m_WebSocket != nullptr;
+}
+
+const std::shared_ptr<QttpWebSocket>& HttpEvent::getWebSocket() const
+{
+  return m_WebSocket;
+}
+
+int HttpEvent::getWebSocketEvent() const
+{
+  return m_WebSocketEvent;
+}
+
+void* HttpEvent::operator new(size_t size)
+{
+  if(size == sizeof(HttpEvent))
+  {
+    std::lock_guard<std::mutex> lock(s_EventPoolMutex);
+    if(!s_EventPool.empty())
+    {
+      void* ptr = s_EventPool.back();
+      s_EventPool.pop_back();
+      s_EventPoolHits.fetch_add(1, std::memory_order_relaxed);
+      return ptr;
+    }
+  }
+
+  s_EventPoolMisses.fetch_add(1, std::memory_order_relaxed);
+  return ::operator new(size);
+}
+
+void HttpEvent::operator delete(void* ptr, size_t size)
+{
+  if(ptr == nullptr)
+  {
+    return;
+  }
+
+  if(size == sizeof(HttpEvent))
+  {
+    std::lock_guard<std::mutex> lock(s_EventPoolMutex);
+    if(s_EventPool.size() < MAX_CACHED_EVENTS)
+    {
+      s_EventPool.push_back(ptr);
+      return;
+    }
+  }
+
+  ::operator delete(ptr);
+}
+
+quint64 HttpEvent::getPoolHits()
+{
+  return s_EventPoolHits.load(std::memory_order_relaxed);
+}
+
+quint64 HttpEvent::getPoolMisses()
+{
+  return s_EventPoolMisses.load(std::memory_order_relaxed);
+}
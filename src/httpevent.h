@@ -16,17 +16,56 @@ class QTTPSHARED_EXPORT HttpEvent : public QEvent
 
     HttpEvent();
     HttpEvent(native::http::QttpRequest*, native::http::QttpResponse*);
+
+    /**
+     * @brief A chunk of a streamed request body, delivered ahead of the
+     * request itself.  An empty chunk means the body was aborted.
+     */
+    HttpEvent(native::http::QttpRequest*, native::http::QttpResponse*, const QByteArray& chunk);
+
+    /**
+     * @brief An event of a connection upgraded to a WebSocket, see
+     * native::http::QttpWebSocket::event.  The message is kept as the body
+     * chunk.
+     */
+    HttpEvent(native::http::QttpRequest*, native::http::QttpResponse*,
+              const std::shared_ptr<native::http::QttpWebSocket>& socket,
+              int webSocketEvent, const QByteArray& message);
     virtual ~HttpEvent();
 
     native::http::QttpRequest* getRequest() const;
     native::http::QttpResponse* getResponse() const;
     const QDateTime& getTimestamp() const;
 
+    bool isBodyChunk() const;
+    const QByteArray& getBodyChunk() const;
+
+    bool isWebSocket() const;
+    const std::shared_ptr<native::http::QttpWebSocket>& getWebSocket() const;
+    int getWebSocketEvent() const;
+
+    /**
+     * @brief Events are created for every request on the I/O threads and
+     * deleted by Qt once delivered, the memory is recycled in between.
+     */
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr, size_t size);
+
+    //! Allocations served from recycled events.
+    static quint64 getPoolHits();
+
+    //! Allocations that had to go to the heap.
+    static quint64 getPoolMisses();
+
 QTTP_PRIVATE:
 
     native::http::QttpRequest * m_Request;
     native::http::QttpResponse* m_Response;
     QDateTime m_Timestamp;
+    QByteArray m_BodyChunk;
+    bool m_IsBodyChunk;
+    std::shared_ptr<native::http::QttpWebSocket> m_WebSocket;
+    int m_WebSocketEvent;
 };
 
 } // End namespace qttp
@@ -19,8 +19,7 @@ HttpRequest::~HttpRequest()
 
 bool HttpRequest::containsHeader(const QString& key) const
 {
-  auto & headers = m_Request->get_headers();
-  return headers.find(key) != headers.end();
+  return m_Request->has_header(key);
 }
 
 const QString& HttpRequest::getHeader(const QString& key) const
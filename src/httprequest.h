@@ -27,6 +27,10 @@ QTTP_PRIVATE:
 
     ~HttpRequest();
 
+    /**
+     * @brief Header names are matched case-insensitively, values are only
+     * converted to QString when first asked for.
+     */
     bool containsHeader(const QString& key) const;
     const QString& getHeader(const QString& key) const;
     bool getHeader(const QString& key, QString& value) const;
@@ -96,10 +96,53 @@ bool HttpResponse::finish(const QJsonObject& json)
 bool HttpResponse::finish(const QByteArray& bytes)
 {
   setFlag(DataControl::Finished);
-  m_Response->write(bytes.length(), bytes.constData());
+  // Shares the bytes with the response instead of copying them.
+  m_Response->write(bytes);
   return m_Response->close();
 }
 
+bool HttpResponse::finishFile(const QString& path, qint64 size)
+{
+  setFlag(DataControl::Finished);
+  return m_Response->end_file(path.toStdString(), static_cast<uint64_t>(size));
+}
+
+bool HttpResponse::beginStream()
+{
+  setFlag(DataControl::Finished);
+  return m_Response->begin_stream();
+}
+
+bool HttpResponse::writeChunk(const QByteArray& chunk)
+{
+  return m_Response->write_chunk(chunk);
+}
+
+bool HttpResponse::endStream()
+{
+  return m_Response->end_stream();
+}
+
+void HttpResponse::setStreamDrainCallback(std::function<void()> callback)
+{
+  m_Response->set_drain_callback(callback);
+}
+
+void HttpResponse::setStreamAbortCallback(std::function<void()> callback)
+{
+  m_Response->set_abort_callback(callback);
+}
+
+qint64 HttpResponse::getStreamBacklog() const
+{
+  return static_cast<qint64>(m_Response->get_stream_backlog());
+}
+
+native::http::QttpResponse* HttpResponse::getStream()
+{
+  return m_Response->is_streaming() ? m_Response : nullptr;
+}
+
 bool HttpResponse::isFinished() const
 {
   return m_ControlFlag & DataControl::Finished;
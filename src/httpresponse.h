@@ -65,6 +65,52 @@ QTTP_PRIVATE:
     bool finish(const QByteArray& bytes);
     bool finish(const QJsonObject& json);
 
+    /**
+     * @brief Finishes the response with the contents of a file.  The file is
+     * sent from the I/O loop without being read into memory first.
+     * @param size The size of the file in bytes, used as the Content-Length.
+     */
+    bool finishFile(const QString& path, qint64 size);
+
+    /**
+     * @brief Sends the status and headers right away and streams the body
+     * after them with chunked transfer-encoding.  The response counts as
+     * finished from here on, complete it with endStream().
+     */
+    bool beginStream();
+
+    /**
+     * @brief Queues a chunk that is written as soon as the socket allows.
+     * @return False once the queued bytes exceed
+     * server.responseBody.streamHighWatermark - hold off until the drain
+     * callback runs.
+     */
+    bool writeChunk(const QByteArray& chunk);
+
+    /**
+     * @brief Sends the terminating chunk.
+     */
+    bool endStream();
+
+    /**
+     * @brief Invoked on the I/O thread once a stream that reported
+     * backpressure drained to server.responseBody.streamLowWatermark.  Set it
+     * before beginStream().
+     */
+    void setStreamDrainCallback(std::function<void()> callback);
+
+    /**
+     * @brief Invoked on the I/O thread once the client went away while the
+     * stream was still open, writeChunk() fails from then on.  endStream()
+     * still has to be called.  Set it before beginStream().
+     */
+    void setStreamAbortCallback(std::function<void()> callback);
+
+    /**
+     * @return Bytes of the stream queued or still being written.
+     */
+    qint64 getStreamBacklog() const;
+
     /**
      * @return Boolean indicating if finishResponse() has been called.
      *
@@ -107,6 +153,14 @@ QTTP_PROTECTED:
      */
     const native::http::QttpResponse* getResponse();
 
+    /**
+     * @brief The response of a stream started with beginStream(), which stays
+     * valid until native::http::QttpResponse::end_stream() even after
+     * HttpData is gone.  Allows producers to keep writing chunks from any
+     * thread once the action returned.
+     */
+    native::http::QttpResponse* getStream();
+
 QTTP_PRIVATE:
 
     QTTP_DECLARE_ASSERT_MEMBER(native::http::QttpResponse)
@@ -3,6 +3,9 @@
 #include "swagger.h"
 #include "defaults.h"
 
+#include <qttp_websocket.h>
+#include <qttp_tls.h>
+
 using namespace std;
 using namespace qttp;
 using namespace native::http;
@@ -39,6 +42,10 @@ HttpServer::HttpServer() :
   m_GlobalConfig(),
   m_RoutesConfig(),
   m_Stats(new Stats()),
+  m_BodyStreams(new QHash<native::http::QttpRequest*, BodyStream>()),
+  m_StreamsBodies(false),
+  m_WebSockets(new QHash<native::http::QttpWebSocket*, std::shared_ptr<WebSocketAction> >()),
+  m_ServesWebSockets(false),
   m_LoggingUtils(),
   m_IsInitialized(false),
   m_IsSwaggerEnabled(false),
@@ -49,7 +56,17 @@ HttpServer::HttpServer() :
   m_ServeFilesDirectory(SERVE_FILES_PATH),
   m_FileLookup(),
   m_EnabledProcessors(),
-  m_ServerInfo()
+  m_ServerInfo(),
+  m_NativeOptions(),
+  m_IoThreads(1),
+  m_IsTcpEnabled(true),
+  m_LocalSocketPath(),
+  m_ListenersMutex(),
+  m_Listeners(),
+  m_Balancer(),
+  m_Workers(),
+  m_ConnectionLimiter(std::make_shared<native::http::QttpConnectionLimiter>()),
+  m_TlsContext()
 {
   this->installEventFilter(this);
 
@@ -68,6 +85,20 @@ HttpServer::~HttpServer()
   {
     delete m_Stats;
   }
+
+  if(m_BodyStreams)
+  {
+    for(auto & stream : *m_BodyStreams)
+    {
+      delete stream.data;
+    }
+    delete m_BodyStreams;
+  }
+
+  if(m_WebSockets)
+  {
+    delete m_WebSockets;
+  }
 }
 
 bool HttpServer::initialize()
@@ -310,6 +341,184 @@ void HttpServer::initGlobal(const QString &filepath)
   m_SendRequestMetadata = serverConfig["metadata"].toBool(false);
   m_StrictHttpMethod = serverConfig["strictHttpMethod"].toBool(false);
 
+  QJsonObject keepAlive = serverConfig["keepAlive"].toObject();
+  m_NativeOptions.keep_alive = keepAlive["isEnabled"].toBool(true);
+  m_NativeOptions.max_requests_per_connection = keepAlive["maxRequests"].toInt(100);
+  m_NativeOptions.keep_alive_timeout_ms = keepAlive["timeoutMs"].toInt(5000);
+  m_NativeOptions.max_pipelined_requests = qMax(1, keepAlive["maxPipelined"].toInt(16));
+
+  LOG_DEBUG("Keep-alive" << m_NativeOptions.keep_alive <<
+            "max requests" << m_NativeOptions.max_requests_per_connection <<
+            "timeout ms" << m_NativeOptions.keep_alive_timeout_ms <<
+            "max pipelined" << m_NativeOptions.max_pipelined_requests);
+
+  QJsonObject requestBody = serverConfig["requestBody"].toObject();
+  m_NativeOptions.body_stream_high_watermark = qMax(1, requestBody["streamHighWatermark"].toInt(1024 * 1024));
+  m_NativeOptions.body_stream_low_watermark = qMax(0, requestBody["streamLowWatermark"].toInt(256 * 1024));
+  if(m_NativeOptions.body_stream_low_watermark > m_NativeOptions.body_stream_high_watermark)
+  {
+    LOG_WARN("server.requestBody.streamLowWatermark is above the high watermark");
+    m_NativeOptions.body_stream_low_watermark = m_NativeOptions.body_stream_high_watermark;
+  }
+
+  QJsonObject responseBody = serverConfig["responseBody"].toObject();
+  m_NativeOptions.response_stream_high_watermark = qMax(1, responseBody["streamHighWatermark"].toInt(1024 * 1024));
+  m_NativeOptions.response_stream_low_watermark = qMax(0, responseBody["streamLowWatermark"].toInt(256 * 1024));
+  if(m_NativeOptions.response_stream_low_watermark > m_NativeOptions.response_stream_high_watermark)
+  {
+    LOG_WARN("server.responseBody.streamLowWatermark is above the high watermark");
+    m_NativeOptions.response_stream_low_watermark = m_NativeOptions.response_stream_high_watermark;
+  }
+
+  QJsonObject writeQueue = serverConfig["writeQueue"].toObject();
+  m_NativeOptions.write_queue_high_watermark = qMax(0, writeQueue["highWatermark"].toInt(1024 * 1024));
+  m_NativeOptions.write_queue_low_watermark = qMax(0, writeQueue["lowWatermark"].toInt(256 * 1024));
+  if(m_NativeOptions.write_queue_low_watermark > m_NativeOptions.write_queue_high_watermark)
+  {
+    LOG_WARN("server.writeQueue.lowWatermark is above the high watermark");
+    m_NativeOptions.write_queue_low_watermark = m_NativeOptions.write_queue_high_watermark;
+  }
+
+  QJsonObject timeouts = serverConfig["timeouts"].toObject();
+  m_NativeOptions.header_timeout_ms = qMax(0, timeouts["headerMs"].toInt(10000));
+  m_NativeOptions.body_timeout_ms = qMax(0, timeouts["bodyMs"].toInt(30000));
+  m_NativeOptions.body_min_rate = qMax(0, timeouts["bodyMinRate"].toInt(1024));
+  m_NativeOptions.write_timeout_ms = qMax(0, timeouts["writeMs"].toInt(30000));
+
+  QJsonObject limits = serverConfig["limits"].toObject();
+  m_NativeOptions.max_header_size = qMax(0, limits["maxHeaderSize"].toInt(0));
+  m_NativeOptions.max_url_length = qMax(0, limits["maxUrlLength"].toInt(0));
+  m_NativeOptions.max_body_size = static_cast<uint64_t>(qMax(0.0, limits["maxBodySize"].toDouble(0)));
+
+  QJsonObject http2 = serverConfig["http2"].toObject();
+  m_NativeOptions.http2 = http2["isEnabled"].toBool(false);
+  m_NativeOptions.http2_max_concurrent_streams = qMax(1, http2["maxConcurrentStreams"].toInt(100));
+  m_NativeOptions.http2_initial_window_size = static_cast<uint32_t>(qBound(65535.0, http2["initialWindowSize"].toDouble(1024 * 1024), 2147483647.0));
+
+  LOG_DEBUG("HTTP/2" << m_NativeOptions.http2 <<
+            "max concurrent streams" << m_NativeOptions.http2_max_concurrent_streams <<
+            "initial window" << m_NativeOptions.http2_initial_window_size);
+
+  QJsonObject webSocket = serverConfig["webSocket"].toObject();
+  m_NativeOptions.websocket_max_message_size = static_cast<uint64_t>(qMax(0.0, webSocket["maxMessageSize"].toDouble(8 * 1024 * 1024)));
+  m_NativeOptions.websocket_idle_timeout_ms = qMax(0, webSocket["idleMs"].toInt(60000));
+
+  QJsonObject tls = serverConfig["tls"].toObject();
+  if(tls["isEnabled"].toBool(false))
+  {
+#ifdef SSL_TLS_UV
+    native::http::QttpTlsOptions tlsOptions;
+    tlsOptions.cert_file = tls["certFile"].toString().toStdString();
+    tlsOptions.key_file = tls["keyFile"].toString().toStdString();
+    tlsOptions.session_cache_size = static_cast<size_t>(qMax(0, tls["sessionCacheSize"].toInt(20480)));
+    tlsOptions.session_timeout_s = qMax(1, tls["sessionTimeoutSec"].toInt(300));
+    tlsOptions.session_tickets = tls["sessionTickets"].toBool(true);
+    tlsOptions.ticket_key_file = tls["ticketKeyFile"].toString().toStdString();
+    tlsOptions.record_size = static_cast<size_t>(qBound(512, tls["recordSize"].toInt(16384), 16384));
+    tlsOptions.http2 = m_NativeOptions.http2;
+
+    auto context = std::make_shared<native::http::QttpTlsContext>();
+    if(context->init(tlsOptions))
+    {
+      m_TlsContext = context;
+      LOG_DEBUG("TLS certificate" << tls["certFile"].toString() <<
+                "session cache" << tlsOptions.session_cache_size <<
+                "tickets" << tlsOptions.session_tickets <<
+                "record size" << tlsOptions.record_size);
+    }
+    else
+    {
+      LOG_ERROR("Unable to load TLS certificate [" << tls["certFile"].toString() <<
+                "] and key [" << tls["keyFile"].toString() << "], serving cleartext");
+    }
+#else
+    LOG_WARN("server.tls is enabled but TLS was not built in, see CONFIG += SSL_TLS");
+#endif
+  }
+
+  QJsonObject shutdown = serverConfig["shutdown"].toObject();
+  m_NativeOptions.drain_timeout_ms = qMax(0, shutdown["drainTimeoutMs"].toInt(10000));
+
+  // Past the cap connections wait in the listen backlog.
+  QJsonObject connections = serverConfig["connections"].toObject();
+  int maxOpen = qMax(0, connections["maxOpen"].toInt(0));
+  int resumeBelow = qMax(0, connections["resumeAt"].toInt(maxOpen - maxOpen / 10));
+  if(resumeBelow > maxOpen)
+  {
+    LOG_WARN("server.connections.resumeAt is above maxOpen");
+    resumeBelow = maxOpen;
+  }
+  m_ConnectionLimiter = std::make_shared<native::http::QttpConnectionLimiter>(maxOpen, resumeBelow);
+
+  QJsonObject socket = serverConfig["socket"].toObject();
+  m_NativeOptions.tcp_nodelay = socket["noDelay"].toBool(true);
+  m_NativeOptions.tcp_keepalive = socket["keepAlive"].toBool(false);
+  m_NativeOptions.tcp_keepalive_delay_s = qMax(1, socket["keepAliveDelaySec"].toInt(60));
+  m_NativeOptions.defer_accept_s = qMax(0, socket["deferAcceptSec"].toInt(0));
+  m_NativeOptions.fast_open_queue = qMax(0, socket["fastOpenQueue"].toInt(0));
+  m_NativeOptions.receive_buffer_size = qMax(0, socket["receiveBufferSize"].toInt(0));
+  m_NativeOptions.send_buffer_size = qMax(0, socket["sendBufferSize"].toInt(0));
+  m_NativeOptions.ipv6_only = socket["ipv6Only"].toBool(false);
+  m_NativeOptions.listen_backlog = qMax(1, socket["backlog"].toInt(511));
+
+  LOG_DEBUG("Socket nodelay" << m_NativeOptions.tcp_nodelay <<
+            "keep-alive" << m_NativeOptions.tcp_keepalive <<
+            "defer accept s" << m_NativeOptions.defer_accept_s <<
+            "fast open" << m_NativeOptions.fast_open_queue <<
+            "backlog" << m_NativeOptions.listen_backlog);
+
+  // A proxy on the same host can skip the TCP stack, next to or instead of
+  // bindIp:bindPort.
+  QJsonObject unixSocket = serverConfig["unixSocket"].toObject();
+  m_LocalSocketPath = unixSocket["path"].toString().trimmed();
+  m_IsTcpEnabled = unixSocket["isTcpEnabled"].toBool(true);
+  QString mode = unixSocket["mode"].toString().trimmed();
+  if(!mode.isEmpty())
+  {
+    bool isValid = false;
+    m_NativeOptions.local_socket_mode = mode.toInt(&isValid, 8);
+    if(!isValid)
+    {
+      LOG_WARN("server.unixSocket.mode is not an octal number" << mode);
+      m_NativeOptions.local_socket_mode = 0;
+    }
+  }
+  if(!m_IsTcpEnabled && m_LocalSocketPath.isEmpty())
+  {
+    LOG_WARN("server.unixSocket.isTcpEnabled is false without a path");
+    m_IsTcpEnabled = true;
+  }
+  LOG_DEBUG("Unix socket" << m_LocalSocketPath << "TCP" << m_IsTcpEnabled);
+
+  // Either each extra thread runs its own loop and listener and the kernel
+  // balances connections between them through SO_REUSEPORT, or a single
+  // acceptor on the default loop hands them to the I/O threads.
+  m_IoThreads = qMax(1, serverConfig["ioThreads"].toInt(1));
+  QString ioBalancing = serverConfig["ioBalancing"].toString("reusePort");
+  if(ioBalancing == "roundRobin")
+  {
+    m_Balancer.reset(new native::http::QttpRoundRobinBalancer());
+  }
+  else if(ioBalancing == "leastConnections")
+  {
+    m_Balancer.reset(new native::http::QttpLeastConnectionsBalancer());
+  }
+  else if(ioBalancing != "reusePort")
+  {
+    LOG_WARN("Unknown server.ioBalancing" << ioBalancing << "using reusePort");
+  }
+#ifdef Q_OS_WIN
+  if(m_Balancer)
+  {
+    // Handing off relies on dup(), a single loop does everything instead.
+    LOG_WARN("server.ioBalancing" << ioBalancing << "is not supported on Windows");
+    m_Balancer.reset();
+    m_IoThreads = 1;
+  }
+#endif
+  m_NativeOptions.reuse_port = (m_IoThreads > 1 && !m_Balancer);
+  LOG_DEBUG("I/O threads" << m_IoThreads << "balancing" << ioBalancing);
+
   QJsonObject processors = serverConfig["processors"].toObject();
   keys = processors.keys();
   for(QString key : keys)
@@ -468,8 +677,53 @@ void HttpServer::startServer()
                    &QCoreApplication::aboutToQuit,
                    quitCB);
 
+  // Decided once, the I/O threads only read it.
+  for(auto & action : m_Actions)
+  {
+    if(action && action->isBodyStreamed())
+    {
+      m_StreamsBodies = true;
+    }
+    if(std::dynamic_pointer_cast<WebSocketAction>(action))
+    {
+      m_ServesWebSockets = true;
+    }
+  }
+
+  if(m_Balancer)
+  {
+    // The acceptor hands connections to these, so they have to exist before
+    // it starts.  Like the default loop they live as long as the process.
+    for(int i = 0; i < m_IoThreads; ++i)
+    {
+      auto loop = new native::loop();
+      auto worker = new native::http::Qttp(*loop);
+      worker->set_options(m_NativeOptions);
+      worker->set_connection_limiter(m_ConnectionLimiter);
+      worker->set_tls_context(m_TlsContext);
+      m_Workers.push_back(worker);
+
+      std::thread workerThread(HttpServer::startHandoffWorker, loop, worker);
+      workerThread.detach();
+    }
+  }
+
   std::thread newThread(HttpServer::start);
   newThread.detach();
+
+  // The extra loops only share the TCP port, the Unix socket belongs to the
+  // default loop.
+  if(!m_Balancer && m_IsTcpEnabled)
+  {
+    QString ip = m_GlobalConfig.value("bindIp").toString("0.0.0.0").trimmed();
+    auto port = m_GlobalConfig.value("bindPort").toInt(8080);
+
+    for(int i = 1; i < m_IoThreads; ++i)
+    {
+      std::thread workerThread(HttpServer::startWorker, ip, port);
+      workerThread.detach();
+    }
+  }
 }
 
 void HttpServer::startServer(QString ip, int port)
@@ -483,39 +737,372 @@ int HttpServer::start()
 {
   HttpServer* svr = HttpServer::getInstance();
 
-  QString ip = svr->m_GlobalConfig["bindIp"].toString("0.0.0.0").trimmed();
-  auto port = svr->m_GlobalConfig["bindPort"].toInt(8080);
+  // Read-only access, worker threads may be looking at the config too.
+  const QJsonObject& config = svr->m_GlobalConfig;
+  QString ip = svr->m_IsTcpEnabled ? config.value("bindIp").toString("0.0.0.0").trimmed() : QString();
+  auto port = config.value("bindPort").toInt(8080);
+
+  return svr->runLoop(native::loop::get_default(), ip, port, svr->m_LocalSocketPath);
+}
+
+int HttpServer::startWorker(QString ip, int port)
+{
+  native::loop loop;
+  auto result = HttpServer::getInstance()->runLoop(loop, ip, port, QString());
+
+  // Give the closed listener a chance to clean up before the loop goes away.
+  loop.run_nowait();
+  return result;
+}
+
+int HttpServer::startHandoffWorker(native::loop* loop, native::http::Qttp* worker)
+{
+  HttpServer* svr = HttpServer::getInstance();
+  svr->setupBodyStreaming(*worker);
+  svr->setupAdmission(*worker);
+  svr->setupWebSockets(*worker);
+  worker->serve(svr->nativeCallback());
+  return svr->runListener(*loop, *worker);
+}
+
+std::function<void(QttpRequest&, QttpResponse&)> HttpServer::nativeCallback()
+{
+  HttpServer* svr = this;
+  return [svr](QttpRequest& req, QttpResponse& resp) {
+           HttpEvent* event = new HttpEvent(&req, &resp);
+           QCoreApplication::postEvent(svr, event);
+         };
+}
+
+void HttpServer::setupBodyStreaming(native::http::Qttp& server)
+{
+  if(!m_StreamsBodies)
+  {
+    return;
+  }
+
+  HttpServer* svr = this;
+  auto filter = [svr](QttpRequest& req) {
+                  HttpMethod method = svr->m_StrictHttpMethod ?
+                                      Utils::fromString(req.get_method()) :
+                                      Utils::fromPartialString(req.get_method());
+                  auto action = svr->matchAction(method, QString::fromUtf8(req.url().path()));
+                  return action && action->isBodyStreamed();
+                };
+
+  auto bodyCallback = [svr](QttpRequest& req, QttpResponse& resp, const QByteArray& chunk) {
+                        HttpEvent* event = new HttpEvent(&req, &resp, chunk);
+                        QCoreApplication::postEvent(svr, event);
+                      };
 
-  auto callback = [svr](QttpRequest& req, QttpResponse& resp) {
-                    HttpEvent* event = new HttpEvent(&req, &resp);
+  server.set_body_streaming(filter, bodyCallback);
+}
+
+void HttpServer::setupAdmission(native::http::Qttp& server)
+{
+  HttpServer* svr = this;
+  auto admission = [svr](QttpRequest& req) {
+                     HttpRequest request(&req);
+                     auto action = svr->matchAction(request.getMethod(svr->m_StrictHttpMethod),
+                                                    request.getUrl().getPath());
+
+                     // Requests without a route are left to the preprocessors
+                     // and the default action.
+                     HttpStatus status = action ? action->admitRequest(request) : HttpStatus::OK;
+                     return (status == HttpStatus::OK) ? 0 : static_cast<int>(status);
+                   };
+
+  server.set_admission(admission);
+}
+
+void HttpServer::setupWebSockets(native::http::Qttp& server)
+{
+  if(!m_ServesWebSockets)
+  {
+    return;
+  }
+
+  HttpServer* svr = this;
+  auto filter = [svr](QttpRequest& req) {
+                  auto action = svr->matchAction(HttpMethod::GET, QString::fromUtf8(req.url().path()));
+                  return dynamic_cast<WebSocketAction*>(action.get()) != nullptr;
+                };
+
+  auto callback = [svr](QttpRequest& req, QttpResponse& resp, const std::shared_ptr<QttpWebSocket>& socket,
+                        int webSocketEvent, const QByteArray& message) {
+                    HttpEvent* event = new HttpEvent(&req, &resp, socket, webSocketEvent, message);
                     QCoreApplication::postEvent(svr, event);
                   };
 
-  native::http::Qttp server;
-  auto result = server.listen(ip.toStdString(), port, callback);
+  server.set_websocket(filter, callback);
+}
+
+std::shared_ptr<Action> HttpServer::matchAction(HttpMethod method, const QString& path) const
+{
+  if(method < 0 || method >= (int) m_Routes.size())
+  {
+    return nullptr;
+  }
+
+  QUrlQuery parameters;
+  auto & routes = m_Routes.at(method);
+  for(auto route = routes.begin(); route != routes.end(); ++route)
+  {
+    parameters.clear();
+    if(HttpServer::matchUrl(route.value().parts, path, parameters))
+    {
+      auto action = m_Actions.find(route.value().action);
+      return (action != m_Actions.end()) ? action.value() : nullptr;
+    }
+  }
+  return nullptr;
+}
+
+void HttpServer::processBodyChunk(HttpEvent* event)
+{
+  QttpRequest* request = event->getRequest();
+  const QByteArray& chunk = event->getBodyChunk();
+  auto stream = m_BodyStreams->find(request);
+
+  if(chunk.isEmpty())
+  {
+    // The connection went away before the body was complete.
+    if(stream != m_BodyStreams->end())
+    {
+      delete stream->data;
+      m_BodyStreams->erase(stream);
+    }
+    request->consume_body(0);
+    return;
+  }
+
+  if(stream == m_BodyStreams->end())
+  {
+    BodyStream bodyStream;
+    bodyStream.data = new HttpData(request, event->getResponse());
+    HttpRequest& httpRequest = bodyStream.data->getRequest();
+    bodyStream.action = matchAction(httpRequest.getMethod(m_StrictHttpMethod), httpRequest.getUrl().getPath());
+    stream = m_BodyStreams->insert(request, bodyStream);
+  }
+
+  try
+  {
+    if(stream->action)
+    {
+      stream->action->onBodyChunk(*stream->data, chunk.constData(), static_cast<size_t>(chunk.size()));
+    }
+  }
+  catch(const std::exception& e)
+  {
+    LOG_ERROR("Exception caught while streaming a body" << e.what());
+  }
+  catch(...)
+  {
+    LOG_ERROR("Exception caught while streaming a body");
+  }
+
+  request->consume_body(static_cast<size_t>(chunk.size()));
+}
+
+HttpData* HttpServer::takeBodyStream(QttpRequest* request) const
+{
+  if(m_BodyStreams->isEmpty())
+  {
+    return nullptr;
+  }
+
+  auto stream = m_BodyStreams->find(request);
+  if(stream == m_BodyStreams->end())
+  {
+    return nullptr;
+  }
+
+  HttpData* data = stream->data;
+  m_BodyStreams->erase(stream);
+  return data;
+}
+
+void HttpServer::processWebSocket(HttpEvent* event)
+{
+  QttpRequest* request = event->getRequest();
+  const QByteArray& message = event->getBodyChunk();
+  const std::shared_ptr<QttpWebSocket>& nativeSocket = event->getWebSocket();
+  WebSocket socket(nativeSocket);
+
+  try
+  {
+    switch(event->getWebSocketEvent())
+    {
+      case QttpWebSocket::opened:
+      {
+        // The handshake request stays valid until the closed event.
+        HttpRequest httpRequest(request);
+        auto action = std::dynamic_pointer_cast<WebSocketAction>(matchAction(HttpMethod::GET, httpRequest.getUrl().getPath()));
+        if(action)
+        {
+          m_WebSockets->insert(nativeSocket.get(), action);
+          action->onOpen(socket, httpRequest);
+        }
+        else
+        {
+          socket.close(1011);
+        }
+        break;
+      }
+
+      case QttpWebSocket::text_message:
+      case QttpWebSocket::binary_message:
+      {
+        auto action = m_WebSockets->value(nativeSocket.get());
+        if(action)
+        {
+          action->onMessage(socket, message, event->getWebSocketEvent() == QttpWebSocket::binary_message);
+        }
+        break;
+      }
+
+      case QttpWebSocket::closed:
+      {
+        auto action = m_WebSockets->take(nativeSocket.get());
+        if(action)
+        {
+          action->onClose(socket, nativeSocket->get_close_code());
+        }
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+  catch(const std::exception& e)
+  {
+    LOG_ERROR("Exception caught while handling a WebSocket" << e.what());
+  }
+  catch(...)
+  {
+    LOG_ERROR("Exception caught while handling a WebSocket");
+  }
+
+  // Lets the I/O thread read further and, after the closed event, recycle
+  // the connection.
+  request->consume_body(static_cast<size_t>(message.size()));
+}
+
+int HttpServer::runLoop(native::loop& loop, const QString& ip, int port, const QString& localPath)
+{
+  HttpServer* svr = this;
+
+  native::http::Qttp server(loop);
+  server.set_options(svr->m_NativeOptions);
+  server.set_connection_limiter(m_ConnectionLimiter);
+  server.set_tls_context(m_TlsContext);
+  setupBodyStreaming(server);
+  setupAdmission(server);
+  setupWebSockets(server);
+
+  if(!m_Workers.empty())
+  {
+    server.set_workers(m_Workers, m_Balancer);
+  }
+
+  QString address = ip.isEmpty() ? localPath : (ip + ":" + QString::number(port));
+  bool result = ip.isEmpty() || server.listen(ip.toStdString(), port, nativeCallback());
+
+  if(result && !localPath.isEmpty())
+  {
+    address = localPath;
+    result = server.listen_local(localPath.toStdString(), nativeCallback());
+  }
 
   if(!result)
   {
-    LOG_ERROR("Unable to bind to" << ip << ":" << port);
+    LOG_ERROR("Unable to bind to" << address);
 
     if(svr->m_ServerErrorCallback)
     {
       svr->m_ServerErrorCallback();
     }
 
-    LOG_FATAL(ip << ":" << port << " " << SERVER_ERROR_MSG);
+    LOG_FATAL(address << " " << SERVER_ERROR_MSG);
     return 1;
   }
 
-  LOG_INFO("Server pid" << QCoreApplication::applicationPid() <<
-           "running at" << ip << port);
+  if(!ip.isEmpty())
+  {
+    LOG_INFO("Server pid" << QCoreApplication::applicationPid() <<
+             "running at" << ip << port);
+  }
+  if(!localPath.isEmpty())
+  {
+    LOG_INFO("Server pid" << QCoreApplication::applicationPid() <<
+             "running at" << localPath);
+  }
+
+  return runListener(loop, server);
+}
+
+int HttpServer::runListener(native::loop& loop, native::http::Qttp& server)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_ListenersMutex);
+    m_Listeners.push_back(&server);
+  }
+
+  auto status = loop.run();
+
+  {
+    std::lock_guard<std::mutex> lock(m_ListenersMutex);
+    m_Listeners.erase(std::remove(m_Listeners.begin(), m_Listeners.end(), &server), m_Listeners.end());
+  }
 
-  return native::run();
+  return status;
 }
 
 void HttpServer::stop()
 {
-  native::stop();
+  HttpServer* svr = HttpServer::getInstance();
+  {
+    std::lock_guard<std::mutex> lock(svr->m_ListenersMutex);
+    for(auto listener : svr->m_Listeners)
+    {
+      listener->shutdown();
+    }
+  }
+
+  quint64 drainTimeoutMs = svr->m_NativeOptions.drain_timeout_ms;
+  if(drainTimeoutMs == 0)
+  {
+    return;
+  }
+
+  // Responses still being produced by actions need the event loop of this
+  // object to ever finish, which is winding down when called on quitting.
+  bool isEventThread = QThread::currentThread() == svr->thread();
+
+  // Each loop stops on its own by the deadline, the extra second covers the
+  // resolution of their timers.
+  QElapsedTimer timer;
+  timer.start();
+  while(static_cast<quint64>(timer.elapsed()) < drainTimeoutMs + 1000)
+  {
+    {
+      std::lock_guard<std::mutex> lock(svr->m_ListenersMutex);
+      if(svr->m_Listeners.empty())
+      {
+        break;
+      }
+    }
+
+    if(isEventThread)
+    {
+      QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    }
+    else
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
 }
 
 void HttpServer::setServerErrorCallback(function<void()> serverErrorCallback)
@@ -539,7 +1126,11 @@ function<void(HttpEvent*)> HttpServer::defaultEventCallback() const
          {
            STATS_INC("http:hits");
 
-           HttpData data(event->getRequest(), event->getResponse());
+           // A streamed body already went to the action with its own data.
+           std::unique_ptr<HttpData, void(*)(HttpData*)> streamed(takeBodyStream(event->getRequest()),
+                                                                   [](HttpData* d) { delete d; });
+           HttpData local(event->getRequest(), event->getResponse());
+           HttpData& data = streamed ? *streamed : local;
            data.setTimestamp(event->getTimestamp());
 
            HttpResponse& response = data.getResponse();
@@ -860,7 +1451,6 @@ bool HttpServer::searchAndServeFile(HttpData& data) const
   }
 
   QString filepath = QDir::cleanPath(m_ServeFilesDirectory.absoluteFilePath(urlPath));
-  QFile file(filepath);
 
   // NOTE:
   // Won't need this check when/if we support multiple directories.
@@ -877,7 +1467,6 @@ bool HttpServer::searchAndServeFile(HttpData& data) const
      QFile::exists(filepath + "/index.html"))
   {
     filepath += "/index.html";
-    file.setFileName(filepath);
     LOG_DEBUG("Detected index.html [" << filepath << "]");
   }
 
@@ -887,7 +1476,8 @@ bool HttpServer::searchAndServeFile(HttpData& data) const
     return false;
   }
 
-  if(!file.open(QIODevice::ReadOnly))
+  QFileInfo fileInfo(filepath);
+  if(!fileInfo.isFile() || !fileInfo.isReadable())
   {
     LOG_DEBUG("Unable to read file [" << filepath << "]");
     return false;
@@ -897,14 +1487,10 @@ bool HttpServer::searchAndServeFile(HttpData& data) const
 
   QString contentType = FileUtils::determineContentType(urlPath);
 
-  // TODO: -- Move this into FileUtils::LoadFile
-  // where we can manage opening and closing.
-
+  // The I/O loop streams the file straight to the socket.
   auto& response = data.getResponse();
   response.setHeader("Content-Type", contentType);
-  auto result = response.finish(file.readAll());
-  file.close();
-  return result;
+  return response.finishFile(filepath, fileInfo.size());
 }
 
 bool HttpServer::eventFilter(QObject* object, QEvent* event)
@@ -928,6 +1514,18 @@ bool HttpServer::eventFilter(QObject* object, QEvent* event)
     return false;
   }
 
+  if(httpEvent->isWebSocket())
+  {
+    processWebSocket(httpEvent);
+    return true;
+  }
+
+  if(httpEvent->isBodyChunk())
+  {
+    processBodyChunk(httpEvent);
+    return true;
+  }
+
   m_EventCallback(httpEvent);
   return true;
 }
@@ -1129,9 +1727,112 @@ void HttpServer::addPostprocessor(std::function<void(HttpData& data)> callback)
 Stats& HttpServer::getStats()
 {
   Q_ASSERT(m_Stats);
+  updateNativeStats();
   return *m_Stats;
 }
 
+void HttpServer::updateNativeStats()
+{
+#ifdef QTTP_COLLECT_STATS
+  quint64 hits = 0;
+  quint64 misses = 0;
+  quint64 contextHits = 0;
+  quint64 contextMisses = 0;
+  quint64 requestHits = 0;
+  quint64 requestMisses = 0;
+  quint64 responseHits = 0;
+  quint64 responseMisses = 0;
+  quint64 writeQueueHighHits = 0;
+  quint64 writeQueueLowHits = 0;
+  quint64 headerTimeouts = 0;
+  quint64 bodyTimeouts = 0;
+  quint64 idleTimeouts = 0;
+  quint64 writeTimeouts = 0;
+  quint64 headersTooLarge = 0;
+  quint64 urlsTooLong = 0;
+  quint64 bodiesTooLarge = 0;
+  quint64 continues = 0;
+  quint64 admissionRejects = 0;
+  quint64 http2Connections = 0;
+  quint64 http2Streams = 0;
+  quint64 webSocketConnections = 0;
+  quint64 webSocketMessages = 0;
+  quint64 tlsHandshakes = 0;
+  quint64 tlsResumedHandshakes = 0;
+  quint64 tlsFailures = 0;
+  {
+    std::lock_guard<std::mutex> lock(m_ListenersMutex);
+    for(auto listener : m_Listeners)
+    {
+      auto& pool = listener->get_loop().get_buffer_pool();
+      hits += pool.hits();
+      misses += pool.misses();
+      contextHits += listener->get_context_pool().hits();
+      contextMisses += listener->get_context_pool().misses();
+      requestHits += listener->get_request_pool().hits();
+      requestMisses += listener->get_request_pool().misses();
+      responseHits += listener->get_response_pool().hits();
+      responseMisses += listener->get_response_pool().misses();
+      writeQueueHighHits += listener->get_stats().write_queue_high_hits;
+      writeQueueLowHits += listener->get_stats().write_queue_low_hits;
+      headerTimeouts += listener->get_stats().header_timeouts;
+      bodyTimeouts += listener->get_stats().body_timeouts;
+      idleTimeouts += listener->get_stats().idle_timeouts;
+      writeTimeouts += listener->get_stats().write_timeouts;
+      headersTooLarge += listener->get_stats().headers_too_large;
+      urlsTooLong += listener->get_stats().urls_too_long;
+      bodiesTooLarge += listener->get_stats().bodies_too_large;
+      continues += listener->get_stats().continues;
+      admissionRejects += listener->get_stats().admission_rejects;
+      http2Connections += listener->get_stats().http2_connections;
+      http2Streams += listener->get_stats().http2_streams;
+      webSocketConnections += listener->get_stats().websocket_connections;
+      webSocketMessages += listener->get_stats().websocket_messages;
+      tlsHandshakes += listener->get_stats().tls_handshakes;
+      tlsResumedHandshakes += listener->get_stats().tls_resumed_handshakes;
+      tlsFailures += listener->get_stats().tls_failures;
+    }
+  }
+  STATS_SET("native:readBuffers:hits", hits);
+  STATS_SET("native:readBuffers:misses", misses);
+  STATS_SET("native:pools:contexts:hits", contextHits);
+  STATS_SET("native:pools:contexts:misses", contextMisses);
+  STATS_SET("native:pools:requests:hits", requestHits);
+  STATS_SET("native:pools:requests:misses", requestMisses);
+  STATS_SET("native:pools:responses:hits", responseHits);
+  STATS_SET("native:pools:responses:misses", responseMisses);
+  STATS_SET("native:pools:events:hits", HttpEvent::getPoolHits());
+  STATS_SET("native:pools:events:misses", HttpEvent::getPoolMisses());
+  STATS_SET("native:writeQueue:highWatermarkHits", writeQueueHighHits);
+  STATS_SET("native:writeQueue:lowWatermarkHits", writeQueueLowHits);
+  STATS_SET("native:timeouts:header", headerTimeouts);
+  STATS_SET("native:timeouts:body", bodyTimeouts);
+  STATS_SET("native:timeouts:idle", idleTimeouts);
+  STATS_SET("native:timeouts:write", writeTimeouts);
+  STATS_SET("native:rejected:headerTooLarge", headersTooLarge);
+  STATS_SET("native:rejected:urlTooLong", urlsTooLong);
+  STATS_SET("native:rejected:bodyTooLarge", bodiesTooLarge);
+  STATS_SET("native:rejected:admission", admissionRejects);
+  STATS_SET("native:expect:continues", continues);
+  STATS_SET("native:http2:connections", http2Connections);
+  STATS_SET("native:http2:streams", http2Streams);
+  STATS_SET("native:webSocket:connections", webSocketConnections);
+  STATS_SET("native:webSocket:messages", webSocketMessages);
+  STATS_SET("native:tls:handshakes", tlsHandshakes);
+  STATS_SET("native:tls:resumedHandshakes", tlsResumedHandshakes);
+  STATS_SET("native:tls:failures", tlsFailures);
+#ifdef SSL_TLS_UV
+  if(m_TlsContext)
+  {
+    STATS_SET("native:tls:cachedSessions", static_cast<quint64>(m_TlsContext->get_cached_sessions()));
+  }
+#endif
+  STATS_SET("native:connections:open", m_ConnectionLimiter->get_open());
+  STATS_SET("native:connections:peak", m_ConnectionLimiter->get_peak());
+  STATS_SET("native:connections:deferredAccepts", static_cast<quint64>(m_ConnectionLimiter->get_deferred()));
+#endif
+}
+
 LoggingUtils& HttpServer::getLoggingUtils()
 {
   return m_LoggingUtils;
@@ -6,6 +6,7 @@
 #include "action.h"
 #include "httpdata.h"
 #include "httpevent.h"
+#include "websocket.h"
 #include "fileutils.h"
 
 #ifdef QTTP_COLLECT_STATS
@@ -44,6 +45,24 @@ class QTTPSHARED_EXPORT HttpServer : public QObject
     void startServer(QString ip, int port);
 
     static int start();
+
+    /**
+     * @brief Runs an additional listener on its own libuv loop, used when
+     * server.ioThreads is greater than one.
+     */
+    static int startWorker(QString ip, int port);
+
+    /**
+     * @brief Runs a loop serving the connections handed over by the acceptor,
+     * used when server.ioBalancing is roundRobin or leastConnections.
+     */
+    static int startHandoffWorker(native::loop* loop, native::http::Qttp* worker);
+
+    /**
+     * @brief Stops accepting and waits up to server.shutdown.drainTimeoutMs
+     * for the requests in flight to be answered before every loop started by
+     * startServer() stops, safe to call from any thread.
+     */
     static void stop();
 
     /**
@@ -295,6 +314,61 @@ QTTP_PRIVATE:
      */
     static bool matchUrl(const QStringList& pathParts, const QString& path, QUrlQuery& responseParams);
 
+    /**
+     * @brief Binds a native listener on the given loop and runs the loop
+     * until it is stopped.  An empty ip skips TCP, localPath is the Unix
+     * domain socket to listen on as well, if any.
+     */
+    int runLoop(native::loop& loop, const QString& ip, int port, const QString& localPath);
+
+    /// @brief Runs the loop until stop() and keeps the listener reachable.
+    int runListener(native::loop& loop, native::http::Qttp& server);
+
+    /// @brief Copies the counters kept by the libuv loops into m_Stats.
+    void updateNativeStats();
+
+    /// @brief Posts every parsed request as an HttpEvent to this object.
+    std::function<void(native::http::QttpRequest&, native::http::QttpResponse&)> nativeCallback();
+
+    /**
+     * @brief Streams the bodies of requests routed to an action that opted in
+     * with Action::isBodyStreamed(), the chunks are posted as HttpEvents too.
+     */
+    void setupBodyStreaming(native::http::Qttp& server);
+
+    /**
+     * @brief Lets the action a request with a body is routed to turn it down
+     * with Action::admitRequest() before the body is read.
+     */
+    void setupAdmission(native::http::Qttp& server);
+
+    /**
+     * @brief Upgrades GET requests routed to a WebSocketAction that ask for a
+     * WebSocket, the events of the connection are posted as HttpEvents.
+     */
+    void setupWebSockets(native::http::Qttp& server);
+
+    /**
+     * @brief Looks up the action routed to by method and path, safe from the
+     * I/O threads once the server started.
+     */
+    std::shared_ptr<Action> matchAction(HttpMethod method, const QString& path) const;
+
+    /// @brief Hands a streamed body chunk to its action, see Action::onBodyChunk().
+    void processBodyChunk(HttpEvent* event);
+
+    /// @brief The HttpData a streamed body was handed out with, if any.
+    HttpData* takeBodyStream(native::http::QttpRequest* request) const;
+
+    /// @brief Hands an event of an upgraded connection to its WebSocketAction.
+    void processWebSocket(HttpEvent* event);
+
+    struct BodyStream
+    {
+      HttpData* data;
+      std::shared_ptr<Action> action;
+    };
+
     /// @brief Private constructor per singleton design.
     HttpServer();
 
@@ -318,6 +392,12 @@ QTTP_PRIVATE:
     QJsonObject m_GlobalConfig;
     QJsonObject m_RoutesConfig;
     Stats* m_Stats; //! To work around const captures this is a pointer.
+    //! Streamed bodies in progress, a pointer for the same reason as m_Stats.
+    QHash<native::http::QttpRequest*, BodyStream>* m_BodyStreams;
+    bool m_StreamsBodies;
+    //! Open WebSockets and the action each one belongs to.
+    QHash<native::http::QttpWebSocket*, std::shared_ptr<WebSocketAction> >* m_WebSockets;
+    bool m_ServesWebSockets;
     LoggingUtils m_LoggingUtils;
     bool m_IsInitialized;
     bool m_IsSwaggerEnabled;
@@ -329,6 +409,19 @@ QTTP_PRIVATE:
     FileUtils m_FileLookup;
     QStringList m_EnabledProcessors;
     ServerInfo m_ServerInfo;
+    native::http::QttpOptions m_NativeOptions;
+    int m_IoThreads;
+    //! server.unixSocket, bindIp:bindPort is skipped unless TCP is enabled.
+    bool m_IsTcpEnabled;
+    QString m_LocalSocketPath;
+    std::mutex m_ListenersMutex;
+    std::vector<native::http::Qttp*> m_Listeners;
+    std::shared_ptr<native::http::QttpBalancer> m_Balancer;
+    std::vector<native::http::Qttp*> m_Workers;
+    //! Shared by every listener and worker.
+    std::shared_ptr<native::http::QttpConnectionLimiter> m_ConnectionLimiter;
+    //! server.tls, shared like the limiter so sessions resume on any loop.
+    std::shared_ptr<native::http::QttpTlsContext> m_TlsContext;
 };
 
 } // End namespace qttp
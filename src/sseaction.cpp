@@ -0,0 +1,195 @@
+#include "sseaction.h"
+
+using namespace std;
+using namespace qttp;
+using namespace native::http;
+
+namespace
+{
+
+//! Appends "<field>: <value>\n" with line breaks in value left out.
+void appendField(QByteArray& out, const char* field, const QByteArray& value)
+{
+  out.append(field);
+  out.append(": ", 2);
+  for(char c : value)
+  {
+    if(c != '\n' && c != '\r')
+    {
+      out.append(c);
+    }
+  }
+  out.append('\n');
+}
+
+} // End namespace
+
+SseAction::SseAction() :
+  Action(),
+  m_Mutex(),
+  m_Subscribers(),
+  m_Joining()
+{
+}
+
+SseAction::~SseAction()
+{
+}
+
+void SseAction::onAction(HttpData& data)
+{
+  auto& response = data.getResponse();
+  response.setHeader("Content-Type", "text/event-stream");
+  response.setHeader("Cache-Control", "no-cache");
+  // Keeps nginx from buffering the stream.
+  response.setHeader("X-Accel-Buffering", "no");
+
+  if(!response.beginStream())
+  {
+    return;
+  }
+
+  QttpResponse* stream = response.getStream();
+  {
+    lock_guard<mutex> lock(m_Mutex);
+    m_Joining[stream];
+  }
+
+  // Not under m_Mutex, so onSubscribe() may publish as well.
+  onSubscribe(data);
+
+  lock_guard<mutex> lock(m_Mutex);
+  auto joining = m_Joining.find(stream);
+  if(joining == m_Joining.end())
+  {
+    // closeAll() ran in the meantime.
+    stream->end_stream();
+    return;
+  }
+
+  vector<QByteArray> heldBack;
+  heldBack.swap(joining->second);
+  m_Joining.erase(joining);
+  for(const QByteArray& serialized : heldBack)
+  {
+    if(stream->is_stream_aborted() || !stream->write_chunk(serialized))
+    {
+      stream->end_stream();
+      return;
+    }
+  }
+  m_Subscribers.push_back(stream);
+}
+
+void SseAction::onSubscribe(HttpData& data)
+{
+  Q_UNUSED(data);
+}
+
+int SseAction::publish(const QByteArray& data, const QString& event, const QString& id)
+{
+  return broadcast(serialize(data, event, id));
+}
+
+int SseAction::broadcast(const QByteArray& serialized)
+{
+  lock_guard<mutex> lock(m_Mutex);
+
+  int count = 0;
+  auto it = m_Subscribers.begin();
+  while(it != m_Subscribers.end())
+  {
+    QttpResponse* stream = *it;
+    if(!stream->is_stream_aborted() && stream->write_chunk(serialized))
+    {
+      ++count;
+      ++it;
+      continue;
+    }
+
+    // Gone or too far behind, the client reconnects if it is still around.
+    if(!stream->is_stream_aborted())
+    {
+      ++count;
+    }
+    stream->end_stream();
+    it = m_Subscribers.erase(it);
+  }
+
+  for(auto& joining : m_Joining)
+  {
+    joining.second.push_back(serialized);
+    ++count;
+  }
+  return count;
+}
+
+int SseAction::heartbeat()
+{
+  static const QByteArray comment(":\n\n");
+  return broadcast(comment);
+}
+
+void SseAction::closeAll()
+{
+  lock_guard<mutex> lock(m_Mutex);
+  for(auto stream : m_Subscribers)
+  {
+    stream->end_stream();
+  }
+  m_Subscribers.clear();
+  // Their onAction() ends them once onSubscribe() returned.
+  m_Joining.clear();
+}
+
+int SseAction::getSubscriberCount() const
+{
+  lock_guard<mutex> lock(m_Mutex);
+  return static_cast<int>(m_Subscribers.size() + m_Joining.size());
+}
+
+QByteArray SseAction::serialize(const QByteArray& data,
+                                const QString& event,
+                                const QString& id,
+                                int retryMs)
+{
+  QByteArray out;
+  out.reserve(data.size() + event.size() + id.size() + 64);
+
+  if(!event.isEmpty())
+  {
+    appendField(out, "event", event.toUtf8());
+  }
+  if(!id.isEmpty())
+  {
+    appendField(out, "id", id.toUtf8());
+  }
+  if(retryMs >= 0)
+  {
+    appendField(out, "retry", QByteArray::number(retryMs));
+  }
+
+  // Each line gets its field, the client joins them with "\n" again.
+  int start = 0;
+  while(true)
+  {
+    int end = data.indexOf('\n', start);
+    int length = ((end < 0) ? data.size() : end) - start;
+    if(length > 0 && data.at(start + length - 1) == '\r')
+    {
+      --length;
+    }
+    out.append("data: ", 6);
+    out.append(data.constData() + start, length);
+    out.append('\n');
+
+    if(end < 0)
+    {
+      break;
+    }
+    start = end + 1;
+  }
+
+  out.append('\n');
+  return out;
+}
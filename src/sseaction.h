@@ -0,0 +1,87 @@
+#ifndef QTTPSSEACTION_H
+#define QTTPSSEACTION_H
+
+#include "qttp_global.h"
+#include "action.h"
+
+namespace qttp
+{
+
+/**
+ * @brief An action keeping its responses open as "text/event-stream" for
+ * EventSource clients (Server-Sent Events), every client that requests it
+ * subscribes to publish().
+ *
+ * An event is serialized once and the same bytes are queued on every stream
+ * without being copied, so a single publish() reaches thousands of clients
+ * for about the cost of one.
+ *
+ * Clients that went away are dropped on the next publish() or heartbeat().
+ * Streams more than "server.responseBody.streamHighWatermark" bytes behind
+ * are ended, EventSource reconnects by itself and may catch up through the
+ * "Last-Event-ID" header.
+ */
+class QTTPSHARED_EXPORT SseAction : public Action
+{
+  public:
+
+    SseAction();
+    virtual ~SseAction();
+
+    //! Sends the head and subscribes the client.
+    virtual void onAction(HttpData& data);
+
+    /**
+     * @brief Runs once the head is on its way, before the client receives
+     * any published event.  Anything written with
+     * data.getResponse().writeChunk() goes out first, e.g. the events a
+     * reconnecting client missed since its "Last-Event-ID".
+     *
+     * Events published meanwhile, including from here, follow once it
+     * returned.
+     */
+    virtual void onSubscribe(HttpData& data);
+
+    /**
+     * @brief Sends an event to every subscriber, safe from any thread.
+     * @return The number of subscribers it was queued for.
+     */
+    int publish(const QByteArray& data, const QString& event = QString(), const QString& id = QString());
+
+    //! Sends bytes put together by serialize() to every subscriber.
+    int broadcast(const QByteArray& serialized);
+
+    /**
+     * @brief Sends a comment line, which keeps proxies from timing out idle
+     * streams and finds out about clients that went away.
+     */
+    int heartbeat();
+
+    //! Ends every stream, EventSource clients reconnect after a while.
+    void closeAll();
+
+    int getSubscriberCount() const;
+
+    /**
+     * @brief Formats an event as it goes out on the stream.  Every line of
+     * data becomes a "data:" field, line breaks in event and id are dropped.
+     * @param retryMs Tells the client how long to wait before reconnecting,
+     * left out if negative.
+     */
+    static QByteArray serialize(const QByteArray& data,
+                                const QString& event = QString(),
+                                const QString& id = QString(),
+                                int retryMs = -1);
+
+QTTP_PRIVATE:
+
+    mutable std::mutex m_Mutex;
+    //! Valid until their stream is ended, which only happens under m_Mutex.
+    std::vector<native::http::QttpResponse*> m_Subscribers;
+    //! Streams whose onSubscribe() runs, with the events held back for them.
+    std::unordered_map<native::http::QttpResponse*, std::vector<QByteArray> > m_Joining;
+};
+
+} // End namespace qttp
+
+#endif // QTTPSSEACTION_H
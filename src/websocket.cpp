@@ -0,0 +1,115 @@
+#include "websocket.h"
+
+#include <qttp_websocket.h>
+
+using namespace std;
+using namespace qttp;
+using namespace native::http;
+
+WebSocket::WebSocket() :
+  m_Socket()
+{
+}
+
+WebSocket::WebSocket(const std::shared_ptr<QttpWebSocket>& socket) :
+  m_Socket(socket)
+{
+}
+
+WebSocket::~WebSocket()
+{
+}
+
+bool WebSocket::sendText(const QString& message)
+{
+  return sendText(message.toUtf8());
+}
+
+bool WebSocket::sendText(const QByteArray& utf8)
+{
+  return m_Socket && m_Socket->send_text(utf8);
+}
+
+bool WebSocket::sendBinary(const QByteArray& data)
+{
+  return m_Socket && m_Socket->send_binary(data);
+}
+
+bool WebSocket::ping(const QByteArray& payload)
+{
+  return m_Socket && m_Socket->ping(payload);
+}
+
+bool WebSocket::close(quint16 code, const QString& reason)
+{
+  return m_Socket && m_Socket->close(code, reason.toUtf8());
+}
+
+bool WebSocket::isOpen() const
+{
+  return m_Socket && m_Socket->is_open();
+}
+
+size_t WebSocket::getBacklog() const
+{
+  return m_Socket ? m_Socket->get_backlog() : 0;
+}
+
+void WebSocket::setDrainCallback(std::function<void()> callback)
+{
+  if(m_Socket)
+  {
+    m_Socket->set_drain_callback(callback);
+  }
+}
+
+quint16 WebSocket::getCloseCode() const
+{
+  return m_Socket ? m_Socket->get_close_code() : 1006;
+}
+
+bool WebSocket::operator ==(const WebSocket& other) const
+{
+  return m_Socket == other.m_Socket;
+}
+
+bool WebSocket::operator !=(const WebSocket& other) const
+{
+  return m_Socket != other.m_Socket;
+}
+
+WebSocketAction::WebSocketAction() :
+  Action()
+{
+}
+
+WebSocketAction::~WebSocketAction()
+{
+}
+
+void WebSocketAction::onAction(HttpData& data)
+{
+  auto& response = data.getResponse();
+  response.setHeader("Upgrade", "websocket");
+  response.setHeader("Sec-WebSocket-Version", "13");
+  data.setErrorResponse("WebSocket handshake required", HttpError::UPGRADE_REQUIRED);
+}
+
+void WebSocketAction::onOpen(WebSocket& socket, const HttpRequest& request)
+{
+  Q_UNUSED(socket);
+  Q_UNUSED(request);
+}
+
+void WebSocketAction::onMessage(WebSocket& socket, const QByteArray& message, bool isBinary)
+{
+  Q_UNUSED(socket);
+  Q_UNUSED(message);
+  Q_UNUSED(isBinary);
+}
+
+void WebSocketAction::onClose(WebSocket& socket, quint16 code)
+{
+  Q_UNUSED(socket);
+  Q_UNUSED(code);
+}
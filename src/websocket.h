@@ -0,0 +1,107 @@
+#ifndef QTTPWEBSOCKET_H
+#define QTTPWEBSOCKET_H
+
+#include "qttp_global.h"
+#include "action.h"
+
+namespace qttp
+{
+
+/**
+ * @brief A connection upgraded to a WebSocket, cheap to copy and to keep
+ * around.  Sending hands the message to the connection's I/O loop and is
+ * safe from any thread, it fails once the connection is closing.
+ */
+class QTTPSHARED_EXPORT WebSocket
+{
+  public:
+
+    WebSocket();
+    WebSocket(const std::shared_ptr<native::http::QttpWebSocket>& socket);
+    ~WebSocket();
+
+    /**
+     * @brief Returns false once the connection is closing, or once more than
+     * "server.responseBody.streamHighWatermark" bytes wait to be written.
+     * The message is queued anyway in the latter case, hold off until the
+     * drain callback runs.
+     */
+    bool sendText(const QString& message);
+    bool sendText(const QByteArray& utf8);
+
+    /**
+     * @brief The bytes are shared rather than copied, sending the same
+     * QByteArray to many connections serializes it once.
+     */
+    bool sendBinary(const QByteArray& data);
+
+    //! The payload is at most 125 bytes.
+    bool ping(const QByteArray& payload = QByteArray());
+
+    /**
+     * @brief Starts the closing handshake, WebSocketAction::onClose() follows
+     * once the connection closed.
+     */
+    bool close(quint16 code = 1000, const QString& reason = QString());
+
+    bool isOpen() const;
+
+    //! Message bytes queued or still being written.
+    size_t getBacklog() const;
+
+    /**
+     * @brief Runs on the I/O thread once a backlog that passed the high
+     * watermark is down to the low watermark again.
+     */
+    void setDrainCallback(std::function<void()> callback);
+
+    //! The status code the client closed with, see RFC 6455 7.4.
+    quint16 getCloseCode() const;
+
+    bool operator ==(const WebSocket& other) const;
+    bool operator !=(const WebSocket& other) const;
+
+QTTP_PRIVATE:
+
+    std::shared_ptr<native::http::QttpWebSocket> m_Socket;
+};
+
+/**
+ * @brief An action answering GET requests asking for "Upgrade: websocket".
+ * Once upgraded the connection belongs to this action, which is told about
+ * it opening, every message and it closing, in order and on the Qt thread
+ * like onAction().
+ *
+ * Reading from the client is paused while too many message bytes wait to be
+ * handled, see "server.requestBody" in the config.  Messages larger than
+ * "server.webSocket.maxMessageSize" close the connection.
+ */
+class QTTPSHARED_EXPORT WebSocketAction : public Action
+{
+  public:
+
+    WebSocketAction();
+    virtual ~WebSocketAction();
+
+    /**
+     * @brief Answers requests that didn't ask for a WebSocket, or for another
+     * version of the protocol, with 426 Upgrade Required.
+     */
+    virtual void onAction(HttpData& data);
+
+    //! The handshake response is on its way, messages may be sent right away.
+    virtual void onOpen(WebSocket& socket, const HttpRequest& request);
+
+    //! A complete message, fragments put together and text checked as UTF-8.
+    virtual void onMessage(WebSocket& socket, const QByteArray& message, bool isBinary);
+
+    /**
+     * @brief The connection closed, nothing can be sent anymore.  code is 1006
+     * if the client went away without a close frame.
+     */
+    virtual void onClose(WebSocket& socket, quint16 code);
+};
+
+} // End namespace qttp
+
+#endif // QTTPWEBSOCKET_H
@@ -0,0 +1,621 @@
+#include <testutils.h>
+#include <hpack.h>
+
+#ifdef SSL_TLS_UV
+  #include <QTemporaryDir>
+  #include <qttp_tls.h>
+  #include <openssl/pem.h>
+  #include <openssl/x509.h>
+#endif
+
+using namespace std;
+using namespace native::http;
+
+static const int BENCHMARK_PORT = 8081;
+static const int TLS_BENCHMARK_PORT = 8082;
+
+//! Requests in flight per round trip of the pipelined, multi-connection and
+//! HTTP/2 benchmarks.
+static const int BATCH_SIZE = 16;
+
+/**
+ * Connection level benchmarks against the bare native::http::Qttp layer so
+ * the numbers aren't dominated by the hop onto the Qt event loop.
+ *
+ * Run with "-iterations N" or let QBENCHMARK pick, requests/sec are printed
+ * at the end of each benchmark.  The pipelined and h2c benchmarks keep
+ * BATCH_SIZE requests in flight on a single connection, as HTTP/1.1
+ * pipelining and as concurrent HTTP/2 streams.  The multi-connection one
+ * spreads as many HTTP/1.1 requests over BATCH_SIZE keep-alive connections
+ * instead, which is what h2c has to beat.  The head benchmarks don't touch
+ * the network, they compare the QTextStream serializer QttpResponse used to
+ * have with QttpResponse::serialize_head().
+ *
+ * Built with SSL_TLS, the TLS benchmarks open a connection per request to a
+ * second listener, negotiating a new session each time or resuming the one
+ * of the connection before.  They print handshakes/sec and the average time
+ * SSL_connect() took.
+ */
+class BenchmarkTest : public QObject
+{
+  Q_OBJECT
+
+  private slots:
+
+    void initTestCase();
+
+    void benchmarkKeepAlive();
+    void benchmarkConnectionClose();
+    void benchmarkPipelined();
+    void benchmarkMultiConnection();
+    void benchmarkH2cMultiplexed();
+#ifdef SSL_TLS_UV
+    void benchmarkTlsFullHandshake();
+    void benchmarkTlsResumedHandshake();
+#endif
+
+    void benchmarkHeadTextStream();
+    void benchmarkHeadSerializer();
+
+    void cleanupTestCase();
+
+  private:
+
+    static bool readResponse(QTcpSocket& socket);
+
+    //! Reads count responses, leaving whatever follows them in buffer.
+    static bool readResponses(QTcpSocket& socket, QByteArray& buffer, int count);
+
+    //! Reads frames until count streams ended, answering SETTINGS and DATA.
+    static bool readStreams(QTcpSocket& socket, QByteArray& buffer, int count);
+    static QByteArray frame(int type, int flags, quint32 streamId, const QByteArray& payload);
+    static void printRate(const char* name, int requests, qint64 elapsedMs);
+
+#ifdef SSL_TLS_UV
+    //! A self-signed P-256 certificate for 127.0.0.1 in m_TlsDir.
+    bool createCertificate(const QString& certFile, const QString& keyFile);
+
+    /**
+     * Sends a request on a new TLS connection, resuming session if set.
+     * session is replaced by the one of this connection.
+     */
+    static bool tlsRequest(SSL_CTX* ctx, SSL_SESSION*& session, qint64& handshakeNs, bool& isResumed);
+    static void printHandshakes(const char* name, int handshakes, qint64 elapsedMs, qint64 handshakeNs);
+
+    QTemporaryDir m_TlsDir;
+#endif
+};
+
+int startServer()
+{
+  // The keep-alive benchmarks would be cut short by the default limit.
+  QttpOptions options;
+  options.max_requests_per_connection = 0;
+  options.http2 = true;
+
+  Qttp server;
+  server.set_options(options);
+  server.listen("127.0.0.1", BENCHMARK_PORT, [](QttpRequest&, QttpResponse& resp) {
+    resp.set_header("Content-Type", "text/plain");
+    resp.end(std::string("Hello World"));
+  });
+  return native::run();
+}
+
+#ifdef SSL_TLS_UV
+int startTlsServer(std::shared_ptr<QttpTlsContext> context)
+{
+  QttpOptions options;
+  options.max_requests_per_connection = 0;
+
+  native::loop loop;
+  Qttp server(loop);
+  server.set_options(options);
+  server.set_tls_context(context);
+  server.listen("127.0.0.1", TLS_BENCHMARK_PORT, [](QttpRequest&, QttpResponse& resp) {
+    resp.set_header("Content-Type", "text/plain");
+    resp.end(std::string("Hello World"));
+  });
+  return loop.run();
+}
+#endif
+
+bool BenchmarkTest::readResponse(QTcpSocket& socket)
+{
+  QByteArray response;
+  int headerEnd = -1;
+  int contentLength = 0;
+
+  while(true)
+  {
+    if(!socket.waitForReadyRead(5000))
+    {
+      return false;
+    }
+    response.append(socket.readAll());
+
+    if(headerEnd < 0)
+    {
+      headerEnd = response.indexOf("\r\n\r\n");
+      if(headerEnd < 0)
+      {
+        continue;
+      }
+      int start = response.indexOf("Content-Length: ");
+      if(start >= 0)
+      {
+        start += 16;
+        contentLength = response.mid(start, response.indexOf("\r\n", start) - start).toInt();
+      }
+    }
+
+    if(response.length() >= headerEnd + 4 + contentLength)
+    {
+      return true;
+    }
+  }
+}
+
+bool BenchmarkTest::readResponses(QTcpSocket& socket, QByteArray& buffer, int count)
+{
+  while(count > 0)
+  {
+    int headerEnd = buffer.indexOf("\r\n\r\n");
+    if(headerEnd >= 0)
+    {
+      int contentLength = 0;
+      int start = buffer.indexOf("Content-Length: ");
+      if(start >= 0 && start < headerEnd)
+      {
+        start += 16;
+        contentLength = buffer.mid(start, buffer.indexOf("\r\n", start) - start).toInt();
+      }
+
+      if(buffer.length() >= headerEnd + 4 + contentLength)
+      {
+        buffer.remove(0, headerEnd + 4 + contentLength);
+        --count;
+        continue;
+      }
+    }
+
+    if(!socket.waitForReadyRead(5000))
+    {
+      return false;
+    }
+    buffer.append(socket.readAll());
+  }
+  return true;
+}
+
+QByteArray BenchmarkTest::frame(int type, int flags, quint32 streamId, const QByteArray& payload)
+{
+  QByteArray out;
+  out.append(static_cast<char>(payload.length() >> 16));
+  out.append(static_cast<char>(payload.length() >> 8));
+  out.append(static_cast<char>(payload.length()));
+  out.append(static_cast<char>(type));
+  out.append(static_cast<char>(flags));
+  out.append(static_cast<char>(streamId >> 24));
+  out.append(static_cast<char>(streamId >> 16));
+  out.append(static_cast<char>(streamId >> 8));
+  out.append(static_cast<char>(streamId));
+  out.append(payload);
+  return out;
+}
+
+bool BenchmarkTest::readStreams(QTcpSocket& socket, QByteArray& buffer, int count)
+{
+  while(count > 0)
+  {
+    if(buffer.length() >= 9)
+    {
+      const uchar* header = reinterpret_cast<const uchar*>(buffer.constData());
+      int length = (header[0] << 16) | (header[1] << 8) | header[2];
+      int type = header[3];
+      int flags = header[4];
+
+      if(buffer.length() >= 9 + length)
+      {
+        if(type == 0x7)
+        {
+          // GOAWAY
+          return false;
+        }
+        if(type == 0x4 && (flags & 0x1) == 0)
+        {
+          socket.write(frame(0x4, 0x1, 0, QByteArray()));
+        }
+        if(type == 0x0 && length > 0)
+        {
+          // The stream windows outlast the tiny responses, the connection's
+          // wouldn't.
+          QByteArray increment;
+          increment.append(static_cast<char>(0)).append(static_cast<char>(length >> 16));
+          increment.append(static_cast<char>(length >> 8)).append(static_cast<char>(length));
+          socket.write(frame(0x8, 0, 0, increment));
+        }
+        if((type == 0x0 || type == 0x1) && (flags & 0x1) != 0)
+        {
+          --count;
+        }
+        buffer.remove(0, 9 + length);
+        continue;
+      }
+    }
+
+    if(!socket.waitForReadyRead(5000))
+    {
+      return false;
+    }
+    buffer.append(socket.readAll());
+  }
+  return true;
+}
+
+void BenchmarkTest::printRate(const char* name, int requests, qint64 elapsedMs)
+{
+  double rate = elapsedMs > 0 ? (requests * 1000.0) / elapsedMs : 0;
+  qDebug("%s: %d requests in %lld ms, %.1f requests/sec", name, requests, elapsedMs, rate);
+}
+
+void BenchmarkTest::benchmarkKeepAlive()
+{
+  QTcpSocket socket;
+  socket.connectToHost("127.0.0.1", BENCHMARK_PORT);
+  QVERIFY(socket.waitForConnected(5000));
+
+  const QByteArray request = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+  int requests = 0;
+  QElapsedTimer timer;
+  timer.start();
+
+  QBENCHMARK {
+    socket.write(request);
+    QVERIFY(readResponse(socket));
+    ++requests;
+  }
+
+  printRate("keep-alive", requests, timer.elapsed());
+}
+
+void BenchmarkTest::benchmarkConnectionClose()
+{
+  const QByteArray request = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n";
+  int requests = 0;
+  QElapsedTimer timer;
+  timer.start();
+
+  QBENCHMARK {
+    QTcpSocket socket;
+    socket.connectToHost("127.0.0.1", BENCHMARK_PORT);
+    QVERIFY(socket.waitForConnected(5000));
+    socket.write(request);
+    QVERIFY(readResponse(socket));
+    ++requests;
+  }
+
+  printRate("connection-close", requests, timer.elapsed());
+}
+
+void BenchmarkTest::benchmarkPipelined()
+{
+  QTcpSocket socket;
+  socket.connectToHost("127.0.0.1", BENCHMARK_PORT);
+  QVERIFY(socket.waitForConnected(5000));
+
+  QByteArray batch;
+  for(int i = 0; i < BATCH_SIZE; ++i)
+  {
+    batch.append("GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n");
+  }
+
+  QByteArray buffer;
+  int requests = 0;
+  QElapsedTimer timer;
+  timer.start();
+
+  QBENCHMARK {
+    socket.write(batch);
+    QVERIFY(readResponses(socket, buffer, BATCH_SIZE));
+    requests += BATCH_SIZE;
+  }
+
+  printRate("pipelined", requests, timer.elapsed());
+}
+
+void BenchmarkTest::benchmarkMultiConnection()
+{
+  std::vector<std::unique_ptr<QTcpSocket> > sockets;
+  for(int i = 0; i < BATCH_SIZE; ++i)
+  {
+    sockets.emplace_back(new QTcpSocket());
+    sockets.back()->connectToHost("127.0.0.1", BENCHMARK_PORT);
+    QVERIFY(sockets.back()->waitForConnected(5000));
+  }
+
+  const QByteArray request = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+  std::vector<QByteArray> buffers(BATCH_SIZE);
+  int requests = 0;
+  QElapsedTimer timer;
+  timer.start();
+
+  QBENCHMARK {
+    // One request in flight per connection, all of them sent before the
+    // first answer is read.
+    for(auto & socket : sockets)
+    {
+      socket->write(request);
+      socket->flush();
+    }
+    for(int i = 0; i < BATCH_SIZE; ++i)
+    {
+      QVERIFY(readResponses(*sockets[i], buffers[i], 1));
+    }
+    requests += BATCH_SIZE;
+  }
+
+  printRate("multi-connection", requests, timer.elapsed());
+}
+
+void BenchmarkTest::benchmarkH2cMultiplexed()
+{
+  QTcpSocket socket;
+  socket.connectToHost("127.0.0.1", BENCHMARK_PORT);
+  QVERIFY(socket.waitForConnected(5000));
+
+  socket.write("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+  socket.write(frame(0x4, 0, 0, QByteArray()));
+
+  // After the first request every field is a single index.
+  native::http::hpack::encoder encoder;
+  quint32 streamId = 1;
+  QByteArray buffer;
+  int requests = 0;
+  QElapsedTimer timer;
+  timer.start();
+
+  QBENCHMARK {
+    QByteArray batch;
+    for(int i = 0; i < BATCH_SIZE; ++i)
+    {
+      std::string block;
+      encoder.begin(block);
+      encoder.encode(block, ":method", "GET");
+      encoder.encode(block, ":scheme", "http");
+      encoder.encode(block, ":path", "/");
+      encoder.encode(block, ":authority", "127.0.0.1");
+      batch.append(frame(0x1, 0x5, streamId, QByteArray(block.data(), static_cast<int>(block.size()))));
+      streamId += 2;
+    }
+    socket.write(batch);
+    QVERIFY(readStreams(socket, buffer, BATCH_SIZE));
+    requests += BATCH_SIZE;
+  }
+
+  printRate("h2c", requests, timer.elapsed());
+}
+
+#ifdef SSL_TLS_UV
+bool BenchmarkTest::createCertificate(const QString& certFile, const QString& keyFile)
+{
+  EVP_PKEY* key = nullptr;
+  EVP_PKEY_CTX* keyCtx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+  bool result = keyCtx && EVP_PKEY_keygen_init(keyCtx) == 1 &&
+                EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keyCtx, NID_X9_62_prime256v1) == 1 &&
+                EVP_PKEY_keygen(keyCtx, &key) == 1;
+  EVP_PKEY_CTX_free(keyCtx);
+
+  X509* cert = X509_new();
+  if(result)
+  {
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_get_notBefore(cert), 0);
+    X509_gmtime_adj(X509_get_notAfter(cert), 24 * 60 * 60);
+    X509_set_pubkey(cert, key);
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("127.0.0.1"), -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    result = X509_sign(cert, key, EVP_sha256()) > 0;
+  }
+
+  if(result)
+  {
+    FILE* out = fopen(certFile.toLocal8Bit().constData(), "w");
+    result = out && PEM_write_X509(out, cert) == 1;
+    if(out)
+    {
+      fclose(out);
+    }
+  }
+  if(result)
+  {
+    FILE* out = fopen(keyFile.toLocal8Bit().constData(), "w");
+    result = out && PEM_write_PrivateKey(out, key, nullptr, nullptr, 0, nullptr, nullptr) == 1;
+    if(out)
+    {
+      fclose(out);
+    }
+  }
+
+  X509_free(cert);
+  EVP_PKEY_free(key);
+  return result;
+}
+
+bool BenchmarkTest::tlsRequest(SSL_CTX* ctx, SSL_SESSION*& session, qint64& handshakeNs, bool& isResumed)
+{
+  QByteArray address = "127.0.0.1:" + QByteArray::number(TLS_BENCHMARK_PORT);
+  BIO* connection = BIO_new_connect(address.data());
+  if(!connection || BIO_do_connect(connection) <= 0)
+  {
+    BIO_free_all(connection);
+    return false;
+  }
+
+  SSL* ssl = SSL_new(ctx);
+  SSL_set_bio(ssl, connection, connection);
+  if(session)
+  {
+    SSL_set_session(ssl, session);
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  bool result = SSL_connect(ssl) == 1;
+  handshakeNs += timer.nsecsElapsed();
+  isResumed = SSL_session_reused(ssl) == 1;
+
+  const QByteArray request = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n";
+  result = result && SSL_write(ssl, request.constData(), request.size()) == request.size();
+
+  // TLS 1.3 tickets arrive after the handshake, they are read along with the
+  // response.
+  QByteArray response;
+  char buffer[4096];
+  int read = 0;
+  while(result && (read = SSL_read(ssl, buffer, sizeof(buffer))) > 0)
+  {
+    response.append(buffer, read);
+  }
+  result = result && response.startsWith("HTTP/1.1 200") && response.endsWith("Hello World");
+
+  if(result)
+  {
+    SSL_SESSION_free(session);
+    session = SSL_get1_session(ssl);
+  }
+
+  // Sessions of connections closed without close_notify can't be resumed.
+  SSL_shutdown(ssl);
+  SSL_free(ssl);
+  return result;
+}
+
+void BenchmarkTest::printHandshakes(const char* name, int handshakes, qint64 elapsedMs, qint64 handshakeNs)
+{
+  double rate = elapsedMs > 0 ? (handshakes * 1000.0) / elapsedMs : 0;
+  double latency = handshakes > 0 ? handshakeNs / (handshakes * 1000.0) : 0;
+  qDebug("%s: %d handshakes in %lld ms, %.1f handshakes/sec, %.1f us per handshake",
+         name, handshakes, elapsedMs, rate, latency);
+}
+
+void BenchmarkTest::benchmarkTlsFullHandshake()
+{
+  SSL_CTX* ctx = SSL_CTX_new(SSLv23_client_method());
+  QVERIFY(ctx);
+
+  int handshakes = 0;
+  qint64 handshakeNs = 0;
+  QElapsedTimer timer;
+  timer.start();
+
+  QBENCHMARK {
+    SSL_SESSION* session = nullptr;
+    bool isResumed = true;
+    QVERIFY(tlsRequest(ctx, session, handshakeNs, isResumed));
+    QVERIFY(!isResumed);
+    SSL_SESSION_free(session);
+    ++handshakes;
+  }
+
+  printHandshakes("tls-full", handshakes, timer.elapsed(), handshakeNs);
+  SSL_CTX_free(ctx);
+}
+
+void BenchmarkTest::benchmarkTlsResumedHandshake()
+{
+  SSL_CTX* ctx = SSL_CTX_new(SSLv23_client_method());
+  QVERIFY(ctx);
+
+  SSL_SESSION* session = nullptr;
+  qint64 handshakeNs = 0;
+  bool isResumed = false;
+  QVERIFY(tlsRequest(ctx, session, handshakeNs, isResumed));
+
+  int handshakes = 0;
+  handshakeNs = 0;
+  QElapsedTimer timer;
+  timer.start();
+
+  QBENCHMARK {
+    QVERIFY(tlsRequest(ctx, session, handshakeNs, isResumed));
+    QVERIFY(isResumed);
+    ++handshakes;
+  }
+
+  printHandshakes("tls-resumed", handshakes, timer.elapsed(), handshakeNs);
+  SSL_SESSION_free(session);
+  SSL_CTX_free(ctx);
+}
+#endif
+
+void BenchmarkTest::benchmarkHeadTextStream()
+{
+  std::map<QString, QString> headers;
+  headers["Content-Type"] = "application/json";
+  headers["Connection"] = "keep-alive";
+  headers["Cache-Control"] = "no-cache";
+  headers["X-Request-Id"] = "3f2a9c";
+  headers["Content-Length"] = QString::number(1234);
+
+  QByteArray head;
+  QBENCHMARK {
+    head.clear();
+    QTextStream stream(&head);
+    stream << "HTTP/1.1 " << 200 << " " << native::http::response::get_status_text(200).c_str() << "\r\n";
+    for(auto & h : headers)
+    {
+      stream << h.first << ": " << h.second << "\r\n";
+    }
+    stream << "\r\n";
+    stream.flush();
+  }
+  QVERIFY(head.startsWith("HTTP/1.1 200 OK\r\n"));
+}
+
+void BenchmarkTest::benchmarkHeadSerializer()
+{
+  // Headers are encoded when they are set, only the head is built per request.
+  std::vector<QttpResponseHeader> headers;
+  headers.push_back(QttpResponseHeader("Content-Type", "application/json"));
+  headers.push_back(QttpResponseHeader("Connection", "keep-alive"));
+  headers.push_back(QttpResponseHeader("Cache-Control", "no-cache"));
+  headers.push_back(QttpResponseHeader("X-Request-Id", "3f2a9c"));
+
+  QByteArray head;
+  QBENCHMARK {
+    QttpResponse::serialize_head(head, 200, headers, 1234);
+  }
+  QVERIFY(head.startsWith("HTTP/1.1 200 OK\r\n"));
+  QVERIFY(head.endsWith("Content-Length: 1234\r\n\r\n"));
+}
+
+void BenchmarkTest::initTestCase()
+{
+  std::thread newThread(startServer);
+  newThread.detach();
+
+#ifdef SSL_TLS_UV
+  QVERIFY(m_TlsDir.isValid());
+  QttpTlsOptions options;
+  options.cert_file = m_TlsDir.filePath("cert.pem").toStdString();
+  options.key_file = m_TlsDir.filePath("key.pem").toStdString();
+  QVERIFY(createCertificate(QString::fromStdString(options.cert_file), QString::fromStdString(options.key_file)));
+
+  auto context = std::make_shared<QttpTlsContext>();
+  QVERIFY(context->init(options));
+  std::thread tlsThread(startTlsServer, context);
+  tlsThread.detach();
+#endif
+
+  QTest::qWait(500);
+}
+
+void BenchmarkTest::cleanupTestCase()
+{
+}
+
+QTEST_MAIN(BenchmarkTest)
+#include "benchmarktest.moc"
@@ -0,0 +1,8 @@
+include($$PWD/../framework/framework.pri)
+
+DESTDIR = $$PWD
+
+SOURCES += benchmarktest.cpp
+
+# Benchmarks are noisy enough without the logs.
+DEFINES += QTTP_DISABLE_LOGGING
@@ -387,6 +387,31 @@ class TestUtils
       TestUtils::requestValidDelete(endpoint, result);
       TestUtils::verifyJson(result, expected);
     }
+
+    /**
+     * @brief Writes a hand-crafted request onto an already connected socket
+     * and collects whatever comes back until "responses" status lines were
+     * seen or the wait times out.  Handy for connection level behaviors that
+     * QNetworkAccessManager hides from us.
+     */
+    void requestRaw(QTcpSocket& socket,
+                    const QByteArray& request,
+                    QByteArray& result,
+                    int responses = 1)
+    {
+      socket.write(request);
+      QTime time;
+      time.start();
+      while(result.count("HTTP/1.1 ") < responses)
+      {
+        QTest::qWait(50);
+        result.append(socket.readAll());
+        if(time.elapsed() > MAX_TEST_WAIT_MS)
+        {
+          break;
+        }
+      }
+    }
 };
 
 int TestUtils::MAX_TEST_WAIT_MS = 5000;
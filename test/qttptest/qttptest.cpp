@@ -1,4 +1,7 @@
 #include <qttptest.h>
+#include <hpack.h>
+#include <QLocalSocket>
+#include <QTemporaryFile>
 
 using namespace std;
 using namespace qttp;
@@ -41,7 +44,48 @@ class QttpTest : public QObject, public TestUtils
     void testDELETE();
     void testDEL();
 
+    void testGET_KeepAlive();
+    void testGET_ConnectionClose();
+    void testGET_Pipelined();
+    void testPOST_StreamedBody();
+    void testGET_ChunkedResponse();
+    void testGET_WebSocketEcho();
+    void testGET_EventStream();
+    void testGET_UrlTooLong();
+    void testPOST_BodyTooLarge();
+    void testPOST_ExpectContinue();
+    void testPOST_ExpectRejected();
+    void testGET_H2cPriorKnowledge();
+    void testGET_H2cUpgrade();
+    void testGET_UnixSocket();
+    void testGET_ConnectionCap();
+    void testGET_ConnectionCapAcrossLoops();
+    void testGET_StalledFileDownload();
+    void testGET_WriteQueueBackpressure();
+    // Stops the server, keep it last.
+    void testPOST_DrainOnStop();
+
     void cleanupTestCase();
+
+  private:
+
+    static QByteArray frame(int type, int flags, quint32 streamId, const QByteArray& payload);
+    static QByteArray requestHeaders(hpack::encoder& encoder, const QByteArray& path);
+
+    /**
+     * Reads the next HTTP/2 frame, acknowledging SETTINGS.  Statuses and
+     * bodies are collected per stream, ended is the stream the frame closed
+     * or 0.  False if nothing arrived in time or the connection failed.
+     */
+    static bool readH2cFrame(QTcpSocket& socket, QByteArray& buffer, hpack::decoder& decoder,
+                             QHash<quint32, QByteArray>& statuses, QHash<quint32, QByteArray>& bodies,
+                             quint32& ended);
+
+    //! Sums a counter of the native listeners.
+    static quint64 nativeStat(const std::function<quint64(const QttpStats&)>& stat);
+
+    //! Large enough to outlast the socket buffers on both ends.
+    QTemporaryFile m_LargeFile;
 };
 
 void QttpTest::testGET_RegExRouteResponse()
@@ -186,6 +230,795 @@ void QttpTest::testDEL()
   TestUtils::verifyDeleteJson("http://127.0.0.1:8080/testDel", expected);
 }
 
+void QttpTest::testGET_KeepAlive()
+{
+  QTcpSocket socket;
+  socket.connectToHost("127.0.0.1", 8080);
+  QVERIFY(socket.waitForConnected(MAX_TEST_WAIT_MS));
+
+  QByteArray request = "GET /test HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+  QByteArray result;
+
+  TestUtils::requestRaw(socket, request, result);
+  QVERIFY(result.startsWith("HTTP/1.1 200"));
+  QVERIFY(result.contains("Connection: keep-alive"));
+
+  // Same socket, the server should have re-armed the parser.
+  result.clear();
+  TestUtils::requestRaw(socket, request, result);
+  QVERIFY(result.startsWith("HTTP/1.1 200"));
+  QCOMPARE(socket.state(), QAbstractSocket::ConnectedState);
+}
+
+void QttpTest::testGET_ConnectionClose()
+{
+  QTcpSocket socket;
+  socket.connectToHost("127.0.0.1", 8080);
+  QVERIFY(socket.waitForConnected(MAX_TEST_WAIT_MS));
+
+  QByteArray result;
+  TestUtils::requestRaw(socket, "GET /test HTTP/1.0\r\n\r\n", result);
+  QVERIFY(result.startsWith("HTTP/1.1 200"));
+  QVERIFY(result.contains("Connection: close"));
+
+  QTest::qWait(300);
+  QCOMPARE(socket.state(), QAbstractSocket::UnconnectedState);
+}
+
+void QttpTest::testGET_Pipelined()
+{
+  QTcpSocket socket;
+  socket.connectToHost("127.0.0.1", 8080);
+  QVERIFY(socket.waitForConnected(MAX_TEST_WAIT_MS));
+
+  // Both requests in a single packet, answers have to come back in order.
+  QByteArray request = "GET /echo/111/data HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+                       "GET /echo/222/data HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+  QByteArray result;
+
+  TestUtils::requestRaw(socket, request, result, 2);
+  QCOMPARE(result.count("HTTP/1.1 200"), 2);
+  QVERIFY(result.indexOf("C++ FTW 111") >= 0);
+  QVERIFY(result.indexOf("C++ FTW 111") < result.indexOf("C++ FTW 222"));
+  QCOMPARE(socket.state(), QAbstractSocket::ConnectedState);
+}
+
+void QttpTest::testPOST_StreamedBody()
+{
+  QTcpSocket socket;
+  socket.connectToHost("127.0.0.1", 8080);
+  QVERIFY(socket.waitForConnected(MAX_TEST_WAIT_MS));
+
+  // Large enough to arrive in several reads and trip the read backpressure.
+  QByteArray body(3 * 1024 * 1024, 'x');
+  QByteArray request = "POST /streamedBody HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                       "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n" + body;
+  QByteArray result;
+
+  TestUtils::requestRaw(socket, request, result, 1);
+  QVERIFY(result.startsWith("HTTP/1.1 200"));
+  QVERIFY(result.indexOf("\"response\":3145728") >= 0);
+  QVERIFY(result.indexOf("\"buffered\":0") >= 0);
+}
+
+void QttpTest::testGET_ChunkedResponse()
+{
+  QTcpSocket socket;
+  socket.connectToHost("127.0.0.1", 8080);
+  QVERIFY(socket.waitForConnected(MAX_TEST_WAIT_MS));
+
+  QByteArray request = "GET /chunked HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+  QByteArray result;
+
+  TestUtils::requestRaw(socket, request, result, 1);
+  QTime time;
+  time.start();
+  while(!result.endsWith("\r\n0\r\n\r\n") && time.elapsed() < MAX_TEST_WAIT_MS)
+  {
+    QTest::qWait(50);
+    result.append(socket.readAll());
+  }
+
+  QVERIFY(result.startsWith("HTTP/1.1 200"));
+  QVERIFY(result.indexOf("Transfer-Encoding: chunked\r\n") >= 0);
+  QVERIFY(result.indexOf("Content-Length") < 0);
+
+  // Decode the chunks back into the body.
+  int pos = result.indexOf("\r\n\r\n") + 4;
+  QByteArray body;
+  while(true)
+  {
+    int end = result.indexOf("\r\n", pos);
+    QVERIFY(end > pos);
+    bool ok = false;
+    int size = result.mid(pos, end - pos).toInt(&ok, 16);
+    QVERIFY(ok);
+    if(size == 0)
+    {
+      break;
+    }
+    body.append(result.mid(end + 2, size));
+    pos = end + 2 + size + 2;
+  }
+
+  QJsonDocument doc = QJsonDocument::fromJson(body);
+  QVERIFY(doc.isArray());
+  QCOMPARE(doc.array().size(), 2000);
+}
+
+void QttpTest::testGET_WebSocketEcho()
+{
+  QTcpSocket socket;
+  socket.connectToHost("127.0.0.1", 8080);
+  QVERIFY(socket.waitForConnected(MAX_TEST_WAIT_MS));
+
+  // The sample handshake from RFC 6455 1.3.
+  QByteArray request = "GET /ws HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                       "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+                       "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                       "Sec-WebSocket-Version: 13\r\n\r\n";
+  QByteArray result;
+
+  TestUtils::requestRaw(socket, request, result, 1);
+  while(!result.contains("\r\n\r\n") && socket.waitForReadyRead(MAX_TEST_WAIT_MS))
+  {
+    result.append(socket.readAll());
+  }
+  QVERIFY(result.startsWith("HTTP/1.1 101"));
+  QVERIFY(result.indexOf("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") >= 0);
+  result.remove(0, result.indexOf("\r\n\r\n") + 4);
+
+  auto frame = [](quint8 head, const QByteArray& payload) {
+    const char key[4] = { 0x12, 0x34, 0x56, 0x78 };
+    QByteArray data;
+    data.append((char) head);
+    data.append((char) (0x80 | payload.size()));
+    data.append(key, 4);
+    for(int i = 0; i < payload.size(); ++i)
+    {
+      data.append((char) (payload[i] ^ key[i % 4]));
+    }
+    return data;
+  };
+
+  // A text message in two fragments with a ping in between.
+  socket.write(frame(0x01, "hel") + frame(0x89, "p") + frame(0x80, "lo"));
+
+  QByteArray expected = QByteArray("\x8a\x01p\x81\x05hello", 9);
+  QTime time;
+  time.start();
+  while(result.size() < expected.size() && time.elapsed() < MAX_TEST_WAIT_MS)
+  {
+    QTest::qWait(50);
+    result.append(socket.readAll());
+  }
+  QCOMPARE(result, expected);
+
+  // The close frame is echoed and the connection goes away.
+  result.clear();
+  socket.write(frame(0x88, QByteArray("\x03\xe8", 2)));
+  time.start();
+  while(result.size() < 4 && time.elapsed() < MAX_TEST_WAIT_MS)
+  {
+    QTest::qWait(50);
+    result.append(socket.readAll());
+  }
+  QCOMPARE(result, QByteArray("\x88\x02\x03\xe8", 4));
+
+  QTest::qWait(300);
+  QCOMPARE(socket.state(), QAbstractSocket::UnconnectedState);
+}
+
+void QttpTest::testGET_EventStream()
+{
+  auto action = std::dynamic_pointer_cast<SseAction>(HttpServer::getInstance()->getAction("events"));
+  QVERIFY(action.get() != nullptr);
+
+  QTcpSocket socket;
+  socket.connectToHost("127.0.0.1", 8080);
+  QVERIFY(socket.waitForConnected(MAX_TEST_WAIT_MS));
+
+  QByteArray request = "GET /events HTTP/1.1\r\nHost: 127.0.0.1\r\nAccept: text/event-stream\r\n\r\n";
+  QByteArray result;
+
+  TestUtils::requestRaw(socket, request, result, 1);
+  QTime time;
+  time.start();
+  while(!result.contains("data: joined\n\n") && time.elapsed() < MAX_TEST_WAIT_MS)
+  {
+    QTest::qWait(50);
+    result.append(socket.readAll());
+  }
+  QVERIFY(result.startsWith("HTTP/1.1 200"));
+  QVERIFY(result.indexOf("Content-Type: text/event-stream\r\n") >= 0);
+  QVERIFY(result.indexOf("Transfer-Encoding: chunked\r\n") >= 0);
+  QVERIFY(result.indexOf("retry: 1000\ndata: welcome\n\n") >= 0);
+  QVERIFY(result.indexOf("event: join\ndata: joined\n\n") > result.indexOf("data: welcome\n\n"));
+  QCOMPARE(action->getSubscriberCount(), 1);
+
+  // The large one is shared with the stream rather than copied into its chunk.
+  QByteArray large(4000, 'x');
+  QCOMPARE(action->publish("hello\nworld", "greeting", "1"), 1);
+  QCOMPARE(action->publish(large), 1);
+
+  time.start();
+  while(!result.endsWith(large + "\n\n\r\n") && time.elapsed() < MAX_TEST_WAIT_MS)
+  {
+    QTest::qWait(50);
+    result.append(socket.readAll());
+  }
+  QVERIFY(result.indexOf("event: greeting\nid: 1\ndata: hello\ndata: world\n\n") >= 0);
+  QVERIFY(result.indexOf("fa8\r\ndata: " + large + "\n\n\r\n") >= 0);
+
+  // Dropped once the server noticed the client went away.
+  socket.disconnectFromHost();
+  time.start();
+  while(action->heartbeat() > 0 && time.elapsed() < MAX_TEST_WAIT_MS)
+  {
+    QTest::qWait(50);
+  }
+  QCOMPARE(action->getSubscriberCount(), 0);
+}
+
+void QttpTest::testGET_UrlTooLong()
+{
+  QTcpSocket socket;
+  socket.connectToHost("127.0.0.1", 8080);
+  QVERIFY(socket.waitForConnected(MAX_TEST_WAIT_MS));
+
+  QByteArray request = "GET /echo/" + QByteArray(10000, 'x') + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+  QByteArray result;
+
+  TestUtils::requestRaw(socket, request, result, 1);
+  QVERIFY(result.startsWith("HTTP/1.1 414"));
+  QVERIFY(result.indexOf("Connection: close\r\n") >= 0);
+}
+
+void QttpTest::testPOST_BodyTooLarge()
+{
+  QTcpSocket socket;
+  socket.connectToHost("127.0.0.1", 8080);
+  QVERIFY(socket.waitForConnected(MAX_TEST_WAIT_MS));
+
+  // Answered from the Content-Length alone, the body is never sent.
+  QByteArray request = "POST /echobody HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                       "Content-Length: 1073741824\r\n\r\n";
+  QByteArray result;
+
+  TestUtils::requestRaw(socket, request, result, 1);
+  QVERIFY(result.startsWith("HTTP/1.1 413"));
+}
+
+void QttpTest::testPOST_ExpectContinue()
+{
+  QTcpSocket socket;
+  socket.connectToHost("127.0.0.1", 8080);
+  QVERIFY(socket.waitForConnected(MAX_TEST_WAIT_MS));
+
+  QByteArray body = "{\"name\":\"continued\"}";
+  QByteArray request = "POST /echobody HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                       "Content-Type: application/json\r\nExpect: 100-continue\r\n"
+                       "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n";
+  QByteArray result;
+
+  TestUtils::requestRaw(socket, request, result, 1);
+  QTest::qWait(200);
+  result.append(socket.readAll());
+  QCOMPARE(result, QByteArray("HTTP/1.1 100 Continue\r\n\r\n"));
+
+  // Only now the body goes out and the request is answered.
+  TestUtils::requestRaw(socket, body, result, 2);
+  QVERIFY(result.indexOf("HTTP/1.1 200", 25) == 25);
+  QVERIFY(result.indexOf("continued") >= 0);
+}
+
+void QttpTest::testPOST_ExpectRejected()
+{
+  auto expectRejected = [](const QByteArray& request, const QByteArray& status) {
+    QTcpSocket socket;
+    socket.connectToHost("127.0.0.1", 8080);
+    QVERIFY(socket.waitForConnected(MAX_TEST_WAIT_MS));
+
+    // The body is never sent, the answer has to come from the headers.
+    QByteArray result;
+    TestUtils::requestRaw(socket, request, result, 1);
+    QVERIFY(result.startsWith("HTTP/1.1 " + status));
+    QVERIFY(result.indexOf("100 Continue") < 0);
+    QVERIFY(result.indexOf("Connection: close\r\n") >= 0);
+
+    QTest::qWait(300);
+    QCOMPARE(socket.state(), QAbstractSocket::UnconnectedState);
+  };
+
+  // Turned down by Action::admitRequest().
+  expectRejected("POST /rejecting HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                 "Expect: 100-continue\r\nContent-Length: 16\r\n\r\n", "417");
+
+  // An expectation the server doesn't know.
+  expectRejected("POST /echobody HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                 "Expect: 200-ok\r\nContent-Length: 16\r\n\r\n", "417");
+
+  // Past maxBodySize.
+  expectRejected("POST /echobody HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                 "Expect: 100-continue\r\nContent-Length: 1073741824\r\n\r\n", "413");
+}
+
+void QttpTest::testGET_H2cPriorKnowledge()
+{
+  QTcpSocket socket;
+  socket.connectToHost("127.0.0.1", 8080);
+  QVERIFY(socket.waitForConnected(MAX_TEST_WAIT_MS));
+
+  // SETTINGS_INITIAL_WINDOW_SIZE of 16, every response stalls after as many
+  // bytes until its stream window is updated.
+  QByteArray request = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+  request.append(frame(0x4, 0, 0, QByteArray("\x00\x04\x00\x00\x00\x10", 6)));
+
+  hpack::encoder encoder;
+  for(quint32 streamId = 1; streamId <= 5; streamId += 2)
+  {
+    QByteArray path = "/echo/" + QByteArray::number(streamId * 111) + "/data";
+    request.append(frame(0x1, 0x5, streamId, requestHeaders(encoder, path)));
+  }
+  socket.write(request);
+
+  hpack::decoder decoder;
+  QByteArray buffer;
+  QHash<quint32, QByteArray> statuses;
+  QHash<quint32, QByteArray> bodies;
+  int endedCount = 0;
+  bool isUpdated = false;
+
+  while(endedCount < 3)
+  {
+    quint32 ended = 0;
+    QVERIFY(readH2cFrame(socket, buffer, decoder, statuses, bodies, ended));
+    endedCount += (ended != 0) ? 1 : 0;
+
+    if(!isUpdated)
+    {
+      QCOMPARE(endedCount, 0);
+      for(auto & body : bodies)
+      {
+        QVERIFY(body.size() <= 16);
+      }
+
+      // All three are under way at once, each waits for its window.
+      if(bodies.size() == 3 && bodies[1].size() == 16 && bodies[3].size() == 16 && bodies[5].size() == 16)
+      {
+        for(quint32 streamId = 1; streamId <= 5; streamId += 2)
+        {
+          socket.write(frame(0x8, 0, streamId, QByteArray("\x00\x00\x10\x00", 4)));
+        }
+        isUpdated = true;
+      }
+    }
+  }
+
+  QVERIFY(isUpdated);
+  for(quint32 streamId = 1; streamId <= 5; streamId += 2)
+  {
+    QCOMPARE(statuses[streamId], QByteArray("200"));
+    QVERIFY(bodies[streamId].indexOf("C++ FTW " + QByteArray::number(streamId * 111)) >= 0);
+  }
+}
+
+void QttpTest::testGET_H2cUpgrade()
+{
+  QTcpSocket socket;
+  socket.connectToHost("127.0.0.1", 8080);
+  QVERIFY(socket.waitForConnected(MAX_TEST_WAIT_MS));
+
+  // HTTP2-Settings carries SETTINGS_MAX_CONCURRENT_STREAMS of 100.
+  QByteArray request = "GET /echo/111/data HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                       "Connection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\n"
+                       "HTTP2-Settings: AAMAAABk\r\n\r\n";
+  QByteArray result;
+
+  TestUtils::requestRaw(socket, request, result, 1);
+  QTime time;
+  time.start();
+  while(!result.contains("\r\n\r\n") && time.elapsed() < MAX_TEST_WAIT_MS)
+  {
+    QTest::qWait(50);
+    result.append(socket.readAll());
+  }
+  QVERIFY(result.startsWith("HTTP/1.1 101"));
+  QVERIFY(result.indexOf("Upgrade: h2c\r\n") >= 0);
+  result.remove(0, result.indexOf("\r\n\r\n") + 4);
+
+  // The upgraded request is answered on stream 1, the next one is sent as
+  // HTTP/2 right after the preface.
+  hpack::encoder encoder;
+  request = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+  request.append(frame(0x4, 0, 0, QByteArray()));
+  request.append(frame(0x1, 0x5, 3, requestHeaders(encoder, "/echo/222/data")));
+  socket.write(request);
+
+  hpack::decoder decoder;
+  QHash<quint32, QByteArray> statuses;
+  QHash<quint32, QByteArray> bodies;
+  int endedCount = 0;
+  while(endedCount < 2)
+  {
+    quint32 ended = 0;
+    QVERIFY(readH2cFrame(socket, result, decoder, statuses, bodies, ended));
+    endedCount += (ended != 0) ? 1 : 0;
+  }
+
+  QCOMPARE(statuses[1], QByteArray("200"));
+  QVERIFY(bodies[1].indexOf("C++ FTW 111") >= 0);
+  QCOMPARE(statuses[3], QByteArray("200"));
+  QVERIFY(bodies[3].indexOf("C++ FTW 222") >= 0);
+}
+
+void QttpTest::testGET_UnixSocket()
+{
+  // server.unixSocket.path of the test config, served next to TCP.
+  QLocalSocket socket;
+  socket.connectToServer("/tmp/qttptest.sock");
+  QVERIFY(socket.waitForConnected(MAX_TEST_WAIT_MS));
+
+  socket.write("GET /echo/111/data HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  QByteArray result;
+  QTime time;
+  time.start();
+  while(!result.contains("C++ FTW 111") && time.elapsed() < MAX_TEST_WAIT_MS)
+  {
+    QTest::qWait(50);
+    result.append(socket.readAll());
+  }
+  QVERIFY(result.startsWith("HTTP/1.1 200"));
+  QVERIFY(result.indexOf("C++ FTW 111") >= 0);
+  QCOMPARE(socket.state(), QLocalSocket::ConnectedState);
+}
+
+void QttpTest::testGET_ConnectionCap()
+{
+  // A listener of its own, a cap of two would starve the other tests.
+  auto limiter = std::make_shared<QttpConnectionLimiter>(2, 1);
+  std::thread listenerThread([limiter]() {
+    native::loop loop;
+    Qttp server(loop);
+    server.set_connection_limiter(limiter);
+    server.listen("127.0.0.1", 8083, [](QttpRequest&, QttpResponse& resp) {
+      resp.set_header("Content-Type", "text/plain");
+      resp.end(std::string("capped"));
+    });
+    loop.run();
+  });
+  listenerThread.detach();
+  QTest::qWait(300);
+
+  QTcpSocket first;
+  QTcpSocket second;
+  QTcpSocket third;
+  for(QTcpSocket* socket : { &first, &second, &third })
+  {
+    socket->connectToHost("127.0.0.1", 8083);
+    QVERIFY(socket->waitForConnected(MAX_TEST_WAIT_MS));
+  }
+
+  const QByteArray request = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+  QByteArray result;
+  TestUtils::requestRaw(first, request, result, 1);
+  QVERIFY(result.startsWith("HTTP/1.1 200"));
+
+  result.clear();
+  TestUtils::requestRaw(second, request, result, 1);
+  QVERIFY(result.startsWith("HTTP/1.1 200"));
+
+  // Connected through the backlog, but never accepted past the cap.
+  third.write(request);
+  QTest::qWait(500);
+  QVERIFY(third.readAll().isEmpty());
+  QCOMPARE(limiter->get_open(), 2);
+  QVERIFY(limiter->get_deferred() > 0);
+
+  // Closing one gets down to the low mark, the waiting one is picked up.
+  first.disconnectFromHost();
+  result.clear();
+  QTime time;
+  time.start();
+  while(!result.contains("capped") && time.elapsed() < MAX_TEST_WAIT_MS)
+  {
+    QTest::qWait(50);
+    result.append(third.readAll());
+  }
+  QVERIFY(result.startsWith("HTTP/1.1 200"));
+  QCOMPARE(limiter->get_peak(), 2);
+}
+
+void QttpTest::testGET_ConnectionCapAcrossLoops()
+{
+  // Four loops accepting on one port through SO_REUSEPORT, sharing the cap
+  // like ioThreads do.
+  auto limiter = std::make_shared<QttpConnectionLimiter>(4, 2);
+  for(int i = 0; i < 4; ++i)
+  {
+    std::thread listenerThread([limiter]() {
+      QttpOptions options;
+      options.reuse_port = true;
+
+      native::loop loop;
+      Qttp server(loop);
+      server.set_options(options);
+      server.set_connection_limiter(limiter);
+      server.listen("127.0.0.1", 8084, [](QttpRequest&, QttpResponse& resp) {
+        resp.set_header("Content-Type", "text/plain");
+        resp.end(std::string("capped"));
+      });
+      loop.run();
+    });
+    listenerThread.detach();
+  }
+  QTest::qWait(300);
+
+  // All at once, the loops race for them.
+  const int count = 32;
+  std::vector<std::unique_ptr<QTcpSocket> > sockets;
+  for(int i = 0; i < count; ++i)
+  {
+    sockets.emplace_back(new QTcpSocket());
+    sockets.back()->connectToHost("127.0.0.1", 8084);
+  }
+  for(auto & socket : sockets)
+  {
+    QVERIFY(socket->waitForConnected(MAX_TEST_WAIT_MS));
+    socket->write("GET / HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n");
+  }
+
+  // Each closes after its response, which lets the next ones in.
+  std::vector<QByteArray> results(count);
+  int answered = 0;
+  QTime time;
+  time.start();
+  while(answered < count && time.elapsed() < MAX_TEST_WAIT_MS)
+  {
+    QTest::qWait(50);
+    answered = 0;
+    for(int i = 0; i < count; ++i)
+    {
+      results[i].append(sockets[i]->readAll());
+      answered += results[i].contains("capped") ? 1 : 0;
+    }
+  }
+  QCOMPARE(answered, count);
+  QVERIFY(limiter->get_peak() <= 4);
+  QVERIFY(limiter->get_deferred() > 0);
+}
+
+void QttpTest::testGET_StalledFileDownload()
+{
+  auto writeTimeouts = [](const QttpStats& stats) {
+    return static_cast<quint64>(stats.write_timeouts);
+  };
+  quint64 timeouts = nativeStat(writeTimeouts);
+
+  // Qt stops reading once its buffer is full, the kernel's fill up behind it
+  // and the server can't get rid of the rest of the file.
+  QTcpSocket socket;
+  socket.setReadBufferSize(64 * 1024);
+  socket.connectToHost("127.0.0.1", 8080);
+  QVERIFY(socket.waitForConnected(MAX_TEST_WAIT_MS));
+  socket.write("GET /largeFile HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n");
+
+  // server.timeouts.writeMs of the test config is a second.
+  QTime time;
+  time.start();
+  while(nativeStat(writeTimeouts) == timeouts && time.elapsed() < MAX_TEST_WAIT_MS)
+  {
+    QTest::qWait(50);
+  }
+  QVERIFY(nativeStat(writeTimeouts) > timeouts);
+  QVERIFY(socket.bytesAvailable() > 0);
+}
+
+void QttpTest::testGET_WriteQueueBackpressure()
+{
+  auto highHits = [](const QttpStats& stats) {
+    return static_cast<quint64>(stats.write_queue_high_hits);
+  };
+  auto lowHits = [](const QttpStats& stats) {
+    return static_cast<quint64>(stats.write_queue_low_hits);
+  };
+  quint64 high = nativeStat(highHits);
+  quint64 low = nativeStat(lowHits);
+
+  // Each response is past the high watermark on its own, the ones behind
+  // it aren't read until the client catches up.
+  QTcpSocket socket;
+  socket.setReadBufferSize(64 * 1024);
+  socket.connectToHost("127.0.0.1", 8080);
+  QVERIFY(socket.waitForConnected(MAX_TEST_WAIT_MS));
+
+  const int count = 3;
+  QByteArray request = "GET /chunked HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+  socket.write(request.repeated(count));
+
+  QTime time;
+  time.start();
+  while(nativeStat(highHits) == high && time.elapsed() < MAX_TEST_WAIT_MS)
+  {
+    QTest::qWait(50);
+  }
+  QVERIFY(nativeStat(highHits) > high);
+
+  // Drained well within server.timeouts.writeMs of the test config.
+  socket.setReadBufferSize(0);
+  QByteArray result;
+  time.start();
+  while(result.count("\r\n0\r\n\r\n") < count && time.elapsed() < MAX_TEST_WAIT_MS)
+  {
+    QTest::qWait(50);
+    result.append(socket.readAll());
+  }
+  QCOMPARE(result.count("\r\n0\r\n\r\n"), count);
+  QCOMPARE(result.count("HTTP/1.1 200"), count);
+  QVERIFY(nativeStat(lowHits) > low);
+  QCOMPARE(socket.state(), QAbstractSocket::ConnectedState);
+}
+
+void QttpTest::testPOST_DrainOnStop()
+{
+  QTcpSocket socket;
+  socket.connectToHost("127.0.0.1", 8080);
+  QVERIFY(socket.waitForConnected(MAX_TEST_WAIT_MS));
+
+  // Half of the body, the request is still being read when stopping.
+  QByteArray body = "{\"name\":\"drain\"}";
+  socket.write("POST /echobody HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+               "Content-Type: application/json\r\n"
+               "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n" +
+               body.left(8));
+  QTest::qWait(300);
+
+  // Waits for the drain, the actions answering it need this thread.
+  std::thread stopThread([]() {
+    HttpServer::stop();
+  });
+  QTest::qWait(300);
+
+  QTcpSocket refused;
+  refused.connectToHost("127.0.0.1", 8080);
+  QVERIFY(!refused.waitForConnected(MAX_TEST_WAIT_MS));
+  QCOMPARE(refused.error(), QAbstractSocket::ConnectionRefusedError);
+
+  socket.write(body.mid(8));
+  QByteArray result;
+  QTime time;
+  time.start();
+  while(socket.state() == QAbstractSocket::ConnectedState && time.elapsed() < MAX_TEST_WAIT_MS)
+  {
+    QTest::qWait(50);
+    result.append(socket.readAll());
+  }
+  result.append(socket.readAll());
+  stopThread.join();
+
+  QVERIFY(result.startsWith("HTTP/1.1 200"));
+  QVERIFY(result.indexOf("Connection: close\r\n") >= 0);
+  QVERIFY(result.indexOf("\"name\":\"drain\"") >= 0);
+  QCOMPARE(socket.state(), QAbstractSocket::UnconnectedState);
+}
+
+QByteArray QttpTest::frame(int type, int flags, quint32 streamId, const QByteArray& payload)
+{
+  QByteArray out;
+  out.append(static_cast<char>(payload.length() >> 16));
+  out.append(static_cast<char>(payload.length() >> 8));
+  out.append(static_cast<char>(payload.length()));
+  out.append(static_cast<char>(type));
+  out.append(static_cast<char>(flags));
+  out.append(static_cast<char>(streamId >> 24));
+  out.append(static_cast<char>(streamId >> 16));
+  out.append(static_cast<char>(streamId >> 8));
+  out.append(static_cast<char>(streamId));
+  out.append(payload);
+  return out;
+}
+
+QByteArray QttpTest::requestHeaders(hpack::encoder& encoder, const QByteArray& path)
+{
+  std::string block;
+  encoder.begin(block);
+  encoder.encode(block, ":method", "GET");
+  encoder.encode(block, ":scheme", "http");
+  encoder.encode(block, ":path", path.toStdString());
+  encoder.encode(block, ":authority", "127.0.0.1");
+  return QByteArray(block.data(), static_cast<int>(block.size()));
+}
+
+quint64 QttpTest::nativeStat(const std::function<quint64(const QttpStats&)>& stat)
+{
+  HttpServer* httpSvr = HttpServer::getInstance();
+  std::lock_guard<std::mutex> lock(httpSvr->m_ListenersMutex);
+
+  quint64 total = 0;
+  for(auto listener : httpSvr->m_Listeners)
+  {
+    total += stat(listener->get_stats());
+  }
+  return total;
+}
+
+bool QttpTest::readH2cFrame(QTcpSocket& socket, QByteArray& buffer, hpack::decoder& decoder,
+                            QHash<quint32, QByteArray>& statuses, QHash<quint32, QByteArray>& bodies,
+                            quint32& ended)
+{
+  QTime time;
+  time.start();
+  int length = 0;
+  while(true)
+  {
+    if(buffer.length() >= 9)
+    {
+      const uchar* header = reinterpret_cast<const uchar*>(buffer.constData());
+      length = (header[0] << 16) | (header[1] << 8) | header[2];
+      if(buffer.length() >= 9 + length)
+      {
+        break;
+      }
+    }
+    if(time.elapsed() > MAX_TEST_WAIT_MS)
+    {
+      return false;
+    }
+    QTest::qWait(50);
+    buffer.append(socket.readAll());
+  }
+
+  const uchar* header = reinterpret_cast<const uchar*>(buffer.constData());
+  int type = header[3];
+  int flags = header[4];
+  quint32 streamId = ((header[5] & 0x7f) << 24) | (header[6] << 16) | (header[7] << 8) | header[8];
+  QByteArray payload = buffer.mid(9, length);
+  buffer.remove(0, 9 + length);
+
+  ended = 0;
+  switch(type)
+  {
+    case 0x0:
+      bodies[streamId].append(payload);
+      break;
+
+    case 0x1:
+    {
+      // Sent without padding or priority, in a single frame.
+      bool isDecoded = decoder.decode(reinterpret_cast<const uint8_t*>(payload.constData()),
+                                      static_cast<size_t>(payload.length()),
+                                      [&](const std::string& name, const std::string& value) {
+        if(name == ":status")
+        {
+          statuses[streamId] = QByteArray::fromStdString(value);
+        }
+      });
+      if(!isDecoded || (flags & 0x4) == 0)
+      {
+        return false;
+      }
+      break;
+    }
+
+    case 0x4:
+      if((flags & 0x1) == 0)
+      {
+        socket.write(frame(0x4, 0x1, 0, QByteArray()));
+      }
+      break;
+
+    case 0x7:
+      // GOAWAY
+      return false;
+  }
+
+  if((type == 0x0 || type == 0x1) && (flags & 0x1) != 0)
+  {
+    ended = streamId;
+  }
+  return true;
+}
+
 // *****************************************************************//
 // *************************** END TESTS ***************************//
 // *****************************************************************//
@@ -246,6 +1079,36 @@ void QttpTest::initTestCase()
   result = httpSvr->registerRoute("get", "sampleWithParameter", "/sampleWithParameter");
   QVERIFY(result == true);
 
+  // Receives its body in chunks.
+  QVERIFY((httpSvr->addAction<StreamedBodyAction>()).get() != nullptr);
+
+  result = httpSvr->registerRoute("post", "streamedBody", "/streamedBody");
+  QVERIFY(result == true);
+
+  // Streams its response in chunks.
+  QVERIFY((httpSvr->addAction<ChunkedAction>()).get() != nullptr);
+
+  result = httpSvr->registerRoute("get", "chunked", "/chunked");
+  QVERIFY(result == true);
+
+  // Echoes WebSocket messages.
+  QVERIFY((httpSvr->addAction<EchoWebSocketAction>()).get() != nullptr);
+
+  result = httpSvr->registerRoute("get", "webSocketEcho", "/ws");
+  QVERIFY(result == true);
+
+  // Streams published events.
+  QVERIFY((httpSvr->addAction<EventsAction>()).get() != nullptr);
+
+  result = httpSvr->registerRoute("get", "events", "/events");
+  QVERIFY(result == true);
+
+  // Turns down requests before their body is read.
+  QVERIFY((httpSvr->addAction<RejectingAction>()).get() != nullptr);
+
+  result = httpSvr->registerRoute("post", "rejecting", "/rejecting");
+  QVERIFY(result == true);
+
   // Uses the action interface.
   QVERIFY((httpSvr->addAction<SampleAction>()).get() != nullptr);
 
@@ -291,6 +1154,24 @@ void QttpTest::initTestCase()
   result = httpSvr->registerRoute(qttp::GET, "regex", "/regex/:name([A-Za-z]+)");
   QVERIFY(result == true);
 
+  QVERIFY(m_LargeFile.open());
+  QByteArray block(1024 * 1024, 'x');
+  for(int i = 0; i < 64; ++i)
+  {
+    QCOMPARE(m_LargeFile.write(block), static_cast<qint64>(block.size()));
+  }
+  QVERIFY(m_LargeFile.flush());
+
+  // Sent from the I/O thread with sendfile.
+  QString largeFile = m_LargeFile.fileName();
+  qint64 largeFileSize = m_LargeFile.size();
+  action = httpSvr->createAction("largeFile", [largeFile, largeFileSize](HttpData& data) {
+    data.getResponse().finishFile(largeFile, largeFileSize);
+  });
+
+  result = httpSvr->registerRoute("get", "largeFile", "/largeFile");
+  QVERIFY(result == true);
+
   httpSvr->startServer("127.0.0.1", 8080);
   QTest::qWait(1000);
 }
@@ -67,6 +67,127 @@ class SampleActionWithHttpMethods : public Action
     }
 };
 
+class StreamedBodyAction : public Action
+{
+  public:
+    bool isBodyStreamed() const
+    {
+      return true;
+    }
+
+    void onBodyChunk(HttpData& data, const char* chunk, size_t length)
+    {
+      TEST_TRACE;
+      Q_UNUSED(chunk);
+      m_Received[&data] += length;
+    }
+
+    void onAction(HttpData& data)
+    {
+      TEST_TRACE;
+      QJsonObject& json = data.getResponse().getJson();
+      json["response"] = static_cast<qint64>(m_Received.take(&data));
+      json["buffered"] = data.getRequest().getBody().size();
+    }
+
+    const char* getName() const
+    {
+      return "streamedBody";
+    }
+
+  private:
+    QHash<const HttpData*, size_t> m_Received;
+};
+
+class ChunkedAction : public Action
+{
+  public:
+    void onAction(HttpData& data)
+    {
+      TEST_TRACE;
+      HttpResponse& response = data.getResponse();
+      response.setHeader("Content-Type", "application/json");
+      response.beginStream();
+
+      // Well past the high watermark, the producer here just keeps going.
+      QByteArray item(1000, 'x');
+      response.writeChunk("[");
+      for(int i = 0; i < 2000; ++i)
+      {
+        response.writeChunk((i > 0 ? ",\"" : "\"") + item + "\"");
+      }
+      response.writeChunk("]");
+      response.endStream();
+    }
+
+    const char* getName() const
+    {
+      return "chunked";
+    }
+};
+
+class EchoWebSocketAction : public WebSocketAction
+{
+  public:
+    void onMessage(WebSocket& socket, const QByteArray& message, bool isBinary)
+    {
+      TEST_TRACE;
+      if(isBinary)
+      {
+        socket.sendBinary(message);
+      }
+      else
+      {
+        socket.sendText(message);
+      }
+    }
+
+    const char* getName() const
+    {
+      return "webSocketEcho";
+    }
+};
+
+class EventsAction : public SseAction
+{
+  public:
+    void onSubscribe(HttpData& data)
+    {
+      TEST_TRACE;
+      data.getResponse().writeChunk(SseAction::serialize("welcome", "", "", 1000));
+      // Held back until the client subscribed, after the welcome.
+      publish("joined", "join");
+    }
+
+    const char* getName() const
+    {
+      return "events";
+    }
+};
+
+class RejectingAction : public Action
+{
+  public:
+    HttpStatus admitRequest(const HttpRequest& request) const
+    {
+      TEST_TRACE;
+      Q_UNUSED(request);
+      return HttpStatus::EXPECTATION_FAILED;
+    }
+
+    void onAction(HttpData& data)
+    {
+      TEST_TRACE;
+      QJsonObject& json = data.getResponse().getJson();
+      json["response"] = "Admitted";
+    }
+
+    const char* getName() const
+    {
+      return "rejecting";
+    }
+};
+
 class ActionWithParameter : public Action
 {
   public: